@@ -0,0 +1,350 @@
+#include "bench_client.hpp"
+#include "minidrive/helpers.hpp"
+#include "minidrive/pack.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <signal.h>
+#include <sstream>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// forks, redirects output to <workdir>/<out_name> and waits until the child accepts connections on port
+ServerProcess spawn_process(const std::vector<std::string> &args, const std::string &workdir, const std::string &out_name, const std::uint16_t &port) {
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        throw std::runtime_error("fork_failed: Failed to fork " + args[0]);
+    }
+    if (pid == 0) {
+        // child -> redirect output and exec
+        if (::chdir(workdir.c_str()) != 0) {
+            ::_exit(127);
+        }
+        int out = ::open(out_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out >= 0) {
+            ::dup2(out, STDOUT_FILENO);
+            ::dup2(out, STDERR_FILENO);
+            ::close(out);
+        }
+        std::vector<std::string> copy = args;
+        std::vector<char*> argv;
+        for (auto &a : copy) {
+            argv.push_back(a.data());
+        }
+        argv.push_back(nullptr);
+        ::execv(copy[0].c_str(), argv.data());
+        ::_exit(127);
+    }
+
+    ServerProcess process{pid, port, workdir};
+
+    // wait until the child accepts connections
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        int status = 0;
+        if (::waitpid(pid, &status, WNOHANG) == pid) {
+            throw std::runtime_error("process_exited: " + args[0] + " exited during startup (see " + workdir + "/" + out_name + ")");
+        }
+        try {
+            int fd = connect_loopback(port);
+            ::close(fd);
+            return process;
+        } catch (const std::exception &) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+    stop_server(process);
+    throw std::runtime_error("process_timeout: " + args[0] + " did not start listening on port " + std::to_string(port));
+}
+
+} // namespace
+
+ServerProcess spawn_server(const std::string &server_path, const std::string &workdir, const std::uint16_t &port, const std::vector<std::string> &extra_args) {
+    // fresh server root inside workdir (server expects a root relative to its cwd)
+    std::filesystem::create_directories(workdir + "/root");
+
+    std::vector<std::string> args = {server_path, "--port", std::to_string(port), "--root", "root", "--log", "server.log"};
+    args.insert(args.end(), extra_args.begin(), extra_args.end());
+    return spawn_process(args, workdir, "server.out", port);
+}
+
+ServerProcess spawn_proxy(const std::string &proxy_path, const std::string &workdir, const std::uint16_t &listen_port, const std::uint16_t &upstream_port, const std::vector<std::string> &wan_args) {
+    std::vector<std::string> args = {proxy_path, "--listen", std::to_string(listen_port), "--upstream", "127.0.0.1:" + std::to_string(upstream_port)};
+    args.insert(args.end(), wan_args.begin(), wan_args.end());
+    return spawn_process(args, workdir, "wanproxy-" + std::to_string(listen_port) + ".out", listen_port);
+}
+
+void stop_server(ServerProcess &server) {
+    if (server.pid <= 0) {
+        return;
+    }
+    ::kill(server.pid, SIGTERM);
+    int status = 0;
+    for (int attempt = 0; attempt < 40; ++attempt) {
+        if (::waitpid(server.pid, &status, WNOHANG) == server.pid) {
+            server.pid = -1;
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ::kill(server.pid, SIGKILL);
+    ::waitpid(server.pid, &status, 0);
+    server.pid = -1;
+}
+
+double process_cpu_seconds(const pid_t &pid) {
+    // utime and stime are fields 14 and 15 of /proc/<pid>/stat
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    if (!stat) {
+        return 0.0;
+    }
+    std::string content((std::istreambuf_iterator<char>(stat)), std::istreambuf_iterator<char>());
+
+    // skip "pid (comm)" since comm may contain spaces
+    size_t pos = content.rfind(')');
+    if (pos == std::string::npos) {
+        return 0.0;
+    }
+    std::istringstream iss(content.substr(pos + 2));
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && (iss >> field); ++i) {
+        if (i == 14) utime = std::stoull(field);
+        if (i == 15) stime = std::stoull(field);
+    }
+    return static_cast<double>(utime + stime) / static_cast<double>(::sysconf(_SC_CLK_TCK));
+}
+
+int connect_loopback(const std::uint16_t &port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error("socket: Failed to create socket");
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        ::close(fd);
+        throw std::runtime_error("connect: Failed to connect to 127.0.0.1:" + std::to_string(port));
+    }
+    int enable = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    return fd;
+}
+
+void handshake(const int &fd) {
+    // public mode auth -> server answers with RESUME (optionally offering a pending upload)
+    send_msg(fd, "AUTH ");
+
+    // never resume transfers left behind by other synthetic clients
+    if (!TransferState::parseOffer(recv_msg(fd)).empty()) {
+        send_msg(fd, "n");
+    }
+}
+
+std::string command(const int &fd, const std::string &cmd) {
+    send_msg(fd, cmd);
+    std::string response = recv_msg(fd);
+    if (response.starts_with("ERROR")) {
+        throw std::runtime_error(response.substr(6));
+    }
+    return response;
+}
+
+void upload_file(const int &fd, const std::string &local_path, const std::string &remote_path, const bool &pipelined) {
+    size_t file_size = std::filesystem::file_size(local_path);
+    send_msg(fd, (pipelined ? "UPLOAD_PIPELINED " : "UPLOAD ") + std::to_string(file_size) + " " + local_path + " " + remote_path);
+
+    // a pipelined upload is answered once, after its data
+    std::string response;
+    if (!pipelined) {
+        response = recv_msg(fd);
+        if (response != "READY") {
+            throw std::runtime_error("upload_rejected: " + response);
+        }
+    }
+    send_file(fd, local_path, 0);
+
+    response = recv_msg(fd);
+    if (!response.starts_with("OK")) {
+        throw std::runtime_error("upload_failed: " + response);
+    }
+}
+
+size_t upload_pack(const int &fd, const std::string &local_dir, const std::string &remote_dir) {
+    pack::Writer writer(local_dir);
+    send_msg(fd, "UPLOAD_PACK " + std::to_string(writer.size()) + " " + local_dir + " " + remote_dir);
+
+    std::string response = recv_msg(fd);
+    if (response != "READY") {
+        throw std::runtime_error("upload_rejected: " + response);
+    }
+    while (writer.position() < writer.size()) {
+        pack::send_pack_chunk(fd, writer, TMP_BUFF_SIZE);
+    }
+
+    response = recv_msg(fd);
+    if (!response.starts_with("OK")) {
+        throw std::runtime_error("upload_failed: " + response);
+    }
+    return static_cast<size_t>(writer.size());
+}
+
+size_t download_discard(const int &fd, const std::string &remote_path, const bool &pack) {
+    send_msg(fd, (pack ? "DOWNLOAD_PACK " : "DOWNLOAD ") + remote_path);
+    std::string response = recv_msg(fd);
+    if (!is_cmd(response, "FILEINFO")) {
+        throw std::runtime_error("download_rejected: " + response);
+    }
+    std::vector<std::string> parts = split_cmd(response);
+    if (parts.size() < 3) {
+        throw std::runtime_error("invalid_response: FILEINFO response requires path and size arguments");
+    }
+
+    // drain file data without touching the local disk
+    size_t remaining = std::stoull(parts[2]);
+    size_t total = remaining;
+    std::vector<char> buffer(TMP_BUFF_SIZE);
+    while (remaining > 0) {
+        ssize_t recvd = ::recv(fd, buffer.data(), std::min(remaining, buffer.size()), 0);
+        if (recvd < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("recv: Failed to receive file data");
+        }
+        if (recvd == 0) {
+            throw std::runtime_error("connection_closed: Connection closed by remote node");
+        }
+        remaining -= static_cast<size_t>(recvd);
+    }
+
+    // completion message carrying the server's digest
+    if (!recv_msg(fd).starts_with("OK")) {
+        throw std::runtime_error("download_failed: No completion message after file data");
+    }
+    return total;
+}
+
+bool download_verify(const int &fd, const std::string &remote_path, const std::string &expected_path) {
+    send_msg(fd, "DOWNLOAD " + remote_path);
+    std::string response = recv_msg(fd);
+    if (!is_cmd(response, "FILEINFO")) {
+        throw std::runtime_error("download_rejected: " + response);
+    }
+    std::vector<std::string> parts = split_cmd(response);
+    if (parts.size() < 3) {
+        throw std::runtime_error("invalid_response: FILEINFO response requires path and size arguments");
+    }
+
+    // always drain the full stream so the connection stays usable, compare as we go
+    size_t remaining = std::stoull(parts[2]);
+    bool same = remaining == std::filesystem::file_size(expected_path);
+    std::ifstream expected(expected_path, std::ios::binary);
+    std::vector<char> buffer(TMP_BUFF_SIZE);
+    std::vector<char> reference(TMP_BUFF_SIZE);
+    StreamHash hash;
+    while (remaining > 0) {
+        ssize_t recvd = ::recv(fd, buffer.data(), std::min(remaining, buffer.size()), 0);
+        if (recvd < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("recv: Failed to receive file data");
+        }
+        if (recvd == 0) {
+            throw std::runtime_error("connection_closed: Connection closed by remote node");
+        }
+        if (same) {
+            expected.read(reference.data(), recvd);
+            same = expected.gcount() == recvd && std::equal(buffer.begin(), buffer.begin() + recvd, reference.begin());
+        }
+        hash.update(buffer.data(), static_cast<size_t>(recvd));
+        remaining -= static_cast<size_t>(recvd);
+    }
+
+    // and the server's streaming digest must match what arrived
+    return same && find_digest(recv_msg(fd)) == hash.hex();
+}
+
+void make_synthetic_file(const std::string &path, const size_t &size, const std::uint64_t &seed) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("file_open_failed: Failed to create synthetic file (path: " + path + ")");
+    }
+
+    // xorshift64 keeps the content incompressible and reproducible
+    std::uint64_t state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    std::vector<std::uint64_t> block(TMP_BUFF_SIZE / sizeof(std::uint64_t));
+    size_t remaining = size;
+    while (remaining > 0) {
+        for (auto &word : block) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            word = state;
+        }
+        size_t n = std::min(remaining, TMP_BUFF_SIZE);
+        out.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(n));
+        remaining -= n;
+    }
+}
+
+// an empty workdir becomes a fresh mkdtemp directory under /tmp, a user-supplied one must be empty or missing
+// and is never the tool's to delete
+bool prepare_workdir(std::string &workdir, const std::string &prefix) {
+    if (workdir.empty()) {
+        std::string tmpl = "/tmp/" + prefix + "_XXXXXX";
+        if (::mkdtemp(tmpl.data()) == nullptr) {
+            throw std::runtime_error("mkdtemp_failed: " + tmpl + ": " + std::strerror(errno));
+        }
+        workdir = tmpl;
+        return true;
+    }
+    std::error_code ec;
+    if (std::filesystem::exists(workdir, ec) && !std::filesystem::is_empty(workdir, ec)) {
+        throw std::runtime_error("workdir_not_empty: " + workdir + " must be empty or missing");
+    }
+    if (ec) {
+        throw std::runtime_error("workdir_unusable: " + workdir + ": " + ec.message());
+    }
+    std::filesystem::create_directories(workdir);
+    return false;
+}
+
+std::vector<std::string> split_args(const std::string &line) {
+    std::istringstream iss(line);
+    std::vector<std::string> args;
+    std::string arg;
+    while (iss >> arg) {
+        args.push_back(arg);
+    }
+    return args;
+}
+
+double percentile(std::vector<double> &samples, const double &p) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    std::sort(samples.begin(), samples.end());
+    double rank = p * static_cast<double>(samples.size() - 1);
+    return samples[static_cast<size_t>(std::llround(rank))];
+}
+
+nlohmann::json latency_report(std::vector<double> &samples, const double &wall_s) {
+    return {
+        {"ops", samples.size()},
+        {"ops_per_s", wall_s > 0 ? static_cast<double>(samples.size()) / wall_s : 0.0},
+        {"p50_us", percentile(samples, 0.50)},
+        {"p99_us", percentile(samples, 0.99)},
+        {"p999_us", percentile(samples, 0.999)},
+    };
+}
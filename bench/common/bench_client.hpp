@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include <nlohmann/json.hpp>
+
+// server (or WAN proxy) child process started for a benchmark run
+struct ServerProcess {
+    pid_t pid = -1;
+    std::uint16_t port = 0;
+    std::string workdir;
+};
+
+// server lifecycle
+ServerProcess spawn_server(const std::string &server_path, const std::string &workdir, const std::uint16_t &port, const std::vector<std::string> &extra_args = {});
+ServerProcess spawn_proxy(const std::string &proxy_path, const std::string &workdir, const std::uint16_t &listen_port, const std::uint16_t &upstream_port, const std::vector<std::string> &wan_args);
+void stop_server(ServerProcess &server); // also stops proxies
+double process_cpu_seconds(const pid_t &pid);
+
+// synthetic client operations (public mode)
+int connect_loopback(const std::uint16_t &port);
+void handshake(const int &fd);
+std::string command(const int &fd, const std::string &cmd);
+void upload_file(const int &fd, const std::string &local_path, const std::string &remote_path, const bool &pipelined = false); // pipelined: UPLOAD_PIPELINED, no READY
+size_t download_discard(const int &fd, const std::string &remote_path, const bool &pack = false); // pack: DOWNLOAD_PACK of a directory
+size_t upload_pack(const int &fd, const std::string &local_dir, const std::string &remote_dir); // UPLOAD_PACK, returns the stream size
+bool download_verify(const int &fd, const std::string &remote_path, const std::string &expected_path);
+
+// helpers
+bool prepare_workdir(std::string &workdir, const std::string &prefix); // true = created here, the caller may remove it
+std::vector<std::string> split_args(const std::string &line);
+void make_synthetic_file(const std::string &path, const size_t &size, const std::uint64_t &seed);
+double percentile(std::vector<double> &samples, const double &p);
+nlohmann::json latency_report(std::vector<double> &samples, const double &wall_s); // ops, ops/s, p50/p99/p999 in us
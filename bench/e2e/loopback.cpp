@@ -0,0 +1,453 @@
+#include "bench_client.hpp"
+#include "minidrive/helpers.hpp"
+#include "minidrive/block_list.hpp"
+#include "minidrive/version.hpp"
+
+#include <algorithm>
+#include <barrier>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#ifndef MINIDRIVE_SERVER_PATH
+#define MINIDRIVE_SERVER_PATH "server"
+#endif
+#ifndef MINIDRIVE_PROXY_PATH
+#define MINIDRIVE_PROXY_PATH "wanproxy"
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Distribution {
+    std::string name;
+    std::vector<size_t> sizes; // file sizes cycled through by every client
+};
+
+struct Options {
+    std::string server_path = MINIDRIVE_SERVER_PATH;
+    std::string proxy_path = MINIDRIVE_PROXY_PATH;
+    std::vector<std::string> wan_args; // WAN proxy shaping between clients and server, none = direct loopback
+    size_t resume_size = 0;            // resume phase file size, 0 = skipped
+    size_t resume_resets = 3;
+    std::string workdir;
+    std::string out_path;
+    std::uint16_t port = 19090;
+    size_t clients = 8;
+    size_t meta_ops = 200;
+    size_t bytes_per_client = 64 * 1024 * 1024;
+    bool keep = false;
+    std::vector<Distribution> dists;
+};
+
+// per-phase samples collected by all client threads
+struct PhaseResult {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::vector<double>> latencies_us;
+    size_t bytes = 0;
+    size_t errors = 0;
+    std::string first_error;
+    double wall_s = 0.0;
+    double server_cpu_s = 0.0;
+};
+
+size_t parse_size(const std::string &s) {
+    size_t pos = 0;
+    double value = std::stod(s, &pos);
+    std::string unit = s.substr(pos);
+    if (unit == "K" || unit == "KiB") value *= 1024.0;
+    else if (unit == "M" || unit == "MiB") value *= 1024.0 * 1024.0;
+    else if (unit == "G" || unit == "GiB") value *= 1024.0 * 1024.0 * 1024.0;
+    else if (!unit.empty()) throw std::runtime_error("invalid_size: Unknown size unit in " + s);
+    return static_cast<size_t>(value);
+}
+
+Distribution parse_dist(const std::string &spec) {
+    // name=size[,size...]
+    size_t eq = spec.find('=');
+    if (eq == std::string::npos) {
+        throw std::runtime_error("invalid_dist: Expected name=size[,size...], got " + spec);
+    }
+    Distribution d{spec.substr(0, eq), {}};
+    std::string sizes = spec.substr(eq + 1);
+    size_t start = 0;
+    while (start <= sizes.size()) {
+        size_t comma = sizes.find(',', start);
+        d.sizes.push_back(parse_size(sizes.substr(start, comma - start)));
+        if (comma == std::string::npos) break;
+        start = comma + 1;
+    }
+    return d;
+}
+
+void print_usage(const char *argv0) {
+    std::cerr << "Usage: " << argv0 << " [options]\n"
+              << "  --server <path>          server binary (default: " << MINIDRIVE_SERVER_PATH << ")\n"
+              << "  --port <port>            loopback port for the server (default: 19090)\n"
+              << "  --clients <n>            concurrent synthetic clients (default: 8)\n"
+              << "  --meta-ops <n>           MKDIR/LIST/MOVE rounds per client, then one BATCH of as many moves (default: 200)\n"
+              << "  --bytes-per-client <sz>  transfer volume per client and distribution (default: 64M)\n"
+              << "  --dist <name=sz[,sz]>    file size distribution, repeatable (default: small, medium, large, mixed)\n"
+              << "  --wan \"<proxy flags>\"    route clients through the WAN proxy, e.g. \"--latency 50 --rate 12.5M\"\n"
+              << "  --proxy <path>           WAN proxy binary (default: " << MINIDRIVE_PROXY_PATH << ")\n"
+              << "  --resume-size <sz>       run the resume phase with a file of this size (default: off)\n"
+              << "  --resume-resets <n>      connection resets injected during the resume phase (default: 3)\n"
+              << "  --workdir <path>         empty scratch directory, never removed (default: fresh /tmp/minidrive_bench_XXXXXX)\n"
+              << "  --out <file>             write JSON report to file instead of stdout\n"
+              << "  --keep                   keep the default scratch directory\n";
+}
+
+Options parse_args(int argc, char *argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::runtime_error("missing_argument: " + arg + " requires a value");
+            return argv[++i];
+        };
+        if (arg == "--server") opt.server_path = next();
+        else if (arg == "--port") opt.port = static_cast<std::uint16_t>(std::stoi(next()));
+        else if (arg == "--clients") opt.clients = std::stoull(next());
+        else if (arg == "--meta-ops") opt.meta_ops = std::stoull(next());
+        else if (arg == "--bytes-per-client") opt.bytes_per_client = parse_size(next());
+        else if (arg == "--dist") opt.dists.push_back(parse_dist(next()));
+        else if (arg == "--wan") { auto a = split_args(next()); opt.wan_args.insert(opt.wan_args.end(), a.begin(), a.end()); }
+        else if (arg == "--proxy") opt.proxy_path = next();
+        else if (arg == "--resume-size") opt.resume_size = parse_size(next());
+        else if (arg == "--resume-resets") opt.resume_resets = std::stoull(next());
+        else if (arg == "--workdir") opt.workdir = next();
+        else if (arg == "--out") opt.out_path = next();
+        else if (arg == "--keep") opt.keep = true;
+        else if (arg == "--help" || arg == "-h") { print_usage(argv[0]); std::exit(0); }
+        else throw std::runtime_error("unknown_argument: " + arg);
+    }
+    if (opt.dists.empty()) {
+        opt.dists = {
+            parse_dist("small=4K"),
+            parse_dist("medium=1M"),
+            parse_dist("large=64M"),
+            parse_dist("mixed=4K,64K,4K,1M,16K,4M,4K,256K"),
+        };
+    }
+    return opt;
+}
+
+// runs one phase: every client connects, waits on a barrier, then runs body concurrently
+void run_phase(const Options &opt, const ServerProcess &server, PhaseResult &result,
+               const std::function<void(size_t, int, PhaseResult&)> &body) {
+    std::barrier start(static_cast<std::ptrdiff_t>(opt.clients + 1));
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < opt.clients; ++i) {
+        threads.emplace_back([&, i]() {
+            int fd = -1;
+            try {
+                fd = connect_loopback(server.port);
+                handshake(fd);
+            } catch (const std::exception &e) {
+                std::lock_guard<std::mutex> lock(result.mutex);
+                result.errors++;
+                if (result.first_error.empty()) result.first_error = e.what();
+            }
+            start.arrive_and_wait();
+            if (fd < 0) return;
+            try {
+                body(i, fd, result);
+                send_msg(fd, "EXIT");
+            } catch (const std::exception &e) {
+                std::lock_guard<std::mutex> lock(result.mutex);
+                result.errors++;
+                if (result.first_error.empty()) result.first_error = e.what();
+            }
+            ::close(fd);
+        });
+    }
+
+    double cpu_before = process_cpu_seconds(server.pid);
+    start.arrive_and_wait();
+    auto t0 = Clock::now();
+    for (auto &t : threads) {
+        t.join();
+    }
+    result.wall_s = std::chrono::duration<double>(Clock::now() - t0).count();
+    result.server_cpu_s = process_cpu_seconds(server.pid) - cpu_before;
+}
+
+// times one operation and stores its latency under the given name
+template <typename F>
+void timed(std::unordered_map<std::string, std::vector<double>> &samples, const std::string &name, F &&op) {
+    auto t0 = Clock::now();
+    op();
+    samples[name].push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+}
+
+void merge(PhaseResult &result, std::unordered_map<std::string, std::vector<double>> &local, const size_t &bytes) {
+    std::lock_guard<std::mutex> lock(result.mutex);
+    for (auto &[name, v] : local) {
+        auto &dst = result.latencies_us[name];
+        dst.insert(dst.end(), v.begin(), v.end());
+    }
+    result.bytes += bytes;
+}
+
+nlohmann::json transfer_report(PhaseResult &result, const std::string &op) {
+    const double gb = static_cast<double>(result.bytes) / 1e9;
+    nlohmann::json j = latency_report(result.latencies_us[op], result.wall_s);
+    j["bytes"] = result.bytes;
+    j["wall_s"] = result.wall_s;
+    j["gb_per_s"] = result.wall_s > 0 ? gb / result.wall_s : 0.0;
+    j["server_cpu_s"] = result.server_cpu_s;
+    j["server_cpu_s_per_gb"] = gb > 0 ? result.server_cpu_s / gb : 0.0;
+    j["errors"] = result.errors;
+    if (!result.first_error.empty()) j["first_error"] = result.first_error;
+    return j;
+}
+
+nlohmann::json run_metadata(const Options &opt, const ServerProcess &server) {
+    PhaseResult result;
+    run_phase(opt, server, result, [&](size_t client, int fd, PhaseResult &r) {
+        std::unordered_map<std::string, std::vector<double>> local;
+        const std::string base = "meta" + std::to_string(client);
+        command(fd, "MKDIR " + base);
+        for (size_t k = 0; k < opt.meta_ops; ++k) {
+            const std::string dir = base + "/d" + std::to_string(k);
+            timed(local, "MKDIR", [&]() { command(fd, "MKDIR " + dir); });
+            timed(local, "LIST", [&]() { command(fd, "LIST " + base); });
+            timed(local, "MOVE", [&]() { command(fd, "MOVE " + dir + " " + base + "/m" + std::to_string(k)); });
+        }
+        // the same reorganization again, all moves in one round trip
+        std::string batch = "BATCH ATOMIC";
+        for (size_t k = 0; k < opt.meta_ops; ++k) {
+            batch += "\nMOVE " + base + "/m" + std::to_string(k) + " " + base + "/b" + std::to_string(k);
+        }
+        timed(local, "BATCH", [&]() { command(fd, batch); });
+        merge(r, local, 0);
+    });
+
+    nlohmann::json j;
+    for (const char *op : {"MKDIR", "LIST", "MOVE", "BATCH"}) {
+        j[op] = latency_report(result.latencies_us[op], result.wall_s);
+    }
+    j["BATCH"]["moves_per_batch"] = opt.meta_ops;
+    j["wall_s"] = result.wall_s;
+    j["server_cpu_s"] = result.server_cpu_s;
+    j["errors"] = result.errors;
+    if (!result.first_error.empty()) j["first_error"] = result.first_error;
+    return j;
+}
+
+nlohmann::json run_transfers(const Options &opt, const ServerProcess &server, const Distribution &dist) {
+    namespace fs = std::filesystem;
+
+    // prepare one local file per distinct size
+    std::vector<std::string> files;
+    size_t total_size = 0;
+    for (size_t j = 0; j < dist.sizes.size(); ++j) {
+        std::string path = opt.workdir + "/data/" + dist.name + "_" + std::to_string(j) + ".bin";
+        if (!fs::exists(path)) {
+            make_synthetic_file(path, dist.sizes[j], j + 1);
+        }
+        files.push_back(path);
+        total_size += dist.sizes[j];
+    }
+    size_t rounds = std::max<size_t>(1, opt.bytes_per_client / std::max<size_t>(1, total_size));
+    size_t files_per_client = rounds * files.size();
+
+    auto remote = [&](size_t client, size_t k) {
+        return "xfer_" + dist.name + "_" + std::to_string(client) + "/f" + std::to_string(k);
+    };
+
+    PhaseResult up;
+    run_phase(opt, server, up, [&](size_t client, int fd, PhaseResult &r) {
+        std::unordered_map<std::string, std::vector<double>> local;
+        size_t bytes = 0;
+        for (size_t k = 0; k < files_per_client; ++k) {
+            const std::string &file = files[k % files.size()];
+            timed(local, "UPLOAD", [&]() { upload_file(fd, file, remote(client, k)); });
+            bytes += dist.sizes[k % files.size()];
+        }
+        merge(r, local, bytes);
+    });
+
+    PhaseResult down;
+    run_phase(opt, server, down, [&](size_t client, int fd, PhaseResult &r) {
+        std::unordered_map<std::string, std::vector<double>> local;
+        size_t bytes = 0;
+        for (size_t k = 0; k < files_per_client; ++k) {
+            timed(local, "DOWNLOAD", [&]() { bytes += download_discard(fd, remote(client, k)); });
+        }
+        merge(r, local, bytes);
+    });
+
+    nlohmann::json j;
+    j["dist"] = dist.name;
+    j["sizes"] = dist.sizes;
+    j["files_per_client"] = files_per_client;
+    j["upload"] = transfer_report(up, "UPLOAD");
+    j["download"] = transfer_report(down, "DOWNLOAD");
+    return j;
+}
+
+// uploads one file through a proxy that resets the connection every size / (resets + 1) bytes,
+// reconnecting and accepting the server's RESUME offer until it completes, then verifies the
+// content over a direct connection
+nlohmann::json run_resume(const Options &opt, const ServerProcess &server) {
+    const std::string local = opt.workdir + "/data/resume.bin";
+    const std::string remote = "resume/file.bin";
+    make_synthetic_file(local, opt.resume_size, 42);
+
+    std::vector<std::string> args = opt.wan_args;
+    args.insert(args.end(), {"--reset-after", std::to_string(std::max<size_t>(1, opt.resume_size / (opt.resume_resets + 1))),
+                             "--max-resets", std::to_string(opt.resume_resets)});
+    ServerProcess proxy = spawn_proxy(opt.proxy_path, opt.workdir, static_cast<std::uint16_t>(opt.port + 2), server.port, args);
+
+    size_t attempts = 0;
+    size_t resumed = 0;
+    bool completed = false;
+    std::string last_error;
+    auto t0 = Clock::now();
+    while (!completed && attempts < 4 * (opt.resume_resets + 1)) {
+        attempts++;
+        int fd = -1;
+        try {
+            fd = connect_loopback(proxy.port);
+            send_msg(fd, "AUTH ");
+            const std::vector<TransferState::Transfer> offer = TransferState::parseOffer(recv_msg(fd));
+            auto own = std::find_if(offer.begin(), offer.end(), [&local](const TransferState::Transfer &t) { return t.local_path == local; });
+            if (own != offer.end()) {
+                // continue our own partial upload from the offset the server verified against our block digests
+                BlockList blocks = BlockList::of(local, own->bytes_completed);
+                send_msg(fd, "y " + own->remote_path + " " + blocks.encode());
+                std::vector<std::string> reply = split_cmd(recv_msg(fd));
+                if (reply.size() != 2 || reply[0] != "OFFSET") {
+                    throw std::runtime_error("resume_failed: Expected OFFSET");
+                }
+                resumed++;
+                send_file(fd, local, std::stoull(reply[1]));
+                completed = recv_msg(fd).starts_with("OK");
+            } else {
+                if (!offer.empty()) {
+                    send_msg(fd, "n");
+                }
+                upload_file(fd, local, remote);
+                completed = true;
+            }
+        } catch (const std::exception &e) {
+            last_error = e.what();
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    const double wall_s = std::chrono::duration<double>(Clock::now() - t0).count();
+    stop_server(proxy);
+
+    bool verified = false;
+    if (completed) {
+        int fd = connect_loopback(server.port);
+        handshake(fd);
+        verified = download_verify(fd, remote, local);
+        send_msg(fd, "EXIT");
+        ::close(fd);
+    }
+
+    nlohmann::json j = {
+        {"bytes", opt.resume_size},
+        {"injected_resets", opt.resume_resets},
+        {"attempts", attempts},
+        {"resumed", resumed},
+        {"completed", completed},
+        {"verified", verified},
+        {"wall_s", wall_s},
+        {"goodput_mb_per_s", wall_s > 0 ? static_cast<double>(opt.resume_size) / 1e6 / wall_s : 0.0},
+    };
+    if (!last_error.empty()) j["last_error"] = last_error;
+    return j;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    namespace fs = std::filesystem;
+
+    Options opt;
+    try {
+        opt = parse_args(argc, argv);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    bool owned_workdir = false;
+    try {
+        owned_workdir = prepare_workdir(opt.workdir, "minidrive_bench");
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    fs::create_directories(opt.workdir + "/data");
+
+    nlohmann::json report;
+    report["benchmark"] = "minidrive_bench";
+    report["version"] = std::string(minidrive::version());
+    report["timestamp"] = static_cast<long long>(std::time(nullptr));
+    report["config"] = {
+        {"clients", opt.clients},
+        {"meta_ops", opt.meta_ops},
+        {"bytes_per_client", opt.bytes_per_client},
+        {"wan", opt.wan_args},
+    };
+
+    ServerProcess server;
+    ServerProcess proxy;
+    int rc = 0;
+    try {
+        server = spawn_server(opt.server_path, opt.workdir, opt.port);
+
+        // resume first, before other phases can leave pending transfers behind
+        if (opt.resume_size > 0) {
+            report["resume"] = run_resume(opt, server);
+        }
+
+        // with --wan the phases talk to the proxy; CPU accounting still follows the server pid
+        ServerProcess endpoint = server;
+        if (!opt.wan_args.empty()) {
+            proxy = spawn_proxy(opt.proxy_path, opt.workdir, static_cast<std::uint16_t>(opt.port + 1), server.port, opt.wan_args);
+            endpoint.port = proxy.port;
+        }
+        report["metadata"] = run_metadata(opt, endpoint);
+        report["transfers"] = nlohmann::json::array();
+        for (const auto &dist : opt.dists) {
+            report["transfers"].push_back(run_transfers(opt, endpoint, dist));
+        }
+    } catch (const std::exception &e) {
+        report["error"] = e.what();
+        rc = 1;
+    }
+    stop_server(proxy);
+    stop_server(server);
+
+    if (opt.out_path.empty()) {
+        std::cout << report.dump(2) << std::endl;
+    } else {
+        std::ofstream out(opt.out_path);
+        out << report.dump(2) << std::endl;
+    }
+
+    if (owned_workdir && !opt.keep) {
+        fs::remove_all(opt.workdir);
+    }
+    return rc;
+}
@@ -0,0 +1,40 @@
+#include "micro.hpp"
+#include "minidrive/lock_table.hpp"
+
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+// every thread reads the same file: one shard, one entry
+void BM_LockSharedSameFile(benchmark::State &state) {
+    const LockTable::Key key{1, 42};
+    for (auto _ : state) {
+        LockTable::Guard guard = LockTable::global().acquire(key, LockTable::Mode::Shared, "file");
+        benchmark::DoNotOptimize(guard);
+    }
+}
+BENCHMARK(BM_LockSharedSameFile)->ThreadRange(1, 16)->UseRealTime();
+
+// every thread writes its own file: spread across shards
+void BM_LockExclusiveDistinctFiles(benchmark::State &state) {
+    const LockTable::Key key{1, static_cast<ino_t>(1000 + state.thread_index())};
+    for (auto _ : state) {
+        LockTable::Guard guard = LockTable::global().acquire(key, LockTable::Mode::Exclusive, "file");
+        benchmark::DoNotOptimize(guard);
+    }
+}
+BENCHMARK(BM_LockExclusiveDistinctFiles)->ThreadRange(1, 16)->UseRealTime();
+
+// the path form used by sessions, including the stat() that maps it to an inode
+void BM_LockByPath(benchmark::State &state) {
+    const std::string path = scratch_dir() + "/lock_target.bin";
+    std::ofstream(path).close();
+    for (auto _ : state) {
+        LockTable::Guard guard = LockTable::global().acquire(path, LockTable::Mode::Shared);
+        benchmark::DoNotOptimize(guard);
+    }
+}
+BENCHMARK(BM_LockByPath);
+
+} // namespace
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+// global operator new is replaced in micro.cpp to count heap allocations
+std::uint64_t allocation_count();
+
+// reports heap allocations per iteration for the enclosing benchmark
+class AllocCounter {
+public:
+    explicit AllocCounter(benchmark::State &state) : state(state), start(allocation_count()) {}
+    ~AllocCounter() {
+        state.counters["allocs/op"] = benchmark::Counter(static_cast<double>(allocation_count() - start), benchmark::Counter::kAvgIterations);
+    }
+
+private:
+    benchmark::State &state;
+    const std::uint64_t start;
+};
+
+// scratch directory on tmpfs (falls back to the system temp directory)
+std::string scratch_dir();
@@ -0,0 +1,174 @@
+#include "micro.hpp"
+#include "minidrive/helpers.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// connected AF_UNIX stream pair, closed on scope exit
+struct SocketPair {
+    int fds[2] = {-1, -1};
+    SocketPair() {
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            throw std::runtime_error("socketpair: Failed to create socket pair");
+        }
+    }
+    ~SocketPair() {
+        close_end(0);
+        close_end(1);
+    }
+    void close_end(const int &i) {
+        if (fds[i] >= 0) {
+            ::close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+};
+
+// command line with the given total length: "MOVE <path> <path>"
+std::string make_command(const size_t &length) {
+    std::string cmd = "MOVE ";
+    size_t half = length > 6 ? (length - 6) / 2 : 1;
+    cmd += std::string(half, 'a');
+    cmd += ' ';
+    cmd += std::string(half, 'b');
+    return cmd;
+}
+
+void BM_IsCmd(benchmark::State &state) {
+    const std::string msg = "DOWNLOAD some/remote/path.bin local.bin";
+    const std::vector<std::string> cmds = {"LIST", "DELETE", "CD", "MKDIR", "RMDIR", "MOVE", "COPY", "EXIT", "UPLOAD", "DOWNLOAD"};
+    AllocCounter allocs(state);
+    for (auto _ : state) {
+        for (const auto &cmd : cmds) {
+            benchmark::DoNotOptimize(is_cmd(msg, cmd));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(cmds.size()));
+}
+BENCHMARK(BM_IsCmd);
+
+void BM_SplitCmd(benchmark::State &state) {
+    const std::string msg = make_command(static_cast<size_t>(state.range(0)));
+    AllocCounter allocs(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(split_cmd(msg));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(msg.size()));
+}
+BENCHMARK(BM_SplitCmd)->RangeMultiplier(4)->Range(16, 4096);
+
+void BM_Tokenize(benchmark::State &state) {
+    const std::string msg = make_command(static_cast<size_t>(state.range(0)));
+    Tokens tokens;
+    AllocCounter allocs(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tokenize(msg, tokens));
+        benchmark::DoNotOptimize(tokens);
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(msg.size()));
+}
+BENCHMARK(BM_Tokenize)->RangeMultiplier(4)->Range(16, 4096);
+
+// one-way framed messages; a peer thread runs recv_msg until it sees an empty message
+void BM_SendRecvMsg(benchmark::State &state) {
+    SocketPair sp;
+    const std::string msg(static_cast<size_t>(state.range(0)), 'x');
+    std::thread peer([&]() {
+        try {
+            while (!recv_msg(sp.fds[1]).empty()) {
+            }
+        } catch (const std::exception &) {
+        }
+    });
+
+    {
+        AllocCounter allocs(state);
+        for (auto _ : state) {
+            send_msg(sp.fds[0], msg);
+        }
+    }
+    send_msg(sp.fds[0], "");
+    peer.join();
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(msg.size()));
+}
+BENCHMARK(BM_SendRecvMsg)->RangeMultiplier(8)->Range(16, 1 << 20)->UseRealTime();
+
+// socket -> tmpfs file; a peer thread keeps the socket full
+void BM_RecvFileChunk(benchmark::State &state) {
+    SocketPair sp;
+    const size_t chunk = static_cast<size_t>(state.range(0));
+    const std::string path = scratch_dir() + "/recv_chunk.bin";
+    const size_t wrap = 64 * 1024 * 1024;
+    std::atomic<bool> stop{false};
+    std::thread peer([&]() {
+        std::vector<char> data(TMP_BUFF_SIZE, 'd');
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (::send(sp.fds[1], data.data(), data.size(), MSG_NOSIGNAL) <= 0) {
+                break;
+            }
+        }
+    });
+
+    {
+        AllocCounter allocs(state);
+        size_t offset = 0;
+        size_t total = 0;
+        for (auto _ : state) {
+            size_t recvd = recv_file_chunk(sp.fds[0], path, offset, chunk);
+            total += recvd;
+            offset = (offset + recvd) % wrap;
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(total));
+    }
+    stop = true;
+    sp.close_end(0);
+    peer.join();
+    std::filesystem::remove(path);
+}
+BENCHMARK(BM_RecvFileChunk)->RangeMultiplier(2)->Range(4 * 1024, TMP_BUFF_SIZE)->UseRealTime();
+
+// tmpfs file -> socket; a peer thread drains the socket
+void BM_SendFileChunk(benchmark::State &state) {
+    SocketPair sp;
+    const size_t chunk = static_cast<size_t>(state.range(0));
+    const std::string path = scratch_dir() + "/send_chunk.bin";
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        std::vector<char> data(1024 * 1024, 's');
+        for (int i = 0; i < 16; ++i) {
+            out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+    }
+    std::thread peer([&]() {
+        std::vector<char> sink(TMP_BUFF_SIZE);
+        while (::recv(sp.fds[1], sink.data(), sink.size(), 0) > 0) {
+        }
+    });
+
+    {
+        std::ifstream in(path, std::ios::binary);
+        AllocCounter allocs(state);
+        for (auto _ : state) {
+            if (in.peek() == std::ifstream::traits_type::eof()) {
+                state.PauseTiming();
+                in.clear();
+                in.seekg(0);
+                state.ResumeTiming();
+            }
+            send_file_chunk(sp.fds[0], in, chunk);
+        }
+    }
+    sp.close_end(0);
+    peer.join();
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+    std::filesystem::remove(path);
+}
+BENCHMARK(BM_SendFileChunk)->RangeMultiplier(2)->Range(4 * 1024, TMP_BUFF_SIZE)->UseRealTime();
+
+}
@@ -0,0 +1,92 @@
+#include "micro.hpp"
+#include "minidrive/transfer_state.hpp"
+
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// user dir on tmpfs whose .transfers_state holds `pending` entries
+std::string seed_transfers(const size_t &pending) {
+    const std::string dir = scratch_dir() + "/transfers";
+    std::filesystem::create_directories(dir);
+    std::ofstream out(dir + "/.transfers_state", std::ios::binary | std::ios::trunc);
+    const std::string now = std::to_string(std::time(nullptr));
+    for (size_t i = 0; i < pending; ++i) {
+        out << "local/file" << i << ".bin:" << dir << "/remote/file" << i << ".bin.part:" << i * 4096 << ":" << 1024 * 1024 << ":" << now << "\n";
+    }
+    return dir;
+}
+
+std::string remote_path(const std::string &dir, const size_t &i) {
+    return dir + "/remote/file" + std::to_string(i) + ".bin.part";
+}
+
+// getActiveTransfers prints every parsed entry; keep that cost but not the output
+class SilenceStdout {
+public:
+    SilenceStdout() : saved(std::cout.rdbuf(sink.rdbuf())) {}
+    ~SilenceStdout() { std::cout.rdbuf(saved); }
+
+private:
+    std::ostringstream sink;
+    std::streambuf *saved;
+};
+
+void BM_UpdateProgress(benchmark::State &state) {
+    const size_t pending = static_cast<size_t>(state.range(0));
+    const std::string dir = seed_transfers(pending);
+    const std::string target = remote_path(dir, pending / 2);
+    AllocCounter allocs(state);
+    size_t bytes = 0;
+    for (auto _ : state) {
+        TransferState::updateProgress(dir, target, bytes);
+        bytes += 64 * 1024;
+    }
+}
+BENCHMARK(BM_UpdateProgress)->RangeMultiplier(4)->Range(1, 4096);
+
+void BM_GetActiveTransfers(benchmark::State &state) {
+    const std::string dir = seed_transfers(static_cast<size_t>(state.range(0)));
+    SilenceStdout silence;
+    AllocCounter allocs(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(TransferState::getActiveTransfers(dir));
+    }
+}
+BENCHMARK(BM_GetActiveTransfers)->RangeMultiplier(4)->Range(1, 4096);
+
+void BM_ClearTransfers(benchmark::State &state) {
+    const std::string dir = seed_transfers(static_cast<size_t>(state.range(0)));
+    AllocCounter allocs(state);
+    for (auto _ : state) {
+        TransferState::clearTransfers(dir);
+    }
+}
+BENCHMARK(BM_ClearTransfers)->RangeMultiplier(4)->Range(1, 4096);
+
+// removing an unknown entry still rewrites the whole file, so the state stays stable
+void BM_RemoveTransfer(benchmark::State &state) {
+    const std::string dir = seed_transfers(static_cast<size_t>(state.range(0)));
+    AllocCounter allocs(state);
+    for (auto _ : state) {
+        TransferState::removeTransfer(dir, "missing");
+    }
+}
+BENCHMARK(BM_RemoveTransfer)->RangeMultiplier(4)->Range(1, 4096);
+
+// every call appends a line, so keep the iteration count bounded to keep the journal small
+void BM_AddTransfer(benchmark::State &state) {
+    const std::string dir = seed_transfers(static_cast<size_t>(state.range(0)));
+    TransferState::Transfer transfer{"local/new.bin", dir + "/remote/new.bin.part", 0, 1024 * 1024, std::to_string(std::time(nullptr))};
+    AllocCounter allocs(state);
+    for (auto _ : state) {
+        TransferState::addTransfer(dir, transfer);
+    }
+}
+BENCHMARK(BM_AddTransfer)->Arg(1)->Arg(1024)->Iterations(256);
+
+}
@@ -0,0 +1,429 @@
+#include "bench_client.hpp"
+#include "minidrive/helpers.hpp"
+#include "minidrive/version.hpp"
+#include "minidrive/workload_trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#ifndef MINIDRIVE_SERVER_PATH
+#define MINIDRIVE_SERVER_PATH "server"
+#endif
+#ifndef MINIDRIVE_PROXY_PATH
+#define MINIDRIVE_PROXY_PATH "wanproxy"
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string server_path = MINIDRIVE_SERVER_PATH;
+    std::vector<std::string> server_args;
+    std::string proxy_path = MINIDRIVE_PROXY_PATH;
+    std::vector<std::string> wan_args; // WAN proxy shaping between sessions and server, none = direct loopback
+    std::vector<std::string> traces;
+    std::string workdir;
+    std::string out_path;
+    std::uint16_t port = 19091;
+    double speed = 1.0; // 1 = recorded pace, 10 = ten times faster, 0 = as fast as possible
+    bool keep = false;
+};
+
+// samples collected by all replayed sessions
+struct ReplayResult {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::vector<double>> latencies_us;
+    std::vector<double> lag_us; // how late each command was issued relative to its schedule
+    size_t bytes_up = 0;
+    size_t bytes_down = 0;
+    size_t commands = 0;
+    size_t errors = 0;
+    size_t mismatches = 0; // outcome differs from the recording (ok vs error)
+    size_t seeded = 0;     // downloads whose source had to be created synthetically
+    std::string first_error;
+    double wall_s = 0.0;
+    double server_cpu_s = 0.0;
+};
+
+void print_usage(const char *argv0) {
+    std::cerr << "Usage: " << argv0 << " [options] --trace <file|dir> [--trace ...]\n"
+              << "  --trace <path>           recorded session (.mdw) or directory of them, repeatable\n"
+              << "  --speed <factor>         replay speed, 1 = recorded pace, 0 = no think time (default: 1)\n"
+              << "  --server <path>          server binary (default: " << MINIDRIVE_SERVER_PATH << ")\n"
+              << "  --server-arg <arg>       extra argument passed to the server, repeatable\n"
+              << "  --wan \"<proxy flags>\"    replay through the WAN proxy, e.g. \"--latency 50 --jitter 10\"\n"
+              << "  --proxy <path>           WAN proxy binary (default: " << MINIDRIVE_PROXY_PATH << ")\n"
+              << "  --port <port>            loopback port for the server (default: 19091)\n"
+              << "  --workdir <path>         empty scratch directory, never removed (default: fresh /tmp/minidrive_replay_XXXXXX)\n"
+              << "  --out <file>             write JSON report to file instead of stdout\n"
+              << "  --keep                   keep the default scratch directory\n";
+}
+
+Options parse_args(int argc, char *argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::runtime_error("missing_argument: " + arg + " requires a value");
+            return argv[++i];
+        };
+        if (arg == "--trace") opt.traces.push_back(next());
+        else if (arg == "--speed") opt.speed = std::stod(next());
+        else if (arg == "--server") opt.server_path = next();
+        else if (arg == "--server-arg") opt.server_args.push_back(next());
+        else if (arg == "--wan") { auto a = split_args(next()); opt.wan_args.insert(opt.wan_args.end(), a.begin(), a.end()); }
+        else if (arg == "--proxy") opt.proxy_path = next();
+        else if (arg == "--port") opt.port = static_cast<std::uint16_t>(std::stoi(next()));
+        else if (arg == "--workdir") opt.workdir = next();
+        else if (arg == "--out") opt.out_path = next();
+        else if (arg == "--keep") opt.keep = true;
+        else if (arg == "--help" || arg == "-h") { print_usage(argv[0]); std::exit(0); }
+        else throw std::runtime_error("unknown_argument: " + arg);
+    }
+    if (opt.traces.empty()) {
+        throw std::runtime_error("missing_argument: at least one --trace is required");
+    }
+    if (opt.speed < 0.0) {
+        throw std::runtime_error("invalid_argument: --speed must not be negative");
+    }
+    return opt;
+}
+
+// expands directories and sorts so the session order is stable between runs
+std::vector<workload::Trace> load_traces(const std::vector<std::string> &paths) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> files;
+    for (const auto &p : paths) {
+        if (fs::is_directory(p)) {
+            for (const auto &entry : fs::directory_iterator(p)) {
+                if (entry.is_regular_file() && entry.path().extension() == workload::EXTENSION) {
+                    files.push_back(entry.path().string());
+                }
+            }
+        } else {
+            files.push_back(p);
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<workload::Trace> traces;
+    for (const auto &f : files) {
+        traces.push_back(workload::read_trace(f));
+    }
+    return traces;
+}
+
+// a recorded UPLOAD_PACK only carries its stream size, so its files are replayed at this size
+constexpr size_t PACK_FILE_SIZE = 64 * 1024;
+
+// synthetic upload sources, one file per distinct size and one directory per distinct pack, created on first use
+class DataFiles {
+public:
+    explicit DataFiles(const std::string &dir) : dir(dir) {}
+
+    std::string get(const size_t &size) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        const std::string path = this->dir + "/" + std::to_string(size) + ".bin";
+        if (!std::filesystem::exists(path)) {
+            make_synthetic_file(path, size, size + 1);
+        }
+        return path;
+    }
+
+    // `size` bytes spread over `files` files (at least one)
+    std::string getPack(const size_t &size, size_t files) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        files = std::max<size_t>(files, 1);
+        const std::string path = this->dir + "/pack-" + std::to_string(size) + "-" + std::to_string(files);
+        if (!std::filesystem::exists(path)) {
+            std::filesystem::create_directories(path);
+            for (size_t i = 0; i < files; ++i) {
+                const size_t file_size = size / files + (i < size % files ? 1 : 0);
+                make_synthetic_file(path + "/" + std::to_string(i) + ".bin", file_size, file_size + i + 1);
+            }
+        }
+        return path;
+    }
+
+private:
+    std::mutex mutex;
+    std::string dir;
+};
+
+void make_parents(const int &fd, const std::string &remote) {
+    for (size_t slash = remote.find('/', 1); slash != std::string::npos; slash = remote.find('/', slash + 1)) {
+        try {
+            command(fd, "MKDIR " + remote.substr(0, slash));
+        } catch (const std::exception &) {
+            // already exists
+        }
+    }
+}
+
+// the recorded download source is missing on the test server: create its parents and upload synthetic data
+void seed_download(const int &fd, DataFiles &data, const std::string &remote, const size_t &size) {
+    make_parents(fd, remote);
+    upload_file(fd, data.get(size), remote);
+}
+
+// same for a packed download: a directory of the recorded number of files
+void seed_pack_download(const int &fd, DataFiles &data, const std::string &remote, const size_t &size, const size_t &files) {
+    make_parents(fd, remote);
+    upload_pack(fd, data.getPack(size, files), remote);
+}
+
+void replay_session(const Options &opt, const ServerProcess &server, const workload::Trace &trace, const std::uint64_t &epoch_us,
+                    const Clock::time_point &t0, DataFiles &data, ReplayResult &result) {
+    std::unordered_map<std::string, std::vector<double>> local;
+    std::vector<double> lag;
+    size_t bytes_up = 0, bytes_down = 0, commands = 0, errors = 0, mismatches = 0, seeded = 0;
+    std::string first_error;
+
+    // schedule relative to the earliest recorded session, compressed by the speed factor
+    auto due = [&](const std::uint64_t &offset_us) {
+        if (opt.speed == 0.0) {
+            return t0;
+        }
+        const double at_us = static_cast<double>(trace.start_us - epoch_us + offset_us) / opt.speed;
+        return t0 + std::chrono::microseconds(static_cast<std::int64_t>(at_us));
+    };
+
+    int fd = -1;
+    try {
+        std::this_thread::sleep_until(due(0));
+        fd = connect_loopback(server.port);
+        handshake(fd);
+
+        for (const auto &r : trace.records) {
+            // the connection is already authenticated in public mode; EXIT ends the session below
+            if (r.op == workload::Op::Auth || r.op == workload::Op::Exit) {
+                continue;
+            }
+            const auto when = due(r.offset_us);
+            std::this_thread::sleep_until(when);
+            auto start = Clock::now();
+            if (opt.speed > 0.0) {
+                lag.push_back(std::chrono::duration<double, std::micro>(start - when).count());
+            }
+
+            bool ok = true;
+            try {
+                switch (r.op) {
+                    case workload::Op::Upload:
+                        upload_file(fd, data.get(r.bytes), r.args.at(0));
+                        bytes_up += r.bytes;
+                        break;
+                    case workload::Op::Download:
+                        try {
+                            bytes_down += download_discard(fd, r.args.at(0));
+                        } catch (const std::exception &) {
+                            if (!r.ok) {
+                                throw;
+                            }
+                            // recorded as successful: seed the source outside the timed window, then retry
+                            seed_download(fd, data, r.args.at(0), r.bytes);
+                            seeded++;
+                            start = Clock::now();
+                            bytes_down += download_discard(fd, r.args.at(0));
+                        }
+                        break;
+                    case workload::Op::UploadPipelined:
+                        upload_file(fd, data.get(r.bytes), r.args.at(0), true);
+                        bytes_up += r.bytes;
+                        break;
+                    case workload::Op::UploadPack:
+                        bytes_up += upload_pack(fd, data.getPack(r.bytes, r.bytes / PACK_FILE_SIZE), r.args.at(0));
+                        break;
+                    case workload::Op::DownloadPack:
+                        try {
+                            bytes_down += download_discard(fd, r.args.at(0), true);
+                        } catch (const std::exception &) {
+                            if (!r.ok) {
+                                throw;
+                            }
+                            seed_pack_download(fd, data, r.args.at(0), r.bytes, r.args.size() > 1 ? std::stoull(r.args[1]) : 1);
+                            seeded++;
+                            start = Clock::now();
+                            bytes_down += download_discard(fd, r.args.at(0), true);
+                        }
+                        break;
+                    case workload::Op::Batch: // mode and operation lines, sent as one message like the client does
+                        command(fd, std::string(workload::op_name(r.op)) + (r.args.at(0).empty() ? "" : " " + r.args[0]) + "\n" + r.args.at(1));
+                        break;
+                    case workload::Op::Move:
+                    case workload::Op::Copy:
+                        command(fd, std::string(workload::op_name(r.op)) + " " + r.args.at(0) + " " + r.args.at(1));
+                        break;
+                    default:
+                        command(fd, std::string(workload::op_name(r.op)) + (r.args.empty() || r.args[0].empty() ? "" : " " + r.args[0]));
+                        break;
+                }
+            } catch (const std::exception &e) {
+                ok = false;
+                errors++;
+                if (first_error.empty()) first_error = std::string(workload::op_name(r.op)) + ": " + e.what();
+            }
+            local[workload::op_name(r.op)].push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+            commands++;
+            if (ok != r.ok) {
+                mismatches++;
+            }
+        }
+        send_msg(fd, "EXIT");
+    } catch (const std::exception &e) {
+        // connection-level failure ends this session
+        errors++;
+        if (first_error.empty()) first_error = e.what();
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+
+    std::lock_guard<std::mutex> lock(result.mutex);
+    for (auto &[name, v] : local) {
+        auto &dst = result.latencies_us[name];
+        dst.insert(dst.end(), v.begin(), v.end());
+    }
+    result.lag_us.insert(result.lag_us.end(), lag.begin(), lag.end());
+    result.bytes_up += bytes_up;
+    result.bytes_down += bytes_down;
+    result.commands += commands;
+    result.errors += errors;
+    result.mismatches += mismatches;
+    result.seeded += seeded;
+    if (result.first_error.empty()) result.first_error = first_error;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    namespace fs = std::filesystem;
+
+    Options opt;
+    std::vector<workload::Trace> traces;
+    try {
+        opt = parse_args(argc, argv);
+        traces = load_traces(opt.traces);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (traces.empty()) {
+        std::cerr << "no traces found" << std::endl;
+        return 1;
+    }
+
+    bool owned_workdir = false;
+    try {
+        owned_workdir = prepare_workdir(opt.workdir, "minidrive_replay");
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    fs::create_directories(opt.workdir + "/data");
+
+    std::uint64_t epoch_us = traces.front().start_us;
+    std::uint64_t recorded_us = 0;
+    size_t recorded_commands = 0;
+    for (const auto &t : traces) {
+        epoch_us = std::min(epoch_us, t.start_us);
+    }
+    for (const auto &t : traces) {
+        if (!t.records.empty()) {
+            recorded_us = std::max(recorded_us, t.start_us - epoch_us + t.records.back().offset_us);
+        }
+        recorded_commands += t.records.size();
+    }
+
+    nlohmann::json report;
+    report["benchmark"] = "minidrive_replay";
+    report["version"] = std::string(minidrive::version());
+    report["timestamp"] = static_cast<long long>(std::time(nullptr));
+    report["config"] = {
+        {"sessions", traces.size()},
+        {"recorded_commands", recorded_commands},
+        {"recorded_s", static_cast<double>(recorded_us) / 1e6},
+        {"speed", opt.speed},
+        {"server_args", opt.server_args},
+        {"wan", opt.wan_args},
+    };
+
+    ServerProcess server;
+    ServerProcess proxy;
+    ReplayResult result;
+    int rc = 0;
+    try {
+        server = spawn_server(opt.server_path, opt.workdir, opt.port, opt.server_args);
+        DataFiles data(opt.workdir + "/data");
+        ServerProcess endpoint = server;
+        if (!opt.wan_args.empty()) {
+            proxy = spawn_proxy(opt.proxy_path, opt.workdir, static_cast<std::uint16_t>(opt.port + 1), server.port, opt.wan_args);
+            endpoint.port = proxy.port;
+        }
+
+        // one thread per recorded session, each sleeping until its commands are due
+        double cpu_before = process_cpu_seconds(server.pid);
+        const auto t0 = Clock::now();
+        std::vector<std::thread> threads;
+        for (const auto &trace : traces) {
+            threads.emplace_back([&, t0]() { replay_session(opt, endpoint, trace, epoch_us, t0, data, result); });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        result.wall_s = std::chrono::duration<double>(Clock::now() - t0).count();
+        result.server_cpu_s = process_cpu_seconds(server.pid) - cpu_before;
+    } catch (const std::exception &e) {
+        report["error"] = e.what();
+        rc = 1;
+    }
+    stop_server(proxy);
+    stop_server(server);
+
+    nlohmann::json ops;
+    for (auto &[name, samples] : result.latencies_us) {
+        ops[name] = latency_report(samples, result.wall_s);
+    }
+    report["ops"] = ops;
+    report["schedule_lag_us"] = {
+        {"p50", percentile(result.lag_us, 0.50)},
+        {"p99", percentile(result.lag_us, 0.99)},
+        {"max", result.lag_us.empty() ? 0.0 : *std::max_element(result.lag_us.begin(), result.lag_us.end())},
+    };
+    report["commands"] = result.commands;
+    report["bytes_up"] = result.bytes_up;
+    report["bytes_down"] = result.bytes_down;
+    report["wall_s"] = result.wall_s;
+    report["server_cpu_s"] = result.server_cpu_s;
+    report["errors"] = result.errors;
+    report["outcome_mismatches"] = result.mismatches;
+    report["seeded_downloads"] = result.seeded;
+    if (!result.first_error.empty()) report["first_error"] = result.first_error;
+
+    if (opt.out_path.empty()) {
+        std::cout << report.dump(2) << std::endl;
+    } else {
+        std::ofstream out(opt.out_path);
+        out << report.dump(2) << std::endl;
+    }
+
+    if (owned_workdir && !opt.keep) {
+        fs::remove_all(opt.workdir);
+    }
+    return rc;
+}
@@ -0,0 +1,399 @@
+// userspace TCP proxy that emulates a WAN link between a client and the server:
+// one-way latency with jitter, a per-direction bandwidth cap, retransmission stalls
+// standing in for packet loss, and connection resets after a byte budget or at random
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t SEGMENT_SIZE = 16 * 1024;           // bytes read per segment (pacing granularity)
+constexpr int POLL_MS = 50;                           // how often blocked threads check for a reset
+constexpr size_t MIN_QUEUE_BYTES = 4 * 1024 * 1024;   // in-flight bytes per direction before the reader blocks
+
+struct Options {
+    std::uint16_t listen_port = 0;
+    std::string upstream_host = "127.0.0.1";
+    std::uint16_t upstream_port = 0;
+    double latency_ms = 0.0;      // one-way, added in each direction
+    double jitter_ms = 0.0;       // uniform +/- around the latency
+    double rate = 0.0;            // bytes per second per direction, 0 = unlimited
+    double loss = 0.0;            // probability that a segment needs a retransmission
+    double loss_penalty_ms = 200; // stall per lost segment (about one RTO)
+    std::uint64_t reset_after = 0; // reset a connection after forwarding this many bytes, 0 = never
+    double reset_prob = 0.0;      // per-segment probability of a reset
+    std::uint64_t max_resets = 0; // stop injecting resets after this many, 0 = unlimited
+    std::uint64_t seed = 1;
+};
+
+Options opt;
+std::atomic<std::uint64_t> resets_done{0};
+std::atomic<std::uint64_t> connection_ids{0};
+
+double parse_rate(const std::string &s) {
+    size_t pos = 0;
+    double value = std::stod(s, &pos);
+    std::string unit = s.substr(pos);
+    if (unit == "K") value *= 1e3;
+    else if (unit == "M") value *= 1e6;
+    else if (unit == "G") value *= 1e9;
+    else if (!unit.empty()) throw std::runtime_error("invalid_rate: Unknown rate unit in " + s);
+    return value;
+}
+
+void print_usage(const char *argv0) {
+    std::cerr << "Usage: " << argv0 << " --listen <port> --upstream <host:port> [options]\n"
+              << "  --latency <ms>        one-way delay added in each direction (default: 0)\n"
+              << "  --jitter <ms>         uniform +/- variation of the delay (default: 0)\n"
+              << "  --rate <bytes/s>      bandwidth cap per direction, K/M/G suffixes (default: unlimited)\n"
+              << "  --loss <p>            probability a segment stalls for a retransmission (default: 0)\n"
+              << "  --loss-penalty <ms>   stall per lost segment (default: 200)\n"
+              << "  --reset-after <bytes> reset each connection after forwarding this many bytes\n"
+              << "  --reset-prob <p>      per-segment probability of resetting the connection\n"
+              << "  --max-resets <n>      stop injecting resets after n (default: unlimited)\n"
+              << "  --seed <n>            random seed for jitter, loss and resets (default: 1)\n";
+}
+
+Options parse_args(int argc, char *argv[]) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::runtime_error("missing_argument: " + arg + " requires a value");
+            return argv[++i];
+        };
+        if (arg == "--listen") o.listen_port = static_cast<std::uint16_t>(std::stoi(next()));
+        else if (arg == "--upstream") {
+            std::string v = next();
+            size_t colon = v.rfind(':');
+            if (colon == std::string::npos) throw std::runtime_error("invalid_argument: --upstream expects host:port");
+            o.upstream_host = v.substr(0, colon);
+            o.upstream_port = static_cast<std::uint16_t>(std::stoi(v.substr(colon + 1)));
+        }
+        else if (arg == "--latency") o.latency_ms = std::stod(next());
+        else if (arg == "--jitter") o.jitter_ms = std::stod(next());
+        else if (arg == "--rate") o.rate = parse_rate(next());
+        else if (arg == "--loss") o.loss = std::stod(next());
+        else if (arg == "--loss-penalty") o.loss_penalty_ms = std::stod(next());
+        else if (arg == "--reset-after") o.reset_after = static_cast<std::uint64_t>(parse_rate(next()));
+        else if (arg == "--reset-prob") o.reset_prob = std::stod(next());
+        else if (arg == "--max-resets") o.max_resets = std::stoull(next());
+        else if (arg == "--seed") o.seed = std::stoull(next());
+        else if (arg == "--help" || arg == "-h") { print_usage(argv[0]); std::exit(0); }
+        else throw std::runtime_error("unknown_argument: " + arg);
+    }
+    if (o.listen_port == 0 || o.upstream_port == 0) {
+        throw std::runtime_error("missing_argument: --listen and --upstream are required");
+    }
+    return o;
+}
+
+// claims one reset from the global budget
+bool take_reset() {
+    if (opt.max_resets == 0) {
+        resets_done++;
+        return true;
+    }
+    std::uint64_t done = resets_done.load();
+    while (done < opt.max_resets) {
+        if (resets_done.compare_exchange_weak(done, done + 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Segment {
+    std::vector<char> data; // empty = end of stream
+    Clock::time_point deliver_at;
+};
+
+// one direction of a connection: a reader stamps segments with their arrival time, a writer delivers them
+struct Direction {
+    int from = -1;
+    int to = -1;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Segment> queue;
+    size_t queued_bytes = 0;
+    Clock::time_point link_free = Clock::now(); // when the emulated link finishes serialising the last segment
+    Clock::time_point last_delivery = Clock::now();
+    std::uint64_t forwarded = 0;
+};
+
+class Connection {
+public:
+    Connection(const int &client_fd, const int &server_fd, const std::uint64_t &id)
+        : id(id), rng(opt.seed * 0x9E3779B97F4A7C15ULL + id) {
+        this->up.from = client_fd;
+        this->up.to = server_fd;
+        this->down.from = server_fd;
+        this->down.to = client_fd;
+    }
+
+    void run() {
+        std::thread up_reader([this]() { this->reader(this->up); });
+        std::thread up_writer([this]() { this->writer(this->up); });
+        std::thread down_reader([this]() { this->reader(this->down); });
+        std::thread down_writer([this]() { this->writer(this->down); });
+        up_reader.join();
+        up_writer.join();
+        down_reader.join();
+        down_writer.join();
+
+        // a reset closes both sides with RST instead of FIN
+        if (this->reset) {
+            linger l{1, 0};
+            ::setsockopt(this->up.from, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+            ::setsockopt(this->up.to, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+        }
+        ::close(this->up.from);
+        ::close(this->up.to);
+        std::cerr << "conn=" << this->id << " up_bytes=" << this->up.forwarded << " down_bytes=" << this->down.forwarded
+                  << (this->reset ? " reset" : " closed") << std::endl;
+    }
+
+private:
+    std::uint64_t id;
+    Direction up;
+    Direction down;
+    std::atomic<bool> reset{false};
+    std::atomic<std::uint64_t> total_forwarded{0};
+    std::mutex rng_mutex;
+    std::mt19937_64 rng;
+
+    double uniform() {
+        std::lock_guard<std::mutex> lock(this->rng_mutex);
+        return std::uniform_real_distribution<double>(0.0, 1.0)(this->rng);
+    }
+
+    void abort() {
+        this->reset = true;
+        this->up.cv.notify_all();
+        this->down.cv.notify_all();
+    }
+
+    size_t queue_limit() const {
+        // at least a bandwidth-delay product so the cap, not the queue, limits throughput
+        double bdp = opt.rate * (opt.latency_ms + opt.jitter_ms + opt.loss_penalty_ms) / 1e3;
+        return std::max(MIN_QUEUE_BYTES, static_cast<size_t>(bdp));
+    }
+
+    void push(Direction &d, Segment segment) {
+        std::unique_lock<std::mutex> lock(d.mutex);
+        d.queued_bytes += segment.data.size();
+        d.queue.push_back(std::move(segment));
+        d.cv.notify_all();
+    }
+
+    void reader(Direction &d) {
+        std::vector<char> buffer(SEGMENT_SIZE);
+        const size_t limit = this->queue_limit();
+        while (!this->reset) {
+            // back-pressure: stop reading while too much is in flight
+            {
+                std::unique_lock<std::mutex> lock(d.mutex);
+                d.cv.wait_for(lock, std::chrono::milliseconds(POLL_MS), [&]() { return d.queued_bytes < limit || this->reset; });
+                if (d.queued_bytes >= limit) {
+                    continue;
+                }
+            }
+
+            pollfd pfd{d.from, POLLIN, 0};
+            int ready = ::poll(&pfd, 1, POLL_MS);
+            if (ready <= 0) {
+                continue;
+            }
+            ssize_t n = ::recv(d.from, buffer.data(), buffer.size(), 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                if (n < 0) {
+                    this->abort(); // peer reset -> pass it on
+                } else {
+                    this->push(d, Segment{{}, std::max(d.last_delivery, Clock::now())});
+                }
+                return;
+            }
+
+            // serialisation on the capped link, then propagation delay with jitter and loss stalls
+            const auto now = Clock::now();
+            const size_t bytes = static_cast<size_t>(n);
+            auto departs = std::max(now, d.link_free);
+            if (opt.rate > 0.0) {
+                departs += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(static_cast<double>(bytes) / opt.rate));
+            }
+            d.link_free = departs;
+            double delay_ms = opt.latency_ms;
+            if (opt.jitter_ms > 0.0) {
+                delay_ms += (this->uniform() * 2.0 - 1.0) * opt.jitter_ms;
+            }
+            if (opt.loss > 0.0 && this->uniform() < opt.loss) {
+                delay_ms += opt.loss_penalty_ms;
+            }
+            auto deliver_at = departs + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(std::max(0.0, delay_ms)));
+
+            // TCP delivers in order, so a segment never overtakes the previous one
+            deliver_at = std::max(deliver_at, d.last_delivery);
+            d.last_delivery = deliver_at;
+            this->push(d, Segment{std::vector<char>(buffer.begin(), buffer.begin() + n), deliver_at});
+        }
+    }
+
+    void writer(Direction &d) {
+        while (!this->reset) {
+            Segment segment;
+            {
+                std::unique_lock<std::mutex> lock(d.mutex);
+                if (!d.cv.wait_for(lock, std::chrono::milliseconds(POLL_MS), [&]() { return !d.queue.empty() || this->reset; })) {
+                    continue;
+                }
+                if (this->reset) {
+                    return;
+                }
+                segment = std::move(d.queue.front());
+                d.queue.pop_front();
+                d.queued_bytes -= segment.data.size();
+                d.cv.notify_all();
+            }
+
+            while (Clock::now() < segment.deliver_at && !this->reset) {
+                std::this_thread::sleep_until(std::min(segment.deliver_at, Clock::now() + std::chrono::milliseconds(POLL_MS)));
+            }
+            if (this->reset) {
+                return;
+            }
+            if (segment.data.empty()) {
+                ::shutdown(d.to, SHUT_WR);
+                return;
+            }
+
+            size_t sent = 0;
+            while (sent < segment.data.size() && !this->reset) {
+                pollfd pfd{d.to, POLLOUT, 0};
+                if (::poll(&pfd, 1, POLL_MS) <= 0) {
+                    continue;
+                }
+                ssize_t n = ::send(d.to, segment.data.data() + sent, segment.data.size() - sent, MSG_NOSIGNAL);
+                if (n < 0) {
+                    if (errno == EINTR || errno == EAGAIN) continue;
+                    this->abort();
+                    return;
+                }
+                sent += static_cast<size_t>(n);
+            }
+            d.forwarded += sent;
+
+            // injected resets
+            std::uint64_t total = this->total_forwarded += sent;
+            bool budget_hit = opt.reset_after > 0 && total >= opt.reset_after;
+            bool random_hit = opt.reset_prob > 0.0 && this->uniform() < opt.reset_prob;
+            if ((budget_hit || random_hit) && take_reset()) {
+                this->abort();
+                return;
+            }
+        }
+    }
+};
+
+int listen_on(const std::uint16_t &port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error("socket: Failed to create socket");
+    }
+    int enable = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(fd, 128) < 0) {
+        ::close(fd);
+        throw std::runtime_error("listen: Failed to listen on 127.0.0.1:" + std::to_string(port));
+    }
+    return fd;
+}
+
+int connect_upstream() {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.upstream_port);
+    if (::inet_pton(AF_INET, opt.upstream_host.c_str(), &addr.sin_addr) != 1 ||
+        ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    try {
+        opt = parse_args(argc, argv);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = -1;
+    try {
+        listen_fd = listen_on(opt.listen_port);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    std::cerr << "wanproxy listening on 127.0.0.1:" << opt.listen_port << " -> " << opt.upstream_host << ":" << opt.upstream_port
+              << " latency_ms=" << opt.latency_ms << " jitter_ms=" << opt.jitter_ms << " rate=" << opt.rate
+              << " loss=" << opt.loss << " reset_after=" << opt.reset_after << " reset_prob=" << opt.reset_prob << std::endl;
+
+    while (true) {
+        int client_fd = ::accept(listen_fd, nullptr, nullptr);
+        if (client_fd < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+            continue;
+        }
+        int server_fd = connect_upstream();
+        if (server_fd < 0) {
+            std::cerr << "upstream connect failed: " << std::strerror(errno) << std::endl;
+            ::close(client_fd);
+            continue;
+        }
+        int enable = 1;
+        ::setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        ::setsockopt(server_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        std::uint64_t id = ++connection_ids;
+        std::thread([client_fd, server_fd, id]() {
+            Connection conn(client_fd, server_fd, id);
+            conn.run();
+        }).detach();
+    }
+}
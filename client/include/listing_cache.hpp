@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// remote listings this client has seen, with the tag the server gave each one. LIST sends the tag
+// back and the server answers NOT_MODIFIED while it still holds, so listing an unchanged directory
+// again costs one small round trip. Keys are directories as the session addresses them: relative
+// paths are resolved against the remote working directory, which the client follows through CD.
+class ListingCache {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 256; // directories, least recently listed dropped first
+
+    struct Entry {
+        std::string etag;
+        std::string listing; // reply body, without the status line
+    };
+
+    explicit ListingCache(const size_t &capacity = DEFAULT_CAPACITY);
+
+    // the server accepted CD <path>
+    void changeDirectory(const std::string &path);
+
+    std::string key(const std::string &path) const;
+
+    // nullptr if not cached; a hit becomes the most recently used
+    const Entry *find(const std::string &key);
+    void store(const std::string &key, const std::string &etag, const std::string &listing);
+    void drop(const std::string &key);
+
+private:
+    size_t capacity;
+    std::string cwd = "~"; // the user directory the session starts in; its absolute path is not known
+    std::list<std::string> order; // most recently used first
+    struct Slot {
+        Entry entry;
+        std::list<std::string>::iterator position;
+    };
+    std::unordered_map<std::string, Slot> entries;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "minidrive/transfer_state.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// restarts interrupted transfers after a reconnect: every upload in the server's RESUME offer and
+// every download in the local journal runs on one of up to `parallel` extra connections. Uploads are
+// only offered right after AUTH, so each one gets a fresh connection; downloads and tree transfers
+// share one per worker.
+class ResumeManager {
+public:
+    enum class Kind { Upload, Download, Tree };
+    struct Job {
+        Kind kind;
+        TransferState::Transfer transfer;
+    };
+
+    // opens and authenticates a connection, stores the server's RESUME offer and returns the fd
+    using Connect = std::function<int(std::string &offer)>;
+
+    ResumeManager(Connect connect, const size_t &parallel, const size_t &window); // window: files in flight per tree
+
+    // runs all jobs and returns how many failed (each outcome is printed as it finishes)
+    size_t run(const std::vector<Job> &jobs);
+
+private:
+    Connect connect;
+    size_t parallel;
+    size_t window;
+    std::mutex output_mutex;
+
+    void worker(const std::vector<Job> &jobs, std::atomic<size_t> &next, std::atomic<size_t> &failed);
+    void report(const Job &job, const std::string &outcome);
+};
+
+// single resumes; both return a one-line summary and throw on failure
+std::string resume_upload(const int &fd, const TransferState::Transfer &transfer);   // answers the offer read at AUTH
+std::string resume_download(const int &fd, const TransferState::Transfer &transfer); // on an idle connection
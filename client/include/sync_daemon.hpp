@@ -0,0 +1,93 @@
+#pragma once
+
+#include "resume_manager.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// --watch <local_dir> <remote_dir>: keeps a remote directory a copy of a local one. inotify reports
+// the changes under the local tree; they are collected until the tree has been quiet for DEBOUNCE
+// (or MAX_DELAY after the first one, so a tree that never settles still syncs), then every changed
+// path is compared with what was last synced and the difference goes out as one BATCH of moves,
+// deletes and mkdirs followed by the pipelined uploads of UPLOAD -r. An editor's save storm of
+// temporary files and renames collapses to the one file that changed. What was synced, and what
+// changed but is not synced yet, is journalled in <local_dir>/.mdsync, so a restart only sends what
+// changed while the daemon was down. Changes made on the server are not brought back.
+class SyncDaemon {
+public:
+    static constexpr std::chrono::milliseconds DEBOUNCE{150};
+    static constexpr std::chrono::milliseconds MAX_DELAY{1000};
+    static constexpr std::chrono::seconds RETRY{5}; // after a refused operation or a lost connection
+    static constexpr const char *JOURNAL = ".mdsync"; // in the local root, never synced itself
+
+    enum class Type { Missing, File, Dir }; // of a local path; symlinks and the like count as missing
+
+    // a path as it was last synced
+    struct Entry {
+        bool dir = false;
+        std::uint64_t size = 0;
+        std::int64_t mtime = 0; // ns
+    };
+
+    SyncDaemon(ResumeManager::Connect connect, const std::string &local_dir, const std::string &remote_dir, const size_t &window);
+    ~SyncDaemon();
+    SyncDaemon(const SyncDaemon &) = delete;
+    SyncDaemon &operator=(const SyncDaemon &) = delete;
+
+    // syncs on the authenticated connection `fd` and reconnects when it is lost (fd follows, -1 while
+    // disconnected); only returns by throwing, when the local tree cannot be watched any more
+    void run(int &fd);
+
+private:
+    using Synced = std::map<std::string, Entry>; // relative path -> entry, so a subtree is a range
+
+    struct Plan; // what one flush sends
+
+    ResumeManager::Connect connect;
+    std::string local_dir;
+    std::string remote_dir;
+    size_t window;
+
+    Synced synced;
+    std::set<std::string> dirty; // relative paths changed since they were synced, "" for the whole tree
+    std::vector<std::pair<std::string, std::string>> moves; // renames inside the tree, in order
+
+    int inotify_fd = -1;
+    std::unordered_map<int, std::string> wds; // watch -> relative directory
+    std::uint32_t moved_cookie = 0; // an IN_MOVED_FROM waiting for its IN_MOVED_TO
+    std::string moved_from;
+    bool moved_dir = false;
+
+    std::ofstream journal;
+    size_t records = 0; // appended since the journal was last rewritten
+    std::set<std::string> warned; // names that cannot be sent, reported once
+
+    std::chrono::steady_clock::time_point first_change{};
+    std::chrono::steady_clock::time_point last_change{};
+    std::chrono::steady_clock::time_point not_before{}; // no flush or reconnect earlier
+
+    std::string full(const std::string &relative) const;
+    bool ignored(const std::string &relative); // the journal, and names that cannot be sent
+
+    void load();
+    void compact();
+    void record(const std::string &line);
+    void markDirty(const std::string &relative);
+
+    void watchTree(const std::string &relative);
+    void unwatchTree(const std::string &relative);
+    void readEvents();
+    void endMove(); // an IN_MOVED_FROM whose pair never came: moved out of the tree
+
+    void reconcile(const std::string &relative, Synced &next, Plan &plan);
+    void reconcileEntry(const std::string &relative, const Type &type, const Entry &local, Synced &next, Plan &plan);
+    void flush(const int &fd);
+};
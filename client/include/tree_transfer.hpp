@@ -0,0 +1,47 @@
+#pragma once
+
+#include "minidrive/transfer_state.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// recursive transfers (UPLOAD -r / DOWNLOAD -r): every file of a tree goes over the one connection
+// with up to `window` requests in flight, so a small file costs a fraction of a round trip instead of
+// a whole one. Replies come back in request order, so the files that are finished always form a
+// prefix of the walk; the client journal keeps the length of that prefix under a marker entry, and a
+// resume walks the tree again and carries on after it (files that were in flight start over).
+namespace tree {
+
+constexpr size_t DEFAULT_WINDOW = 8;
+constexpr const char *UPLOAD_MARKER = ".mdtree-upload"; // journal entry "<remote_dir>/<marker>"
+constexpr const char *DOWNLOAD_MARKER = ".mdtree-download";
+
+// command arguments are split on spaces, so paths with spaces or newlines cannot be sent; an empty
+// path passes (it is the root of a tree), callers that need a name check for one
+bool sendable(const std::string &path);
+
+// journal entries of tree transfers: bytes_completed / total_bytes count files, not bytes
+bool is_tree(const TransferState::Transfer &transfer);
+
+// whether a pending single upload is one of the files of a journalled tree upload (the tree resume
+// sends it again, so it is not resumed on its own)
+bool covers(const TransferState::Transfer &tree, const std::string &local_path);
+
+// both print a summary; a failed file is reported and counted, a failed connection throws
+void upload(const int &fd, const std::string &local_dir, const std::string &remote_dir, const size_t &window);
+void download(const int &fd, const std::string &remote_dir, const std::string &local_dir, const size_t &window);
+
+struct Failures {
+    std::vector<std::string> paths;
+    std::vector<std::string> errors; // "<path>: <error>", in the same order
+};
+
+// sends some files of a local directory (relative paths) the same way, without a journal or output;
+// a file that cannot be read or is refused is returned, a failed connection throws
+Failures upload_some(const int &fd, const std::string &local_dir, const std::string &remote_dir, const std::vector<std::string> &paths, const size_t &window);
+
+// continues a journalled tree transfer on an idle connection, returns a one-line summary
+std::string resume(const int &fd, const TransferState::Transfer &transfer, const size_t &window);
+
+} // namespace tree
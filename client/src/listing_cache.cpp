@@ -0,0 +1,61 @@
+#include "listing_cache.hpp"
+
+#include <filesystem>
+
+namespace {
+
+std::string normalize(const std::string &path) {
+    std::string key = std::filesystem::path(path).lexically_normal().generic_string();
+    while (key.size() > 1 && key.back() == '/') {
+        key.pop_back();
+    }
+    return key;
+}
+
+} // namespace
+
+ListingCache::ListingCache(const size_t &capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+void ListingCache::changeDirectory(const std::string &path) {
+    this->cwd = this->key(path);
+}
+
+std::string ListingCache::key(const std::string &path) const {
+    if (path.starts_with("/")) {
+        return normalize(path);
+    }
+    return normalize(this->cwd + "/" + (path.empty() ? "." : path));
+}
+
+const ListingCache::Entry *ListingCache::find(const std::string &key) {
+    const auto it = this->entries.find(key);
+    if (it == this->entries.end()) {
+        return nullptr;
+    }
+    this->order.splice(this->order.begin(), this->order, it->second.position);
+    return &it->second.entry;
+}
+
+void ListingCache::store(const std::string &key, const std::string &etag, const std::string &listing) {
+    const auto it = this->entries.find(key);
+    if (it != this->entries.end()) {
+        it->second.entry = {etag, listing};
+        this->order.splice(this->order.begin(), this->order, it->second.position);
+        return;
+    }
+    if (this->entries.size() >= this->capacity) {
+        this->entries.erase(this->order.back());
+        this->order.pop_back();
+    }
+    this->order.push_front(key);
+    this->entries.emplace(key, Slot{{etag, listing}, this->order.begin()});
+}
+
+void ListingCache::drop(const std::string &key) {
+    const auto it = this->entries.find(key);
+    if (it == this->entries.end()) {
+        return;
+    }
+    this->order.erase(it->second.position);
+    this->entries.erase(it);
+}
@@ -1,6 +1,11 @@
 #include "minidrive/version.hpp"
 #include "minidrive/helpers.hpp"
+#include "minidrive/pack.hpp"
 #include "minidrive/transfer_state.hpp"
+#include "listing_cache.hpp"
+#include "sync_daemon.hpp"
+#include "resume_manager.hpp"
+#include "tree_transfer.hpp"
 
 #include <iostream>
 #include <string>
@@ -8,6 +13,8 @@
 #include <cerrno>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -16,6 +23,7 @@
 #include <fstream>
 #include <filesystem>
 #include <vector>
+#include <algorithm>
 
 struct HostPort {
     std::string host;
@@ -40,15 +48,22 @@ void print_help() {
     std::cout << "Available commands:\n";
     std::cout << "HELP - Show this help message\n";
     std::cout << "EXIT - Exit the client\n";
-    std::cout << "LIST [path] - List files in the specified directory (default: current directory)\n";
+    std::cout << "LIST [path] - List files in the specified directory (default: current directory); unchanged listings come from a local cache\n";
+    std::cout << "WATCH [path] - Print changes to the directory's entries as they happen, until Enter is pressed\n";
     std::cout << "CD <path> - Change the current directory to the specified path\n";
     std::cout << "UPLOAD <local_path> [remote_path] - Upload a file from the client to the server\n";
+    std::cout << "UPLOAD --pack <local_dir> [remote_dir] - Upload a whole directory as one packed stream\n";
+    std::cout << "UPLOAD -r <local_dir> [remote_dir] - Upload a directory tree, several files in flight at once\n";
     std::cout << "DOWNLOAD <remote_path> [local_path] - Download a file from the server to the client\n";
+    std::cout << "DOWNLOAD --pack <remote_dir> [local_dir] - Download a whole directory as one packed stream\n";
+    std::cout << "DOWNLOAD -r <remote_dir> [local_dir] - Download a directory tree, several files in flight at once\n";
     std::cout << "DELETE <path> - Delete a file on the server\n";
     std::cout << "MKDIR <path> - Create a new directory on the server\n";
     std::cout << "RMDIR <path> - Remove a directory on the server\n";
     std::cout << "MOVE <source> <destination> - Move a file or directory on the server\n";
     std::cout << "COPY <source> <destination> - Copy a file or directory on the server\n";
+    std::cout << "DU [path] - Show the space used below a directory and your quota\n";
+    std::cout << "BATCH [--atomic] <ops_file> - Run the MKDIR/DELETE/RMDIR/MOVE/COPY lines of a local file in one round trip\n";
 }
 
 enum class Mode {
@@ -56,9 +71,70 @@ enum class Mode {
     Remote
 };
 
-void download(const int &fd, const std::string &cmd) {    
+void download_pack(const int &fd, const std::string &remote_dir, std::string local_dir) {
+    if (local_dir.empty()) {
+        local_dir = std::filesystem::path(remote_dir).lexically_normal().filename().string();
+        local_dir = local_dir.empty() ? "download" : local_dir;
+    }
+    send_msg(fd, "DOWNLOAD_PACK " + remote_dir);
+    std::string response = recv_msg(fd);
+    std::vector<std::string> parts = split_cmd(response);
+    if (parts.size() < 3 || parts[0] != "FILEINFO") {
+        throw std::runtime_error(is_cmd(response, "ERROR") ? response.substr(6) : "unknown_response: Expected FILEINFO response, got " + response);
+    }
+
+    // journalled with the local directory; the offset is the last entry boundary, where a resume restarts
+    TransferState::Transfer transfer;
+    transfer.local_path = local_dir;
+    transfer.remote_path = parts[1];
+    transfer.bytes_completed = 0;
+    transfer.total_bytes = std::stoull(parts[2]);
+    transfer.timestamp = std::to_string(std::time(nullptr));
+    transfer.hash_state = StreamHash().save();
+    std::filesystem::create_directories(local_dir);
+    TransferState::addTransfer(".", transfer);
+
+    pack::Reader reader(local_dir);
+    while (reader.position() < transfer.total_bytes) {
+        const std::uint64_t boundary = reader.boundary();
+        pack::recv_pack_chunk(fd, reader, static_cast<size_t>(std::min<std::uint64_t>(TMP_BUFF_SIZE, transfer.total_bytes - reader.position())));
+        if (reader.boundary() != boundary) {
+            TransferState::updateProgress(".", transfer.remote_path, static_cast<size_t>(reader.boundary()), reader.boundaryHash().save());
+        }
+    }
+    verify_digest(recv_msg(fd), reader.hash(), transfer.remote_path);
+    TransferState::removeTransfer(".", transfer.remote_path);
+    std::cout << "OK\nUnpacked " << reader.files() << " files (" << reader.bytes() << " bytes) to " << local_dir << "\n" << digest_line(reader.hash().hex()) << std::endl;
+}
+
+void upload_pack(const int &fd, const std::string &local_dir, const std::string &remote_dir) {
+    pack::Writer writer(local_dir);
+    send_msg(fd, "UPLOAD_PACK " + std::to_string(writer.size()) + " " + local_dir + (remote_dir.empty() ? "" : " " + remote_dir));
+    std::string response = recv_msg(fd);
+    if (response != "READY") {
+        std::cout << response << std::flush;
+        return;
+    }
+    StreamHash hash;
+    while (writer.position() < writer.size()) {
+        pack::send_pack_chunk(fd, writer, TMP_BUFF_SIZE, &hash);
+    }
+    response = recv_msg(fd);
+    std::cout << response << std::endl;
+    verify_digest(response, hash, local_dir);
+}
+
+void download(const int &fd, const std::string &cmd, const size_t &window) {    
     // parse command
     std::vector<std::string> parts = split_cmd(cmd);
+    if (parts.size() >= 3 && parts[1] == "--pack") {
+        download_pack(fd, parts[2], parts.size() >= 4 ? parts[3] : "");
+        return;
+    }
+    if (parts.size() >= 3 && parts[1] == "-r") {
+        tree::download(fd, parts[2], parts.size() >= 4 ? parts[3] : "", window);
+        return;
+    }
     if (parts.size() < 2) {
         throw std::runtime_error("invalid_command: DOWNLOAD command requires a path argument");
     }
@@ -94,30 +170,48 @@ void download(const int &fd, const std::string &cmd) {
     transfer.bytes_completed = 0;
     transfer.total_bytes = file_size;
     transfer.timestamp = std::to_string(std::time(nullptr));
+    StreamHash hash;
+    transfer.hash_state = hash.save();
     TransferState::addTransfer(".", transfer);
 
-    // receive file in chunks
+    // receive file in chunks, hashing as they arrive
     while (transfer.bytes_completed < transfer.total_bytes) {
         size_t bytes_left = transfer.total_bytes - transfer.bytes_completed;
         size_t to_recv = bytes_left < TMP_BUFF_SIZE ? bytes_left : TMP_BUFF_SIZE;
-        size_t recvd = recv_file_chunk(fd, local_path, transfer.bytes_completed, to_recv);
+        size_t recvd = recv_file_chunk(fd, local_path, transfer.bytes_completed, to_recv, &hash);
         transfer.bytes_completed += recvd;
-        TransferState::updateProgress(".", remote_path, transfer.bytes_completed);
+        TransferState::updateProgress(".", remote_path, transfer.bytes_completed, hash.save());
+    }
+    try {
+        verify_digest(recv_msg(fd), hash, remote_path);
+    } catch (const std::exception &) {
+        // corrupt or incomplete: do not leave it around to be resumed
+        std::filesystem::remove(local_path);
+        TransferState::removeTransfer(".", remote_path);
+        throw;
     }
     
     // finalize
     std::filesystem::rename(local_path, local_path.substr(0, local_path.size() - 5));
     local_path = local_path.substr(0, local_path.size() - 5);
     TransferState::removeTransfer(".", remote_path);
-    std::cout << "OK\nFile downloaded successfully to " << local_path << std::endl;
+    std::cout << "OK\nFile downloaded successfully to " << local_path << "\n" << digest_line(hash.hex()) << std::endl;
 }
 
-void upload(const int &fd, const std::string &cmd) {
+void upload(const int &fd, const std::string &cmd, const size_t &window) {
     // parse local path
     std::vector<std::string> parts = split_cmd(cmd);
     if (parts.size() < 2) {
         throw std::runtime_error("invalid_command: UPLOAD command requires a path argument");
     }
+    if (parts.size() >= 3 && parts[1] == "--pack") {
+        upload_pack(fd, parts[2], parts.size() >= 4 ? parts[3] : "");
+        return;
+    }
+    if (parts.size() >= 3 && parts[1] == "-r") {
+        tree::upload(fd, parts[2], parts.size() >= 4 ? parts[3] : "", window);
+        return;
+    }
     std::string local_path = parts[1];
 
     // send cmd with file size
@@ -129,83 +223,229 @@ void upload(const int &fd, const std::string &cmd) {
     std::string response = recv_msg(fd);
     parts = split_cmd(response);
     if (parts.size() == 1 && parts[0] == "READY") {
-        send_file(fd, local_path, 0);
-        std::cout << recv_msg(fd) << std::endl;
+        StreamHash hash;
+        send_file(fd, local_path, 0, &hash);
+        response = recv_msg(fd);
+        std::cout << response << std::endl;
+        verify_digest(response, hash, local_path);
     } else {
         std::cout << response << std::flush;
     }
 }
 
-void resume(const int &fd) {
-    bool found_smth = false;
+void batch(const int &fd, const std::string &cmd) {
+    // BATCH [--atomic] <ops_file>: one message for every operation in the file
+    std::vector<std::string> parts = split_cmd(cmd);
+    const bool atomic = parts.size() == 3 && parts[1] == "--atomic";
+    if (parts.size() != (atomic ? 3u : 2u)) {
+        throw std::runtime_error("invalid_command: Usage: BATCH [--atomic] <ops_file>");
+    }
+    std::ifstream in(parts.back());
+    if (!in) {
+        throw std::runtime_error("file_not_found: Cannot read " + parts.back());
+    }
+    std::string msg = atomic ? "BATCH ATOMIC" : "BATCH";
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty() && line[0] != '#') {
+            msg += "\n" + line;
+        }
+    }
+    send_msg(fd, msg);
+    std::cout << recv_msg(fd) << std::flush;
+}
+
+void list(const int &fd, const std::string &cmd, ListingCache &cache) {
+    // LIST [path]: revalidates a cached listing with its tag ("-" when there is none), printed the same way either way
+    std::vector<std::string> parts = split_cmd(cmd);
+    if (parts.size() > 2) {
+        throw std::runtime_error("invalid_command: Usage: LIST [path]");
+    }
+    const std::string path = parts.size() == 2 ? parts[1] : ".";
+    const std::string key = cache.key(path);
+    const ListingCache::Entry *cached = cache.find(key);
+    send_msg(fd, "LIST " + path + " " + (cached ? cached->etag : "-"));
+    const std::string response = recv_msg(fd);
+
+    if (cached && response == "NOT_MODIFIED " + cached->etag) {
+        std::cout << "OK\n" << cached->listing << std::endl;
+        return;
+    }
+    const size_t newline = std::min(response.find('\n'), response.size());
+    const std::string status = response.substr(0, newline);
+    if (!status.starts_with("OK ")) {
+        cache.drop(key);
+        std::cout << response << std::endl;
+        return;
+    }
+    const std::string listing = newline < response.size() ? response.substr(newline + 1) : "";
+    cache.store(key, status.substr(3), listing);
+    std::cout << "OK\n" << listing << std::endl;
+}
 
-    // receive RESUME command from server
-    std::cout << "Checking for incomplete uploads/downloads...\n" << std::flush;
-    std::string cmd = recv_msg(fd);
-    if (!is_cmd(cmd, "RESUME")) {
-        throw std::runtime_error("unknown_response: Expected RESUME command, got " + cmd);
+static void print_events(const std::string &msg) {
+    // EVENTS <path>\n<kind> <generation> <name> [<new name>]...
+    std::istringstream in(msg);
+    std::string line;
+    std::getline(in, line);
+    const std::string path = line.substr(std::min(line.size(), std::string("EVENTS ").size()));
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string kind, generation, name, to;
+        fields >> kind >> generation >> name >> to;
+        if (kind == "overflow") {
+            std::cout << "[" << path << "] too many changes to list, LIST it again\n";
+        } else if (kind == "moved") {
+            std::cout << "[" << path << "] moved " << name << " -> " << to << "\n";
+        } else {
+            std::cout << "[" << path << "] " << kind << " " << name << "\n";
+        }
     }
+    std::cout << std::flush;
+}
+
+void watch(const int &fd, const std::string &cmd, std::string &input_buffer) {
+    // WATCH [path]: prints the changes the server pushes until Enter is pressed
     std::vector<std::string> parts = split_cmd(cmd);
+    if (parts.size() > 2) {
+        throw std::runtime_error("invalid_command: Usage: WATCH [path]");
+    }
+    const std::string path = parts.size() == 2 ? parts[1] : ".";
+    send_msg(fd, "WATCH " + path);
+    const std::string response = recv_msg(fd);
+    std::cout << response << std::endl;
+    if (!response.starts_with("OK")) {
+        return;
+    }
+    std::cout << "Press Enter to stop watching." << std::endl;
 
-    // incomplete upload transfer -> prompt user to resume
-    if (parts.size() >= 3) {
-        std::cout << "Incomplete uploads detected, resume? (y/n):\n> " << std::flush;
-        std::string answer;
-        std::getline(std::cin, answer);
-        send_msg(fd, answer);
-        
-        // users chooses to resume -> resume transfer
-        if (answer == "y") {
-            std::cout << "Resuming upload of file '" << parts[1] << "' from offset " << parts[3] << "...\n" << std::flush;
-            size_t offset = std::stoull(parts[3]);
-            send_file(fd, parts[1], offset);
-            std::cout << recv_msg(fd) << std::endl;
+    char temp[TMP_BUFF_SIZE];
+    while (input_buffer.find('\n') == std::string::npos) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        FD_SET(STDIN_FILENO, &fds);
+        if (::select(std::max(fd, STDIN_FILENO) + 1, &fds, nullptr, nullptr, nullptr) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("select_failed: " + std::string(std::strerror(errno)));
         }
+        if (FD_ISSET(fd, &fds)) {
+            print_events(recv_msg(fd));
+        }
+        if (FD_ISSET(STDIN_FILENO, &fds)) {
+            const ssize_t n = ::read(STDIN_FILENO, temp, sizeof(temp));
+            if (n <= 0) {
+                break;
+            }
+            input_buffer.append(temp, static_cast<size_t>(n));
+        }
+    }
+    input_buffer.erase(0, std::min(input_buffer.size(), input_buffer.find('\n') + 1));
 
-        found_smth = true;
+    // events pushed before the server saw UNWATCH arrive ahead of its reply
+    send_msg(fd, "UNWATCH");
+    while (true) {
+        const std::string reply = recv_msg(fd);
+        if (!reply.starts_with("EVENTS ")) {
+            std::cout << reply << std::flush;
+            break;
+        }
+        print_events(reply);
     }
+}
 
-    // check for incomplete downloads
+void resume(const int &fd, const ResumeManager::Connect &connect, const size_t &parallel, const size_t &window) {
+    // receive RESUME offer from server and collect incomplete downloads and tree transfers from the local journal
+    std::cout << "Checking for incomplete uploads/downloads...\n" << std::flush;
+    const std::vector<TransferState::Transfer> offer = TransferState::parseOffer(recv_msg(fd));
     TransferState::clearTransfers(".");
-    std::vector<TransferState::Transfer> transfers = TransferState::getActiveTransfers(".");
+    const std::vector<TransferState::Transfer> journal = TransferState::getActiveTransfers(".");
+    std::vector<ResumeManager::Job> jobs;
+    for (const auto &transfer : offer) {
+        // files of an interrupted tree upload are sent again by the tree resume
+        if (std::none_of(journal.begin(), journal.end(), [&transfer](const TransferState::Transfer &t) { return tree::covers(t, transfer.local_path); })) {
+            jobs.push_back({ResumeManager::Kind::Upload, transfer});
+        }
+    }
+    const size_t uploads = jobs.size();
+    size_t trees = 0;
+    for (const auto &transfer : journal) {
+        const bool is_tree = tree::is_tree(transfer);
+        trees += is_tree;
+        jobs.push_back({is_tree ? ResumeManager::Kind::Tree : ResumeManager::Kind::Download, transfer});
+    }
+    if (jobs.empty()) {
+        std::cout << "No incomplete uploads/downloads found." << std::endl;
+        return;
+    }
 
-    // incomplete downloads found -> prompt to resume
-    if (!transfers.empty()) {
-        std::cout << "Incomplete downloads detected, resume? (y/n)\n>" << std::flush;
-        std::string answer;
-        std::getline(std::cin, answer);
+    // one prompt for the whole set
+    std::cout << "Incomplete transfers detected (" << uploads << " uploads, " << jobs.size() - uploads - trees << " downloads, " << trees << " directory trees), resume? (y/n)\n> " << std::flush;
+    std::string answer;
+    std::getline(std::cin, answer);
 
-        // user chooses to resume -> resume downloads
-        if (answer == "y") {
-            for (const auto& transfer : transfers) {
-                std::cout << "Resuming download of file '" << transfer.remote_path << "' from offset " << transfer.bytes_completed << "...\n" << std::flush;
+    // this connection stays interactive, the resumes run on their own connections
+    if (!offer.empty()) {
+        send_msg(fd, "n");
+    }
+    if (answer != "y") {
+        return;
+    }
+    ResumeManager manager(connect, parallel, window);
+    const size_t failed = manager.run(jobs);
+    std::cout << "Resumed " << jobs.size() - failed << " of " << jobs.size() << " transfers." << std::endl;
+}
 
-                // send RESUME command
-                send_msg(fd, "RESUME " + transfer.remote_path + " " + std::to_string(transfer.bytes_completed));
-        
-                // receive file in chunks
-                size_t bytes_completed = transfer.bytes_completed;
-                while (bytes_completed < transfer.total_bytes) {
-                    size_t bytes_left = transfer.total_bytes - bytes_completed;
-                    size_t to_recv = bytes_left < TMP_BUFF_SIZE ? bytes_left : TMP_BUFF_SIZE;
-                    size_t recvd = recv_file_chunk(fd, transfer.local_path, bytes_completed, to_recv);
-                    bytes_completed += recvd;
-                    TransferState::updateProgress(".", transfer.remote_path, bytes_completed);
-                }
-        
-                // finalize
-                std::cout << "\nOK\nFile downloaded successfully to " << transfer.local_path << std::endl;
-                TransferState::removeTransfer(".", transfer.remote_path);
-            }
-            found_smth = true;
-        }
+// opens a TCP connection, throws on failure
+int connect_to(const HostPort &hp) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
     }
-    if (!found_smth) {
-        std::cout << "No incomplete uploads/downloads found." << std::endl;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(hp.port);
+    if (::inet_pton(AF_INET, hp.host.c_str(), &addr.sin_addr) != 1) {
+        ::close(fd);
+        throw std::runtime_error("invalid_address: Invalid IPv4 address: " + hp.host);
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        const int err = errno;
+        ::close(fd);
+        throw std::runtime_error(std::string("connect: ") + std::strerror(err));
+    }
+
+    // a command and its data go out in separate sends, which Nagle would hold back per file in a
+    // pipelined tree transfer
+    int nodelay = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    return fd;
+}
+
+// non-interactive AUTH for resume connections with the password typed at startup; returns the RESUME offer
+std::string login(const int &fd, const std::string &user, const std::string &password) {
+    send_msg(fd, "AUTH " + user);
+    if (!user.empty()) {
+        std::string response = recv_msg(fd);
+        if (!response.starts_with("Password")) {
+            throw std::runtime_error("auth_failed: " + response);
+        }
+        send_msg(fd, password);
+        response = recv_msg(fd);
+        if (!response.starts_with("Logged as")) {
+            throw std::runtime_error("auth_failed: " + response);
+        }
     }
+    return recv_msg(fd);
 }
 
-void authenticate(const int &fd, const std::string &user) {
+// returns the password, reused by the resume connections ("" in public mode)
+std::string authenticate(const int &fd, const std::string &user) {
     if (user.empty()) {
         std::cout << "[warning] operating in public mode - files are visible to everyone" << std::endl;
     }
@@ -221,6 +461,7 @@ void authenticate(const int &fd, const std::string &user) {
             std::getline(std::cin, answer);
             send_msg(fd, answer);
             std::cout << recv_msg(fd) << std::endl;
+            return answer;
         
         // server promts for registration -> send answers and wait for result
         } else if (response.starts_with("User " + user + " not found")) {
@@ -237,11 +478,13 @@ void authenticate(const int &fd, const std::string &user) {
             throw std::runtime_error("unknown_response: Unknown authentication response: " + response);
         }
     }
+    return "";
 }
 
-void main_loop(const int &fd, const Mode &mode) {
+void main_loop(const int &fd, const Mode &mode, const size_t &window) {
     std::string input_buffer;
     char temp[TMP_BUFF_SIZE];
+    ListingCache listings;
     
     std::cout << "> " << std::flush;
     while (true) {
@@ -277,9 +520,22 @@ void main_loop(const int &fd, const Mode &mode) {
                     try {
                         std::vector<std::string> parts = split_cmd(cmd);
                         if (parts[0] == "DOWNLOAD") {
-                            download(fd, cmd);                        
+                            download(fd, cmd, window);                        
                         } else if (parts[0] == "UPLOAD") {
-                            upload(fd, cmd);
+                            upload(fd, cmd, window);
+                        } else if (parts[0] == "BATCH") {
+                            batch(fd, cmd);
+                        } else if (parts[0] == "LIST") {
+                            list(fd, cmd, listings);
+                        } else if (parts[0] == "WATCH") {
+                            watch(fd, cmd, input_buffer);
+                        } else if (parts[0] == "CD" && parts.size() == 2) {
+                            send_msg(fd, cmd);
+                            const std::string response = recv_msg(fd);
+                            if (response.starts_with("OK")) {
+                                listings.changeDirectory(parts[1]);
+                            }
+                            std::cout << response << std::endl;
                         } else {
                             send_msg(fd, cmd);
                             std::cout << recv_msg(fd) << std::endl;
@@ -311,9 +567,28 @@ int main(int argc, char* argv[]) {
     std::cout << std::endl;
     
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <host>:<port>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [user@]<host>:<port> [--resume-parallel <n>] [--window <n>] [--watch <local_dir> <remote_dir>]" << std::endl;
         return 1;
     }
+
+    // options
+    size_t resume_parallel = 4; // connections used to resume interrupted transfers
+    size_t window = tree::DEFAULT_WINDOW; // files in flight in UPLOAD -r / DOWNLOAD -r
+    std::string watch_local, watch_remote; // --watch: sync a local directory instead of the prompt
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--resume-parallel" && i + 1 < argc) {
+            resume_parallel = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--window" && i + 1 < argc) {
+            window = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--watch" && i + 2 < argc) {
+            watch_local = argv[++i];
+            watch_remote = argv[++i];
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
     
     // parse user
     std::string host = argv[1];
@@ -333,31 +608,37 @@ int main(int argc, char* argv[]) {
     std::cout << "MiniDrive client (version " << minidrive::version() << ")" << std::endl;
     std::cout << "Connecting to " << hp.host << ':' << hp.port << std::endl;
     
-    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) {
-        std::perror("socket");
-        return 2;
-    }
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(hp.port);
-    if (::inet_pton(AF_INET, hp.host.c_str(), &addr.sin_addr) != 1) {
-        std::cerr << "Invalid IPv4 address: " << hp.host << std::endl;
-        ::close(fd);
-        return 2;
-    }
-    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
-        std::perror("connect");
-        ::close(fd);
-        main_loop(fd, Mode::Local);
+    int fd = -1;
+    try {
+        fd = connect_to(hp);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        main_loop(fd, Mode::Local, window);
         return 2;
     }
     std::cout << "Connected to server." << std::endl;
 
     try {
-        authenticate(fd, user);
-        resume(fd);
-        main_loop(fd, Mode::Remote);
+        const std::string password = authenticate(fd, user);
+        const ResumeManager::Connect reconnect = [hp, user, password](std::string &offer) {
+            int resume_fd = connect_to(hp);
+            try {
+                offer = login(resume_fd, user, password);
+            } catch (...) {
+                ::close(resume_fd);
+                throw;
+            }
+            return resume_fd;
+        };
+        if (!watch_local.empty()) {
+            // nobody is there to answer the resume prompt: interrupted uploads wait for an interactive run
+            if (!TransferState::parseOffer(recv_msg(fd)).empty()) {
+                send_msg(fd, "n");
+            }
+            SyncDaemon(reconnect, watch_local, watch_remote, window).run(fd);
+        }
+        resume(fd, reconnect, resume_parallel, window);
+        main_loop(fd, Mode::Remote, window);
     } catch (const std::exception &e) {
         std::cerr << e.what() << std::endl;
         ::close(fd);
@@ -0,0 +1,211 @@
+#include "resume_manager.hpp"
+#include "tree_transfer.hpp"
+#include "minidrive/block_list.hpp"
+#include "minidrive/helpers.hpp"
+#include "minidrive/pack.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+void close_connection(int &fd) {
+    if (fd < 0) {
+        return;
+    }
+    try {
+        send_msg(fd, "EXIT");
+    } catch (const std::exception &) {
+        // already gone
+    }
+    ::close(fd);
+    fd = -1;
+}
+
+size_t parse_offset(const std::string &response) {
+    if (!is_cmd(response, "OFFSET")) {
+        throw std::runtime_error("resume_failed: " + response);
+    }
+    return std::stoull(split_cmd(response)[1]);
+}
+
+std::string resume_pack_upload(const int &fd, const TransferState::Transfer &transfer) {
+    // the server answers with the last entry boundary it journalled; the stream is packed again and
+    // fast-forwarded to it
+    send_msg(fd, "y " + transfer.remote_path);
+    const size_t offset = parse_offset(recv_msg(fd));
+    pack::Writer writer(transfer.local_path);
+    if (writer.size() != transfer.total_bytes) {
+        throw std::runtime_error("file_changed: " + transfer.local_path + " changed since the upload started");
+    }
+    StreamHash hash;
+    writer.skip(offset, hash);
+    while (writer.position() < writer.size()) {
+        pack::send_pack_chunk(fd, writer, TMP_BUFF_SIZE, &hash);
+    }
+    verify_digest(recv_msg(fd), hash, transfer.local_path);
+    return "from offset " + std::to_string(offset) + ", " + digest_line(hash.hex());
+}
+
+std::string resume_pack_download(const int &fd, const TransferState::Transfer &transfer) {
+    StreamHash hash;
+    size_t offset = transfer.bytes_completed;
+    if (!hash.restore(transfer.hash_state)) {
+        hash = StreamHash();
+        offset = 0;
+    }
+    send_msg(fd, "RESUME " + transfer.remote_path + " " + std::to_string(offset));
+    pack::Reader reader(transfer.local_path, offset, hash);
+    while (reader.position() < transfer.total_bytes) {
+        const std::uint64_t boundary = reader.boundary();
+        pack::recv_pack_chunk(fd, reader, static_cast<size_t>(std::min<std::uint64_t>(TMP_BUFF_SIZE, transfer.total_bytes - reader.position())));
+        if (reader.boundary() != boundary) {
+            TransferState::updateProgress(".", transfer.remote_path, static_cast<size_t>(reader.boundary()), reader.boundaryHash().save());
+        }
+    }
+    try {
+        verify_digest(recv_msg(fd), reader.hash(), transfer.remote_path);
+    } catch (const std::exception &) {
+        TransferState::removeTransfer(".", transfer.remote_path);
+        throw;
+    }
+    TransferState::removeTransfer(".", transfer.remote_path);
+    return "to " + transfer.local_path + " from offset " + std::to_string(offset) + ", " + std::to_string(reader.files()) + " files, " + digest_line(reader.hash().hex());
+}
+
+} // namespace
+
+std::string resume_upload(const int &fd, const TransferState::Transfer &transfer) {
+    if (transfer.remote_path.ends_with(std::string("/") + pack::PART_NAME)) {
+        return resume_pack_upload(fd, transfer);
+    }
+
+    // the rest of the file is sent as it is now, so it must still be the size the server expects
+    std::error_code ec;
+    const std::uintmax_t size = std::filesystem::file_size(transfer.local_path, ec);
+    if (ec || size != transfer.total_bytes) {
+        throw std::runtime_error("file_changed: " + transfer.local_path + " changed since the upload started");
+    }
+
+    // digests of the blocks the journal says were sent; the server answers with the offset its .part
+    // really matches up to
+    BlockList blocks = BlockList::of(transfer.local_path, transfer.bytes_completed);
+    send_msg(fd, "y " + transfer.remote_path + " " + blocks.encode());
+    const size_t offset = parse_offset(recv_msg(fd));
+
+    StreamHash hash = blocks.prefix(offset); // the server's digest covers the whole file
+    send_file(fd, transfer.local_path, offset, &hash);
+    verify_digest(recv_msg(fd), hash, transfer.local_path);
+    return "from offset " + std::to_string(offset) + ", " + digest_line(hash.hex());
+}
+
+std::string resume_download(const int &fd, const TransferState::Transfer &transfer) {
+    if (std::filesystem::is_directory(transfer.local_path)) {
+        return resume_pack_download(fd, transfer);
+    }
+
+    // digests of the whole blocks on disk (the journal may be ahead of or behind the .part after a
+    // crash); the server answers with the offset it verified
+    std::error_code ec;
+    const std::uintmax_t on_disk = std::filesystem::file_size(transfer.local_path, ec);
+    const size_t usable = ec ? 0 : std::min(static_cast<size_t>(on_disk), transfer.total_bytes);
+    BlockList blocks = BlockList::of(transfer.local_path, usable);
+    send_msg(fd, "RESUME " + transfer.remote_path + " " + std::to_string(usable) + " " + blocks.encode());
+    size_t bytes_completed = parse_offset(recv_msg(fd));
+    const size_t offset = bytes_completed;
+
+    // drop whatever follows the verified prefix and receive the rest, hashing on from there
+    StreamHash hash = blocks.prefix(bytes_completed);
+    std::ofstream(transfer.local_path, std::ios::binary | std::ios::app).close();
+    std::filesystem::resize_file(transfer.local_path, bytes_completed);
+    TransferState::updateProgress(".", transfer.remote_path, bytes_completed, hash.save());
+    while (bytes_completed < transfer.total_bytes) {
+        size_t bytes_left = transfer.total_bytes - bytes_completed;
+        size_t to_recv = bytes_left < TMP_BUFF_SIZE ? bytes_left : TMP_BUFF_SIZE;
+        bytes_completed += recv_file_chunk(fd, transfer.local_path, bytes_completed, to_recv, &hash);
+        TransferState::updateProgress(".", transfer.remote_path, bytes_completed, hash.save());
+    }
+    try {
+        verify_digest(recv_msg(fd), hash, transfer.remote_path);
+    } catch (const std::exception &) {
+        // corrupt: do not leave it around to be resumed again
+        std::filesystem::remove(transfer.local_path);
+        TransferState::removeTransfer(".", transfer.remote_path);
+        throw;
+    }
+
+    // finalize
+    std::string local_path = transfer.local_path;
+    if (local_path.ends_with(".part")) {
+        local_path.resize(local_path.size() - 5);
+        std::filesystem::rename(transfer.local_path, local_path);
+    }
+    TransferState::removeTransfer(".", transfer.remote_path);
+    return "to " + local_path + " from offset " + std::to_string(offset) + ", " + digest_line(hash.hex());
+}
+
+ResumeManager::ResumeManager(Connect connect, const size_t &parallel, const size_t &window)
+    : connect(std::move(connect)), parallel(std::max<size_t>(1, parallel)), window(std::max<size_t>(1, window)) {}
+
+size_t ResumeManager::run(const std::vector<Job> &jobs) {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> failed{0};
+    std::vector<std::thread> workers;
+    const size_t count = std::min(this->parallel, jobs.size());
+    for (size_t i = 0; i < count; ++i) {
+        workers.emplace_back([this, &jobs, &next, &failed]() { this->worker(jobs, next, failed); });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    return failed.load();
+}
+
+void ResumeManager::worker(const std::vector<Job> &jobs, std::atomic<size_t> &next, std::atomic<size_t> &failed) {
+    int download_fd = -1; // reused by consecutive downloads
+    for (size_t i = next++; i < jobs.size(); i = next++) {
+        const Job &job = jobs[i];
+        int upload_fd = -1;
+        try {
+            std::string outcome;
+            if (job.kind == Kind::Upload) {
+                std::string offer;
+                upload_fd = this->connect(offer);
+                const std::vector<TransferState::Transfer> pending = TransferState::parseOffer(offer);
+                const bool offered = std::any_of(pending.begin(), pending.end(), [&job](const TransferState::Transfer &t) { return t.remote_path == job.transfer.remote_path; });
+                if (!offered) {
+                    throw std::runtime_error("resume_busy: No longer pending on the server");
+                }
+                outcome = resume_upload(upload_fd, job.transfer);
+                close_connection(upload_fd);
+            } else {
+                if (download_fd < 0) {
+                    std::string offer;
+                    download_fd = this->connect(offer);
+                    if (!TransferState::parseOffer(offer).empty()) {
+                        send_msg(download_fd, "n"); // its uploads belong to other workers
+                    }
+                }
+                outcome = job.kind == Kind::Tree ? tree::resume(download_fd, job.transfer, this->window) : resume_download(download_fd, job.transfer);
+            }
+            this->report(job, "OK " + outcome);
+        } catch (const std::exception &e) {
+            failed++;
+            this->report(job, "ERROR " + std::string(e.what()));
+            close_connection(upload_fd);
+            close_connection(download_fd); // the stream may be mid-file, start the next one clean
+        }
+    }
+    close_connection(download_fd);
+}
+
+void ResumeManager::report(const Job &job, const std::string &outcome) {
+    std::lock_guard<std::mutex> lock(this->output_mutex);
+    const std::string what = job.kind == Kind::Upload ? "Upload of '" + job.transfer.local_path
+                           : job.kind == Kind::Tree ? "Tree transfer of '" + job.transfer.local_path
+                                                    : "Download of '" + job.transfer.remote_path;
+    std::cout << what << "': " << outcome << std::endl;
+}
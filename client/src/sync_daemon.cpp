@@ -0,0 +1,617 @@
+#include "sync_daemon.hpp"
+#include "tree_transfer.hpp"
+#include "minidrive/helpers.hpp"
+#include "minidrive/transfer_state.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/inotify.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+using Entries = std::map<std::string, SyncDaemon::Entry>;
+
+// files are picked up when closed after writing, not while they are still being written
+constexpr std::uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+constexpr size_t COMPACT_RECORDS = 1024; // the journal is rewritten once it has this many more lines than entries
+constexpr const char *JOURNAL_HEADER = "minidrive-sync 1";
+
+std::string join(const std::string &dir, const std::string &name) {
+    return dir.empty() ? name : name.empty() ? dir : dir + "/" + name;
+}
+
+// `path` is `dir` or below it
+bool within(const std::string &path, const std::string &dir) {
+    return path == dir || (path.size() > dir.size() && path.starts_with(dir) && path[dir.size()] == '/');
+}
+
+// symlinks and special files are not synced, as in UPLOAD -r
+SyncDaemon::Type inspect(const std::string &path, SyncDaemon::Entry &entry) {
+    struct stat st{};
+    if (::lstat(path.c_str(), &st) != 0) {
+        return SyncDaemon::Type::Missing;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        entry = {true, 0, 0};
+        return SyncDaemon::Type::Dir;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        return SyncDaemon::Type::Missing;
+    }
+    entry = {false, static_cast<std::uint64_t>(st.st_size), static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec};
+    return SyncDaemon::Type::File;
+}
+
+void erase_tree(Entries &entries, const std::string &path) {
+    entries.erase(path);
+    const std::string prefix = path + "/";
+    for (auto it = entries.lower_bound(prefix); it != entries.end() && it->first.starts_with(prefix);) {
+        it = entries.erase(it);
+    }
+}
+
+void rename_tree(Entries &entries, const std::string &from, const std::string &to) {
+    std::vector<std::pair<std::string, SyncDaemon::Entry>> moved;
+    const auto it = entries.find(from);
+    if (it != entries.end()) {
+        moved.emplace_back(to, it->second);
+    }
+    const std::string prefix = from + "/";
+    for (auto below = entries.lower_bound(prefix); below != entries.end() && below->first.starts_with(prefix); ++below) {
+        moved.emplace_back(to + below->first.substr(from.size()), below->second);
+    }
+    erase_tree(entries, from);
+    erase_tree(entries, to);
+    entries.insert(moved.begin(), moved.end());
+}
+
+} // namespace
+
+struct SyncDaemon::Plan {
+    struct Op {
+        enum class Kind { Move, Delete, Rmdir, Mkdir };
+        Kind kind;
+        std::string path; // relative; "" is the remote directory itself
+        std::string to;   // for Move
+    };
+    std::vector<Op> moves;
+    std::vector<Op> removals;
+    std::vector<Op> mkdirs; // parents first
+    std::vector<std::pair<std::string, Entry>> uploads;
+};
+
+SyncDaemon::SyncDaemon(ResumeManager::Connect connect, const std::string &local_dir, const std::string &remote_dir, const size_t &window)
+    : connect(std::move(connect)), window(std::max<size_t>(1, window)) {
+    this->local_dir = fs::path(local_dir).lexically_normal().generic_string();
+    this->remote_dir = fs::path(remote_dir).lexically_normal().generic_string();
+    for (std::string *dir : {&this->local_dir, &this->remote_dir}) {
+        while (dir->size() > 1 && dir->back() == '/') {
+            dir->pop_back();
+        }
+    }
+    if (this->remote_dir.empty() || this->remote_dir == "." || !tree::sendable(this->local_dir) || !tree::sendable(this->remote_dir)) {
+        throw std::runtime_error("invalid_path: Usage: --watch <local_dir> <remote_dir>, names without spaces");
+    }
+    if (!fs::is_directory(this->local_dir)) {
+        throw std::runtime_error("not_directory: Not a local directory: " + this->local_dir);
+    }
+    this->inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this->inotify_fd < 0) {
+        throw std::runtime_error(std::string("inotify_failed: ") + std::strerror(errno));
+    }
+}
+
+SyncDaemon::~SyncDaemon() {
+    if (this->inotify_fd >= 0) {
+        ::close(this->inotify_fd);
+    }
+}
+
+std::string SyncDaemon::full(const std::string &relative) const {
+    return join(this->local_dir, relative);
+}
+
+bool SyncDaemon::ignored(const std::string &relative) {
+    if (relative == JOURNAL || relative == std::string(JOURNAL) + ".tmp") {
+        return true;
+    }
+    if (tree::sendable(relative)) {
+        return false;
+    }
+    if (this->warned.insert(relative).second) {
+        std::cout << "[sync] skipped " << relative << ": names with spaces cannot be sent" << std::endl;
+    }
+    return true;
+}
+
+void SyncDaemon::load() {
+    std::ifstream in(this->full(JOURNAL));
+    std::string line;
+    if (!std::getline(in, line) || line != std::string(JOURNAL_HEADER) + " " + this->remote_dir) {
+        return; // none yet, or kept for another remote directory: everything is compared as new
+    }
+    while (std::getline(in, line)) {
+        if (line.size() < 2 || line[1] != ' ') {
+            continue; // cut off by a crash
+        }
+        const std::string rest = line.substr(2);
+        if (line[0] == 'P') {
+            this->dirty.insert(rest); // "" is the whole tree
+        } else if (rest.empty()) {
+            continue;
+        } else if (line[0] == 'D') {
+            this->synced[rest] = {true, 0, 0};
+        } else if (line[0] == '-') {
+            erase_tree(this->synced, rest);
+        } else if (line[0] == 'M') {
+            const size_t space = rest.find(' ');
+            if (space != std::string::npos) {
+                rename_tree(this->synced, rest.substr(0, space), rest.substr(space + 1));
+            }
+        } else if (line[0] == 'F') {
+            std::istringstream fields(rest);
+            Entry entry;
+            std::string path;
+            if (fields >> entry.size >> entry.mtime && fields.get() == ' ' && std::getline(fields, path) && !path.empty()) {
+                this->synced[path] = entry;
+            }
+        }
+    }
+}
+
+// "<header> <remote_dir>", then "F <size> <mtime> <path>" / "D <path>" per synced entry and "P <path>"
+// per pending change; appended to as things happen ("-" and "M" undo or rename synced entries)
+void SyncDaemon::compact() {
+    const std::string path = this->full(JOURNAL);
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << JOURNAL_HEADER << " " << this->remote_dir << "\n";
+        for (const auto &[name, entry] : this->synced) {
+            if (entry.dir) {
+                out << "D " << name << "\n";
+            } else {
+                out << "F " << entry.size << " " << entry.mtime << " " << name << "\n";
+            }
+        }
+        for (const std::string &name : this->dirty) {
+            out << "P " << name << "\n";
+        }
+        if (!out.flush()) {
+            throw std::runtime_error("journal_failed: Cannot write " + tmp);
+        }
+    }
+    this->journal.close();
+    fs::rename(tmp, path);
+    this->journal.open(path, std::ios::app);
+    this->records = 0;
+}
+
+void SyncDaemon::record(const std::string &line) {
+    this->journal << line << '\n';
+    this->records++;
+}
+
+void SyncDaemon::markDirty(const std::string &relative) {
+    const auto now = Clock::now();
+    if (this->dirty.empty()) {
+        this->first_change = now;
+    }
+    this->last_change = now;
+    if (this->dirty.insert(relative).second) {
+        this->record("P " + relative);
+    }
+}
+
+void SyncDaemon::watchTree(const std::string &relative) {
+    auto add = [this](const std::string &path) {
+        const int wd = ::inotify_add_watch(this->inotify_fd, this->full(path).c_str(), WATCH_MASK);
+        if (wd >= 0) {
+            this->wds[wd] = path;
+            return true;
+        }
+        if (errno == ENOSPC) {
+            throw std::runtime_error("inotify_failed: Out of inotify watches at " + this->full(path) + " (see fs.inotify.max_user_watches)");
+        }
+        return false; // gone already
+    };
+    if (!add(relative)) {
+        return;
+    }
+    // directories created before their parent's watch was in place are only found here, and the
+    // files in them by the reconcile of the new directory
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(this->full(relative), fs::directory_options::skip_permission_denied, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->is_symlink(ec) || !it->is_directory(ec)) {
+            continue;
+        }
+        const std::string path = it->path().lexically_relative(this->local_dir).generic_string();
+        if (this->ignored(path)) {
+            it.disable_recursion_pending();
+            continue;
+        }
+        add(path);
+    }
+}
+
+void SyncDaemon::unwatchTree(const std::string &relative) {
+    for (auto it = this->wds.begin(); it != this->wds.end();) {
+        if (within(it->second, relative)) {
+            ::inotify_rm_watch(this->inotify_fd, it->first);
+            it = this->wds.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void SyncDaemon::endMove() {
+    if (this->moved_cookie == 0) {
+        return;
+    }
+    // its old path is dirty already, so it is deleted remotely
+    if (this->moved_dir) {
+        this->unwatchTree(this->moved_from);
+    }
+    this->moved_cookie = 0;
+}
+
+void SyncDaemon::readEvents() {
+    alignas(inotify_event) char buffer[64 * 1024];
+    ssize_t length = 0;
+    while ((length = ::read(this->inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t offset = 0; offset < length;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // changes were lost: every directory is watched again and the whole tree compared
+                this->endMove();
+                this->watchTree("");
+                this->markDirty("");
+                continue;
+            }
+            const auto dir = this->wds.find(event->wd);
+            if (dir == this->wds.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                this->wds.erase(dir);
+                continue;
+            }
+            if (event->mask & IN_DELETE_SELF) {
+                if (dir->second.empty()) {
+                    throw std::runtime_error("not_directory: " + this->local_dir + " was removed");
+                }
+                continue;
+            }
+
+            const std::string relative = join(dir->second, event->len > 0 ? std::string(event->name) : "");
+            const bool is_dir = (event->mask & IN_ISDIR) != 0;
+            const bool paired = (event->mask & IN_MOVED_TO) && this->moved_cookie != 0 && event->cookie == this->moved_cookie;
+            if (!paired) {
+                this->endMove();
+            }
+            if (this->ignored(relative)) {
+                continue;
+            }
+            if (event->mask & IN_MOVED_FROM) {
+                this->moved_cookie = event->cookie;
+                this->moved_from = relative;
+                this->moved_dir = is_dir;
+                this->markDirty(relative);
+                continue;
+            }
+            if (paired) {
+                // a rename inside the tree, replayed remotely with MOVE instead of sending the data again
+                this->moves.emplace_back(this->moved_from, relative);
+                if (this->moved_dir) {
+                    for (auto &[wd, path] : this->wds) {
+                        if (within(path, this->moved_from)) {
+                            path = relative + path.substr(this->moved_from.size());
+                        }
+                    }
+                }
+                this->moved_cookie = 0;
+                this->markDirty(relative);
+                continue;
+            }
+            if (is_dir && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                this->watchTree(relative);
+            } else if (event->mask & IN_CREATE) {
+                continue; // a new file is synced when it is closed after writing
+            }
+            this->markDirty(relative);
+        }
+    }
+    this->endMove();
+    this->journal.flush();
+}
+
+void SyncDaemon::reconcileEntry(const std::string &relative, const Type &type, const Entry &local, Synced &next, Plan &plan) {
+    using Kind = Plan::Op::Kind;
+    const auto it = next.find(relative);
+    const bool known = it != next.end();
+    const bool known_dir = known && it->second.dir;
+    if (type == Type::Dir && known_dir) {
+        return;
+    }
+    if (type == Type::File && known && !known_dir && it->second.size == local.size && it->second.mtime == local.mtime) {
+        return;
+    }
+    if (known && (type == Type::Missing || (type == Type::Dir) != known_dir)) {
+        // gone, or replaced by the other kind
+        plan.removals.push_back({known_dir ? Kind::Rmdir : Kind::Delete, relative, ""});
+        erase_tree(next, relative);
+    }
+    if (type == Type::Dir) {
+        plan.mkdirs.push_back({Kind::Mkdir, relative, ""});
+        next[relative] = local;
+    } else if (type == Type::File) {
+        plan.uploads.emplace_back(relative, local);
+        next[relative] = local;
+    }
+}
+
+void SyncDaemon::reconcile(const std::string &relative, Synced &next, Plan &plan) {
+    if (!relative.empty() && this->ignored(relative)) {
+        return;
+    }
+    Entry local;
+    const Type type = inspect(this->full(relative), local);
+    if (relative.empty()) {
+        if (type != Type::Dir) {
+            throw std::runtime_error("not_directory: " + this->local_dir + " was removed");
+        }
+        plan.mkdirs.push_back({Plan::Op::Kind::Mkdir, "", ""});
+    } else {
+        this->reconcileEntry(relative, type, local, next, plan);
+    }
+    if (type != Type::Dir) {
+        return;
+    }
+
+    // a directory: everything below it that is there locally, then what was synced and is gone
+    std::set<std::string> seen;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(this->full(relative), fs::directory_options::skip_permission_denied, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        const std::string path = it->path().lexically_relative(this->local_dir).generic_string();
+        if (this->ignored(path)) {
+            it.disable_recursion_pending();
+            continue;
+        }
+        Entry entry;
+        const Type found = inspect(it->path().string(), entry);
+        this->reconcileEntry(path, found, entry, next, plan);
+        if (found != Type::Missing) {
+            seen.insert(path);
+        }
+    }
+    const std::string prefix = relative.empty() ? "" : relative + "/";
+    std::vector<std::string> gone;
+    for (auto it = next.lower_bound(prefix); it != next.end() && it->first.starts_with(prefix); ++it) {
+        if (!seen.contains(it->first)) {
+            gone.push_back(it->first);
+        }
+    }
+    for (const std::string &path : gone) {
+        this->reconcileEntry(path, Type::Missing, {}, next, plan); // nothing left to do below a removed directory
+    }
+}
+
+void SyncDaemon::flush(const int &fd) {
+    using Kind = Plan::Op::Kind;
+    const auto started = Clock::now();
+    std::set<std::string> work;
+    work.swap(this->dirty);
+    std::vector<std::pair<std::string, std::string>> renames;
+    renames.swap(this->moves);
+    if (work.contains("")) {
+        work = {""};
+    }
+
+    // planned against a copy of what is synced, as if every operation succeeds; what actually
+    // succeeded is applied as the replies come back, and the rest is dirty again
+    Synced next = this->synced;
+    Plan plan;
+    for (const auto &[from, to] : renames) {
+        Entry local;
+        if (next.contains(from) && !next.contains(to) && !this->ignored(to) && inspect(this->full(to), local) != Type::Missing) {
+            plan.moves.push_back({Kind::Move, from, to});
+            rename_tree(next, from, to);
+        }
+    }
+    for (const std::string &path : work) {
+        this->reconcile(path, next, plan);
+    }
+
+    std::vector<Plan::Op> ops = std::move(plan.moves);
+    ops.insert(ops.end(), plan.removals.begin(), plan.removals.end());
+    ops.insert(ops.end(), plan.mkdirs.begin(), plan.mkdirs.end());
+    auto remote = [this](const std::string &relative) { return join(this->remote_dir, relative); };
+    size_t moved = 0, removed = 0, created = 0, uploaded = 0, failed = 0;
+    auto refuse = [&](const std::string &what, std::string error) {
+        std::replace(error.begin(), error.end(), '\n', ' ');
+        std::cout << "[sync] " << what << ": " << error << std::endl;
+        failed++;
+    };
+
+    try {
+        for (size_t start = 0; start < ops.size(); start += MAX_BATCH_OPS) {
+            const size_t end = std::min(ops.size(), start + MAX_BATCH_OPS);
+            std::string msg = "BATCH";
+            for (size_t i = start; i < end; ++i) {
+                const Plan::Op &op = ops[i];
+                const char *command = op.kind == Kind::Move ? "MOVE " : op.kind == Kind::Delete ? "DELETE " : op.kind == Kind::Rmdir ? "RMDIR " : "MKDIR ";
+                msg += "\n" + std::string(command) + remote(op.path) + (op.kind == Kind::Move ? " " + remote(op.to) : "");
+            }
+            send_msg(fd, msg);
+
+            // "OK\n<k> of <n> operations succeeded" and a line per operation
+            const std::string response = recv_msg(fd);
+            std::istringstream lines(response);
+            std::string result;
+            std::getline(lines, result);
+            const bool accepted = result == "OK";
+            if (accepted) {
+                std::getline(lines, result);
+            }
+            for (size_t i = start; i < end; ++i) {
+                const Plan::Op &op = ops[i];
+                if (!accepted || !std::getline(lines, result)) {
+                    result = accepted ? "ERROR missing reply" : response;
+                }
+                const bool ok = result == "OK";
+                if (op.kind == Kind::Move && ok) {
+                    rename_tree(this->synced, op.path, op.to);
+                    this->record("M " + op.path + " " + op.to);
+                    moved++;
+                } else if ((op.kind == Kind::Delete || op.kind == Kind::Rmdir) && (ok || result.find("_not_found") != std::string::npos)) {
+                    erase_tree(this->synced, op.path);
+                    this->record("- " + op.path);
+                    removed += ok;
+                } else if (op.kind == Kind::Mkdir && (ok || result.find("overwrite_error") != std::string::npos)) {
+                    if (!op.path.empty()) {
+                        this->synced[op.path] = {true, 0, 0};
+                        this->record("D " + op.path);
+                        created += ok;
+                    }
+                } else {
+                    refuse(remote(op.path), result.starts_with("ERROR ") ? result.substr(6) : result);
+                    this->markDirty(op.path);
+                    if (op.kind == Kind::Move) {
+                        this->markDirty(op.to);
+                    }
+                }
+            }
+        }
+
+        if (!plan.uploads.empty()) {
+            std::vector<std::string> paths;
+            for (const auto &[path, entry] : plan.uploads) {
+                paths.push_back(path);
+            }
+            const tree::Failures failures = tree::upload_some(fd, this->local_dir, this->remote_dir, paths, this->window);
+            const std::set<std::string> refused(failures.paths.begin(), failures.paths.end());
+            for (const auto &[path, entry] : plan.uploads) {
+                if (refused.contains(path)) {
+                    this->markDirty(path);
+                    continue;
+                }
+                this->synced[path] = entry;
+                this->record("F " + std::to_string(entry.size) + " " + std::to_string(entry.mtime) + " " + path);
+                uploaded++;
+            }
+            for (size_t i = 0; i < failures.errors.size(); ++i) {
+                if (failures.paths[i] != this->remote_dir) { // the directory itself was created above
+                    refuse(failures.paths[i], failures.errors[i].substr(failures.paths[i].size() + 2));
+                }
+            }
+        }
+    } catch (...) {
+        // the connection broke: whatever was not confirmed is compared again after the reconnect
+        for (const std::string &path : work) {
+            this->markDirty(path);
+        }
+        this->journal.flush();
+        throw;
+    }
+
+    if (failed > 0) {
+        this->not_before = Clock::now() + RETRY;
+    }
+    if (this->records > std::max(COMPACT_RECORDS, this->synced.size())) {
+        this->compact();
+    } else {
+        this->journal.flush();
+    }
+    if (moved + removed + created + uploaded > 0) {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - started).count();
+        std::cout << "[sync] " << uploaded << " uploaded, " << removed << " deleted, " << moved << " moved, " << created << " directories created ("
+                  << elapsed << " ms)" << std::endl;
+    }
+}
+
+void SyncDaemon::run(int &fd) {
+    this->load();
+    this->watchTree("");
+    this->markDirty(""); // whatever changed while nobody was watching
+    this->compact();
+    std::cout << "[sync] Watching " << this->local_dir << " -> " << this->remote_dir << " (Ctrl+C to stop)" << std::endl;
+
+    while (true) {
+        // blocks for good while nothing is pending, so an idle tree costs no CPU
+        const auto due = std::max(this->not_before, std::min(this->last_change + DEBOUNCE, this->first_change + MAX_DELAY));
+        timeval timeout{};
+        if (!this->dirty.empty()) {
+            const auto left = std::max<std::int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(due - Clock::now()).count());
+            timeout.tv_sec = static_cast<time_t>(left / 1000000);
+            timeout.tv_usec = static_cast<suseconds_t>(left % 1000000);
+        }
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(this->inotify_fd, &readfds);
+        if (fd >= 0) {
+            FD_SET(fd, &readfds);
+        }
+        if (::select(std::max(this->inotify_fd, fd) + 1, &readfds, nullptr, nullptr, this->dirty.empty() ? nullptr : &timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("select_failed: ") + std::strerror(errno));
+        }
+        if (FD_ISSET(this->inotify_fd, &readfds)) {
+            this->readEvents();
+        }
+        if (fd >= 0 && FD_ISSET(fd, &readfds)) {
+            // the server never speaks first, so this is the connection closing
+            std::cout << "[sync] Connection lost" << std::endl;
+            ::close(fd);
+            fd = -1;
+        }
+
+        const auto now = Clock::now();
+        if (this->dirty.empty() || now < std::max(this->not_before, std::min(this->last_change + DEBOUNCE, this->first_change + MAX_DELAY))) {
+            continue;
+        }
+        if (fd < 0) {
+            try {
+                std::string offer;
+                fd = this->connect(offer);
+                if (!TransferState::parseOffer(offer).empty()) {
+                    send_msg(fd, "n"); // interrupted uploads are left for an interactive client
+                }
+                std::cout << "[sync] Reconnected" << std::endl;
+            } catch (const std::exception &e) {
+                std::cout << "[sync] Reconnect failed: " << e.what() << std::endl;
+                if (fd >= 0) {
+                    ::close(fd);
+                    fd = -1;
+                }
+                this->not_before = now + RETRY;
+                continue;
+            }
+        }
+        try {
+            this->flush(fd);
+        } catch (const std::exception &e) {
+            if (std::string(e.what()).starts_with("not_directory")) {
+                throw; // the local root went away, nothing left to sync
+            }
+            std::cout << "[sync] " << e.what() << std::endl;
+            ::close(fd);
+            fd = -1;
+            this->not_before = Clock::now() + RETRY;
+        }
+    }
+}
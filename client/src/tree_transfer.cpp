@@ -0,0 +1,487 @@
+#include "tree_transfer.hpp"
+#include "minidrive/helpers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+namespace tree {
+namespace {
+
+namespace fs = std::filesystem;
+
+struct File {
+    std::string path; // relative, '/'-separated
+    std::uint64_t size = 0;
+};
+
+// a request on the wire whose reply has not been read yet
+struct Request {
+    enum class Kind { Mkdirs, List, File };
+    Kind kind;
+    size_t index = 0; // first directory of the batch, directory listed or file sent
+    StreamHash hash;  // of the data sent, for uploads
+};
+
+struct Outcome {
+    size_t files = 0; // transferred by this run
+    std::uint64_t bytes = 0;
+    std::vector<std::string> errors; // "<path>: <error>"
+    std::vector<std::string> failed; // the paths, in the same order
+
+    void fail(const std::string &path, const std::string &error) {
+        std::string line = path + ": " + error;
+        std::replace(line.begin(), line.end(), '\n', ' '); // server errors are "code:\nmessage"
+        this->errors.push_back(line);
+        this->failed.push_back(path);
+    }
+};
+
+// aggregate progress of a whole tree, redrawn in place on a terminal
+class Progress {
+public:
+    Progress(const std::string &verb, const bool &visible) : verb(verb), visible(visible && ::isatty(STDOUT_FILENO) != 0) {}
+
+    void expect(const size_t &files, const std::uint64_t &bytes) {
+        this->total_files += files;
+        this->total_bytes += bytes;
+    }
+
+    void add(const size_t &files, const std::uint64_t &bytes) {
+        this->done_files += files;
+        this->done_bytes += bytes;
+        const auto now = std::chrono::steady_clock::now();
+        if (!this->visible || now - this->last_draw < std::chrono::milliseconds(100)) {
+            return;
+        }
+        this->last_draw = now;
+        std::cout << "\r" << this->verb << " " << this->done_files << "/" << this->total_files << " files, " << this->done_bytes << " of " << this->total_bytes << " bytes" << std::flush;
+    }
+
+    void finish() {
+        if (this->visible && this->last_draw != std::chrono::steady_clock::time_point{}) {
+            std::cout << "\r\033[K" << std::flush;
+        }
+    }
+
+private:
+    std::string verb;
+    bool visible;
+    size_t total_files = 0;
+    size_t done_files = 0;
+    std::uint64_t total_bytes = 0;
+    std::uint64_t done_bytes = 0;
+    std::chrono::steady_clock::time_point last_draw{};
+};
+
+std::string strip_slashes(std::string path) {
+    while (path.size() > 1 && path.back() == '/') {
+        path.pop_back();
+    }
+    return path;
+}
+
+std::string join(const std::string &dir, const std::string &relative) {
+    return relative.empty() ? dir : dir.empty() ? relative : dir + "/" + relative;
+}
+
+// the stream cannot continue after a file broke off half sent or received
+[[noreturn]] void broken(const std::string &path, const std::exception &e) {
+    throw std::runtime_error("connection_closed: Tree transfer broke off in " + path + " (" + e.what() + ")");
+}
+
+std::string marker_path(const std::string &remote_root, const char *marker) {
+    return remote_root + "/" + marker;
+}
+
+void start_journal(const std::string &local_dir, const std::string &key, const size_t &files) {
+    TransferState::Transfer transfer;
+    transfer.local_path = local_dir;
+    transfer.remote_path = key;
+    transfer.bytes_completed = 0;
+    transfer.total_bytes = files;
+    transfer.timestamp = std::to_string(std::time(nullptr));
+    TransferState::addTransfer(".", transfer);
+}
+
+struct LocalTree {
+    std::vector<std::string> dirs; // relative, parents first
+    std::vector<File> files;       // sorted by path
+    std::uint64_t bytes = 0;
+};
+
+LocalTree walk_local(const std::string &dir) {
+    if (!fs::is_directory(dir)) {
+        throw std::runtime_error("not_directory: Not a local directory: " + dir);
+    }
+    LocalTree tree;
+    for (auto it = fs::recursive_directory_iterator(dir); it != fs::recursive_directory_iterator(); ++it) {
+        if (it->is_symlink()) {
+            continue; // as in packed transfers
+        }
+        const std::string relative = fs::relative(it->path(), dir).generic_string();
+        if (it->is_directory()) {
+            tree.dirs.push_back(relative);
+        } else if (it->is_regular_file()) {
+            tree.files.push_back({relative, it->file_size()});
+            tree.bytes += tree.files.back().size;
+        }
+    }
+    std::sort(tree.dirs.begin(), tree.dirs.end());
+    std::sort(tree.files.begin(), tree.files.end(), [](const File &a, const File &b) { return a.path < b.path; });
+    return tree;
+}
+
+// files before `skip` were finished by an earlier run; nothing is journalled without a `key`
+Outcome upload_files(const int &fd, const std::string &local_dir, const std::string &remote_root, const LocalTree &tree, const size_t &skip, const std::string &key,
+                     const size_t &window, Progress &progress) {
+    Outcome outcome;
+    std::deque<Request> pending;
+    progress.expect(tree.files.size(), tree.bytes);
+    for (size_t i = 0; i < skip; ++i) {
+        progress.add(1, tree.files[i].size);
+    }
+
+    // directories go out first as BATCHes nobody waits for, so the server creates them while the file
+    // data queues up behind; MKDIR of one that exists fails harmlessly, and the server creates the
+    // parents of every upload anyway, so only empty directories really depend on it
+    std::vector<std::string> mkdirs{remote_root};
+    for (const std::string &dir : tree.dirs) {
+        if (sendable(dir)) {
+            mkdirs.push_back(join(remote_root, dir));
+        }
+    }
+    for (size_t start = 0; start < mkdirs.size(); start += MAX_BATCH_OPS) {
+        std::string msg = "BATCH";
+        for (size_t i = start; i < std::min(mkdirs.size(), start + MAX_BATCH_OPS); ++i) {
+            msg += "\nMKDIR " + mkdirs[i];
+        }
+        send_msg(fd, msg);
+        pending.push_back({Request::Kind::Mkdirs, start, {}});
+    }
+
+    size_t next = skip;
+    auto finished = [&]() {
+        for (const Request &request : pending) {
+            if (request.kind == Request::Kind::File) {
+                return request.index;
+            }
+        }
+        return next;
+    };
+    auto collect = [&]() {
+        Request request = std::move(pending.front());
+        pending.pop_front();
+        const std::string response = recv_msg(fd);
+        if (request.kind == Request::Kind::Mkdirs) {
+            // "OK\n<k> of <n> operations succeeded" and a line per MKDIR
+            std::istringstream lines(response);
+            std::string line;
+            std::getline(lines, line);
+            if (line != "OK") {
+                outcome.fail(mkdirs[request.index], response);
+                return;
+            }
+            std::getline(lines, line);
+            for (size_t i = request.index; std::getline(lines, line); ++i) {
+                if (line.starts_with("ERROR") && line.find("overwrite_error") == std::string::npos) {
+                    outcome.fail(mkdirs[std::min(i, mkdirs.size() - 1)], line.substr(6));
+                }
+            }
+            return;
+        }
+        const File &file = tree.files[request.index];
+        try {
+            verify_digest(response, request.hash, file.path);
+            outcome.files++;
+            outcome.bytes += file.size;
+        } catch (const std::exception &e) {
+            outcome.fail(file.path, e.what());
+        }
+        progress.add(1, file.size);
+        if (!key.empty()) {
+            TransferState::updateProgress(".", key, finished());
+        }
+    };
+
+    // a pipelined upload is refused or accepted after its data arrived, so the data is always sent
+    for (; next < tree.files.size(); ++next) {
+        const File &file = tree.files[next];
+        const std::string local = join(local_dir, file.path);
+        std::ifstream in(local, std::ios::binary);
+        if (!sendable(local) || !in) {
+            outcome.fail(file.path, sendable(local) ? "file_open_failed: Cannot read " + local : "invalid_path: Names with spaces cannot be sent");
+            progress.add(1, file.size);
+            continue;
+        }
+        while (pending.size() >= window) {
+            collect();
+        }
+        send_msg(fd, "UPLOAD_PIPELINED " + std::to_string(file.size) + " " + local + " " + join(remote_root, file.path));
+        Request request{Request::Kind::File, next, {}};
+        try {
+            for (std::uint64_t left = file.size; left > 0;) {
+                left -= send_file_chunk(fd, in, static_cast<size_t>(std::min<std::uint64_t>(left, TMP_BUFF_SIZE)), &request.hash);
+            }
+        } catch (const std::exception &e) {
+            broken(local, e); // shrank since the walk, or the connection is gone
+        }
+        pending.push_back(std::move(request));
+    }
+    while (!pending.empty()) {
+        collect();
+    }
+    return outcome;
+}
+
+// metadata the server keeps in user directories, and uploads in progress
+bool listed_name_skipped(const std::string &name) {
+    return name == ".transfers_state" || name == ".usage" || name == ".usage.tmp" || name.ends_with(".part");
+}
+
+// files in the order the listings arrive, which only depends on the tree; before `skip` they were
+// finished by an earlier run and are only fetched again if they are missing locally
+Outcome download_files(const int &fd, const std::string &remote_root, const std::string &local_dir, const size_t &skip, const bool &overwrite, const std::string &key,
+                       const size_t &window, Progress &progress) {
+    Outcome outcome;
+    std::deque<Request> pending;
+    std::vector<std::string> dirs{""}; // relative, in the order they are listed
+    std::vector<File> files;
+    size_t listed = 0;
+    size_t next = 0;
+    fs::create_directories(local_dir);
+
+    auto finished = [&]() {
+        for (const Request &request : pending) {
+            if (request.kind == Request::Kind::File) {
+                return request.index;
+            }
+        }
+        return next;
+    };
+    auto collect = [&]() {
+        Request request = std::move(pending.front());
+        pending.pop_front();
+        const std::string response = recv_msg(fd);
+        if (request.kind == Request::Kind::List) {
+            if (response.starts_with("ERROR")) {
+                if (request.index == 0) {
+                    throw std::runtime_error(response.substr(6)); // nothing else is in flight yet
+                }
+                outcome.fail(dirs[request.index], response.substr(6));
+                return;
+            }
+
+            // "[DIR]  name" or "       name" per entry; directories are created as they are found,
+            // while earlier files stream in
+            std::vector<std::string> subdirs;
+            std::vector<std::string> names;
+            std::istringstream lines(response);
+            std::string line;
+            std::getline(lines, line);
+            while (std::getline(lines, line)) {
+                if (line.size() <= 7 || listed_name_skipped(line.substr(7))) {
+                    continue;
+                }
+                (line.starts_with("[DIR]") ? subdirs : names).push_back(join(dirs[request.index], line.substr(7)));
+            }
+            std::sort(subdirs.begin(), subdirs.end());
+            std::sort(names.begin(), names.end());
+            for (const std::string &dir : subdirs) {
+                fs::create_directories(join(local_dir, dir));
+                dirs.push_back(dir);
+            }
+            for (const std::string &name : names) {
+                files.push_back({name, 0});
+            }
+            progress.expect(names.size(), 0);
+            return;
+        }
+
+        const std::string path = files[request.index].path;
+        if (!is_cmd(response, "FILEINFO")) {
+            outcome.fail(path, response.starts_with("ERROR") ? response.substr(6) : "unknown_response: " + response);
+            progress.add(1, 0);
+            TransferState::updateProgress(".", key, finished());
+            return;
+        }
+        const std::vector<std::string> parts = split_cmd(response);
+        const std::uint64_t size = parts.size() >= 3 ? std::stoull(parts[2]) : 0;
+        progress.expect(0, size);
+        const std::string local = join(local_dir, path);
+        const std::string part = local + ".part";
+        StreamHash hash;
+        std::string trailer;
+        try {
+            std::ofstream(part, std::ios::binary | std::ios::trunc).close();
+            for (std::uint64_t received = 0; received < size;) {
+                const size_t n = recv_file_chunk(fd, part, static_cast<size_t>(received), static_cast<size_t>(std::min<std::uint64_t>(size - received, TMP_BUFF_SIZE)), &hash);
+                received += n;
+                progress.add(0, n);
+            }
+            trailer = recv_msg(fd);
+        } catch (const std::exception &e) {
+            broken(path, e);
+        }
+        try {
+            verify_digest(trailer, hash, path);
+            fs::rename(part, local);
+            outcome.files++;
+            outcome.bytes += size;
+        } catch (const std::exception &e) {
+            std::error_code ec;
+            fs::remove(part, ec);
+            outcome.fail(path, e.what());
+        }
+        progress.add(1, 0);
+        TransferState::updateProgress(".", key, finished());
+    };
+
+    // listings go first so the file queue never runs dry while directories are still unexplored
+    while (true) {
+        while (pending.size() < window) {
+            if (listed < dirs.size()) {
+                send_msg(fd, "LIST " + join(remote_root, dirs[listed]));
+                pending.push_back({Request::Kind::List, listed++, {}});
+                continue;
+            }
+            if (next == files.size()) {
+                break;
+            }
+            const File &file = files[next];
+            const std::string local = join(local_dir, file.path);
+            const bool exists = fs::exists(local);
+            if (next < skip && exists) {
+                progress.add(1, 0);
+            } else if (!sendable(file.path)) {
+                outcome.fail(file.path, "invalid_path: Names with spaces cannot be sent");
+                progress.add(1, 0);
+            } else if (exists && !overwrite) {
+                outcome.fail(file.path, "file_exists: Local file already exists: " + local);
+                progress.add(1, 0);
+            } else {
+                send_msg(fd, "DOWNLOAD " + join(remote_root, file.path));
+                pending.push_back({Request::Kind::File, next, {}});
+            }
+            next++;
+        }
+        if (pending.empty()) {
+            break;
+        }
+        collect();
+    }
+    return outcome;
+}
+
+std::string summary(const char *verb, const Outcome &outcome, const std::string &from, const std::string &to) {
+    return verb + (" " + std::to_string(outcome.files)) + " files (" + std::to_string(outcome.bytes) + " bytes) from " + from + " to " + to +
+           (outcome.errors.empty() ? "" : ", " + std::to_string(outcome.errors.size()) + " failed");
+}
+
+void print(const char *verb, const Outcome &outcome, const std::string &from, const std::string &to) {
+    std::cout << "OK\n" << summary(verb, outcome, from, to);
+    for (const std::string &error : outcome.errors) {
+        std::cout << "\n  " << error;
+    }
+    std::cout << std::endl;
+}
+
+} // namespace
+
+bool sendable(const std::string &path) {
+    return path.find_first_of(" \n") == std::string::npos;
+}
+
+bool is_tree(const TransferState::Transfer &transfer) {
+    return transfer.remote_path.ends_with(std::string("/") + UPLOAD_MARKER) || transfer.remote_path.ends_with(std::string("/") + DOWNLOAD_MARKER);
+}
+
+bool covers(const TransferState::Transfer &tree, const std::string &local_path) {
+    return tree.remote_path.ends_with(std::string("/") + UPLOAD_MARKER) && local_path.starts_with(tree.local_path + "/");
+}
+
+void upload(const int &fd, const std::string &local_dir, const std::string &remote_dir, const size_t &window) {
+    const std::string local_root = strip_slashes(local_dir);
+    const std::string remote_root = remote_dir.empty() ? fs::path(local_root).filename().string() : strip_slashes(remote_dir);
+    if (remote_root.empty() || !sendable(remote_root)) {
+        throw std::runtime_error("invalid_path: Usage: UPLOAD -r <local_dir> [remote_dir]");
+    }
+    const LocalTree tree = walk_local(local_root);
+    const std::string key = marker_path(remote_root, UPLOAD_MARKER);
+    start_journal(local_root, key, tree.files.size());
+
+    Progress progress("Uploaded", true);
+    const Outcome outcome = upload_files(fd, local_root, remote_root, tree, 0, key, std::max<size_t>(1, window), progress);
+    progress.finish();
+    TransferState::removeTransfer(".", key);
+    print("Uploaded", outcome, local_root, remote_root);
+}
+
+void download(const int &fd, const std::string &remote_dir, const std::string &local_dir, const size_t &window) {
+    const std::string remote_root = strip_slashes(remote_dir);
+    const std::string local_root = local_dir.empty() ? fs::path(remote_root).filename().string() : strip_slashes(local_dir);
+    if (remote_root.empty() || !sendable(remote_root) || local_root.empty()) {
+        throw std::runtime_error("invalid_path: Usage: DOWNLOAD -r <remote_dir> [local_dir]");
+    }
+    const std::string key = marker_path(remote_root, DOWNLOAD_MARKER);
+    start_journal(local_root, key, 0); // the file count is not known before the walk ends
+
+    Progress progress("Downloaded", true);
+    Outcome outcome;
+    try {
+        outcome = download_files(fd, remote_root, local_root, 0, false, key, std::max<size_t>(1, window), progress);
+    } catch (const std::exception &e) {
+        progress.finish();
+        if (std::string(e.what()).find("connection_closed") == std::string::npos) {
+            TransferState::removeTransfer(".", key); // refused outright, nothing to resume
+        }
+        throw;
+    }
+    progress.finish();
+    TransferState::removeTransfer(".", key);
+    print("Downloaded", outcome, remote_root, local_root);
+}
+
+Failures upload_some(const int &fd, const std::string &local_dir, const std::string &remote_dir, const std::vector<std::string> &paths, const size_t &window) {
+    LocalTree tree;
+    for (const std::string &path : paths) {
+        std::error_code ec;
+        const std::uintmax_t size = fs::file_size(join(local_dir, path), ec);
+        tree.files.push_back({path, ec ? 0 : size}); // one that is gone fails to open
+        tree.bytes += tree.files.back().size;
+    }
+    Progress progress("", false);
+    Outcome outcome = upload_files(fd, local_dir, strip_slashes(remote_dir), tree, 0, "", std::max<size_t>(1, window), progress);
+    return {std::move(outcome.failed), std::move(outcome.errors)};
+}
+
+std::string resume(const int &fd, const TransferState::Transfer &transfer, const size_t &window) {
+    const bool upload = transfer.remote_path.ends_with(std::string("/") + UPLOAD_MARKER);
+    const std::string marker = upload ? UPLOAD_MARKER : DOWNLOAD_MARKER;
+    const std::string remote_root = transfer.remote_path.substr(0, transfer.remote_path.size() - marker.size() - 1);
+    Progress progress("", false);
+    Outcome outcome;
+    size_t skip = transfer.bytes_completed;
+    if (upload) {
+        // a tree that changed since is sent again whole
+        const LocalTree tree = walk_local(transfer.local_path);
+        if (tree.files.size() != transfer.total_bytes) {
+            skip = 0;
+        }
+        outcome = upload_files(fd, transfer.local_path, remote_root, tree, std::min(skip, tree.files.size()), transfer.remote_path, std::max<size_t>(1, window), progress);
+    } else {
+        outcome = download_files(fd, remote_root, transfer.local_path, skip, true, transfer.remote_path, std::max<size_t>(1, window), progress);
+    }
+    TransferState::removeTransfer(".", transfer.remote_path);
+    if (!outcome.errors.empty()) {
+        throw std::runtime_error("tree_incomplete: " + summary(upload ? "Uploaded" : "Downloaded", outcome, upload ? transfer.local_path : remote_root,
+                                                               upload ? remote_root : transfer.local_path) + ", first: " + outcome.errors.front());
+    }
+    return "from file " + std::to_string(skip) + ", " + summary(upload ? "uploaded" : "downloaded", outcome, upload ? transfer.local_path : remote_root, upload ? remote_root : transfer.local_path);
+}
+
+} // namespace tree
@@ -29,6 +29,20 @@ FetchContent_Declare(
 )
 FetchContent_MakeAvailable(spdlog)
 
+# Google Benchmark (microbenchmarks only)
+if(MINIDRIVE_BUILD_BENCH)
+    FetchContent_Declare(
+        benchmark
+        GIT_REPOSITORY https://github.com/google/benchmark.git
+        GIT_TAG v1.9.1
+    )
+    set(BENCHMARK_ENABLE_TESTING OFF CACHE INTERNAL "")
+    set(BENCHMARK_ENABLE_GTEST_TESTS OFF CACHE INTERNAL "")
+    set(BENCHMARK_ENABLE_INSTALL OFF CACHE INTERNAL "")
+    set(BENCHMARK_ENABLE_WERROR OFF CACHE INTERNAL "")
+    FetchContent_MakeAvailable(benchmark)
+endif()
+
 set(SODIUM_DISABLE_TESTS ON)
 
 # libsodium
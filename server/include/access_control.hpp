@@ -6,6 +6,9 @@
 #include <nlohmann/json.hpp>
 #include <sodium.h>
 
+// a user's directory is <root>/<name>, so names cannot be paths or start with '.' (the server's own
+// entries in the root and in every user directory are dot names)
+bool valid_username(const std::string &user);
 bool exists_user(const std::string &user, const std::string &root);
 void register_user(const std::string &user, const std::string &password, const std::string &root);
 bool authenticate_user(const std::string &user, const std::string &password, const std::string &root);
\ No newline at end of file
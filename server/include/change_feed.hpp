@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// change events for WATCH. Sessions publish what their own mutations did (through DirGenerations);
+// changes made outside the server reach the same subscribers through inotify, and the inotify echo
+// of a change a session already published is dropped. A subscription covers the entries of one
+// directory, like LIST. Its queue coalesces events for the same name (created + modified = created,
+// created + deleted = nothing) and is bounded: a consumer too slow to keep up gets one "overflow"
+// event in place of the backlog, and lists the directory again.
+class ChangeFeed {
+public:
+    static constexpr size_t MAX_QUEUED = 1024;             // live events per subscription
+    static constexpr std::chrono::seconds ECHO_WINDOW{2}; // an inotify event for a name a session published this recently is its echo
+
+    enum class Kind { Created, Modified, Deleted, Moved, Overflow };
+
+    struct Event {
+        Kind kind = Kind::Modified;
+        std::string name; // entry of the watched directory ("." for the directory itself)
+        std::string to;   // new name, for Moved
+        std::uint64_t generation = 0; // of the directory, after the change
+    };
+
+    // one watcher of one directory; unsubscribes when destroyed
+    class Subscription {
+    public:
+        ~Subscription();
+        Subscription(const Subscription &) = delete;
+        Subscription &operator=(const Subscription &) = delete;
+
+        const std::string &directory() const { return this->key; }
+        bool pending() const;
+        std::vector<Event> take(const size_t &max); // oldest first
+
+    private:
+        friend class ChangeFeed;
+        Subscription(ChangeFeed &feed, const std::string &key) : feed(feed), key(key) {}
+        void push(const Event &event);
+        void overflow(const std::uint64_t &generation);
+
+        struct Queued {
+            Event event;
+            bool dropped = false; // coalesced away
+        };
+
+        ChangeFeed &feed;
+        const std::string key;
+        mutable std::mutex mutex;
+        std::deque<Queued> queue;
+        std::uint64_t first_seq = 0; // sequence number of queue.front()
+        std::unordered_map<std::string, std::uint64_t> index; // name -> sequence of its event still open to coalescing
+        size_t live = 0;
+        bool overflowed = false;
+        std::uint64_t overflow_generation = 0;
+    };
+
+    // process-wide feed shared by all sessions
+    static ChangeFeed &global();
+
+    // `dir` is a DirGenerations key
+    std::shared_ptr<Subscription> subscribe(const std::string &dir);
+
+    // a session changed an entry of `dir`
+    void publish(const std::string &dir, const Event &event);
+
+    // a session is about to change an entry of `dir` off the reactor (executor jobs), so inotify may
+    // report it before publish() does: those reports are taken for its echo too
+    void expect(const std::string &dir, const std::string &name);
+
+    // the reactor selects on this and calls readInotify when it is readable; -1 before the first
+    // subscription or when inotify is unavailable (sessions' own changes are still reported)
+    int inotifyFd() const { return this->inotify_fd; }
+    void readInotify();
+
+    static const char *kindName(const Kind &kind);
+
+    // names that are the server's own bookkeeping or unfinished uploads, never reported
+    static bool hidden(const std::string &name);
+
+private:
+    ChangeFeed() = default;
+
+    struct Watched {
+        int wd = -1;
+        std::vector<Subscription *> subscribers;
+    };
+
+    void unsubscribe(Subscription *subscription);
+    void deliver(const std::string &dir, const Event &event); // feed mutex held
+    bool echo(const std::string &dir, const std::string &name, const std::chrono::steady_clock::time_point &now); // feed mutex held
+    void remember(const std::string &dir, const std::string &name); // feed mutex held
+
+    mutable std::mutex mutex;
+    std::atomic<size_t> subscriptions{0}; // lets publish skip the lock while nobody watches
+    std::unordered_map<std::string, Watched> watched;
+    std::unordered_map<int, std::string> wds;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> recent; // "<dir>/<name>" a session published
+    int inotify_fd = -1;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+// per-session transfer chunk size, adapted from the socket buffer, TCP round-trip time
+// and observed throughput; always a buffer pool size class between 16 KB and 4 MB
+class ChunkSizer {
+public:
+    enum class Direction { Send, Receive };
+
+    // bytes to move with the next syscall; for sends never more than the socket buffer can take
+    size_t next(const int &fd, const Direction &direction);
+
+    // account a finished chunk and retune every few chunks
+    void observe(const int &fd, const Direction &direction, const size_t &bytes);
+
+    size_t current() const { return this->chunk; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t RETUNE_CHUNKS = 16;
+    static constexpr auto RETUNE_INTERVAL = std::chrono::milliseconds(50);
+    static constexpr double TARGET_SECONDS = 0.002; // aim for ~2 ms of data per syscall
+
+    size_t chunk = 64 * 1024;
+    Direction last_direction = Direction::Send;
+    Clock::time_point window_start = Clock::now();
+    size_t window_bytes = 0;
+    size_t window_chunks = 0;
+    double throughput = 0.0; // bytes per second, EWMA
+    int socket_buffer = 0;   // SO_SNDBUF / SO_RCVBUF as reported by the kernel
+
+    void retune(const int &fd, const Direction &direction, const Clock::time_point &now);
+};
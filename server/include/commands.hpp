@@ -0,0 +1,173 @@
+#pragma once
+
+#include "metrics.hpp"
+#include "minidrive/helpers.hpp"
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+// command table for Session::onMessage: names are looked up through a perfect hash built at
+// compile time, and each command declares how many arguments it takes
+namespace commands {
+
+enum class Opcode : std::uint8_t {
+    List,
+    Delete,
+    Cd,
+    Mkdir,
+    Rmdir,
+    Move,
+    Copy,
+    Exit,
+    Upload,
+    Download,
+    Auth,
+    Resume,
+    Stats,
+    Trace,
+    Du,
+    Batch,
+    UploadPack,
+    DownloadPack,
+    UploadPipelined,
+    Watch,
+    Unwatch,
+    Count
+};
+
+struct Spec {
+    std::string_view name;
+    Opcode opcode;
+    metrics::Command metric;
+    std::uint8_t min_args; // missing optional arguments reach the handler as empty strings
+    std::uint8_t max_args;
+};
+
+constexpr size_t OPCODE_COUNT = static_cast<size_t>(Opcode::Count);
+
+// indexed by opcode
+constexpr std::array<Spec, OPCODE_COUNT> SPECS = {{
+    {"LIST", Opcode::List, metrics::Command::List, 0, 2},             // [path [etag]], NOT_MODIFIED while the etag matches
+    {"DELETE", Opcode::Delete, metrics::Command::Delete, 0, 1},
+    {"CD", Opcode::Cd, metrics::Command::Cd, 0, 1},
+    {"MKDIR", Opcode::Mkdir, metrics::Command::Mkdir, 0, 1},
+    {"RMDIR", Opcode::Rmdir, metrics::Command::Rmdir, 0, 1},
+    {"MOVE", Opcode::Move, metrics::Command::Move, 0, 2},
+    {"COPY", Opcode::Copy, metrics::Command::Copy, 0, 2},
+    {"EXIT", Opcode::Exit, metrics::Command::Exit, 0, 0},
+    {"UPLOAD", Opcode::Upload, metrics::Command::Upload, 1, 3},       // <size> <local> [remote]
+    {"DOWNLOAD", Opcode::Download, metrics::Command::Download, 0, 2}, // <remote> [local], local is client-side
+    {"AUTH", Opcode::Auth, metrics::Command::Auth, 0, 1},
+    {"RESUME", Opcode::Resume, metrics::Command::Resume, 2, 4},       // <path> <offset> [<block_size> <digests>]
+    {"STATS", Opcode::Stats, metrics::Command::Stats, 0, 0},
+    {"TRACE", Opcode::Trace, metrics::Command::Trace, 0, 3},
+    {"DU", Opcode::Du, metrics::Command::Du, 0, 1},
+    {"BATCH", Opcode::Batch, metrics::Command::Batch, 0, 1},          // [ATOMIC], then one operation per line
+    {"UPLOAD_PACK", Opcode::UploadPack, metrics::Command::UploadPack, 1, 3},       // <size> <local_dir> [remote_dir]
+    {"DOWNLOAD_PACK", Opcode::DownloadPack, metrics::Command::DownloadPack, 0, 2}, // <remote_dir> [local_dir]
+    {"UPLOAD_PIPELINED", Opcode::UploadPipelined, metrics::Command::UploadPipelined, 1, 3}, // <size> <local> [remote], data follows without READY
+    {"WATCH", Opcode::Watch, metrics::Command::Watch, 0, 1},          // [path], then EVENTS messages are pushed
+    {"UNWATCH", Opcode::Unwatch, metrics::Command::Unwatch, 0, 1},    // [path], all directories without one
+}};
+
+constexpr size_t SLOT_BITS = 5;
+constexpr size_t SLOT_COUNT = size_t{1} << SLOT_BITS;
+constexpr std::uint8_t EMPTY_SLOT = 0xff;
+
+constexpr size_t max_name_length() {
+    size_t n = 0;
+    for (const auto &spec : SPECS) {
+        n = spec.name.size() > n ? spec.name.size() : n;
+    }
+    return n;
+}
+constexpr size_t MAX_NAME_LENGTH = max_name_length();
+
+// seeded FNV-1a
+constexpr std::uint32_t hash(const std::string_view &name, const std::uint32_t &seed) {
+    std::uint32_t h = 2166136261u ^ seed;
+    for (char c : name) {
+        h = (h ^ static_cast<std::uint8_t>(c)) * 16777619u;
+    }
+    return h;
+}
+
+constexpr size_t slot_of(const std::string_view &name, const std::uint32_t &seed) {
+    return static_cast<size_t>(hash(name, seed) >> (32 - SLOT_BITS));
+}
+
+constexpr bool collision_free(const std::uint32_t &seed) {
+    std::array<bool, SLOT_COUNT> used{};
+    for (const auto &spec : SPECS) {
+        const size_t slot = slot_of(spec.name, seed);
+        if (used[slot]) {
+            return false;
+        }
+        used[slot] = true;
+    }
+    return true;
+}
+
+// first seed that gives every name its own slot; fails to compile if there is none
+constexpr std::uint32_t find_seed() {
+    for (std::uint32_t seed = 0; seed < 100000; ++seed) {
+        if (collision_free(seed)) {
+            return seed;
+        }
+    }
+    throw std::logic_error("commands: no collision-free hash seed");
+}
+constexpr std::uint32_t SEED = find_seed();
+
+constexpr std::array<std::uint8_t, SLOT_COUNT> build_slots() {
+    std::array<std::uint8_t, SLOT_COUNT> slots{};
+    slots.fill(EMPTY_SLOT);
+    for (size_t i = 0; i < SPECS.size(); ++i) {
+        slots[slot_of(SPECS[i].name, SEED)] = static_cast<std::uint8_t>(i);
+    }
+    return slots;
+}
+constexpr std::array<std::uint8_t, SLOT_COUNT> SLOTS = build_slots();
+
+// one hash and one compare of at most MAX_NAME_LENGTH bytes; nullptr for unknown commands
+constexpr const Spec *lookup(const std::string_view &name) {
+    if (name.empty() || name.size() > MAX_NAME_LENGTH) {
+        return nullptr;
+    }
+    const std::uint8_t i = SLOTS[slot_of(name, SEED)];
+    if (i == EMPTY_SLOT || SPECS[i].name != name) {
+        return nullptr;
+    }
+    return &SPECS[i];
+}
+
+constexpr const Spec &spec(const Opcode &op) {
+    return SPECS[static_cast<size_t>(op)];
+}
+
+constexpr bool table_valid() {
+    for (size_t i = 0; i < SPECS.size(); ++i) {
+        const Spec &s = SPECS[i];
+        if (static_cast<size_t>(s.opcode) != i || s.name.empty() || s.min_args > s.max_args || s.max_args >= MAX_TOKENS) {
+            return false;
+        }
+        if (lookup(s.name) != &s) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(table_valid(), "commands: SPECS must be indexed by opcode, with max_args < MAX_TOKENS");
+static_assert(lookup("LIS") == nullptr && lookup("LISTS") == nullptr && lookup("list") == nullptr);
+
+// argument I (0-based, after the command name) of command Op; reading past what the command
+// declares is a compile error, so handlers and the table cannot drift apart
+template <Opcode Op, size_t I>
+constexpr std::string_view arg(const Tokens &tokens) {
+    static_assert(I < spec(Op).max_args, "handler reads an argument its command does not declare");
+    return tokens[I + 1];
+}
+
+} // namespace commands
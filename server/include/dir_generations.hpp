@@ -0,0 +1,57 @@
+#pragma once
+
+#include "change_feed.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// generation numbers of directories, behind conditional LIST: a client sends the tag of the listing
+// it has cached and gets NOT_MODIFIED back while the directory is unchanged. Every mutation a session
+// makes bumps the directory it changed, after the change; LIST reads the tag before it reads the
+// directory, so a listing is never cached under a tag newer than its contents. Creating, removing or
+// renaming a directory bumps its whole subtree with one entry instead of a walk. Numbering starts at
+// the startup time, so tags handed out before a restart never match again. Since every mutation
+// reports here, this is also where the download cache forgets what it held for the path.
+class DirGenerations {
+public:
+    // process-wide table shared by all sessions
+    static DirGenerations &global();
+
+    // `path` was created, modified or deleted: bumps the directory holding it, and everything below it
+    // if it is a directory now, then tells the directory's watchers
+    void changed(const std::string &path, const ChangeFeed::Kind &kind);
+    void moved(const std::string &from, const std::string &to);
+
+    // before a change made off the reactor, which inotify may see before changed() runs
+    void expect(const std::string &path);
+
+    // bumps like changed() without an event, for writers whose entries reach watchers through inotify
+    // (packed uploads create whole trees entry by entry)
+    void bump(const std::string &path);
+
+    // of a directory: the newest of its own generation and the subtree bumps of it and its ancestors
+    std::uint64_t generation(const std::string &dir) const;
+
+    // "<generation>-<mtime in ns>"; the mtime catches what changes outside the sessions (the server's
+    // own metadata files, edits made directly on the disk)
+    std::string etag(const std::string &dir) const;
+
+    // one spelling per directory: "a/./b/" and "a/b" share an entry (and a watch)
+    static std::string key(const std::string &path);
+
+private:
+    DirGenerations();
+    std::uint64_t bumpLocked(const std::string &key, const bool &directory);
+
+    const std::uint64_t start; // generation of every directory nothing has bumped yet
+    mutable std::mutex mutex;
+    std::uint64_t counter;
+    std::unordered_map<std::string, std::uint64_t> own;  // an entry of the directory changed
+    std::unordered_map<std::string, std::uint64_t> trees; // the directory itself was replaced
+};
+
+// the highest directory create_directories(path) would create, "" if all exist
+std::string first_missing(const std::filesystem::path &path);
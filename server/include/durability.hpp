@@ -0,0 +1,46 @@
+#pragma once
+
+#include "server_config.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <string>
+#include <vector>
+
+// crash safety of uploads. With `none` a finished .part is renamed as soon as its last byte is
+// written, so a power loss can leave a complete-looking file without its contents. `on-complete`
+// makes the data durable before the rename and the rename durable before the upload is
+// acknowledged. `strict` also keeps the transfer journal consistent with the disk: it is replaced
+// atomically and synced in the next round, and an upload's progress is only recorded once the data it
+// covers is synced, a checkpoint at a time. The fsyncs of every session go through one group commit thread: whatever is
+// queued while a round runs is flushed together in the next one: writeback of all its files is
+// started at once, their fsyncs are issued side by side so the filesystem can share journal commits,
+// and each directory is synced once however many files it gained, so many small uploads share the
+// cost instead of queueing behind one fsync each.
+namespace durability {
+
+enum class Level {
+    None,
+    OnComplete,
+    Strict
+};
+
+constexpr std::uint64_t CHECKPOINT_STEP = 8 * 1024 * 1024; // strict: journal progress of an upload at most this often
+
+using Done = std::function<void(std::exception_ptr)>; // null on success
+
+// "none", "on-complete" or "strict"; throws invalid_argument
+Level parse_level(const std::string &name);
+
+void configure(const ServerConfig &config);
+Level level();
+
+// fsyncs `paths` (files or directories) in the next group commit round, then calls done on the
+// commit thread; fsync_failed when one of them could not be synced
+void sync(std::vector<std::string> paths, Done done);
+
+size_t queued(); // paths waiting for a round or in the current one
+
+} // namespace durability
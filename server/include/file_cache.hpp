@@ -0,0 +1,87 @@
+#pragma once
+
+#include "server_config.hpp"
+#include "../../shared/include/minidrive/helpers.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+
+// files being downloaded, shared by all sessions: downloads of the same file share one open
+// descriptor, and a small file downloaded again is read into memory once and served from there to
+// everyone after that, so a file every client fetches costs one open and one read instead of one per
+// session. An entry is checked against the file's inode, size and mtime when a download starts (one
+// stat, which also catches edits made outside the server) and dropped as soon as a session changes
+// the path; downloads already streaming keep the contents they started with. Least recently used
+// entries go first once there are more than `max_files` of them or the contents in memory pass
+// `max_bytes`.
+class FileCache {
+public:
+    static constexpr std::uint64_t MAX_LOADED_FILE = 4 * 1024 * 1024; // larger files only share the descriptor
+
+    // one version of a file, read-only; closed or freed when the last download lets go of it
+    class File {
+    public:
+        ~File();
+        File(const File &) = delete;
+        File &operator=(const File &) = delete;
+
+        std::uint64_t size() const { return this->length; }
+        bool loaded() const { return this->contents != nullptr; }
+        int descriptor() const { return this->fd; } // -1 when loaded, for page cache advice
+
+        // sends up to `length` bytes from `offset` (at most MAX_CHUNK_SIZE), returns how many were sent
+        size_t send(const int &fd, const std::uint64_t &offset, const size_t &length, StreamHash *hash) const;
+
+    private:
+        friend class FileCache;
+        File(const int &fd, std::unique_ptr<char[]> contents, const struct stat &st);
+
+        const int fd;                           // -1 once loaded
+        const std::unique_ptr<char[]> contents; // the whole file, or nullptr
+        const std::uint64_t length;
+        const dev_t device;
+        const ino_t inode;
+        const std::int64_t mtime; // ns
+
+        bool current(const struct stat &st) const;
+    };
+
+    // process-wide cache shared by all sessions
+    static FileCache &global();
+
+    void configure(const ServerConfig &config);
+
+    // the file at `path` as it is now; throws file_open_failed when it cannot be opened
+    std::shared_ptr<const File> open(const std::string &path);
+
+    // `path` was written, removed or replaced, with everything below it
+    void invalidate(const std::string &path);
+
+    size_t files() const;
+    std::uint64_t bytes() const; // in memory
+
+private:
+    FileCache() = default;
+
+    struct Entry {
+        std::shared_ptr<const File> file;
+        std::list<std::string>::iterator position;
+        unsigned opens = 0; // since it was cached; the second one loads a small file
+    };
+
+    void erase(std::map<std::string, Entry>::iterator it); // mutex held
+    void evict();                                          // mutex held
+
+    mutable std::mutex mutex;
+    size_t max_files = 256;
+    std::uint64_t max_bytes = 64 * 1024 * 1024;
+    std::uint64_t loaded_bytes = 0;
+    std::map<std::string, Entry> entries; // by DirGenerations::key, so a subtree is a range
+    std::list<std::string> order;         // most recently used first
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "fs_executor.hpp"
+
+#include <cstddef>
+#include <string>
+
+// server-side COPY without moving bytes through userspace where the kernel allows it:
+// FICLONE reflinks first (XFS, Btrfs: shared extents, no extra space), then copy_file_range,
+// then a pooled read/write loop for filesystems that support neither
+namespace fscopy {
+
+enum class Method { Reflink, CopyFileRange, ReadWrite };
+
+struct Stats {
+    size_t files = 0;
+    size_t directories = 0;
+    size_t symlinks = 0;
+    size_t bytes = 0;
+    size_t reflinked = 0;
+    size_t kernel_copied = 0;
+    size_t userspace_copied = 0;
+};
+
+// copy one regular file to a new path (fails if it exists), keeping its permission bits
+Method copy_file(const std::string &source, const std::string &destination, size_t &bytes);
+
+// copy a file or a whole tree; directories are created up front and files are copied in
+// parallel on the executor (symlinks are recreated, never followed)
+Stats copy(const std::string &source, const std::string &destination, FsExecutor &executor);
+
+} // namespace fscopy
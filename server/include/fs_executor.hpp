@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// thread pool for slow filesystem work (tree copies, batches) so the reactor keeps serving other
+// sessions; completions are handed back to the reactor thread through an eventfd
+class FsExecutor {
+public:
+    using Work = std::function<void()>;
+    using Done = std::function<void(std::exception_ptr)>; // null on success
+
+    explicit FsExecutor(const size_t &threads);
+    ~FsExecutor();
+    FsExecutor(const FsExecutor &) = delete;
+    FsExecutor &operator=(const FsExecutor &) = delete;
+
+    // run work on a pool thread, then done on the reactor thread during drain()
+    void submit(Work work, Done done);
+
+    // for work finished by a thread other than the pool's (the group commit): returns a completion to
+    // call once, from any thread, which then runs done on the reactor thread during drain()
+    Done handoff(Done done);
+
+    // fn(0) .. fn(n - 1) spread over the pool; the caller works too, so this is safe to call
+    // from a pool thread; rethrows the first failure once every started call has returned
+    void parallelFor(const size_t &n, const std::function<void(size_t)> &fn);
+
+    // readable when completions are waiting; the reactor adds it to its select() set
+    int wakeFd() const { return this->wake_fd; }
+
+    // run finished completions; reactor thread only
+    void drain();
+
+    size_t threadCount() const { return this->workers.size(); }
+    size_t pending() const; // submitted jobs whose completion has not run yet
+
+private:
+    struct Completion {
+        Done done;
+        std::exception_ptr error;
+    };
+
+    void workerLoop();
+    void post(Work task);
+    void complete(Done done, std::exception_ptr error);
+
+    int wake_fd = -1;
+    std::vector<std::thread> workers;
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Work> tasks;
+    std::vector<Completion> completions;
+    size_t in_flight = 0;
+    bool stopping = false;
+};
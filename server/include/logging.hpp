@@ -0,0 +1,38 @@
+#pragma once
+
+#include "server_config.hpp"
+
+#include <chrono>
+#include <cstdint>
+
+#include <spdlog/spdlog.h>
+
+namespace logging {
+
+// installs an async file logger as spdlog's default logger; never blocks the caller on overflow
+void init(const ServerConfig &config);
+void shutdown();
+
+// token bucket for log lines emitted per message (only used from the reactor thread)
+class RateLimiter {
+public:
+    RateLimiter(const unsigned &per_second, const unsigned &sample_every);
+
+    // true if this event should be logged; keeps a count of suppressed events
+    bool allow();
+    std::uint64_t suppressed() const { return dropped; }
+
+private:
+    double tokens;
+    const double rate;
+    const unsigned sample_every;
+    std::uint64_t seen = 0;
+    std::uint64_t dropped = 0;
+    std::chrono::steady_clock::time_point last;
+};
+
+// shared limiter for per-message debug logs and for per-command error logs
+RateLimiter &message_limiter();
+RateLimiter &error_limiter();
+
+} // namespace logging
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace metrics {
+
+// everything Session::onMessage dispatches, plus the chunk paths driven by the reactor
+enum class Command : size_t {
+    Auth,
+    List,
+    Delete,
+    Cd,
+    Mkdir,
+    Rmdir,
+    Move,
+    Copy,
+    Exit,
+    Upload,
+    Download,
+    Resume,
+    Stats,
+    Trace,
+    Du,
+    Batch,
+    UploadPack,
+    DownloadPack,
+    UploadPipelined,
+    Watch,
+    Unwatch,
+    UploadChunk,
+    DownloadChunk,
+    Unknown,
+    Count
+};
+
+enum class Gauge : size_t {
+    ActiveSessions,
+    OpenUploads,
+    OpenDownloads,
+    ReadyFds,      // sockets ready after the last select() (reactor queue depth)
+    PendingCloses, // sessions queued for close after the last iteration
+    ThrottledFlows, // transfers held back by a per-user rate limit in the last iteration
+    FsPending,      // commands waiting for or running on the filesystem executor
+    Watches,        // directories subscribed to with WATCH, over all sessions
+    CachedFiles,    // files held open by the download cache
+    CachedBytes,    // contents of hot files the download cache keeps in memory
+    SyncQueued,     // files and directories waiting for the group commit fsync
+    Count
+};
+
+constexpr size_t COMMAND_COUNT = static_cast<size_t>(Command::Count);
+constexpr size_t GAUGE_COUNT = static_cast<size_t>(Gauge::Count);
+
+const char *command_name(const Command &cmd);
+
+// log-linear latency histogram in nanoseconds (HDR-style, ~12.5% relative error)
+class Histogram {
+public:
+    static constexpr size_t SUB_BITS = 3;
+    static constexpr size_t SUB_BUCKETS = size_t{1} << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    static size_t bucketOf(const std::uint64_t &ns) {
+        if (ns < SUB_BUCKETS) {
+            return static_cast<size_t>(ns);
+        }
+        const size_t exp = static_cast<size_t>(std::bit_width(ns)) - 1;
+        const size_t sub = static_cast<size_t>(ns >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return (exp - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+    static std::uint64_t upperBound(const size_t &bucket);
+
+    // single writer per histogram (the owning thread), relaxed readers
+    void record(const std::uint64_t &ns) {
+        bump(counts[bucketOf(ns)], 1);
+        bump(sum_ns, ns);
+    }
+
+    std::array<std::atomic<std::uint64_t>, BUCKETS> counts{};
+    std::atomic<std::uint64_t> sum_ns{0};
+
+private:
+    static void bump(std::atomic<std::uint64_t> &c, const std::uint64_t &v) {
+        c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+};
+
+// per-thread counters; each shard is written only by the thread that owns it
+struct Shard {
+    std::array<Histogram, COMMAND_COUNT> latency;
+    std::array<std::atomic<std::uint64_t>, COMMAND_COUNT> errors{};
+    std::atomic<std::uint64_t> bytes_in{0};
+    std::atomic<std::uint64_t> bytes_out{0};
+};
+
+Shard *register_shard();
+
+inline Shard &local_shard() {
+    thread_local Shard *shard = register_shard();
+    return *shard;
+}
+
+inline void add(std::atomic<std::uint64_t> &counter, const std::uint64_t &v) {
+    counter.store(counter.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+inline void bytes_in(const std::uint64_t &n) { add(local_shard().bytes_in, n); }
+inline void bytes_out(const std::uint64_t &n) { add(local_shard().bytes_out, n); }
+inline void record_error(const Command &cmd) { add(local_shard().errors[static_cast<size_t>(cmd)], 1); }
+inline void record_latency(const Command &cmd, const std::chrono::nanoseconds &d) {
+    local_shard().latency[static_cast<size_t>(cmd)].record(static_cast<std::uint64_t>(d.count()));
+}
+
+// process-wide gauges, written by the reactor
+std::atomic<std::int64_t> &gauge(const Gauge &g);
+inline void set_gauge(const Gauge &g, const std::int64_t &v) { gauge(g).store(v, std::memory_order_relaxed); }
+
+// times the enclosing scope and records it under the (possibly late-bound) command
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const Command &cmd = Command::Unknown) : cmd(cmd), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        if (!detached) {
+            record_latency(cmd, elapsed());
+        }
+    }
+    void tag(const Command &c) { cmd = c; }
+    const Command &command() const { return cmd; }
+    std::chrono::nanoseconds elapsed() const { return std::chrono::steady_clock::now() - start; }
+    const std::chrono::steady_clock::time_point &started() const { return start; }
+    void detach() { detached = true; } // the command finishes later and records itself
+
+private:
+    Command cmd;
+    bool detached = false;
+    const std::chrono::steady_clock::time_point start;
+};
+
+// exporters
+std::string render_stats();
+std::string render_prometheus();
+void write_prometheus(const std::string &path);
+
+} // namespace metrics
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "server_config.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// decides which ready transfer sockets the reactor serves, and how much, on each iteration:
+// deficit round robin across users and, within each user, across priority classes (interactive
+// weighted), round robin across a class's sessions, and an optional token bucket per user and direction
+class TransferScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Direction { Upload, Download };
+    enum class Priority { Interactive, Bulk };
+
+    // a session whose socket is ready for its next transfer chunk
+    struct Flow {
+        int fd;
+        std::string user;
+        Direction direction;
+        size_t total_bytes; // size of the file being transferred (picks the default class)
+    };
+
+    struct Grant {
+        int fd;
+        size_t max_bytes; // serve chunks until this many bytes have moved
+    };
+
+    explicit TransferScheduler(const ServerConfig &config);
+
+    // false while the user's token bucket is empty: keep the fd out of select until nextWake()
+    bool eligible(const std::string &user, const Direction &direction, const Clock::time_point &now);
+    Clock::time_point nextWake() const { return this->next_wake; }
+    void resetWake() { this->next_wake = Clock::time_point::max(); }
+
+    // one DRR round over the flows that are ready this iteration
+    std::vector<Grant> schedule(const std::vector<Flow> &flows, const Clock::time_point &now);
+
+    // actual bytes moved for a grant; settles the deficit (refund or debt) and charges the token bucket
+    void complete(const Flow &flow, const size_t &granted, const size_t &moved);
+
+    Priority priorityOf(const std::string &user, const size_t &total_bytes) const;
+
+private:
+    struct Bucket {
+        double rate = 0.0;   // bytes per second, 0 = unlimited
+        double tokens = 0.0; // may go negative by up to one chunk
+        Clock::time_point last = Clock::now();
+    };
+
+    // per direction, then per priority class: a user's interactive and bulk flows earn and spend
+    // separate deficits, so one small transfer does not lend its weight to the user's bulk ones
+    struct UserState {
+        Bucket buckets[2];
+        std::int64_t deficit[2][2] = {{0, 0}, {0, 0}}; // negative after a chunk larger than the grant
+        size_t next_flow[2][2] = {{0, 0}, {0, 0}};     // round-robin offset into the class's ready flows
+    };
+
+    const ServerConfig &config;
+    std::unordered_map<std::string, UserState> users;
+    Clock::time_point next_wake = Clock::time_point::max();
+
+    UserState &state(const std::string &user);
+    void refill(Bucket &bucket, const Clock::time_point &now) const;
+};
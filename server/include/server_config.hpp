@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// server settings parsed from the command line
+struct ServerConfig {
+    std::uint16_t port = 9000;
+    std::string root = "";
+    std::string log_file = "log.txt";
+
+    // logging
+    std::string log_level = "info";   // trace, debug, info, warn, err, critical, off
+    size_t log_queue_size = 8192;     // async ring buffer entries (oldest dropped when full)
+    unsigned log_sample_every = 1;    // log 1 of every n per-message events
+    unsigned log_rate_limit = 1000;   // max per-message / error lines per second
+
+    // metrics
+    std::unordered_set<std::string> admin_users; // authenticated users allowed to run STATS
+    std::string stats_file = "";                 // Prometheus text file, disabled when empty
+    unsigned stats_interval_seconds = 10;
+
+    // tracing
+    std::string trace_dir = "";                  // Chrome trace-event output, disabled when empty
+    std::unordered_set<std::string> trace_users; // always traced ("" = public sessions)
+    double trace_sample_rate = 0.0;              // fraction of other sessions traced
+
+    // transfer scheduling (deficit round robin across users, see scheduler.hpp)
+    std::unordered_map<std::string, std::uint64_t> user_rate_limits; // bytes/s per direction ("" = public)
+    std::uint64_t default_user_rate = 0;                             // bytes/s for other users, 0 = unlimited
+    std::unordered_map<std::string, std::string> user_classes;       // user -> "interactive" | "bulk"
+    size_t interactive_max_bytes = 1024 * 1024; // unclassified transfers up to this size are interactive
+    unsigned interactive_weight = 4;            // interactive users earn this many quanta per round
+    size_t sched_quantum = 256 * 1024;          // bytes each active user may move per round
+    size_t sched_max_chunks_per_flow = 8;       // 64 KB chunks one session may move per round
+
+    // filesystem executor
+    size_t fs_threads = 4; // threads for COPY and other long filesystem work off the reactor
+
+    // download file cache (see file_cache.hpp)
+    size_t file_cache_files = 256;                      // open files shared by downloads, 0 = disabled
+    std::uint64_t file_cache_bytes = 64 * 1024 * 1024;  // contents of small hot files kept in memory
+
+    // page cache policy of transfers (see transfer_io.hpp)
+    size_t readahead_bytes = 2 * 1024 * 1024;            // requested ahead of a download's cursor, 0 = kernel default
+    std::uint64_t drop_behind_bytes = 64 * 1024 * 1024;  // transfers of files this large leave the cache behind them, 0 = never
+    std::uint64_t direct_upload_bytes = 0;               // uploads this large bypass the cache with O_DIRECT, 0 = never
+
+    // crash safety of uploads (see durability.hpp)
+    std::string durability = "on-complete"; // none, on-complete (synced before acknowledged) or strict (journal too)
+
+    // storage quotas (usage is tracked per user directory, see usage.hpp)
+    std::unordered_map<std::string, std::uint64_t> user_quotas; // bytes per user ("" = public)
+    std::uint64_t default_user_quota = 0;                       // bytes for other users, 0 = unlimited
+
+    // workload recording
+    std::string record_dir = ""; // per-session command traces for minidrive_replay, disabled when empty
+};
@@ -1,14 +1,26 @@
 #pragma once
 
 #include "../../shared/include/minidrive/helpers.hpp"
+#include "../../shared/include/minidrive/block_list.hpp"
+#include "../../shared/include/minidrive/lock_table.hpp"
+#include "../../shared/include/minidrive/pack.hpp"
+#include "../../shared/include/minidrive/workload_trace.hpp"
+#include "server_config.hpp"
+#include "change_feed.hpp"
+#include "chunk_sizer.hpp"
+#include "commands.hpp"
+#include "file_cache.hpp"
+#include "fs_executor.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+#include "transfer_io.hpp"
+#include "usage.hpp"
 
 #include <memory>
 #include <functional>
 #include <iostream>
 #include <fstream>
 #include <mutex>
-#include <shared_mutex>
-#include <unordered_set>
 
 class Session {
 public:
@@ -19,7 +31,8 @@ public:
         AwaitingPassword,
         AwaitingResumeChoice,
         AwaitingFile,
-        DownloadingFile
+        DownloadingFile,
+        Busy // command running on the filesystem executor; no reads until it replies
     };
     enum class VerifyType {
         File,
@@ -32,8 +45,11 @@ public:
         DontCare
     };
 
-    Session(const int &fd, const std::string &root, std::function<void(int)> close_callback);
-    ~Session(); // Custom destructor to handle unique_ptr<Flow>
+    Session(const int &fd, const ServerConfig &config, FsExecutor &executor, std::function<void(int)> close_callback);
+    ~Session(); // Custom destructor to flush the session trace and workload recording
+
+    // at startup, before any session: discards what ATOMIC batches left parked in a crash
+    static void sweepBatchStaging(const std::string &root);
 
     void onMessage(const std::string &msg);
     void exit();
@@ -41,45 +57,116 @@ public:
     // downloading files
     void downloadFileChunk();
     
-    // file locking for concurrent downloads
-    static void lockFileForDownload(const std::string &filepath);
-    static void unlockFileForDownload(const std::string &filepath);
-    static bool isFileLocked(const std::string &filepath);
-    
     // getters and setters
     const int &getClientFD() const;
     const std::string &getRoot() const;
     const std::string &getWorkingDirectory() const;
     const std::string &getClientDirectory() const;
     State getState() const;
+    const std::string &getUsername() const;
+    size_t getUploadProgress() const;
+    size_t getDownloadProgress() const;
+    size_t getTransferTotal() const; // size of the file being uploaded / downloaded
+
+    // WATCH: change events are pushed by the reactor whenever the socket is writable
+    bool hasEvents() const;
+    void pushEvents();
+    size_t watchCount() const { return this->watches.size(); }
     
 private:
     const int client_fd;
+    const ServerConfig &config;
+    FsExecutor &executor;
     const std::string root;
     std::function<void(int)> close_callback;
     std::string working_directory = "public";
     std::string client_directory = "public";
     
     // download state
-    std::ifstream download_stream;
+    std::shared_ptr<const FileCache::File> download_file; // shared with other downloads of it
+    transfer_io::ReadCursor download_cursor;
     std::string download_path;
     size_t download_bytes_sent = 0;
     size_t download_total_bytes = 0;
+    StreamHash download_hash; // of everything sent so far, digest follows the last chunk
+    
+    LockTable::Guard download_lock; // shared, so the file cannot be deleted or moved while it streams
+
+    // packed transfers: a directory as one stream (see pack.hpp), in place of download_file /
+    // the .part of a single upload
+    std::shared_ptr<pack::Writer> download_pack;
+    std::vector<LockTable::Guard> download_tree_lock;
+    std::unique_ptr<pack::Reader> upload_pack;
+
+    // pipelined uploads send their data without waiting for READY, so a refused one still has to be
+    // read off the socket before the next command
+    size_t discard_left = 0;
+    size_t discarded = 0; // total, counted as upload progress
     
-    // global file lock tracking across all sessions
-    static std::shared_mutex files_mutex;
-    static std::unordered_set<std::string> locked_files;
+    // exclusive lock on the .part being received or resumed, so two sessions never write one upload
+    LockTable::Guard upload_lock;
+    std::unique_ptr<transfer_io::PartWriter> upload_writer; // opened by the first chunk
+    std::uint64_t upload_checkpoint = 0;                    // --durability strict: last offset sent to be synced and journalled
+
+    void claimUpload(const std::string &part_path);
+    void releaseUpload();
+
+    // quota accounting for the upload in flight: space reserved up front, charged chunk by chunk
+    usage::UserUsage *upload_usage = nullptr;
+    std::string upload_usage_key;
+    std::uint64_t upload_reserved = 0;
+    bool upload_dirty = false; // holds a UserUsage::markDirty until releaseUpload
+    usage::UserUsage &usage() const;
+    std::uint64_t userQuota() const; // bytes, 0 = unlimited
+    void reserveQuota(const std::uint64_t &bytes);
+    // reserves what a copy of `source` will add (quota_exceeded when it would not fit) and returns it,
+    // for a usage::Reservation held until the copy is charged; safe on the executor
+    std::uint64_t reserveCopy(usage::UserUsage &usage, const std::string &source) const;
     
     // session helpers
     std::string verifyPath(const std::string &path, const VerifyType &type, const VerifyExistence &existence) const;
+    // for paths a command creates: nothing may be created at or below the server's own entries of the
+    // user directory (UserUsage::isMetadata)
+    void refuseReserved(const std::string &path) const;
+    void requireAdmin(const std::string &command) const;
     void send(const std::string &msg) const;
     void setState(const State &new_state);
     
     std::string client_username = "";
     State state = State::AwaitingMessage;
     bool auth_initiated = false;
+    bool authenticated = false;
     bool resume_initiated = false;
     TransferState::Transfer current_transfer;
+    std::vector<TransferState::Transfer> resume_offer; // pending uploads listed in the last RESUME offer
+    StreamHash upload_hash; // saved with the transfer state so a resumed upload keeps hashing
+    ChunkSizer chunk_sizer;
+
+    // request tracing (no-op unless enabled for this session)
+    tracing::SessionTrace session_trace;
+    tracing::Clock::time_point last_chunk_end{};
+    void startTracing(); // after authentication, or for a public session
+
+    // workload recording for lab replay (no-op unless --record-dir is set)
+    workload::TraceWriter workload_recorder;
+    std::chrono::steady_clock::time_point record_start{};
+    void startRecording(const std::string &username); // after authentication, or for a public session
+    void recordCommand(const metrics::Command &cmd, const Tokens &parts, const std::string_view &body, const bool &ok, const std::chrono::nanoseconds &duration);
+
+    // command dispatch
+    void dispatch(const commands::Opcode &op, const Tokens &parts, const std::string_view &body);
+    void commandFailed(const metrics::Command &cmd, const Tokens &parts, const std::string_view &body, const bool &recordable, const std::chrono::nanoseconds &elapsed, const std::exception &e);
+
+    // commands finished on the filesystem executor (the reactor neither reads nor closes a Busy session)
+    struct PendingCommand {
+        std::string msg;
+        metrics::Command cmd = metrics::Command::Unknown;
+        std::chrono::steady_clock::time_point start{};
+        bool recordable = false;
+    };
+    PendingCommand pending;
+    void runAsync(std::function<std::string()> work, std::function<void()> then = nullptr); // work returns the reply ("" = none)
+    void finishAsync(const std::string &reply, std::exception_ptr error, const std::function<void()> &then);
 
     // helpers
     std::string path(const std::string &relative_path) const;
@@ -94,18 +181,52 @@ private:
     void resumeUpload();
     void processResumeChoice(const std::string &choice);
     void resumeDownload(const std::string &path, const size_t &offset);
+    void resumeDownload(const std::string &path, const size_t &offset, const BlockList &blocks);
+    void startDownload(const std::string &path, const size_t &offset, const StreamHash &hash);
+    void resumePackUpload(const bool &announce);
+    void resumePackDownload(const std::string &path, const size_t &offset);
+    void startPackUpload(const std::uint64_t &offset, const StreamHash &hash);
+    void startPackDownload(const std::string &path, const std::shared_ptr<pack::Writer> &writer, std::vector<LockTable::Guard> locks, const StreamHash &hash);
+    void finishDownload();
 
     // uploading files
-    void uploadFile(const std::string &local_path, const std::string &remote_path, const size_t &filesize);
+    void uploadFile(const std::string &local_path, const std::string &remote_path, const size_t &filesize, const bool &pipelined = false);
     void uploadFileChunk();
+    void finishUpload();
+    std::string renameUpload(const std::string &part_path); // returns the reply
+    void checkpointUpload();
+    void discardUpload();
+    void uploadPack(const std::string &local_dir, const std::string &remote_dir, const size_t &size);
+    void uploadPackChunk();
+    void commitPack(const bool &complete);
+    std::string finishPackUpload(); // returns the reply
 
     // file operations
-    void list(const std::string &path);
+    void list(const std::string &path, const std::string &etag);
     void downloadFile(const std::string &path);
+    void downloadPack(const std::string &path);
     void deleteFile(const std::string &path);
     void changeDirectory(const std::string &path);
     void makeDirectory(const std::string &path);
     void removeDirectory(const std::string &path);
     void move(const std::string &source, const std::string &destination);
     void copy(const std::string &source, const std::string &destination);
+    void diskUsage(const std::string &path);
+    void batch(const std::string &mode, const std::string_view &body); // operations run on the executor
+
+    // watched directories; while there is one the session takes only WATCH, UNWATCH and EXIT, whose
+    // replies arrive between EVENTS messages
+    static constexpr size_t MAX_WATCHES = 64;
+    static constexpr size_t MAX_EVENTS_PER_MESSAGE = 256;
+    struct Watch {
+        std::string path; // as the client named it, echoed in each EVENTS message
+        std::shared_ptr<ChangeFeed::Subscription> subscription;
+    };
+    std::vector<Watch> watches;
+    void watch(const std::string &path);
+    void unwatch(const std::string &path);
+
+    // admin
+    void stats();
+    void traceControl(const std::string &what, const std::string &arg, const std::string &value);
 };
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include "../../shared/include/minidrive/helpers.hpp"
+#include "server_config.hpp"
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -18,4 +19,4 @@
 #include <unordered_map>
 #include <vector>
 
-void start_simple_server(const std::uint16_t &port, const std::string &root, const std::string &log_file);
+void start_simple_server(const ServerConfig &config);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "server_config.hpp"
+#include "fs_executor.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tracing {
+
+using Clock = std::chrono::steady_clock;
+
+// runtime switches, seeded from ServerConfig and changed by the admin TRACE command
+void configure(const ServerConfig &config);
+void set_user(const std::string &user, const bool &enabled);
+void set_sample_rate(const double &rate);
+bool should_trace(const std::string &user);
+std::string describe();
+
+// username reduced to [A-Za-z0-9_-] for use in trace and recording file names ("public" for public mode)
+std::string file_tag(const std::string &user);
+
+// per-session span buffer dumped as Chrome trace-event JSON when the session ends; spans of the login
+// itself are held until the session authenticates (or goes public), so failed logins never reach the
+// trace directory
+class SessionTrace {
+public:
+    static constexpr size_t MAX_EVENTS = 100000;
+
+    bool enabled() const { return this->active || this->held; }
+    void hold();                                        // record, but keep the spans back until start()
+    void start(const int &fd, const std::string &user); // no-op unless held
+    void discard();                                     // the login failed, forget the held spans
+    void complete(const char *name, const char *category, const Clock::time_point &begin, const Clock::time_point &end, const std::uint64_t &bytes = 0);
+    void dump(FsExecutor &executor); // serialized and written on the executor, the buffer is handed over
+
+private:
+    struct Event {
+        const char *name;
+        const char *category;
+        std::int64_t ts_us;
+        std::int64_t dur_us;
+        std::uint64_t bytes;
+    };
+
+    bool held = false;
+    bool active = false;
+    int fd = -1;
+    std::string user;
+    std::vector<Event> events;
+    size_t dropped = 0;
+};
+
+// RAII span; costs one branch when the session is not traced
+class Span {
+public:
+    Span(SessionTrace &trace, const char *name, const char *category = "session") : trace(trace.enabled() ? &trace : nullptr), name(name), category(category) {
+        if (this->trace) {
+            this->begin = Clock::now();
+        }
+    }
+    ~Span() {
+        if (this->trace) {
+            this->trace->complete(this->name, this->category, this->begin, Clock::now(), this->bytes);
+        }
+    }
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+    void rename(const char *new_name) { this->name = new_name; }
+    void setBytes(const std::uint64_t &n) { this->bytes = n; }
+
+private:
+    SessionTrace *trace;
+    const char *name;
+    const char *category;
+    std::uint64_t bytes = 0;
+    Clock::time_point begin;
+};
+
+} // namespace tracing
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "server_config.hpp"
+#include "../../shared/include/minidrive/helpers.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// page cache policy of file transfers. Bulk data passes through once, so it should not push out the
+// directory metadata and small hot files every other session reads: downloads are read sequentially
+// with an explicit readahead window, and large ones drop what they have sent from the cache behind
+// the cursor; large uploads either bypass the cache (O_DIRECT, through an aligned staging buffer) or
+// have what they wrote pushed to disk and dropped a few windows behind.
+namespace transfer_io {
+
+constexpr size_t DROP_STEP = 4 * 1024 * 1024; // granularity of drop-behind, downloads and uploads
+constexpr size_t DIRECT_ALIGN = 4096;          // offset and length alignment of O_DIRECT writes
+constexpr size_t DIRECT_STAGE = 1024 * 1024;   // O_DIRECT staging buffer, written whenever full
+
+void configure(const ServerConfig &config);
+
+// readahead and drop-behind of one download; a no-op for files served from memory (fd -1)
+class ReadCursor {
+public:
+    void start(const int &fd, const std::uint64_t &size, const std::uint64_t &offset);
+
+    // everything before `offset` was sent; `shared` while other sessions stream the same file, whose
+    // pages are then left alone
+    void advance(const std::uint64_t &offset, const bool &shared);
+
+private:
+    int fd = -1;
+    std::uint64_t size = 0;
+    std::uint64_t prefetched = 0; // end of the last readahead window
+    std::uint64_t dropped = 0;    // pages before this were dropped
+    bool drop = false;
+};
+
+// the .part of one upload, open from its first chunk to its last
+class PartWriter {
+public:
+    PartWriter(const std::string &path, const std::uint64_t &offset, const std::uint64_t &total);
+    ~PartWriter();
+    PartWriter(const PartWriter &) = delete;
+    PartWriter &operator=(const PartWriter &) = delete;
+
+    // receives up to `max` bytes of the upload from the socket and writes them; `hash` is updated with
+    // what reaches the file, so it always matches written()
+    size_t receive(const int &fd, const size_t &max, StreamHash *hash);
+
+    // end of the data written to the file: what the journal may record, since staged bytes are lost
+    // with the process
+    std::uint64_t written() const { return this->disk; }
+
+private:
+    void writeAll(const char *data, const size_t &length);
+    void flushStage(StreamHash *hash);
+    void writeBehind();
+
+    std::string path;
+    int file = -1;
+    std::uint64_t disk = 0;
+    std::uint64_t total = 0;
+    bool direct = false;
+    char *stage = nullptr; // O_DIRECT only, DIRECT_ALIGN-aligned
+    size_t fill = 0;
+    bool drop = false;
+    std::uint64_t flushed = 0; // writeback was started for everything before this
+    std::uint64_t dropped = 0;
+};
+
+} // namespace transfer_io
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+// per-user space accounting: subtree totals for every directory of a user, updated by the commands
+// that change sizes instead of walking the tree, and saved to <user dir>/.usage. A file that is
+// missing or was not saved cleanly (server stopped during an upload) is rebuilt by one walk.
+namespace usage {
+
+constexpr const char *FILE_NAME = ".usage";
+
+// where ATOMIC batches park what they delete until they commit (see Session::batch); one per user
+// directory, so parked data never leaves its owner's tree or the filesystem it was deleted from
+constexpr const char *BATCH_STAGING = ".batch-staging";
+
+struct Totals {
+    std::int64_t bytes = 0;
+    std::int64_t files = 0;
+};
+
+// what removing a path takes away, measured while it is still there (see UserUsage::measure)
+struct Removal {
+    std::string key; // the directory itself, or the one holding the file
+    bool directory = false;
+    std::int64_t bytes = 0;
+    std::int64_t files = 0;
+};
+
+class UserUsage {
+public:
+    explicit UserUsage(const std::string &user_dir);
+
+    // key of the directory holding `path` (a file) or of `path` itself (a directory); cache it for
+    // repeated updates, as resolving it touches the filesystem
+    std::string parentKey(const std::string &path) const;
+    std::string dirKey(const std::string &path) const;
+
+    // a file below `key` grew or shrank by `bytes`, or appeared / disappeared (`files` = +1 / -1)
+    void add(const std::string &key, const std::int64_t &bytes, const std::int64_t &files);
+
+    // whole subtrees: count one that appeared (walks only it, e.g. after COPY), forget one before
+    // it is removed, or re-key one after a rename (both from the aggregates alone)
+    void addTree(const std::string &path);
+    void removeTree(const std::string &path);
+    void moveTree(const std::string &from, const std::string &to);
+
+    // removeTree in two steps, for a removal that can still fail: measure `path` before, and forget
+    // it only once it is gone
+    Removal measure(const std::string &path) const;
+    void forget(const Removal &removal);
+
+    Totals totals(const std::string &path) const;
+    std::int64_t used() const;
+
+    // space promised to uploads in flight, so concurrent uploads cannot overshoot the quota together;
+    // quota 0 = unlimited
+    bool reserve(const std::uint64_t &bytes, const std::uint64_t &quota);
+    void unreserve(const std::uint64_t &bytes);
+
+    // marks the saved copy stale before changes that are not saved right away (upload chunks); every
+    // markDirty is paired with a releaseDirty once those changes are in, and until the last holder
+    // has released, save() keeps the file marked dirty
+    void markDirty();
+    void releaseDirty();
+    void save();
+
+    // the server's own names in a user directory, which clients cannot create there (.usage,
+    // .transfers_state, the batch staging directory); the files are never charged
+    static bool isMetadata(const std::string &name);
+
+private:
+    void addLocked(const std::string &key, const std::int64_t &bytes, const std::int64_t &files);
+    void rebuild();
+    bool load();
+    void write(const bool &clean);
+
+    const std::string user_dir;
+    const std::string base; // canonical user_dir
+    mutable std::mutex mutex;
+    std::map<std::string, Totals> dirs; // relative directory -> subtree totals ("" = user root)
+    std::uint64_t reserved = 0;
+    size_t dirty_holders = 0;
+    bool saved_clean = false;
+    bool changed = false;
+};
+
+// space already reserved with UserUsage::reserve, given back when this goes out of scope (by then
+// the operation it was for has been charged in full, or has failed)
+class Reservation {
+public:
+    Reservation(UserUsage &usage, const std::uint64_t &bytes) : usage(usage), bytes(bytes) {}
+    ~Reservation() { this->usage.unreserve(this->bytes); }
+    Reservation(const Reservation &) = delete;
+    Reservation &operator=(const Reservation &) = delete;
+
+private:
+    UserUsage &usage;
+    const std::uint64_t bytes;
+};
+
+// shared by all sessions of a user (keyed by the user directory path)
+UserUsage &for_directory(const std::string &user_dir);
+
+} // namespace usage
@@ -61,7 +61,14 @@ bool exists_user(const std::string &user, const std::string &root) {
     return users.contains(user);
 }
 
+bool valid_username(const std::string &user) {
+    return !user.empty() && !user.starts_with(".") && user.find_first_of("/\\") == std::string::npos;
+}
+
 void register_user(const std::string &user, const std::string &password, const std::string &root) {
+    if (!valid_username(user)) {
+        throw std::runtime_error("invalid_argument: Usernames cannot start with '.' or contain '/'");
+    }
     nlohmann::json users = load_users(root);
     if (users.contains(user)) {
         throw std::runtime_error("user_exists: User already exists");
@@ -0,0 +1,349 @@
+#include "change_feed.hpp"
+#include "dir_generations.hpp"
+#include "usage.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+constexpr std::uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+constexpr size_t MAX_RECENT = 4096; // echo candidates kept before expired ones are swept
+
+// what a queued event and a newer one for the same name amount to; `cancel` when they amount to nothing
+ChangeFeed::Kind combine(const ChangeFeed::Kind &queued, const ChangeFeed::Kind &next, bool &cancel) {
+    using Kind = ChangeFeed::Kind;
+    cancel = false;
+    if (queued == Kind::Created) {
+        cancel = next == Kind::Deleted;
+        return Kind::Created;
+    }
+    if (queued == Kind::Deleted) {
+        return next == Kind::Deleted ? Kind::Deleted : Kind::Modified;
+    }
+    return next == Kind::Deleted ? Kind::Deleted : Kind::Modified;
+}
+
+} // namespace
+
+// subscription
+
+ChangeFeed::Subscription::~Subscription() {
+    this->feed.unsubscribe(this);
+}
+
+bool ChangeFeed::Subscription::pending() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->live > 0 || this->overflowed;
+}
+
+std::vector<ChangeFeed::Event> ChangeFeed::Subscription::take(const size_t &max) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::vector<Event> out;
+    if (this->overflowed) {
+        this->overflowed = false;
+        out.push_back({Kind::Overflow, ".", "", this->overflow_generation});
+        return out;
+    }
+    while (!this->queue.empty() && out.size() < max) {
+        Queued &front = this->queue.front();
+        const auto it = this->index.find(front.event.name);
+        if (it != this->index.end() && it->second == this->first_seq) {
+            this->index.erase(it);
+        }
+        if (!front.dropped) {
+            out.push_back(std::move(front.event));
+            this->live--;
+        }
+        this->queue.pop_front();
+        this->first_seq++;
+    }
+    return out;
+}
+
+void ChangeFeed::Subscription::push(const Event &event) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->overflowed) {
+        this->overflow_generation = event.generation;
+        return;
+    }
+
+    // a rename ends coalescing for both names, so later events stay behind it
+    if (event.kind == Kind::Moved) {
+        this->index.erase(event.name);
+        this->index.erase(event.to);
+    } else {
+        const auto it = this->index.find(event.name);
+        if (it != this->index.end()) {
+            Queued &queued = this->queue[static_cast<size_t>(it->second - this->first_seq)];
+            bool cancel = false;
+            queued.event.kind = combine(queued.event.kind, event.kind, cancel);
+            queued.event.generation = event.generation;
+            if (cancel) {
+                queued.dropped = true;
+                this->live--;
+                this->index.erase(it);
+            }
+            return;
+        }
+    }
+
+    if (this->live >= MAX_QUEUED) {
+        this->queue.clear();
+        this->index.clear();
+        this->first_seq = 0;
+        this->live = 0;
+        this->overflowed = true;
+        this->overflow_generation = event.generation;
+        return;
+    }
+    if (event.kind != Kind::Moved) {
+        this->index[event.name] = this->first_seq + this->queue.size();
+    }
+    this->queue.push_back({event, false});
+    this->live++;
+}
+
+void ChangeFeed::Subscription::overflow(const std::uint64_t &generation) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->queue.clear();
+    this->index.clear();
+    this->first_seq = 0;
+    this->live = 0;
+    this->overflowed = true;
+    this->overflow_generation = generation;
+}
+
+// feed
+
+ChangeFeed &ChangeFeed::global() {
+    // never destroyed, so subscriptions released during static destruction still find it
+    static ChangeFeed *feed = new ChangeFeed();
+    return *feed;
+}
+
+std::shared_ptr<ChangeFeed::Subscription> ChangeFeed::subscribe(const std::string &dir) {
+    std::shared_ptr<Subscription> subscription(new Subscription(*this, dir));
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->inotify_fd < 0) {
+        this->inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (this->inotify_fd < 0) {
+            spdlog::warn("inotify unavailable, WATCH reports server-side changes only error=\"{}\"", std::strerror(errno));
+        }
+    }
+    Watched &watched = this->watched[dir];
+    if (watched.subscribers.empty() && this->inotify_fd >= 0) {
+        watched.wd = ::inotify_add_watch(this->inotify_fd, dir.c_str(), WATCH_MASK);
+        if (watched.wd < 0) {
+            spdlog::warn("inotify_add_watch failed dir={} error=\"{}\"", dir, std::strerror(errno));
+        } else {
+            this->wds[watched.wd] = dir;
+        }
+    }
+    watched.subscribers.push_back(subscription.get());
+    this->subscriptions++;
+    return subscription;
+}
+
+void ChangeFeed::unsubscribe(Subscription *subscription) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->watched.find(subscription->key);
+    if (it == this->watched.end()) {
+        return;
+    }
+    std::vector<Subscription *> &subscribers = it->second.subscribers;
+    subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), subscription), subscribers.end());
+    this->subscriptions--;
+    if (!subscribers.empty()) {
+        return;
+    }
+    if (it->second.wd >= 0) {
+        ::inotify_rm_watch(this->inotify_fd, it->second.wd);
+        this->wds.erase(it->second.wd);
+    }
+    this->watched.erase(it);
+}
+
+void ChangeFeed::publish(const std::string &dir, const Event &event) {
+    if (this->subscriptions.load(std::memory_order_relaxed) == 0 || hidden(event.name)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->watched.find(dir);
+    if (it == this->watched.end()) {
+        return;
+    }
+    if (it->second.wd >= 0) {
+        this->remember(dir, event.name);
+        if (event.kind == Kind::Moved) {
+            this->remember(dir, event.to);
+        }
+    }
+    this->deliver(dir, event);
+}
+
+void ChangeFeed::expect(const std::string &dir, const std::string &name) {
+    if (this->subscriptions.load(std::memory_order_relaxed) == 0 || hidden(name)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->watched.find(dir);
+    if (it != this->watched.end() && it->second.wd >= 0) {
+        this->remember(dir, name);
+    }
+}
+
+void ChangeFeed::remember(const std::string &dir, const std::string &name) {
+    const auto now = std::chrono::steady_clock::now();
+    if (this->recent.size() >= MAX_RECENT) {
+        std::erase_if(this->recent, [&now](const auto &entry) { return now - entry.second > ECHO_WINDOW; });
+    }
+    this->recent[dir + "/" + name] = now;
+}
+
+void ChangeFeed::deliver(const std::string &dir, const Event &event) {
+    const auto it = this->watched.find(dir);
+    if (it == this->watched.end()) {
+        return;
+    }
+    for (Subscription *subscription : it->second.subscribers) {
+        subscription->push(event);
+    }
+}
+
+bool ChangeFeed::echo(const std::string &dir, const std::string &name, const std::chrono::steady_clock::time_point &now) {
+    const auto it = this->recent.find(dir + "/" + name);
+    return it != this->recent.end() && now - it->second <= ECHO_WINDOW;
+}
+
+void ChangeFeed::readInotify() {
+    if (this->inotify_fd < 0) {
+        return;
+    }
+    struct Raw {
+        std::uint32_t mask;
+        std::uint32_t cookie;
+        std::string dir;
+        std::string name;
+    };
+    std::vector<Raw> raw;
+    alignas(inotify_event) char buffer[64 * 1024];
+    while (true) {
+        const ssize_t n = ::read(this->inotify_fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            break;
+        }
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (ssize_t offset = 0; offset < n;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+            if (event->mask & IN_Q_OVERFLOW) {
+                raw.push_back({IN_Q_OVERFLOW, 0, "", ""});
+                continue;
+            }
+            const auto it = this->wds.find(event->wd);
+            if (it == this->wds.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // the directory is gone; its subscribers stay, but nothing more comes from the kernel
+                const auto watched = this->watched.find(it->second);
+                if (watched != this->watched.end()) {
+                    watched->second.wd = -1;
+                }
+                this->wds.erase(it);
+                continue;
+            }
+            raw.push_back({event->mask, event->cookie, it->second, event->len > 0 ? std::string(event->name) : "."});
+        }
+    }
+    if (raw.empty()) {
+        return;
+    }
+
+    // generations are looked up outside the feed lock, DirGenerations publishes while holding none
+    std::vector<std::pair<std::string, Event>> events;
+    for (size_t i = 0; i < raw.size(); ++i) {
+        const Raw &r = raw[i];
+        if (r.mask == IN_Q_OVERFLOW) {
+            events.push_back({"", {Kind::Overflow, ".", "", 0}});
+            continue;
+        }
+        const std::uint64_t generation = DirGenerations::global().generation(r.dir);
+        if (r.mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+            events.push_back({r.dir, {Kind::Deleted, ".", "", generation}});
+        } else if (r.mask & IN_MOVED_FROM) {
+            // a rename within the directory arrives as a FROM / TO pair with one cookie
+            if (i + 1 < raw.size() && (raw[i + 1].mask & IN_MOVED_TO) && raw[i + 1].cookie == r.cookie && raw[i + 1].dir == r.dir) {
+                events.push_back({r.dir, {Kind::Moved, r.name, raw[i + 1].name, generation}});
+                i++;
+            } else {
+                events.push_back({r.dir, {Kind::Deleted, r.name, "", generation}});
+            }
+        } else if (r.mask & (IN_CREATE | IN_MOVED_TO)) {
+            events.push_back({r.dir, {Kind::Created, r.name, "", generation}});
+        } else if (r.mask & IN_DELETE) {
+            events.push_back({r.dir, {Kind::Deleted, r.name, "", generation}});
+        } else if (r.mask & IN_CLOSE_WRITE) {
+            events.push_back({r.dir, {Kind::Modified, r.name, "", generation}});
+        }
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto &[dir, event] : events) {
+        if (event.kind == Kind::Overflow) {
+            // the kernel dropped events: every subscriber lists again
+            for (auto &watched : this->watched) {
+                for (Subscription *subscription : watched.second.subscribers) {
+                    subscription->overflow(DirGenerations::global().generation(watched.first));
+                }
+            }
+            continue;
+        }
+        if (event.kind == Kind::Moved) {
+            // a rename between a hidden name and a visible one is a create / delete to the watcher
+            // (x.part -> x finishes an upload)
+            const bool from_hidden = hidden(event.name);
+            const bool to_hidden = hidden(event.to);
+            if (from_hidden && to_hidden) {
+                continue;
+            }
+            if (from_hidden || to_hidden) {
+                event = {from_hidden ? Kind::Created : Kind::Deleted, from_hidden ? event.to : event.name, "", event.generation};
+            }
+        }
+        if (hidden(event.name) || echo(dir, event.name, now) || (event.kind == Kind::Moved && echo(dir, event.to, now))) {
+            continue;
+        }
+        this->deliver(dir, event);
+    }
+    if (this->recent.size() >= MAX_RECENT) {
+        std::erase_if(this->recent, [&now](const auto &entry) { return now - entry.second > ECHO_WINDOW; });
+    }
+}
+
+const char *ChangeFeed::kindName(const Kind &kind) {
+    switch (kind) {
+        case Kind::Created:
+            return "created";
+        case Kind::Modified:
+            return "modified";
+        case Kind::Deleted:
+            return "deleted";
+        case Kind::Moved:
+            return "moved";
+        case Kind::Overflow:
+            return "overflow";
+    }
+    return "unknown";
+}
+
+bool ChangeFeed::hidden(const std::string &name) {
+    return name.ends_with(".part") || usage::UserUsage::isMetadata(name);
+}
@@ -0,0 +1,81 @@
+#include "chunk_sizer.hpp"
+#include "minidrive/helpers.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+namespace {
+
+size_t floor_class(const size_t &bytes) {
+    return std::clamp(std::bit_floor(std::max<size_t>(bytes, 1)), MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+}
+
+} // namespace
+
+size_t ChunkSizer::next(const int &fd, const Direction &direction) {
+    if (direction != Direction::Send || this->socket_buffer <= 0) {
+        return this->chunk;
+    }
+
+    // sockets are blocking: do not hand send() more than the buffer has room for
+    int queued = 0;
+    if (::ioctl(fd, SIOCOUTQ, &queued) != 0) {
+        return this->chunk;
+    }
+    const size_t usable = static_cast<size_t>(this->socket_buffer) / 2; // the kernel reports twice the payload capacity
+    const size_t room = usable > static_cast<size_t>(queued) ? usable - static_cast<size_t>(queued) : 0;
+    return room >= this->chunk ? this->chunk : floor_class(room);
+}
+
+void ChunkSizer::observe(const int &fd, const Direction &direction, const size_t &bytes) {
+    const auto now = Clock::now();
+    if (direction != this->last_direction) {
+        // the other direction has its own buffer and pace
+        this->last_direction = direction;
+        this->window_start = now;
+        this->window_bytes = 0;
+        this->window_chunks = 0;
+        this->throughput = 0.0;
+        this->socket_buffer = 0;
+    }
+    this->window_bytes += bytes;
+    this->window_chunks++;
+    if (this->socket_buffer == 0 || this->window_chunks >= RETUNE_CHUNKS || now - this->window_start >= RETUNE_INTERVAL) {
+        this->retune(fd, direction, now);
+    }
+}
+
+void ChunkSizer::retune(const int &fd, const Direction &direction, const Clock::time_point &now) {
+    // throughput over the last window, smoothed
+    const double elapsed = std::chrono::duration<double>(now - this->window_start).count();
+    if (elapsed > 0.0 && this->window_bytes > 0) {
+        const double sample = static_cast<double>(this->window_bytes) / elapsed;
+        this->throughput = this->throughput == 0.0 ? sample : 0.7 * this->throughput + 0.3 * sample;
+    }
+    this->window_start = now;
+    this->window_bytes = 0;
+    this->window_chunks = 0;
+
+    int buffer = 0;
+    socklen_t len = sizeof(buffer);
+    ::getsockopt(fd, SOL_SOCKET, direction == Direction::Send ? SO_SNDBUF : SO_RCVBUF, &buffer, &len);
+    this->socket_buffer = buffer;
+
+    tcp_info info{};
+    len = sizeof(info);
+    const double rtt_s = ::getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 ? static_cast<double>(info.tcpi_rtt) / 1e6 : 0.0;
+
+    // enough data to cover the path (bandwidth-delay product) or ~2 ms of transfer, whichever is
+    // larger, but at most half the socket buffer so one chunk never has to wait for the peer
+    const double wanted = std::max(this->throughput * rtt_s, this->throughput * TARGET_SECONDS);
+    size_t target = floor_class(static_cast<size_t>(wanted));
+    if (buffer > 0) {
+        target = std::min(target, floor_class(static_cast<size_t>(buffer) / 2));
+    }
+    this->chunk = target;
+}
@@ -0,0 +1,131 @@
+#include "dir_generations.hpp"
+#include "file_cache.hpp"
+
+#include <chrono>
+#include <system_error>
+
+namespace {
+
+std::string parent_of(const std::string &key) {
+    const size_t slash = key.find_last_of('/');
+    return slash == std::string::npos || slash == 0 ? "" : key.substr(0, slash);
+}
+
+std::string name_of(const std::string &key) {
+    return key.substr(key.find_last_of('/') + 1);
+}
+
+} // namespace
+
+DirGenerations::DirGenerations()
+    : start(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count())), counter(start) {}
+
+DirGenerations &DirGenerations::global() {
+    static DirGenerations *table = new DirGenerations();
+    return *table;
+}
+
+std::string DirGenerations::key(const std::string &path) {
+    std::string key = std::filesystem::path(path).lexically_normal().generic_string();
+    while (key.size() > 1 && key.back() == '/') {
+        key.pop_back();
+    }
+    return key;
+}
+
+std::uint64_t DirGenerations::bumpLocked(const std::string &key, const bool &directory) {
+    const std::uint64_t generation = ++this->counter;
+    this->own[parent_of(key)] = generation;
+    if (directory) {
+        this->trees[key] = generation;
+    }
+    return generation;
+}
+
+void DirGenerations::bump(const std::string &path) {
+    const std::string key = DirGenerations::key(path);
+    FileCache::global().invalidate(key);
+    std::error_code ec;
+    const bool directory = std::filesystem::is_directory(path, ec);
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->bumpLocked(key, directory);
+}
+
+void DirGenerations::changed(const std::string &path, const ChangeFeed::Kind &kind) {
+    const std::string key = DirGenerations::key(path);
+    FileCache::global().invalidate(key);
+    std::error_code ec;
+    const bool directory = std::filesystem::is_directory(path, ec);
+    std::uint64_t generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        generation = this->bumpLocked(key, directory);
+    }
+    ChangeFeed::global().publish(parent_of(key), {kind, name_of(key), "", generation});
+}
+
+void DirGenerations::expect(const std::string &path) {
+    const std::string key = DirGenerations::key(path);
+    ChangeFeed::global().expect(parent_of(key), name_of(key));
+}
+
+void DirGenerations::moved(const std::string &from, const std::string &to) {
+    const std::string from_key = DirGenerations::key(from);
+    const std::string to_key = DirGenerations::key(to);
+    FileCache::global().invalidate(from_key);
+    FileCache::global().invalidate(to_key);
+    std::error_code ec;
+    const bool directory = std::filesystem::is_directory(to, ec);
+    std::uint64_t from_generation = 0;
+    std::uint64_t to_generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        from_generation = this->bumpLocked(from_key, false);
+        to_generation = this->bumpLocked(to_key, directory);
+    }
+    const std::string from_dir = parent_of(from_key);
+    const std::string to_dir = parent_of(to_key);
+    if (from_dir == to_dir) {
+        ChangeFeed::global().publish(to_dir, {ChangeFeed::Kind::Moved, name_of(from_key), name_of(to_key), to_generation});
+        return;
+    }
+    ChangeFeed::global().publish(from_dir, {ChangeFeed::Kind::Deleted, name_of(from_key), "", from_generation});
+    ChangeFeed::global().publish(to_dir, {ChangeFeed::Kind::Created, name_of(to_key), "", to_generation});
+}
+
+std::uint64_t DirGenerations::generation(const std::string &dir) const {
+    std::string key = DirGenerations::key(dir);
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::uint64_t generation = this->start;
+    const auto own_it = this->own.find(key);
+    if (own_it != this->own.end()) {
+        generation = own_it->second;
+    }
+    for (; !key.empty(); key = parent_of(key)) {
+        const auto it = this->trees.find(key);
+        if (it != this->trees.end() && it->second > generation) {
+            generation = it->second;
+        }
+    }
+    return generation;
+}
+
+std::string DirGenerations::etag(const std::string &dir) const {
+    const std::uint64_t generation = this->generation(dir);
+    std::error_code ec;
+    const auto mtime = std::filesystem::last_write_time(dir, ec);
+    const long long ns = ec ? 0 : static_cast<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count());
+    return std::to_string(generation) + "-" + std::to_string(ns);
+}
+
+std::string first_missing(const std::filesystem::path &path) {
+    std::filesystem::path top;
+    for (std::filesystem::path p = path; !p.empty() && !std::filesystem::exists(p); p = p.parent_path()) {
+        top = p;
+        if (p == p.parent_path()) {
+            break;
+        }
+    }
+    return top.string();
+}
@@ -0,0 +1,272 @@
+#include "durability.hpp"
+#include "../../shared/include/minidrive/transfer_state.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <spdlog/spdlog.h>
+
+namespace durability {
+namespace {
+
+constexpr size_t SYNC_THREADS = 8;
+
+struct Request {
+    std::vector<std::string> paths;
+    Done done;
+};
+
+// SYNC_THREADS - 1 helper threads started with the commit thread and kept for the life of the process,
+// so a round does not pay for thread creation; run() is called by the commit thread only
+class SyncPool {
+public:
+    void start() {
+        for (size_t i = 1; i < SYNC_THREADS; ++i) {
+            std::thread([this]() { this->helperLoop(); }).detach();
+        }
+    }
+
+    // fn(0) .. fn(n - 1) on the helpers and the calling thread, returns once every call has
+    void run(const size_t &n, const std::function<void(size_t)> &fn) {
+        if (n == 0) {
+            return;
+        }
+        auto job = std::make_shared<Job>();
+        job->fn = &fn;
+        job->total = n;
+        if (n > 1) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->current = job;
+                this->generation++;
+            }
+            this->cv.notify_all();
+        }
+        work(*job);
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->cv.wait(lock, [&job]() { return job->finished == job->total; });
+    }
+
+private:
+    struct Job {
+        const std::function<void(size_t)> *fn = nullptr;
+        size_t total = 0;
+        std::atomic<size_t> next{0};
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t finished = 0;
+    };
+
+    // a helper that arrives after every index is taken returns without touching fn, which may be gone
+    static void work(Job &job) {
+        for (size_t i = job.next++; i < job.total; i = job.next++) {
+            (*job.fn)(i);
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (++job.finished == job.total) {
+                job.cv.notify_all();
+            }
+        }
+    }
+
+    void helperLoop() {
+        std::uint64_t seen = 0;
+        while (true) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->cv.wait(lock, [this, &seen]() { return this->generation != seen; });
+                seen = this->generation;
+                job = this->current;
+            }
+            work(*job);
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::shared_ptr<Job> current;
+    std::uint64_t generation = 0;
+};
+
+class GroupCommit {
+public:
+    void enqueue(Request request) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (!this->started) {
+                // lives as long as the process, like the sessions that may still be waiting on it
+                this->pool.start();
+                std::thread([this]() { this->loop(); }).detach();
+                this->started = true;
+            }
+            this->waiting += request.paths.size();
+            this->queue.push_back(std::move(request));
+        }
+        this->cv.notify_one();
+    }
+
+    size_t queued() const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->waiting;
+    }
+
+private:
+    void loop() {
+        while (true) {
+            std::vector<Request> round;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->cv.wait(lock, [this]() { return !this->queue.empty(); });
+                round.swap(this->queue);
+            }
+
+            const std::map<std::string, std::exception_ptr> failed = this->flush(round);
+            size_t paths = 0;
+            for (auto &request : round) {
+                std::exception_ptr error;
+                for (const auto &path : request.paths) {
+                    const auto it = failed.find(path);
+                    if (it != failed.end()) {
+                        error = it->second;
+                        break;
+                    }
+                }
+                paths += request.paths.size();
+                try {
+                    request.done(error);
+                } catch (const std::exception &e) {
+                    spdlog::warn("group commit callback failed error=\"{}\"", e.what());
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->waiting -= paths;
+        }
+    }
+
+    // waits for `fds` from up to SYNC_THREADS threads at once, so the filesystem can fold concurrent
+    // fsyncs into one journal commit instead of committing for each in turn; closes them
+    void wait_all(const std::map<std::string, int> &fds, const bool &directories, const std::function<void(const std::string &, const std::string &)> &fail) {
+        const std::vector<std::pair<std::string, int>> list(fds.begin(), fds.end());
+        std::vector<std::string> errors(list.size());
+        this->pool.run(list.size(), [&](size_t i) {
+            if ((directories ? ::fsync(list[i].second) : ::fdatasync(list[i].second)) != 0) {
+                errors[i] = directories ? "sync directory" : "sync file";
+            }
+            ::close(list[i].second);
+        });
+        for (size_t i = 0; i < list.size(); ++i) {
+            if (!errors[i].empty()) {
+                fail(list[i].first, errors[i]);
+            }
+        }
+    }
+
+    // syncs every distinct path of the round once: writeback of all files is started first so the
+    // disk works on them together, then the files are waited for, then the directories
+    std::map<std::string, std::exception_ptr> flush(const std::vector<Request> &round) {
+        std::map<std::string, std::exception_ptr> failed;
+        std::map<std::string, int> files;
+        std::map<std::string, int> directories;
+        auto fail = [&failed](const std::string &path, const std::string &what) {
+            failed[path] = std::make_exception_ptr(std::runtime_error("fsync_failed: Failed to " + what + " (path: " + path + ")"));
+        };
+
+        for (const auto &request : round) {
+            for (const auto &path : request.paths) {
+                if (files.contains(path) || directories.contains(path) || failed.contains(path)) {
+                    continue;
+                }
+                const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                struct stat st{};
+                if (fd < 0 || ::fstat(fd, &st) != 0) {
+                    if (fd >= 0) {
+                        ::close(fd);
+                    }
+                    fail(path, "open for syncing");
+                    continue;
+                }
+                if (S_ISDIR(st.st_mode)) {
+                    directories.emplace(path, fd);
+                } else {
+                    ::sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+                    files.emplace(path, fd);
+                }
+            }
+        }
+
+        this->wait_all(files, false, fail);
+        this->wait_all(directories, true, fail);
+        return failed;
+    }
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<Request> queue;
+    size_t waiting = 0;
+    bool started = false;
+    SyncPool pool;
+};
+
+Level current = Level::OnComplete;
+
+GroupCommit &group_commit() {
+    static GroupCommit *commit = new GroupCommit();
+    return *commit;
+}
+
+} // namespace
+
+Level parse_level(const std::string &name) {
+    if (name == "none") {
+        return Level::None;
+    }
+    if (name == "on-complete") {
+        return Level::OnComplete;
+    }
+    if (name == "strict") {
+        return Level::Strict;
+    }
+    throw std::runtime_error("invalid_argument: Unknown durability level " + name);
+}
+
+void configure(const ServerConfig &config) {
+    current = parse_level(config.durability);
+    if (current != Level::Strict) {
+        TransferState::setDurable(nullptr);
+        return;
+    }
+    // the journal rides along with the next round instead of being synced where it is written
+    TransferState::setDurable([](std::vector<std::string> paths) {
+        sync(std::move(paths), [](std::exception_ptr error) {
+            try {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            } catch (const std::exception &e) {
+                spdlog::warn("transfer journal sync failed error=\"{}\"", e.what());
+            }
+        });
+    });
+}
+
+Level level() {
+    return current;
+}
+
+void sync(std::vector<std::string> paths, Done done) {
+    group_commit().enqueue({std::move(paths), std::move(done)});
+}
+
+size_t queued() {
+    return group_commit().queued();
+}
+
+} // namespace durability
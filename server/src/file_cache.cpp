@@ -0,0 +1,193 @@
+#include "file_cache.hpp"
+#include "dir_generations.hpp"
+#include "../../shared/include/minidrive/buffer_pool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <iterator>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// reads until `length` bytes are in or the file ends, returns how many
+size_t pread_full(const int &fd, char *buffer, const size_t &length, const std::uint64_t &offset) {
+    size_t done = 0;
+    while (done < length) {
+        const ssize_t n = ::pread(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return done;
+}
+
+std::int64_t mtime_of(const struct stat &st) {
+    return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+} // namespace
+
+FileCache::File::File(const int &fd, std::unique_ptr<char[]> contents, const struct stat &st)
+    : fd(fd), contents(std::move(contents)), length(static_cast<std::uint64_t>(st.st_size)), device(st.st_dev), inode(st.st_ino), mtime(mtime_of(st)) {}
+
+FileCache::File::~File() {
+    if (this->fd >= 0) {
+        ::close(this->fd);
+    }
+}
+
+bool FileCache::File::current(const struct stat &st) const {
+    return st.st_dev == this->device && st.st_ino == this->inode && static_cast<std::uint64_t>(st.st_size) == this->length && mtime_of(st) == this->mtime;
+}
+
+size_t FileCache::File::send(const int &fd, const std::uint64_t &offset, const size_t &length, StreamHash *hash) const {
+    if (length > MAX_CHUNK_SIZE) {
+        throw std::runtime_error("invalid_argument: chunk_size exceeds MAX_CHUNK_SIZE");
+    }
+    if (offset >= this->length) {
+        throw std::runtime_error("file_read_failed: Failed to read from file during download");
+    }
+
+    // a loaded file is sent straight from memory; otherwise pread, so sessions sharing the
+    // descriptor never move each other's position
+    BufferPool::Buffer pooled;
+    const char *buffer = nullptr;
+    size_t read_bytes = static_cast<size_t>(std::min<std::uint64_t>(length, this->length - offset));
+    if (this->contents != nullptr) {
+        buffer = this->contents.get() + offset;
+    } else {
+        pooled = BufferPool::global().acquire(read_bytes);
+        read_bytes = pread_full(this->fd, pooled.data(), read_bytes, offset);
+        if (read_bytes == 0) {
+            throw std::runtime_error("file_read_failed: Failed to read from file during download");
+        }
+        buffer = pooled.data();
+    }
+    if (hash) {
+        hash->update(buffer, read_bytes);
+    }
+
+    size_t sent_total = 0;
+    while (sent_total < read_bytes) {
+        const ssize_t sent = ::send(fd, buffer + sent_total, read_bytes - sent_total, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("send_failed: Failed to send download chunk");
+        }
+        if (sent == 0) {
+            throw std::runtime_error("connection_closed: Connection closed during download");
+        }
+        sent_total += static_cast<size_t>(sent);
+    }
+    return sent_total;
+}
+
+FileCache &FileCache::global() {
+    static FileCache *cache = new FileCache();
+    return *cache;
+}
+
+void FileCache::configure(const ServerConfig &config) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->max_files = config.file_cache_files;
+    this->max_bytes = config.file_cache_bytes;
+    this->evict();
+}
+
+std::shared_ptr<const FileCache::File> FileCache::open(const std::string &path) {
+    const std::string key = DirGenerations::key(path);
+    struct stat st{};
+    const bool exists = ::stat(path.c_str(), &st) == 0;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->entries.find(key);
+    if (it != this->entries.end() && exists && it->second.file->current(st)) {
+        Entry &entry = it->second;
+        this->order.splice(this->order.begin(), this->order, entry.position);
+        const std::uint64_t size = entry.file->size();
+        if (++entry.opens >= 2 && !entry.file->loaded() && size > 0 && size <= MAX_LOADED_FILE && size <= this->max_bytes) {
+            // hot: from now on served from memory, and without holding a descriptor. A copy rather
+            // than a mapping, which would fault if the file were truncated in place behind our back
+            std::unique_ptr<char[]> contents(new char[static_cast<size_t>(size)]);
+            if (pread_full(entry.file->fd, contents.get(), static_cast<size_t>(size), 0) == size) {
+                entry.file = std::shared_ptr<const File>(new File(-1, std::move(contents), st));
+                this->loaded_bytes += size;
+                const std::shared_ptr<const File> file = entry.file;
+                this->evict();
+                return file;
+            }
+        }
+        return entry.file;
+    }
+    if (it != this->entries.end()) {
+        this->erase(it); // stale
+    }
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw std::runtime_error("file_open_failed: Failed to open file for reading (path: " + path + ")");
+    }
+    const std::shared_ptr<const File> file(new File(fd, nullptr, st));
+    if (this->max_files == 0) {
+        return file;
+    }
+    this->order.push_front(key);
+    this->entries.emplace(key, Entry{file, this->order.begin(), 1});
+    this->evict();
+    return file;
+}
+
+void FileCache::invalidate(const std::string &path) {
+    const std::string key = DirGenerations::key(path);
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->entries.empty()) {
+        return;
+    }
+    const auto it = this->entries.find(key);
+    if (it != this->entries.end()) {
+        this->erase(it);
+    }
+    const std::string prefix = key + "/";
+    for (auto below = this->entries.lower_bound(prefix); below != this->entries.end() && below->first.starts_with(prefix);) {
+        const auto next = std::next(below);
+        this->erase(below);
+        below = next;
+    }
+}
+
+size_t FileCache::files() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->entries.size();
+}
+
+std::uint64_t FileCache::bytes() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->loaded_bytes;
+}
+
+void FileCache::erase(std::map<std::string, Entry>::iterator it) {
+    if (it->second.file->loaded()) {
+        this->loaded_bytes -= it->second.file->size();
+    }
+    this->order.erase(it->second.position);
+    this->entries.erase(it); // downloads still holding the file keep it open
+}
+
+void FileCache::evict() {
+    while (!this->order.empty() && (this->entries.size() > this->max_files || this->loaded_bytes > this->max_bytes)) {
+        this->erase(this->entries.find(this->order.back()));
+    }
+}
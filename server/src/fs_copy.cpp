@@ -0,0 +1,181 @@
+#include "fs_copy.hpp"
+#include "minidrive/buffer_pool.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <linux/fs.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fscopy {
+
+namespace {
+
+// closes on scope exit
+struct Fd {
+    int fd = -1;
+    ~Fd() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+};
+
+std::string error_text(const std::string &what, const std::string &path) {
+    return "copy_failed: " + what + " " + path + " (" + std::strerror(errno) + ")";
+}
+
+// errors meaning "this filesystem pair cannot do it", as opposed to real I/O failures
+bool unsupported(const int &err) {
+    return err == EXDEV || err == ENOSYS || err == EINVAL || err == EOPNOTSUPP || err == ENOTTY || err == EPERM || err == EBADF;
+}
+
+void read_write(const int &in, const int &out, const std::string &source, size_t &bytes) {
+    BufferPool::Buffer buffer = BufferPool::global().acquire(1024 * 1024);
+    while (true) {
+        ssize_t n = ::read(in, buffer.data(), buffer.size());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(error_text("Failed to read", source));
+        }
+        if (n == 0) {
+            return;
+        }
+        size_t written = 0;
+        while (written < static_cast<size_t>(n)) {
+            ssize_t w = ::write(out, buffer.data() + written, static_cast<size_t>(n) - written);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(error_text("Failed to write copy of", source));
+            }
+            written += static_cast<size_t>(w);
+        }
+        bytes += static_cast<size_t>(n);
+    }
+}
+
+} // namespace
+
+Method copy_file(const std::string &source, const std::string &destination, size_t &bytes) {
+    Fd in{::open(source.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (in.fd < 0) {
+        throw std::runtime_error(error_text("Failed to open", source));
+    }
+    struct stat st {};
+    if (::fstat(in.fd, &st) != 0) {
+        throw std::runtime_error(error_text("Failed to stat", source));
+    }
+    Fd out{::open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777)};
+    if (out.fd < 0) {
+        throw std::runtime_error(error_text("Failed to create", destination));
+    }
+
+    try {
+        // shared extents: constant time and no extra space
+        if (::ioctl(out.fd, FICLONE, in.fd) == 0) {
+            bytes += static_cast<size_t>(st.st_size);
+            return Method::Reflink;
+        }
+
+        // in-kernel copy; may still be offloaded (NFS server-side copy, reflink inside the kernel)
+        size_t remaining = static_cast<size_t>(st.st_size);
+        size_t copied = 0;
+        bool kernel = true;
+        while (kernel) {
+            ssize_t n = ::copy_file_range(in.fd, nullptr, out.fd, nullptr, remaining > 0 ? remaining : 1024 * 1024, 0);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (copied == 0 && unsupported(errno)) {
+                    kernel = false;
+                    break;
+                }
+                throw std::runtime_error(error_text("Failed to copy", source));
+            }
+            if (n == 0) {
+                break; // end of file (also covers files that grew or shrank meanwhile)
+            }
+            copied += static_cast<size_t>(n);
+            remaining -= std::min(remaining, static_cast<size_t>(n));
+        }
+        if (kernel) {
+            bytes += copied;
+            return Method::CopyFileRange;
+        }
+
+        read_write(in.fd, out.fd, source, bytes);
+        return Method::ReadWrite;
+    } catch (...) {
+        ::unlink(destination.c_str());
+        throw;
+    }
+}
+
+Stats copy(const std::string &source, const std::string &destination, FsExecutor &executor) {
+    namespace fs = std::filesystem;
+    Stats stats;
+    auto count = [&stats](const Method &method) {
+        if (method == Method::Reflink) stats.reflinked++;
+        else if (method == Method::CopyFileRange) stats.kernel_copied++;
+        else stats.userspace_copied++;
+    };
+
+    const fs::file_status root_status = fs::symlink_status(source);
+    if (fs::is_symlink(root_status)) {
+        fs::copy_symlink(source, destination);
+        stats.symlinks++;
+        return stats;
+    }
+    if (!fs::is_directory(root_status)) {
+        count(copy_file(source, destination, stats.bytes));
+        stats.files++;
+        return stats;
+    }
+
+    if (!fs::create_directory(destination, source)) {
+        throw std::runtime_error("overwrite_error: Directory already exists: " + destination);
+    }
+    try {
+        // directories and links first (cheap, and files need their parents)
+        std::vector<std::pair<std::string, std::string>> files;
+        stats.directories++;
+        const fs::path base(source);
+        for (const auto &entry : fs::recursive_directory_iterator(source)) {
+            const fs::path target = fs::path(destination) / entry.path().lexically_relative(base);
+            const fs::file_status status = entry.symlink_status();
+            if (fs::is_symlink(status)) {
+                fs::copy_symlink(entry.path(), target);
+                stats.symlinks++;
+            } else if (fs::is_directory(status)) {
+                fs::create_directory(target, entry.path());
+                stats.directories++;
+            } else if (fs::is_regular_file(status)) {
+                files.emplace_back(entry.path().string(), target.string());
+            }
+        }
+
+        // file contents in parallel
+        std::vector<Method> methods(files.size());
+        std::vector<size_t> sizes(files.size(), 0);
+        executor.parallelFor(files.size(), [&](size_t i) {
+            methods[i] = copy_file(files[i].first, files[i].second, sizes[i]);
+        });
+        for (size_t i = 0; i < files.size(); ++i) {
+            count(methods[i]);
+            stats.bytes += sizes[i];
+        }
+        stats.files = files.size();
+    } catch (...) {
+        // the destination did not exist before, so only our own partial copy is removed
+        std::error_code ec;
+        fs::remove_all(destination, ec);
+        throw;
+    }
+    return stats;
+}
+
+} // namespace fscopy
@@ -0,0 +1,162 @@
+#include "fs_executor.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+FsExecutor::FsExecutor(const size_t &threads) {
+    this->wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->wake_fd < 0) {
+        throw std::runtime_error("eventfd: Failed to create executor wake-up fd");
+    }
+    for (size_t i = 0; i < std::max<size_t>(1, threads); ++i) {
+        this->workers.emplace_back([this]() { this->workerLoop(); });
+    }
+}
+
+FsExecutor::~FsExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+    for (auto &worker : this->workers) {
+        worker.join();
+    }
+    ::close(this->wake_fd);
+}
+
+void FsExecutor::post(Work task) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->tasks.push_back(std::move(task));
+    }
+    this->cv.notify_one();
+}
+
+void FsExecutor::submit(Work work, Done done) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->in_flight++;
+    }
+    this->post([this, work = std::move(work), done = std::move(done)]() mutable {
+        std::exception_ptr error;
+        try {
+            work();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        this->complete(std::move(done), error);
+    });
+}
+
+FsExecutor::Done FsExecutor::handoff(Done done) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->in_flight++;
+    }
+    return [this, done = std::move(done)](std::exception_ptr error) { this->complete(done, error); };
+}
+
+void FsExecutor::complete(Done done, std::exception_ptr error) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->completions.push_back({std::move(done), error});
+    }
+    const std::uint64_t one = 1;
+    [[maybe_unused]] ssize_t n = ::write(this->wake_fd, &one, sizeof(one));
+}
+
+void FsExecutor::parallelFor(const size_t &n, const std::function<void(size_t)> &fn) {
+    if (n == 0) {
+        return;
+    }
+
+    struct Shared {
+        std::atomic<size_t> next{0};
+        std::atomic<bool> failed{false};
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t finished = 0;
+        std::exception_ptr error;
+    };
+    auto shared = std::make_shared<Shared>();
+    const size_t total = n;
+
+    // helpers that start after every index is taken return without touching fn
+    auto run = [shared, &fn, total]() {
+        while (true) {
+            const size_t i = shared->next.fetch_add(1);
+            if (i >= total) {
+                return;
+            }
+            if (!shared->failed.load()) {
+                try {
+                    fn(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(shared->mutex);
+                    if (!shared->error) {
+                        shared->error = std::current_exception();
+                    }
+                    shared->failed = true;
+                }
+            }
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            if (++shared->finished == total) {
+                shared->cv.notify_all();
+            }
+        }
+    };
+
+    const size_t helpers = std::min(n, this->workers.size()) - 1;
+    for (size_t i = 0; i < helpers; ++i) {
+        this->post(run);
+    }
+    run();
+
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->cv.wait(lock, [&]() { return shared->finished == total; });
+    if (shared->error) {
+        std::rethrow_exception(shared->error);
+    }
+}
+
+void FsExecutor::drain() {
+    std::uint64_t count = 0;
+    [[maybe_unused]] ssize_t n = ::read(this->wake_fd, &count, sizeof(count));
+
+    std::vector<Completion> ready;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        ready.swap(this->completions);
+        this->in_flight -= ready.size();
+    }
+    for (auto &completion : ready) {
+        completion.done(completion.error);
+    }
+}
+
+size_t FsExecutor::pending() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->in_flight;
+}
+
+void FsExecutor::workerLoop() {
+    while (true) {
+        Work task;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->cv.wait(lock, [this]() { return this->stopping || !this->tasks.empty(); });
+            if (this->stopping && this->tasks.empty()) {
+                return;
+            }
+            task = std::move(this->tasks.front());
+            this->tasks.pop_front();
+        }
+        task();
+    }
+}
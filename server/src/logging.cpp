@@ -0,0 +1,73 @@
+#include "logging.hpp"
+
+#include <algorithm>
+#include <memory>
+
+#include <spdlog/async.h>
+#include <spdlog/sinks/basic_file_sink.h>
+
+namespace logging {
+
+namespace {
+
+std::unique_ptr<RateLimiter> messages;
+std::unique_ptr<RateLimiter> errors;
+
+} // namespace
+
+void init(const ServerConfig &config) {
+    // single background worker drains a bounded ring buffer; when full the oldest entries are overwritten
+    spdlog::init_thread_pool(config.log_queue_size, 1);
+    auto sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(config.log_file);
+    auto logger = std::make_shared<spdlog::async_logger>("server", sink, spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest);
+    logger->set_level(spdlog::level::from_str(config.log_level));
+    logger->set_pattern("%Y-%m-%dT%H:%M:%S.%e %l %v");
+    logger->flush_on(spdlog::level::err);
+    spdlog::set_default_logger(logger);
+    spdlog::flush_every(std::chrono::seconds(1));
+
+    messages = std::make_unique<RateLimiter>(config.log_rate_limit, config.log_sample_every);
+    errors = std::make_unique<RateLimiter>(config.log_rate_limit, 1);
+}
+
+void shutdown() {
+    spdlog::shutdown();
+}
+
+RateLimiter::RateLimiter(const unsigned &per_second, const unsigned &sample_every) : tokens(per_second), rate(per_second), sample_every(std::max(1u, sample_every)), last(std::chrono::steady_clock::now()) {}
+
+bool RateLimiter::allow() {
+    // sampling: only every n-th event is a candidate
+    if (this->seen++ % this->sample_every != 0) {
+        this->dropped++;
+        return false;
+    }
+
+    // rate limiting: refill tokens, one token per line
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - this->last).count();
+    this->last = now;
+    this->tokens = std::min(this->rate, this->tokens + elapsed * this->rate);
+    if (this->tokens < 1.0) {
+        this->dropped++;
+        return false;
+    }
+    this->tokens -= 1.0;
+    return true;
+}
+
+RateLimiter &message_limiter() {
+    if (!messages) {
+        messages = std::make_unique<RateLimiter>(1000, 1);
+    }
+    return *messages;
+}
+
+RateLimiter &error_limiter() {
+    if (!errors) {
+        errors = std::make_unique<RateLimiter>(1000, 1);
+    }
+    return *errors;
+}
+
+} // namespace logging
@@ -1,10 +1,36 @@
+#include <charconv>
+#include <cmath>
 #include <iostream>
 #include <string>
 #include <cstdint>
+#include <stdexcept>
+#include <utility>
 
 #include "minidrive/version.hpp"
 #include "simple_server.hpp"
 
+// "64K", "10M", "1G" -> bytes
+static std::uint64_t parse_bytes(const std::string &s) {
+    size_t pos = 0;
+    double value = std::stod(s, &pos);
+    std::string unit = s.substr(pos);
+    if (unit == "K") value *= 1024.0;
+    else if (unit == "M") value *= 1024.0 * 1024.0;
+    else if (unit == "G") value *= 1024.0 * 1024.0 * 1024.0;
+    else if (!unit.empty()) throw std::runtime_error("invalid_size: Unknown unit in " + s);
+    return static_cast<std::uint64_t>(value);
+}
+
+// "<user>=<value>" with "-" standing for public mode
+static std::pair<std::string, std::string> parse_user_value(const std::string &s) {
+    size_t eq = s.find('=');
+    if (eq == std::string::npos) {
+        throw std::runtime_error("invalid_argument: Expected <user>=<value>, got " + s);
+    }
+    std::string user = s.substr(0, eq);
+    return {user == "-" ? "" : user, s.substr(eq + 1)};
+}
+
 int main(int argc, char* argv[]) {
     // Echo full command line once for diagnostics
     std::cout << "[cmd]";
@@ -12,27 +38,108 @@ int main(int argc, char* argv[]) {
         std::cout << " \"" << argv[i] << '"';
     }
     std::cout << std::endl;
-    std::uint16_t port = 9000; // default
-    std::string root = "";
-    std::string log_file = "log.txt";
+    ServerConfig config;
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "--port" && i + 1 < argc) {
-            port = static_cast<std::uint16_t>(std::stoi(argv[++i]));
-        } else if (arg.starts_with("--root")) {
-            root = std::string(argv[++i]);
-        } else if (arg.starts_with("--log")) {
-            log_file = std::string(argv[++i]);
+            config.port = static_cast<std::uint16_t>(std::stoi(argv[++i]));
+        } else if (arg == "--root" && i + 1 < argc) {
+            config.root = std::string(argv[++i]);
+        } else if (arg == "--log" && i + 1 < argc) {
+            config.log_file = std::string(argv[++i]);
+        } else if (arg == "--log-level" && i + 1 < argc) {
+            config.log_level = std::string(argv[++i]);
+            // spdlog turns any name it does not know into "off", which would silently disable logging
+            const std::string &level = config.log_level;
+            if (level != "trace" && level != "debug" && level != "info" && level != "warn" && level != "err" && level != "critical" && level != "off") {
+                std::cerr << "Error: --log-level expects trace|debug|info|warn|err|critical|off" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--log-queue" && i + 1 < argc) {
+            config.log_queue_size = std::stoull(argv[++i]);
+        } else if (arg == "--log-sample" && i + 1 < argc) {
+            config.log_sample_every = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else if (arg == "--log-rate" && i + 1 < argc) {
+            config.log_rate_limit = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else if (arg == "--trace-dir" && i + 1 < argc) {
+            config.trace_dir = std::string(argv[++i]);
+        } else if (arg == "--trace-user" && i + 1 < argc) {
+            config.trace_users.insert(argv[++i]);
+        } else if (arg == "--trace-sample" && i + 1 < argc) {
+            // same rules as TRACE SAMPLE: std::stod would accept "nan", "inf" and trailing junk
+            const std::string rate = argv[++i];
+            const auto [end, ec] = std::from_chars(rate.data(), rate.data() + rate.size(), config.trace_sample_rate);
+            if (ec != std::errc() || end != rate.data() + rate.size() || !std::isfinite(config.trace_sample_rate)
+                || config.trace_sample_rate < 0.0 || config.trace_sample_rate > 1.0) {
+                std::cerr << "Error: --trace-sample expects a rate between 0 and 1" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--fs-threads" && i + 1 < argc) {
+            config.fs_threads = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--file-cache-files" && i + 1 < argc) {
+            config.file_cache_files = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--file-cache" && i + 1 < argc) {
+            config.file_cache_bytes = parse_bytes(argv[++i]);
+        } else if (arg == "--readahead" && i + 1 < argc) {
+            config.readahead_bytes = static_cast<size_t>(parse_bytes(argv[++i]));
+        } else if (arg == "--drop-behind" && i + 1 < argc) {
+            config.drop_behind_bytes = parse_bytes(argv[++i]);
+        } else if (arg == "--direct-upload" && i + 1 < argc) {
+            config.direct_upload_bytes = parse_bytes(argv[++i]);
+        } else if (arg == "--durability" && i + 1 < argc) {
+            config.durability = std::string(argv[++i]);
+            if (config.durability != "none" && config.durability != "on-complete" && config.durability != "strict") {
+                std::cerr << "Error: --durability expects none|on-complete|strict" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--record-dir" && i + 1 < argc) {
+            config.record_dir = std::string(argv[++i]);
+        } else if (arg == "--user-rate" && i + 1 < argc) {
+            auto [user, rate] = parse_user_value(argv[++i]);
+            config.user_rate_limits[user] = parse_bytes(rate);
+        } else if (arg == "--default-user-rate" && i + 1 < argc) {
+            config.default_user_rate = parse_bytes(argv[++i]);
+        } else if (arg == "--quota" && i + 1 < argc) {
+            auto [user, quota] = parse_user_value(argv[++i]);
+            config.user_quotas[user] = parse_bytes(quota);
+        } else if (arg == "--default-quota" && i + 1 < argc) {
+            config.default_user_quota = parse_bytes(argv[++i]);
+        } else if (arg == "--user-class" && i + 1 < argc) {
+            auto [user, cls] = parse_user_value(argv[++i]);
+            if (cls != "interactive" && cls != "bulk") {
+                std::cerr << "Error: --user-class expects <user>=interactive|bulk" << std::endl;
+                return 1;
+            }
+            config.user_classes[user] = cls;
+        } else if (arg == "--interactive-max" && i + 1 < argc) {
+            config.interactive_max_bytes = parse_bytes(argv[++i]);
+        } else if (arg == "--interactive-weight" && i + 1 < argc) {
+            config.interactive_weight = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else if (arg == "--sched-quantum" && i + 1 < argc) {
+            config.sched_quantum = parse_bytes(argv[++i]);
+        } else if (arg == "--sched-max-chunks" && i + 1 < argc) {
+            config.sched_max_chunks_per_flow = std::stoull(argv[++i]);
+        } else if (arg == "--admin" && i + 1 < argc) {
+            config.admin_users.insert(argv[++i]);
+        } else if (arg == "--stats-file" && i + 1 < argc) {
+            config.stats_file = std::string(argv[++i]);
+        } else if (arg == "--stats-interval" && i + 1 < argc) {
+            config.stats_interval_seconds = static_cast<unsigned>(std::stoul(argv[++i]));
+            // the interval also bounds the select() wait, so 0 would spin the reactor
+            if (config.stats_interval_seconds == 0) {
+                std::cerr << "Error: --stats-interval expects at least 1 second" << std::endl;
+                return 1;
+            }
         }
     }
 
-    if (root.empty()) {
+    if (config.root.empty()) {
         std::cerr << "Error: --root <path> argument is required" << std::endl;
         return 1;
     }
 
-    std::cout << "Starting simple server (version " << minidrive::version() << ") on port " << port << std::endl;
-    start_simple_server(port, root, log_file);
+    std::cout << "Starting simple server (version " << minidrive::version() << ") on port " << config.port << std::endl;
+    start_simple_server(config);
     std::cout << "Server exited." << std::endl;
     return 0;
 }
@@ -0,0 +1,219 @@
+#include "metrics.hpp"
+#include "minidrive/buffer_pool.hpp"
+#include "minidrive/lock_table.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace metrics {
+
+namespace {
+
+std::mutex shards_mutex;
+std::vector<std::unique_ptr<Shard>> shards;
+std::array<std::atomic<std::int64_t>, GAUGE_COUNT> gauges{};
+
+const char *const COMMAND_NAMES[COMMAND_COUNT] = {
+    "AUTH", "LIST", "DELETE", "CD", "MKDIR", "RMDIR", "MOVE", "COPY", "EXIT",
+    "UPLOAD", "DOWNLOAD", "RESUME", "STATS", "TRACE", "DU", "BATCH", "UPLOAD_PACK", "DOWNLOAD_PACK", "UPLOAD_PIPELINED", "WATCH", "UNWATCH", "UPLOAD_CHUNK", "DOWNLOAD_CHUNK", "UNKNOWN",
+};
+
+const char *const GAUGE_NAMES[GAUGE_COUNT] = {
+    "active_sessions", "open_uploads", "open_downloads", "ready_fds", "pending_closes", "throttled_flows", "fs_pending", "watches",
+    "cached_files", "cached_bytes", "sync_queued",
+};
+
+// merged view over all shards
+struct Snapshot {
+    std::array<std::array<std::uint64_t, Histogram::BUCKETS>, COMMAND_COUNT> buckets{};
+    std::array<std::uint64_t, COMMAND_COUNT> count{};
+    std::array<std::uint64_t, COMMAND_COUNT> sum_ns{};
+    std::array<std::uint64_t, COMMAND_COUNT> errors{};
+    std::uint64_t bytes_in = 0;
+    std::uint64_t bytes_out = 0;
+};
+
+Snapshot snapshot() {
+    Snapshot s;
+    std::lock_guard<std::mutex> lock(shards_mutex);
+    for (const auto &shard : shards) {
+        for (size_t c = 0; c < COMMAND_COUNT; ++c) {
+            const Histogram &h = shard->latency[c];
+            for (size_t b = 0; b < Histogram::BUCKETS; ++b) {
+                std::uint64_t n = h.counts[b].load(std::memory_order_relaxed);
+                s.buckets[c][b] += n;
+                s.count[c] += n;
+            }
+            s.sum_ns[c] += h.sum_ns.load(std::memory_order_relaxed);
+            s.errors[c] += shard->errors[c].load(std::memory_order_relaxed);
+        }
+        s.bytes_in += shard->bytes_in.load(std::memory_order_relaxed);
+        s.bytes_out += shard->bytes_out.load(std::memory_order_relaxed);
+    }
+    return s;
+}
+
+std::uint64_t quantile_ns(const std::array<std::uint64_t, Histogram::BUCKETS> &buckets, const std::uint64_t &count, const double &q) {
+    if (count == 0) {
+        return 0;
+    }
+    std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(count))));
+    std::uint64_t seen = 0;
+    for (size_t b = 0; b < Histogram::BUCKETS; ++b) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            return Histogram::upperBound(b);
+        }
+    }
+    return Histogram::upperBound(Histogram::BUCKETS - 1);
+}
+
+} // namespace
+
+std::uint64_t Histogram::upperBound(const size_t &bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    const size_t exp = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    const std::uint64_t sub = bucket % SUB_BUCKETS;
+    const std::uint64_t upper = ((SUB_BUCKETS + sub + 1) << (exp - SUB_BITS)) - 1;
+    return upper;
+}
+
+const char *command_name(const Command &cmd) {
+    return COMMAND_NAMES[static_cast<size_t>(cmd)];
+}
+
+Shard *register_shard() {
+    std::lock_guard<std::mutex> lock(shards_mutex);
+    shards.push_back(std::make_unique<Shard>());
+    return shards.back().get();
+}
+
+std::atomic<std::int64_t> &gauge(const Gauge &g) {
+    return gauges[static_cast<size_t>(g)];
+}
+
+std::string render_stats() {
+    Snapshot s = snapshot();
+    std::ostringstream out;
+    for (size_t g = 0; g < GAUGE_COUNT; ++g) {
+        out << GAUGE_NAMES[g] << " " << gauges[g].load(std::memory_order_relaxed) << "\n";
+    }
+    out << "bytes_in " << s.bytes_in << "\n";
+    out << "bytes_out " << s.bytes_out << "\n";
+    out << std::left << std::setw(16) << "command" << std::right
+        << std::setw(10) << "count" << std::setw(8) << "errors"
+        << std::setw(12) << "p50_us" << std::setw(12) << "p99_us" << std::setw(12) << "p999_us";
+    for (size_t c = 0; c < COMMAND_COUNT; ++c) {
+        if (s.count[c] == 0 && s.errors[c] == 0) {
+            continue;
+        }
+        out << "\n" << std::left << std::setw(16) << COMMAND_NAMES[c] << std::right
+            << std::setw(10) << s.count[c] << std::setw(8) << s.errors[c] << std::fixed << std::setprecision(1)
+            << std::setw(12) << static_cast<double>(quantile_ns(s.buckets[c], s.count[c], 0.50)) / 1e3
+            << std::setw(12) << static_cast<double>(quantile_ns(s.buckets[c], s.count[c], 0.99)) / 1e3
+            << std::setw(12) << static_cast<double>(quantile_ns(s.buckets[c], s.count[c], 0.999)) / 1e3;
+    }
+    out << "\n" << BufferPool::global().render();
+    out << "\n" << LockTable::global().render();
+    return out.str();
+}
+
+std::string render_prometheus() {
+    // coarse cumulative buckets derived from the fine-grained histogram
+    static const std::uint64_t LE_NS[] = {1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000, 10000000000};
+
+    Snapshot s = snapshot();
+    std::ostringstream out;
+
+    out << "# HELP minidrive_command_duration_seconds Time spent handling each command.\n";
+    out << "# TYPE minidrive_command_duration_seconds histogram\n";
+    for (size_t c = 0; c < COMMAND_COUNT; ++c) {
+        std::uint64_t cumulative = 0;
+        size_t b = 0;
+        for (std::uint64_t le : LE_NS) {
+            while (b < Histogram::BUCKETS && Histogram::upperBound(b) <= le) {
+                cumulative += s.buckets[c][b++];
+            }
+            out << "minidrive_command_duration_seconds_bucket{command=\"" << COMMAND_NAMES[c] << "\",le=\"" << static_cast<double>(le) / 1e9 << "\"} " << cumulative << "\n";
+        }
+        out << "minidrive_command_duration_seconds_bucket{command=\"" << COMMAND_NAMES[c] << "\",le=\"+Inf\"} " << s.count[c] << "\n";
+        out << "minidrive_command_duration_seconds_sum{command=\"" << COMMAND_NAMES[c] << "\"} " << static_cast<double>(s.sum_ns[c]) / 1e9 << "\n";
+        out << "minidrive_command_duration_seconds_count{command=\"" << COMMAND_NAMES[c] << "\"} " << s.count[c] << "\n";
+    }
+
+    out << "# HELP minidrive_command_errors_total Commands that ended with an ERROR response.\n";
+    out << "# TYPE minidrive_command_errors_total counter\n";
+    for (size_t c = 0; c < COMMAND_COUNT; ++c) {
+        out << "minidrive_command_errors_total{command=\"" << COMMAND_NAMES[c] << "\"} " << s.errors[c] << "\n";
+    }
+
+    out << "# TYPE minidrive_bytes_received_total counter\n";
+    out << "minidrive_bytes_received_total " << s.bytes_in << "\n";
+    out << "# TYPE minidrive_bytes_sent_total counter\n";
+    out << "minidrive_bytes_sent_total " << s.bytes_out << "\n";
+
+    const auto pool = BufferPool::global().stats();
+    out << "# HELP minidrive_buffer_acquires_total Transfer buffers handed out per size class.\n";
+    out << "# TYPE minidrive_buffer_acquires_total counter\n";
+    for (const auto &c : pool) {
+        out << "minidrive_buffer_acquires_total{size=\"" << c.size << "\"} " << c.acquires << "\n";
+    }
+    out << "# HELP minidrive_buffer_hits_total Transfer buffers reused from the pool cache.\n";
+    out << "# TYPE minidrive_buffer_hits_total counter\n";
+    for (const auto &c : pool) {
+        out << "minidrive_buffer_hits_total{size=\"" << c.size << "\"} " << c.hits << "\n";
+    }
+    out << "# TYPE minidrive_buffers_in_use gauge\n";
+    for (const auto &c : pool) {
+        out << "minidrive_buffers_in_use{size=\"" << c.size << "\"} " << c.in_use << "\n";
+    }
+    out << "# TYPE minidrive_buffers_cached gauge\n";
+    for (const auto &c : pool) {
+        out << "minidrive_buffers_cached{size=\"" << c.size << "\"} " << c.cached << "\n";
+    }
+
+    const LockTable::Stats locks = LockTable::global().stats();
+    out << "# HELP minidrive_locks_granted_total File locks granted between sessions.\n";
+    out << "# TYPE minidrive_locks_granted_total counter\n";
+    out << "minidrive_locks_granted_total{mode=\"shared\"} " << locks.shared << "\n";
+    out << "minidrive_locks_granted_total{mode=\"exclusive\"} " << locks.exclusive << "\n";
+    out << "# HELP minidrive_lock_conflicts_total Commands refused because another session held the file.\n";
+    out << "# TYPE minidrive_lock_conflicts_total counter\n";
+    out << "minidrive_lock_conflicts_total " << locks.conflicts << "\n";
+    out << "# HELP minidrive_lock_shard_contended_total Lock table shard mutex found busy.\n";
+    out << "# TYPE minidrive_lock_shard_contended_total counter\n";
+    out << "minidrive_lock_shard_contended_total " << locks.shard_contended << "\n";
+    out << "# TYPE minidrive_locks_held gauge\n";
+    out << "minidrive_locks_held " << locks.held << "\n";
+
+    for (size_t g = 0; g < GAUGE_COUNT; ++g) {
+        out << "# TYPE minidrive_" << GAUGE_NAMES[g] << " gauge\n";
+        out << "minidrive_" << GAUGE_NAMES[g] << " " << gauges[g].load(std::memory_order_relaxed) << "\n";
+    }
+    return out.str();
+}
+
+void write_prometheus(const std::string &path) {
+    // write next to the target and rename so scrapers never see a partial file
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("file_open_failed: Failed to open stats file for writing (path: " + tmp + ")");
+        }
+        out << render_prometheus();
+    }
+    std::filesystem::rename(tmp, path);
+}
+
+} // namespace metrics
@@ -0,0 +1,151 @@
+#include "scheduler.hpp"
+#include "minidrive/helpers.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+constexpr double BURST_SECONDS = 0.25; // token bucket depth relative to the rate
+constexpr std::int64_t UNIT = static_cast<std::int64_t>(TMP_BUFF_SIZE); // grant granularity
+
+size_t index(const TransferScheduler::Direction &d) {
+    return d == TransferScheduler::Direction::Upload ? 0 : 1;
+}
+
+size_t index(const TransferScheduler::Priority &p) {
+    return p == TransferScheduler::Priority::Interactive ? 0 : 1;
+}
+
+} // namespace
+
+TransferScheduler::TransferScheduler(const ServerConfig &config) : config(config) {}
+
+TransferScheduler::UserState &TransferScheduler::state(const std::string &user) {
+    auto it = this->users.find(user);
+    if (it != this->users.end()) {
+        return it->second;
+    }
+
+    UserState &s = this->users[user];
+    auto rate = this->config.user_rate_limits.find(user);
+    double r = static_cast<double>(rate != this->config.user_rate_limits.end() ? rate->second : this->config.default_user_rate);
+    for (auto &bucket : s.buckets) {
+        bucket.rate = r;
+        bucket.tokens = std::max(r * BURST_SECONDS, 2.0 * TMP_BUFF_SIZE);
+    }
+    return s;
+}
+
+void TransferScheduler::refill(Bucket &bucket, const Clock::time_point &now) const {
+    if (bucket.rate <= 0.0) {
+        return;
+    }
+    const double capacity = std::max(bucket.rate * BURST_SECONDS, 2.0 * TMP_BUFF_SIZE);
+    const double elapsed = std::chrono::duration<double>(now - bucket.last).count();
+    bucket.tokens = std::min(capacity, bucket.tokens + elapsed * bucket.rate);
+    bucket.last = now;
+}
+
+TransferScheduler::Priority TransferScheduler::priorityOf(const std::string &user, const size_t &total_bytes) const {
+    auto it = this->config.user_classes.find(user);
+    if (it != this->config.user_classes.end()) {
+        return it->second == "interactive" ? Priority::Interactive : Priority::Bulk;
+    }
+    return total_bytes <= this->config.interactive_max_bytes ? Priority::Interactive : Priority::Bulk;
+}
+
+bool TransferScheduler::eligible(const std::string &user, const Direction &direction, const Clock::time_point &now) {
+    Bucket &bucket = this->state(user).buckets[index(direction)];
+    if (bucket.rate <= 0.0) {
+        return true;
+    }
+    this->refill(bucket, now);
+    if (bucket.tokens > 0.0) {
+        return true;
+    }
+
+    // wake up once the bucket is positive again
+    auto wait = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((1.0 - bucket.tokens) / bucket.rate));
+    this->next_wake = std::min(this->next_wake, now + wait);
+    return false;
+}
+
+std::vector<TransferScheduler::Grant> TransferScheduler::schedule(const std::vector<Flow> &flows, const Clock::time_point &now) {
+    std::vector<Grant> grants;
+    grants.reserve(flows.size());
+
+    // group ready flows by direction, user and priority class, keeping arrival order
+    std::unordered_map<std::string, std::array<std::vector<size_t>, 2>> by_user[2];
+    for (size_t i = 0; i < flows.size(); ++i) {
+        by_user[index(flows[i].direction)][flows[i].user][index(this->priorityOf(flows[i].user, flows[i].total_bytes))].push_back(i);
+    }
+
+    const size_t max_per_flow = std::max<size_t>(1, this->config.sched_max_chunks_per_flow) * TMP_BUFF_SIZE;
+    for (size_t d = 0; d < 2; ++d) {
+        // classes without ready flows lose their credit (classic DRR) but keep any debt
+        for (auto &[user, s] : this->users) {
+            const auto ready = by_user[d].find(user);
+            for (size_t c = 0; c < 2; ++c) {
+                if (ready == by_user[d].end() || ready->second[c].empty()) {
+                    s.deficit[d][c] = std::min<std::int64_t>(s.deficit[d][c], 0);
+                }
+            }
+        }
+
+        for (auto &[user, classes] : by_user[d]) {
+            UserState &s = this->state(user);
+            Bucket &bucket = s.buckets[d];
+            this->refill(bucket, now);
+            double tokens = bucket.rate > 0.0 ? bucket.tokens : INFINITY;
+
+            // each active class of each user earns a quantum per round, interactive ones weight times
+            // more; interactive goes first, so it is served before bulk when the token bucket runs dry
+            for (size_t c = 0; c < 2; ++c) {
+                const std::vector<size_t> &indices = classes[c];
+                if (indices.empty()) {
+                    continue;
+                }
+                std::int64_t &deficit = s.deficit[d][c];
+                const std::int64_t quantum = static_cast<std::int64_t>(std::max(this->config.sched_quantum, TMP_BUFF_SIZE) * (c == 0 ? std::max(1u, this->config.interactive_weight) : 1u));
+                deficit = std::min(deficit + quantum, 2 * quantum);
+
+                // hand out chunks round robin across the class's sessions while deficit and tokens last
+                std::vector<size_t> granted(indices.size(), 0);
+                size_t start = s.next_flow[d][c] % indices.size();
+                bool progress = true;
+                while (progress && deficit >= UNIT && tokens > 0.0) {
+                    progress = false;
+                    for (size_t k = 0; k < indices.size() && deficit >= UNIT && tokens > 0.0; ++k) {
+                        size_t j = (start + k) % indices.size();
+                        if (granted[j] + TMP_BUFF_SIZE > max_per_flow) {
+                            continue;
+                        }
+                        granted[j] += TMP_BUFF_SIZE;
+                        deficit -= UNIT;
+                        tokens -= static_cast<double>(TMP_BUFF_SIZE);
+                        progress = true;
+                    }
+                }
+                s.next_flow[d][c] = start + 1;
+
+                for (size_t j = 0; j < indices.size(); ++j) {
+                    if (granted[j] > 0) {
+                        grants.push_back({flows[indices[j]].fd, granted[j]});
+                    }
+                }
+            }
+        }
+    }
+    return grants;
+}
+
+void TransferScheduler::complete(const Flow &flow, const size_t &granted, const size_t &moved) {
+    UserState &s = this->state(flow.user);
+    const size_t d = index(flow.direction);
+    s.deficit[d][index(this->priorityOf(flow.user, flow.total_bytes))] += static_cast<std::int64_t>(granted) - static_cast<std::int64_t>(moved);
+    if (s.buckets[d].rate > 0.0) {
+        s.buckets[d].tokens -= static_cast<double>(moved);
+    }
+}
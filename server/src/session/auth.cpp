@@ -6,14 +6,27 @@ void Session::auth(const std::string &username) {
     if (this->auth_initiated) {
         throw std::runtime_error("permission_denied: Unable to re-authenticate");
     }
+    if (!username.empty() && !valid_username(username)) {
+        throw std::runtime_error("invalid_argument: Usernames cannot start with '.' or contain '/'");
+    }
     this->auth_initiated = true;
 
     // set username
     this->client_username = username;
+
+    // sampled once per login; the auth spans below are only kept if the login succeeds
+    if (tracing::should_trace(username)) {
+        this->session_trace.hold();
+    }
     
     if (!username.empty()) {
         // non-existent user -> prompt for registration
-        if (!exists_user(username, this->root)) {
+        bool exists = false;
+        {
+            tracing::Span span(this->session_trace, "exists_user", "auth");
+            exists = exists_user(username, this->root);
+        }
+        if (!exists) {
             this->send("User " + username + " not found. Register? (y/n)");
             this->state = State::AwaitingRegistrationChoice; // implement register()
             
@@ -25,10 +38,17 @@ void Session::auth(const std::string &username) {
         
         // no username -> public mode
     } else {
+        this->startTracing();
+        this->startRecording(username);
         this->resumeUpload();
     }
 }
 
+// only sessions that got in are traced; the name is the one that authenticated
+void Session::startTracing() {
+    this->session_trace.start(this->client_fd, this->client_username);
+}
+
 void Session::processRegisterChoice(std::string choice) {
     if (choice == "y") { // yes -> ask for password
         this->send("Password for " + this->client_username + ":");
@@ -40,16 +60,29 @@ void Session::processRegisterChoice(std::string choice) {
 
 void Session::registerUser(std::string password) {
     // register user
-    register_user(this->client_username, password, this->root);
+    {
+        tracing::Span span(this->session_trace, "register_user", "auth");
+        register_user(this->client_username, password, this->root);
+    }
+    this->session_trace.discard(); // registering does not log in, the session ends here
     this->send("User " + this->client_username + " registered successfully.");
     this->exit();
 }
 
 void Session::authenticateUser(std::string password) {
     // authenticate user
-    if (authenticate_user(this->client_username, password, this->root)) {
+    bool ok = false;
+    {
+        tracing::Span span(this->session_trace, "authenticate_user", "auth");
+        ok = authenticate_user(this->client_username, password, this->root);
+    }
+    if (ok) {
+        this->authenticated = true;
+        this->startTracing();
+        this->startRecording(this->client_username);
         this->send("Logged as " + this->client_username + ".");
     } else {
+        this->session_trace.discard();
         this->send("Authentication failed: Incorrect password.");
     }
     this->client_directory = this->root + "/" + this->client_username;
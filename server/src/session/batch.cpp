@@ -0,0 +1,316 @@
+#include "session.hpp"
+#include "fs_copy.hpp"
+#include "dir_generations.hpp"
+#include "logging.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr const char *KEPT_PREFIX = "kept-"; // staged data a failed rollback could not put back
+
+struct BatchOp {
+    commands::Opcode opcode;
+    std::string line;   // as sent, for error messages
+    std::string source; // full paths
+    std::string destination;
+};
+
+// undoes create_directories(leaf) that created `top` and everything below it, but only as far as the
+// directories are still empty: other sessions may have written into them since, unlocked
+void remove_empty_dirs(const std::filesystem::path &leaf, const std::filesystem::path &top) {
+    for (std::filesystem::path dir = leaf; !dir.empty(); dir = dir.parent_path()) {
+        std::error_code ec;
+        std::filesystem::remove(dir, ec); // fails on a non-empty directory, a missing one is fine
+        if (ec || dir == top) {
+            return;
+        }
+    }
+}
+
+// undo steps run after the operations' locks are gone, so another session may have created the
+// path meanwhile: refuse rather than replace what it wrote
+void restore(const std::string &from, const std::string &to) {
+    if (::renameat2(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(), RENAME_NOREPLACE) == 0) {
+        return;
+    }
+    if (errno == EINVAL || errno == ENOSYS) {
+        // filesystems without RENAME_NOREPLACE: check first, leaving a small window
+        if (std::filesystem::exists(std::filesystem::symlink_status(to))) {
+            errno = EEXIST;
+        } else {
+            std::filesystem::rename(from, to);
+            return;
+        }
+    }
+    if (errno == EEXIST || errno == ENOTEMPTY) {
+        throw std::runtime_error("path_exists: Cannot put back " + to + ", it has been created again since");
+    }
+    throw std::runtime_error("rollback_failed: Cannot put back " + to + " (" + std::strerror(errno) + ")");
+}
+
+} // namespace
+
+void Session::sweepBatchStaging(const std::string &root) {
+    // what ATOMIC batches parked when the server stopped mid-batch. Such a batch never replied, but its
+    // other operations may have run and stay done, so its deletions stay done as well: the parked
+    // data is discarded rather than put back (it was forgotten by the usage totals when parked).
+    // What a failed rollback kept was reported to its user and is charged again, so it stays.
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    for (const auto &user_dir : fs::directory_iterator(root, ec)) {
+        const fs::path staging = user_dir.path() / usage::BATCH_STAGING;
+        if (!fs::is_directory(fs::symlink_status(staging, ec))) {
+            continue;
+        }
+        for (const auto &batch : fs::directory_iterator(staging, ec)) {
+            if (batch.path().filename().string().starts_with(KEPT_PREFIX)) {
+                spdlog::info("batch staging kept path={}", batch.path().string());
+                continue;
+            }
+            std::error_code remove_ec;
+            const std::uintmax_t removed = fs::remove_all(batch.path(), remove_ec);
+            if (remove_ec) {
+                spdlog::warn("batch staging sweep failed path={} error=\"{}\"", batch.path().string(), remove_ec.message());
+            } else {
+                spdlog::info("batch staging swept path={} entries={}", batch.path().string(), removed);
+            }
+        }
+        fs::remove(staging, ec); // only if nothing was kept
+    }
+}
+
+void Session::batch(const std::string &mode, const std::string_view &body) {
+    if (!mode.empty() && mode != "ATOMIC") {
+        throw std::runtime_error("invalid_argument: Usage: BATCH [ATOMIC], followed by one MKDIR, DELETE, RMDIR, MOVE or COPY per line");
+    }
+    const bool atomic = mode == "ATOMIC";
+
+    // parse and resolve every line against the working directory before anything runs
+    std::vector<BatchOp> ops;
+    size_t start = 0;
+    while (start < body.size()) {
+        const size_t end = std::min(body.find('\n', start), body.size());
+        const std::string_view line = body.substr(start, end - start);
+        start = end + 1;
+        if (line.empty()) {
+            continue;
+        }
+        Tokens parts;
+        const size_t count = tokenize(line, parts);
+        const commands::Spec *spec = commands::lookup(parts[0]);
+        using commands::Opcode;
+        if (spec == nullptr || (spec->opcode != Opcode::Mkdir && spec->opcode != Opcode::Delete && spec->opcode != Opcode::Rmdir && spec->opcode != Opcode::Move && spec->opcode != Opcode::Copy)) {
+            throw std::runtime_error("invalid_argument: BATCH line " + std::to_string(ops.size() + 1) + " is not MKDIR, DELETE, RMDIR, MOVE or COPY: " + std::string(line));
+        }
+        if (count - 1 != spec->max_args || parts[1].empty() || (spec->max_args == 2 && parts[2].empty())) {
+            throw std::runtime_error("invalid_argument: BATCH line " + std::to_string(ops.size() + 1) + ": " + std::string(spec->name) + " takes " + std::to_string(spec->max_args) + " path(s)");
+        }
+        if (ops.size() == MAX_BATCH_OPS) {
+            throw std::runtime_error("invalid_argument: BATCH takes at most " + std::to_string(MAX_BATCH_OPS) + " operations");
+        }
+        ops.push_back({spec->opcode, std::string(line), this->path(std::string(parts[1])), spec->max_args == 2 ? this->path(std::string(parts[2])) : ""});
+    }
+    if (ops.empty()) {
+        throw std::runtime_error("invalid_argument: BATCH has no operations");
+    }
+
+    // all of it runs on the filesystem executor, one reply for the whole batch. In ATOMIC mode every
+    // completed operation leaves an undo step; DELETE and RMDIR only rename into a staging directory
+    // in the user's own directory (same filesystem, so renames are atomic) until the batch commits.
+    // Locks are taken per operation, as for the single commands, so the batch is all-or-nothing but
+    // not isolated from other sessions.
+    static std::atomic<std::uint64_t> batch_ids{0};
+    const std::string batch_id = std::to_string(::getpid()) + "-" + std::to_string(batch_ids.fetch_add(1));
+    const std::string staging_root = this->client_directory + "/" + usage::BATCH_STAGING;
+    const std::string staging = staging_root + "/" + batch_id;
+    FsExecutor &executor = this->executor;
+    usage::UserUsage &usage = this->usage();
+    this->runAsync([this, ops = std::move(ops), atomic, batch_id, staging_root, staging, &executor, &usage]() {
+        namespace fs = std::filesystem;
+        std::vector<std::function<void()>> undo;
+        std::vector<std::string> results;
+        size_t failed = 0;
+
+        // every path an operation or its undo step may have changed, bumped once the batch is over;
+        // watchers hear of what actually happened, nothing after a rollback
+        struct Touched {
+            std::string path;
+            ChangeFeed::Kind kind;
+            std::string to; // for moves
+        };
+        std::vector<Touched> touched;
+        auto touch = [&touched](const std::string &path, const ChangeFeed::Kind &kind, const std::string &to) {
+            touched.push_back({path, kind, to});
+            if (!path.empty()) {
+                DirGenerations::global().expect(path);
+            }
+            if (!to.empty()) {
+                DirGenerations::global().expect(to);
+            }
+        };
+        auto bump = [&touched](const bool &rolled_back) {
+            DirGenerations &generations = DirGenerations::global();
+            for (const Touched &t : touched) {
+                if (t.path.empty()) {
+                    continue;
+                }
+                const bool exists = fs::exists(t.path);
+                if (t.kind == ChangeFeed::Kind::Moved) {
+                    if (!rolled_back && !exists && fs::exists(t.to)) {
+                        generations.moved(t.path, t.to);
+                    } else {
+                        generations.bump(t.path);
+                        generations.bump(t.to);
+                    }
+                } else if (!rolled_back && exists == (t.kind == ChangeFeed::Kind::Created)) {
+                    generations.changed(t.path, t.kind);
+                } else {
+                    generations.bump(t.path);
+                }
+            }
+        };
+
+        auto run = [&](const BatchOp &op, const size_t &index) {
+            switch (op.opcode) {
+                case commands::Opcode::Mkdir: {
+                    this->refuseReserved(op.source);
+                    this->verifyPath(op.source, VerifyType::None, VerifyExistence::MustNotExist);
+                    const std::string created = first_missing(op.source);
+                    touch(created, ChangeFeed::Kind::Created, "");
+                    fs::create_directories(op.source);
+                    undo.push_back([created, leaf = op.source]() { remove_empty_dirs(leaf, created); });
+                    break;
+                }
+                case commands::Opcode::Delete:
+                case commands::Opcode::Rmdir: {
+                    const bool is_file = op.opcode == commands::Opcode::Delete;
+                    this->verifyPath(op.source, is_file ? VerifyType::File : VerifyType::Directory, VerifyExistence::MustExist);
+                    std::vector<LockTable::Guard> locks = LockTable::global().acquireTree(op.source, LockTable::Mode::Exclusive);
+                    // measured while it is there, forgotten once it is gone (as MOVE and COPY charge)
+                    const usage::Removal removal = usage.measure(op.source);
+                    touch(op.source, ChangeFeed::Kind::Deleted, "");
+                    if (!atomic) {
+                        fs::remove_all(op.source);
+                        usage.forget(removal);
+                        break;
+                    }
+                    const std::string parked = staging + "/" + std::to_string(index);
+                    fs::create_directories(staging);
+                    fs::rename(op.source, parked);
+                    usage.forget(removal);
+                    undo.push_back([parked, source = op.source, &usage]() {
+                        restore(parked, source);
+                        usage.addTree(source);
+                    });
+                    break;
+                }
+                case commands::Opcode::Move: {
+                    this->verifyPath(op.source, VerifyType::None, VerifyExistence::MustExist);
+                    this->refuseReserved(op.destination);
+                    this->verifyPath(op.destination, VerifyType::None, VerifyExistence::MustNotExist);
+                    std::vector<LockTable::Guard> locks = LockTable::global().acquireTree(op.source, LockTable::Mode::Exclusive);
+                    const fs::path parent = fs::path(op.destination).parent_path();
+                    const std::string created = first_missing(parent);
+                    touch(created, ChangeFeed::Kind::Created, "");
+                    touch(op.source, ChangeFeed::Kind::Moved, op.destination);
+                    fs::create_directories(parent);
+                    fs::rename(op.source, op.destination);
+                    usage.moveTree(op.source, op.destination);
+                    undo.push_back([op, created, &usage]() {
+                        restore(op.destination, op.source);
+                        usage.moveTree(op.destination, op.source);
+                        if (!created.empty()) {
+                            remove_empty_dirs(fs::path(op.destination).parent_path(), created);
+                        }
+                    });
+                    break;
+                }
+                case commands::Opcode::Copy: {
+                    this->verifyPath(op.source, VerifyType::None, VerifyExistence::MustExist);
+                    this->refuseReserved(op.destination);
+                    this->verifyPath(op.destination, VerifyType::None, VerifyExistence::MustNotExist);
+                    std::vector<LockTable::Guard> locks = LockTable::global().acquireTree(op.source, LockTable::Mode::Shared);
+                    const usage::Reservation reservation(usage, this->reserveCopy(usage, op.source));
+                    const fs::path parent = fs::path(op.destination).parent_path();
+                    const std::string created = first_missing(parent);
+                    touch(created, ChangeFeed::Kind::Created, "");
+                    touch(op.destination, ChangeFeed::Kind::Created, "");
+                    fs::create_directories(parent);
+                    fscopy::copy(op.source, op.destination, executor);
+                    usage.addTree(op.destination);
+                    undo.push_back([op, created, &usage]() {
+                        usage.removeTree(op.destination);
+                        fs::remove_all(op.destination);
+                        if (!created.empty()) {
+                            remove_empty_dirs(fs::path(op.destination).parent_path(), created);
+                        }
+                    });
+                    break;
+                }
+                default:
+                    throw std::runtime_error("unknown_command: Invalid batch opcode");
+            }
+        };
+
+        for (size_t i = 0; i < ops.size(); ++i) {
+            try {
+                run(ops[i], i);
+                results.push_back("OK");
+            } catch (const std::exception &e) {
+                if (!atomic) {
+                    results.push_back("ERROR " + std::string(e.what()));
+                    failed++;
+                    continue;
+                }
+
+                // put back what already ran, newest first
+                size_t rolled_back = 0;
+                for (auto it = undo.rbegin(); it != undo.rend(); ++it) {
+                    try {
+                        (*it)();
+                        rolled_back++;
+                    } catch (const std::exception &undo_error) {
+                        spdlog::error("batch rollback step failed: {}", undo_error.what());
+                    }
+                }
+
+                // parked data a step could not put back is the only copy left: keep it where the user
+                // can reach it, charged again, instead of deleting it with the staging directory
+                std::string kept;
+                std::error_code ec;
+                if (rolled_back != undo.size() && fs::exists(staging, ec)) {
+                    const std::string kept_path = staging_root + "/" + KEPT_PREFIX + batch_id;
+                    fs::rename(staging, kept_path, ec);
+                    kept = ec ? staging : kept_path;
+                    usage.addTree(kept);
+                    spdlog::error("batch rollback incomplete, parked data kept path={}", kept);
+                } else {
+                    fs::remove_all(staging, ec);
+                }
+                bump(true);
+                usage.save();
+                throw std::runtime_error("batch_aborted: Operation " + std::to_string(i + 1) + " (" + ops[i].line + ") failed with " + e.what() + "; rolled back " +
+                                         std::to_string(rolled_back) + " of " + std::to_string(undo.size()) + " completed operations" +
+                                         (kept.empty() ? "" : "; what could not be put back is kept in " + fs::path(kept).lexically_relative(this->client_directory).generic_string()));
+            }
+        }
+
+        // commit: what DELETE and RMDIR parked is gone for good now
+        std::error_code ec;
+        fs::remove_all(staging, ec);
+        bump(false);
+        usage.save();
+
+        std::string reply = "OK\n" + std::to_string(ops.size() - failed) + " of " + std::to_string(ops.size()) + " operations succeeded";
+        for (const std::string &result : results) {
+            reply += "\n" + result;
+        }
+        return reply;
+    });
+}
@@ -1,4 +1,5 @@
 #include "session.hpp"
+#include "metrics.hpp"
 
 void Session::downloadFile(const std::string &path) {
     if (path.empty()) {
@@ -7,54 +8,121 @@ void Session::downloadFile(const std::string &path) {
     std::string full_path = this->path(path);
     this->verifyPath(full_path, VerifyType::File, VerifyExistence::MustExist);
 
-    // lock the file for download
-    lockFileForDownload(full_path);
+    // switch to DownloadingFile state then announce file info
+    this->startDownload(full_path, 0, StreamHash());
+    this->send("FILEINFO " + full_path + " " + std::to_string(this->download_total_bytes));
+}
 
-    // prepare download state
-    this->download_path = full_path;
-    this->download_total_bytes = static_cast<size_t>(std::filesystem::file_size(full_path));
-    this->download_bytes_sent = 0;
-    this->download_stream.close();
-    this->download_stream.clear();
-    this->download_stream.open(full_path, std::ios::binary);
-    if (!this->download_stream) {
-        unlockFileForDownload(full_path);
-        throw std::runtime_error("file_open_failed: Failed to open file for reading (path: " + full_path + ")");
+void Session::downloadPack(const std::string &path) {
+    if (path.empty()) {
+        throw std::runtime_error("no_path: DOWNLOAD_PACK command requires a path argument");
     }
+    std::string full_path = this->path(path);
+    this->verifyPath(full_path, VerifyType::Directory, VerifyExistence::MustExist);
 
-    // announce file info then switch to DownloadingFile state
-    this->send("FILEINFO " + full_path + " " + std::to_string(this->download_total_bytes));
+    // walking and locking the tree happens on the executor; the stream then goes through the reactor
+    // like any download
+    auto writer = std::make_shared<std::shared_ptr<pack::Writer>>();
+    auto locks = std::make_shared<std::vector<LockTable::Guard>>();
+    this->runAsync([full_path, writer, locks]() {
+        *locks = LockTable::global().acquireTree(full_path, LockTable::Mode::Shared);
+        *writer = std::make_shared<pack::Writer>(full_path);
+        return std::string();
+    }, [this, full_path, writer, locks]() {
+        this->startPackDownload(full_path, *writer, std::move(*locks), StreamHash());
+        this->send("FILEINFO " + full_path + " " + std::to_string(this->download_total_bytes));
+    });
+}
+
+void Session::startPackDownload(const std::string &path, const std::shared_ptr<pack::Writer> &writer, std::vector<LockTable::Guard> locks, const StreamHash &hash) {
+    this->download_path = path;
+    this->download_total_bytes = static_cast<size_t>(writer->size());
+    this->download_bytes_sent = static_cast<size_t>(writer->position());
+    this->download_hash = hash;
+    this->download_file.reset();
+    this->download_pack = writer;
+    this->download_tree_lock = std::move(locks);
+    this->state = State::DownloadingFile;
+    if (this->session_trace.enabled()) {
+        this->last_chunk_end = tracing::Clock::now();
+    }
+}
+
+void Session::startDownload(const std::string &path, const size_t &offset, const StreamHash &hash) {
+    // readers share the file; refused while a session writes, deletes or moves it
+    LockTable::Guard lock = LockTable::global().acquire(path, LockTable::Mode::Shared);
+
+    // prepare download state (a file other sessions are downloading is already open, and a hot one
+    // already in memory)
+    std::shared_ptr<const FileCache::File> file = FileCache::global().open(path);
+    this->download_path = path;
+    this->download_total_bytes = static_cast<size_t>(file->size());
+    this->download_bytes_sent = offset;
+    this->download_hash = hash;
+    this->download_file = std::move(file);
+    this->download_cursor.start(this->download_file->descriptor(), this->download_file->size(), offset);
+
+    this->download_lock = std::move(lock);
     this->state = State::DownloadingFile;
+    if (this->session_trace.enabled()) {
+        this->last_chunk_end = tracing::Clock::now();
+    }
+}
+
+void Session::finishDownload() {
+    this->state = State::AwaitingMessage;
+    this->download_lock.release();
+    this->download_tree_lock.clear();
+    this->download_pack.reset();
+    this->download_file.reset();
+
+    // the client hashed the same bytes on arrival; no second read on either side
+    this->send("OK\n" + digest_line(this->download_hash.hex()));
 }
 
 void Session::downloadFileChunk() {
     if (this->state != State::DownloadingFile) {
         return;
     }
+    metrics::ScopedTimer timer(metrics::Command::DownloadChunk);
 
-    // finished
+    // finished (empty file)
     if (this->download_bytes_sent >= this->download_total_bytes) {
-        this->state = State::AwaitingMessage;
-        unlockFileForDownload(this->download_path);
-        if (this->download_stream.is_open()) {
-            this->download_stream.close();
-        }
+        this->finishDownload();
         return;
     }
 
+    // time since the previous chunk = waiting for the socket to become writable
+    if (this->session_trace.enabled()) {
+        this->session_trace.complete("socket_wait", "download", this->last_chunk_end, tracing::Clock::now());
+    }
+
     // read and send next chunk via helper
     size_t remaining = this->download_total_bytes - this->download_bytes_sent;
-    size_t to_read = std::min(TMP_BUFF_SIZE, remaining);
-    size_t sent = send_file_chunk(this->client_fd, this->download_stream, to_read);
+    size_t to_read = std::min(this->chunk_sizer.next(this->client_fd, ChunkSizer::Direction::Send), remaining);
+    size_t sent = 0;
+    {
+        tracing::Span span(this->session_trace, "send_file_chunk", "download");
+        sent = this->download_pack ? pack::send_pack_chunk(this->client_fd, *this->download_pack, to_read, &this->download_hash)
+                                   : this->download_file->send(this->client_fd, this->download_bytes_sent, to_read, &this->download_hash);
+        span.setBytes(sent);
+    }
+
+    metrics::bytes_out(sent);
+    this->chunk_sizer.observe(this->client_fd, ChunkSizer::Direction::Send, sent);
 
     this->download_bytes_sent += sent;
+    if (!this->download_pack) {
+        // the cache holds one reference; more means other sessions are reading the same pages
+        this->download_cursor.advance(this->download_bytes_sent, this->download_file.use_count() > 2);
+    }
 
-    // if finished, clean up
+    // if finished, clean up and send the digest
     if (this->download_bytes_sent >= this->download_total_bytes) {
-        this->state = State::AwaitingMessage;
-        unlockFileForDownload(this->download_path);
-        if (this->download_stream.is_open()) {
-            this->download_stream.close();
-        }
+        this->finishDownload();
+    }
+
+    if (this->session_trace.enabled()) {
+        this->last_chunk_end = tracing::Clock::now();
     }
 }
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "session.hpp"
+
+#include <charconv>
+#include <spdlog/spdlog.h>
+
+namespace {
+
+// user commands worth replaying; auth dialog, admin and chunk messages are never recorded
+bool to_workload_op(const metrics::Command &cmd, workload::Op &op) {
+    switch (cmd) {
+        case metrics::Command::Auth: op = workload::Op::Auth; return true;
+        case metrics::Command::List: op = workload::Op::List; return true;
+        case metrics::Command::Delete: op = workload::Op::Delete; return true;
+        case metrics::Command::Cd: op = workload::Op::Cd; return true;
+        case metrics::Command::Mkdir: op = workload::Op::Mkdir; return true;
+        case metrics::Command::Rmdir: op = workload::Op::Rmdir; return true;
+        case metrics::Command::Move: op = workload::Op::Move; return true;
+        case metrics::Command::Copy: op = workload::Op::Copy; return true;
+        case metrics::Command::Exit: op = workload::Op::Exit; return true;
+        case metrics::Command::Upload: op = workload::Op::Upload; return true;
+        case metrics::Command::Download: op = workload::Op::Download; return true;
+        case metrics::Command::Du: op = workload::Op::Du; return true;
+        case metrics::Command::Batch: op = workload::Op::Batch; return true;
+        case metrics::Command::UploadPack: op = workload::Op::UploadPack; return true;
+        case metrics::Command::DownloadPack: op = workload::Op::DownloadPack; return true;
+        case metrics::Command::UploadPipelined: op = workload::Op::UploadPipelined; return true;
+        default: return false;
+    }
+}
+
+// the size argument of an upload command, 0 when it is malformed
+std::uint64_t upload_size(const std::string_view &arg) {
+    std::uint64_t size = 0;
+    if (std::from_chars(arg.data(), arg.data() + arg.size(), size).ec != std::errc()) {
+        return 0;
+    }
+    return size;
+}
+
+} // namespace
+
+void Session::startRecording(const std::string &username) {
+    if (this->config.record_dir.empty()) {
+        return;
+    }
+
+    this->record_start = std::chrono::steady_clock::now();
+    const auto start_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    // the file name only gets the sanitized name; the trace header keeps the real one
+    const std::string path = this->config.record_dir + "/session-" + tracing::file_tag(username) + "-fd" + std::to_string(this->client_fd) + "-" + std::to_string(start_us) + workload::EXTENSION;
+    try {
+        std::filesystem::create_directories(this->config.record_dir);
+        this->workload_recorder.open(path, username, static_cast<std::uint64_t>(start_us));
+    } catch (const std::exception &e) {
+        // recording is best effort and must never fail the session
+        spdlog::warn("workload recording disabled fd={} path={} error=\"{}\"", this->client_fd, path, e.what());
+        this->workload_recorder.close();
+    }
+}
+
+void Session::recordCommand(const metrics::Command &cmd, const Tokens &parts, const std::string_view &body, const bool &ok, const std::chrono::nanoseconds &duration) {
+    workload::Record record;
+    if (!to_workload_op(cmd, record.op)) {
+        return;
+    }
+    record.ok = ok;
+    const auto begin = std::chrono::steady_clock::now() - duration;
+    record.offset_us = static_cast<std::uint64_t>(std::max<std::int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(begin - this->record_start).count()));
+    record.duration_us = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+
+    // keep only what the server saw: paths as sent by the client and the transfer size
+    switch (record.op) {
+        case workload::Op::Upload: // UPLOAD <size> <local> <remote>; the local path is client-side only
+        case workload::Op::UploadPipelined:
+            record.args = {std::string(parts[3])};
+            record.bytes = upload_size(parts[1]);
+            break;
+        case workload::Op::UploadPack: { // UPLOAD_PACK <size> <local_dir> [remote_dir]; without one the server names the target after the local directory
+            std::string_view target = parts[3];
+            if (target.empty()) {
+                target = parts[2];
+                while (target.size() > 1 && target.back() == '/') {
+                    target.remove_suffix(1);
+                }
+                target = target.substr(target.find_last_of("/\\") + 1);
+            }
+            record.args = {std::string(target)};
+            record.bytes = upload_size(parts[1]);
+            break;
+        }
+        case workload::Op::Download:
+            record.args = {std::string(parts[1])};
+            record.bytes = ok ? this->download_total_bytes : 0;
+            break;
+        case workload::Op::DownloadPack: // stream size and file count, so a replay can recreate a missing source
+            record.args = {std::string(parts[1]), std::to_string(ok && this->download_pack ? this->download_pack->files() : 0)};
+            record.bytes = ok ? this->download_total_bytes : 0;
+            break;
+        case workload::Op::Batch: // BATCH [ATOMIC] and its operation lines
+            record.args = {std::string(parts[1]), std::string(body)};
+            break;
+        case workload::Op::Move:
+        case workload::Op::Copy:
+            record.args = {std::string(parts[1]), std::string(parts[2])};
+            break;
+        case workload::Op::Exit:
+            break;
+        default:
+            record.args = {std::string(parts[1])};
+            break;
+    }
+    this->workload_recorder.append(record);
+}
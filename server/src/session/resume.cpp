@@ -1,29 +1,176 @@
 #include "session.hpp"
 
+#include <algorithm>
+
 void Session::resumeUpload() {
-    // check for active transfers to resume
+    tracing::Span span(this->session_trace, "resumeUpload", "auth");
+
+    // offer every pending upload no other session is receiving or resuming right now
     TransferState::clearTransfers(this->getClientDirectory());
-    std::vector<TransferState::Transfer> transfers = TransferState::getActiveTransfers(this->getClientDirectory());
+    this->resume_offer.clear();
+    for (const auto &transfer : TransferState::getActiveTransfers(this->getClientDirectory())) {
+        if (!LockTable::global().isLocked(transfer.remote_path)) {
+            this->resume_offer.push_back(transfer);
+        }
+    }
 
-    if (!transfers.empty()) {
-        this->send("RESUME " + transfers[0].local_path +  " " + transfers[0].remote_path + " " + std::to_string(transfers[0].bytes_completed));
-        this->current_transfer = transfers[0];
+    this->send(TransferState::formatOffer(this->resume_offer));
+    if (!this->resume_offer.empty()) {
         this->state = State::AwaitingResumeChoice;
-    } else {
-        this->send("RESUME");
     }
 }
 
 void Session::processResumeChoice(const std::string &choice) {
-    if (choice == "y") {
-        this->state = State::AwaitingFile;
-    } else {
+    Tokens parts;
+    const size_t count = tokenize(choice, parts);
+    const std::vector<TransferState::Transfer> offer = std::move(this->resume_offer);
+    this->resume_offer.clear();
+    if (parts[0] != "y" || count > 4) {
         this->state = State::AwaitingMessage;
+        return;
+    }
+
+    // "y" takes the first offered upload; "y <remote.part> <block_size> <digests>" names one, so a client
+    // resuming several runs one connection per upload ("y <remote.part>" for packed uploads, which
+    // resume at entry boundaries instead of verified blocks)
+    auto it = offer.begin();
+    if (count > 1) {
+        it = std::find_if(offer.begin(), offer.end(), [&parts](const TransferState::Transfer &t) { return t.remote_path == parts[1]; });
+        if (it == offer.end()) {
+            throw std::runtime_error("path_not_found: No pending upload " + std::string(parts[1]));
+        }
+    }
+    this->current_transfer = *it;
+    if (this->current_transfer.remote_path.ends_with(std::string("/") + pack::PART_NAME)) {
+        this->resumePackUpload(count > 1);
+        return;
+    }
+    if (count != 1 && count != 4) {
+        throw std::runtime_error("invalid_argument: Resuming " + this->current_transfer.remote_path + " needs \"y <remote.part> <block_size> <digests>\"");
+    }
+
+    // the client hashed the blocks it believes were sent, so continue from the first one the .part does
+    // not actually hold (the journal can disagree with the disk after a crash)
+    if (count > 1) {
+        const BlockList blocks = BlockList::parse(parts[2], parts[3]);
+        this->claimUpload(this->current_transfer.remote_path);
+        const std::string path = this->current_transfer.remote_path;
+        const size_t total = this->current_transfer.total_bytes;
+        auto prefix = std::make_shared<StreamHash>();
+        auto offset = std::make_shared<size_t>(0);
+        auto before = std::make_shared<size_t>(0);
+        this->runAsync([blocks, path, total, prefix, offset, before]() {
+            // stop short of the end so the client always has a chunk left to send
+            *offset = blocks.match(path, total > 0 ? total - 1 : 0, *prefix);
+            std::ofstream(path, std::ios::binary | std::ios::app).close();
+            *before = static_cast<size_t>(std::filesystem::file_size(path));
+            std::filesystem::resize_file(path, *offset);
+            return "OFFSET " + std::to_string(*offset);
+        }, [this, prefix, offset, before, total]() {
+            this->upload_usage->add(this->upload_usage_key, static_cast<std::int64_t>(*offset) - static_cast<std::int64_t>(*before), 0);
+            this->reserveQuota(total - *offset);
+            this->upload_hash = *prefix;
+            this->current_transfer.bytes_completed = *offset;
+            TransferState::updateProgress(this->getClientDirectory(), this->current_transfer.remote_path, *offset, this->upload_hash.save());
+            this->state = State::AwaitingFile;
+        });
+        return;
+    }
+    this->claimUpload(this->current_transfer.remote_path);
+    this->reserveQuota(this->current_transfer.total_bytes - this->current_transfer.bytes_completed);
+
+    // keep hashing from the saved state; transfers recorded without one re-hash the bytes on disk
+    if (this->upload_hash.restore(this->current_transfer.hash_state)) {
+        this->state = State::AwaitingFile;
+        return;
+    }
+    auto prefix = std::make_shared<StreamHash>();
+    const std::string path = this->current_transfer.remote_path;
+    const size_t bytes = this->current_transfer.bytes_completed;
+    this->runAsync([path, bytes, prefix]() {
+        *prefix = StreamHash::ofPrefix(path, bytes);
+        return std::string();
+    }, [this, prefix]() {
+        this->upload_hash = *prefix;
+        this->state = State::AwaitingFile;
+    });
+}
+
+void Session::resumePackUpload(const bool &announce) {
+    // continue after the last entry the journal recorded as complete; "y <remote.part>" is answered
+    // with that offset, plain "y" relies on the one in the offer
+    this->claimUpload(this->current_transfer.remote_path);
+    StreamHash hash;
+    if (!hash.restore(this->current_transfer.hash_state)) {
+        hash = StreamHash();
+        this->current_transfer.bytes_completed = 0;
+    }
+    this->reserveQuota(this->current_transfer.total_bytes - this->current_transfer.bytes_completed);
+    this->startPackUpload(this->current_transfer.bytes_completed, hash);
+    this->state = State::AwaitingFile;
+    if (announce) {
+        this->send("OFFSET " + std::to_string(this->current_transfer.bytes_completed));
     }
 }
 
 void Session::resumeDownload(const std::string &path, const size_t &offset) {
-    // resume download from offset
-    send_file(this->client_fd, path, offset);
+    if (std::filesystem::is_directory(path)) {
+        this->resumePackDownload(path, offset);
+        return;
+    }
+
+    // the client resumes with the full path it got in FILEINFO
+    this->verifyPath(path, VerifyType::File, VerifyExistence::MustExist);
+    const size_t size = static_cast<size_t>(std::filesystem::file_size(path));
+    if (offset > size) {
+        throw std::runtime_error("invalid_offset: Resume offset " + std::to_string(offset) + " is past the end of " + path);
+    }
+
+    // stream the rest through the reactor (and scheduler) like a regular download, without FILEINFO;
+    // the final digest covers the whole file, so the part the client already has is hashed first,
+    // off the reactor thread
+    if (offset == 0) {
+        this->startDownload(path, 0, StreamHash());
+        return;
+    }
+    auto prefix = std::make_shared<StreamHash>();
+    this->runAsync([path, offset, prefix]() {
+        *prefix = StreamHash::ofPrefix(path, offset);
+        return std::string();
+    }, [this, path, offset, prefix]() { this->startDownload(path, offset, *prefix); });
+}
+
+void Session::resumePackDownload(const std::string &path, const size_t &offset) {
+    this->verifyPath(path, VerifyType::Directory, VerifyExistence::MustExist);
+
+    // the offset is an entry boundary the client reached; the stream is packed again and fast-forwarded
+    // to it, which also rebuilds the hash of the part the client already has
+    auto writer = std::make_shared<std::shared_ptr<pack::Writer>>();
+    auto locks = std::make_shared<std::vector<LockTable::Guard>>();
+    auto prefix = std::make_shared<StreamHash>();
+    this->runAsync([path, offset, writer, locks, prefix]() {
+        *locks = LockTable::global().acquireTree(path, LockTable::Mode::Shared);
+        *writer = std::make_shared<pack::Writer>(path);
+        if (offset > (*writer)->size()) {
+            throw std::runtime_error("invalid_offset: Resume offset " + std::to_string(offset) + " is past the end of the pack of " + path);
+        }
+        (*writer)->skip(offset, *prefix);
+        return std::string();
+    }, [this, path, writer, locks, prefix]() { this->startPackDownload(path, *writer, std::move(*locks), *prefix); });
+}
+
+void Session::resumeDownload(const std::string &path, const size_t &offset, const BlockList &blocks) {
+    this->verifyPath(path, VerifyType::File, VerifyExistence::MustExist);
+
+    // the client sent the digests of the blocks its .part holds; the longest prefix that matches the
+    // file here is where streaming continues, announced with OFFSET before the data
+    auto prefix = std::make_shared<StreamHash>();
+    auto agreed = std::make_shared<size_t>(0);
+    this->runAsync([path, offset, blocks, prefix, agreed]() {
+        *agreed = blocks.match(path, offset, *prefix);
+        return std::string();
+    }, [this, path, prefix, agreed]() {
+        this->startDownload(path, *agreed, *prefix);
+        this->send("OFFSET " + std::to_string(*agreed));
+    });
 }
-    
\ No newline at end of file
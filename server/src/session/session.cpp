@@ -1,79 +1,282 @@
 #include "session.hpp"
 #include "access_control.hpp"
+#include "metrics.hpp"
+#include "logging.hpp"
+#include "commands.hpp"
+#include "fs_copy.hpp"
+#include "dir_generations.hpp"
 
-// static member initialization
-std::shared_mutex Session::files_mutex;
-std::unordered_set<std::string> Session::locked_files;
+#include <charconv>
 
 // constructor
-Session::Session(const int &fd, const std::string &root, std::function<void(int)> close_callback) : client_fd(fd), root(root), close_callback(close_callback), working_directory(root + "/public"), client_directory(root + "/public") {
+Session::Session(const int &fd, const ServerConfig &config, FsExecutor &executor, std::function<void(int)> close_callback) : client_fd(fd), config(config), executor(executor), root(config.root), close_callback(close_callback), working_directory(config.root + "/public"), client_directory(config.root + "/public") {
     // clear transfers
     TransferState::clearTransfers(this->client_directory);
 }
 
 // destructor
-Session::~Session() = default;
+Session::~Session() {
+    this->releaseUpload();
+    this->session_trace.dump(this->executor);
+    this->workload_recorder.close();
+}
+
+namespace {
+
+size_t parse_size(const std::string_view &value, const std::string_view &what) {
+    size_t out = 0;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), out);
+    if (value.empty() || ec != std::errc() || end != value.data() + value.size()) {
+        throw std::runtime_error("invalid_argument: " + std::string(what) + " must be a non-negative integer");
+    }
+    return out;
+}
+
+// arguments are on the first line; the lines after it are the command's body (BATCH operations)
+std::string_view command_line(const std::string &msg) {
+    return std::string_view(msg).substr(0, msg.find('\n'));
+}
+
+std::string_view command_body(const std::string &msg) {
+    const size_t newline = msg.find('\n');
+    return newline == std::string::npos ? std::string_view() : std::string_view(msg).substr(newline + 1);
+}
+
+void reserve_or_throw(usage::UserUsage &usage, const std::uint64_t &bytes, const std::uint64_t &limit) {
+    if (!usage.reserve(bytes, limit)) {
+        throw std::runtime_error("quota_exceeded: " + std::to_string(bytes) + " more bytes would exceed the quota of " + std::to_string(limit) +
+                                 " bytes (" + std::to_string(usage.used()) + " used)");
+    }
+}
+
+} // namespace
 
 // main message handler
 void Session::onMessage(const std::string &msg) {
-    std::vector<std::string> parts = split_cmd(msg);
-    while (parts.size() < 5) {
-        parts.push_back("");
-    }
+    Tokens parts;
+    const size_t part_count = tokenize(command_line(msg), parts);
+    metrics::ScopedTimer timer;
+    tracing::Span span(this->session_trace, "command", "command");
+    const bool recordable = this->state == State::AwaitingMessage;
     try {
 
         if (this->state == State::AwaitingRegistrationChoice) {
+            timer.tag(metrics::Command::Auth);
             this->processRegisterChoice(msg);
         } else if (this->state == State::AwaitingRegistrationPassword) {
+            timer.tag(metrics::Command::Auth);
             this->registerUser(msg);
         } else if (this->state == State::AwaitingPassword) {
+            timer.tag(metrics::Command::Auth);
             this->authenticateUser(msg);
         } else if (this->state == State::AwaitingResumeChoice) {
+            timer.tag(metrics::Command::Resume);
             this->processResumeChoice(msg);
         } else if (this->state == State::AwaitingFile) {
+            timer.tag(metrics::Command::UploadChunk);
             this->uploadFileChunk();
         }
 
-        // user commands
-        else if (is_cmd(msg, "LIST")) {
-            this->list(parts[1]);
-        } else if (is_cmd(msg, "DELETE")) {
-            this->deleteFile(parts[1]);
-        } else if (is_cmd(msg, "CD")) {
-            this->changeDirectory(parts[1]);
-        } else if (is_cmd(msg, "MKDIR")) {
-            this->makeDirectory(parts[1]);
-        } else if (is_cmd(msg, "RMDIR")) {
-            this->removeDirectory(parts[1]);
-        } else if (is_cmd(msg, "MOVE")) {
-            this->move(parts[1], parts[2]);
-        } else if (is_cmd(msg, "COPY")) {
-            this->copy(parts[1], parts[2]);
-        } else if (is_cmd(msg, "EXIT")) {
+        // user, control and admin commands
+        else {
+            const commands::Spec *spec = commands::lookup(parts[0]);
+            if (spec == nullptr) {
+                throw std::runtime_error("unknown_command: Unknown command: " + msg);
+            }
+            timer.tag(spec->metric);
+            if (!this->watches.empty() && spec->opcode != commands::Opcode::Watch && spec->opcode != commands::Opcode::Unwatch && spec->opcode != commands::Opcode::Exit) {
+                throw std::runtime_error("watching: Only WATCH, UNWATCH and EXIT are accepted while watching; UNWATCH first");
+            }
+            const size_t arg_count = part_count - 1;
+            if (arg_count < spec->min_args || arg_count > spec->max_args) {
+                throw std::runtime_error("invalid_argument: " + std::string(spec->name) + " takes " + std::to_string(spec->min_args) +
+                                         (spec->min_args == spec->max_args ? "" : " to " + std::to_string(spec->max_args)) + " argument(s), got " + std::to_string(arg_count));
+            }
+            this->dispatch(spec->opcode, parts, command_body(msg));
+        }
+    } catch (const std::exception &e) {
+        span.rename(metrics::command_name(timer.command()));
+        this->commandFailed(timer.command(), parts, command_body(msg), recordable, timer.elapsed(), e);
+        return;
+    }
+
+    if (this->state == State::Busy) {
+        // replied to (and timed and recorded) by finishAsync
+        span.rename(metrics::command_name(timer.command()));
+        timer.detach();
+        this->pending = {msg, timer.command(), timer.started(), recordable};
+        return;
+    }
+
+    span.rename(metrics::command_name(timer.command()));
+    if (recordable && this->workload_recorder.isOpen()) {
+        this->recordCommand(timer.command(), parts, command_body(msg), true, timer.elapsed());
+    }
+
+    // sampled per-message trace (never includes message contents, which may carry passwords)
+    if (spdlog::should_log(spdlog::level::debug) && logging::message_limiter().allow()) {
+        spdlog::debug("command fd={} user={} cmd={} bytes={} dur_us={}", this->client_fd, this->client_username, metrics::command_name(timer.command()), msg.size(),
+                      std::chrono::duration_cast<std::chrono::microseconds>(timer.elapsed()).count());
+    }
+}
+
+// one case per opcode; -Wswitch flags a command added to the table without a handler.
+// Tokenizing and the table lookup do not allocate, but each argument is copied into a
+// std::string here: the handlers resolve it against the working directory into a full
+// path (another allocation anyway), so taking string_view would only move the copy.
+void Session::dispatch(const commands::Opcode &op, const Tokens &parts, const std::string_view &body) {
+    using commands::Opcode;
+    using commands::arg;
+    switch (op) {
+        case Opcode::List:
+            this->list(std::string(arg<Opcode::List, 0>(parts)), std::string(arg<Opcode::List, 1>(parts)));
+            break;
+        case Opcode::Delete:
+            this->deleteFile(std::string(arg<Opcode::Delete, 0>(parts)));
+            break;
+        case Opcode::Cd:
+            this->changeDirectory(std::string(arg<Opcode::Cd, 0>(parts)));
+            break;
+        case Opcode::Mkdir:
+            this->makeDirectory(std::string(arg<Opcode::Mkdir, 0>(parts)));
+            break;
+        case Opcode::Rmdir:
+            this->removeDirectory(std::string(arg<Opcode::Rmdir, 0>(parts)));
+            break;
+        case Opcode::Move:
+            this->move(std::string(arg<Opcode::Move, 0>(parts)), std::string(arg<Opcode::Move, 1>(parts)));
+            break;
+        case Opcode::Copy:
+            this->copy(std::string(arg<Opcode::Copy, 0>(parts)), std::string(arg<Opcode::Copy, 1>(parts)));
+            break;
+        case Opcode::Exit:
             this->exit();
-        } else if (is_cmd(msg, "UPLOAD")) {
-            this->uploadFile(parts[2], parts[3], std::stoull(parts[1]));
-        } else if (is_cmd(msg, "DOWNLOAD")) {
-            this->downloadFile(parts[1]);
-
-        // control commands
-        } else if (is_cmd(msg, "AUTH")) {
-            this->auth(parts[1]);
-        } else if (is_cmd(msg, "RESUME")) {
-            this->resumeDownload(parts[1], std::stoull(parts[2]));
+            break;
+        case Opcode::Upload:
+            this->uploadFile(std::string(arg<Opcode::Upload, 1>(parts)), std::string(arg<Opcode::Upload, 2>(parts)), parse_size(arg<Opcode::Upload, 0>(parts), "UPLOAD size"));
+            break;
+        case Opcode::UploadPipelined: {
+            const size_t size = parse_size(arg<Opcode::UploadPipelined, 0>(parts), "UPLOAD_PIPELINED size");
+            try {
+                this->uploadFile(std::string(arg<Opcode::UploadPipelined, 1>(parts)), std::string(arg<Opcode::UploadPipelined, 2>(parts)), size, true);
+            } catch (const std::exception &) {
+                this->discard_left = size; // the data is on its way regardless
+                throw;
+            }
+            break;
+        }
+        case Opcode::Download:
+            this->downloadFile(std::string(arg<Opcode::Download, 0>(parts)));
+            break;
+        case Opcode::Auth:
+            this->auth(std::string(arg<Opcode::Auth, 0>(parts)));
+            break;
+        case Opcode::Resume:
+            if (arg<Opcode::Resume, 2>(parts).empty()) {
+                this->resumeDownload(std::string(arg<Opcode::Resume, 0>(parts)), parse_size(arg<Opcode::Resume, 1>(parts), "RESUME offset"));
+            } else {
+                this->resumeDownload(std::string(arg<Opcode::Resume, 0>(parts)), parse_size(arg<Opcode::Resume, 1>(parts), "RESUME offset"),
+                                     BlockList::parse(arg<Opcode::Resume, 2>(parts), arg<Opcode::Resume, 3>(parts)));
+            }
+            break;
+        case Opcode::Stats:
+            this->stats();
+            break;
+        case Opcode::Trace:
+            this->traceControl(std::string(arg<Opcode::Trace, 0>(parts)), std::string(arg<Opcode::Trace, 1>(parts)), std::string(arg<Opcode::Trace, 2>(parts)));
+            break;
+        case Opcode::Du:
+            this->diskUsage(std::string(arg<Opcode::Du, 0>(parts)));
+            break;
+        case Opcode::Batch:
+            this->batch(std::string(arg<Opcode::Batch, 0>(parts)), body);
+            break;
+        case Opcode::UploadPack:
+            this->uploadPack(std::string(arg<Opcode::UploadPack, 1>(parts)), std::string(arg<Opcode::UploadPack, 2>(parts)), parse_size(arg<Opcode::UploadPack, 0>(parts), "UPLOAD_PACK size"));
+            break;
+        case Opcode::DownloadPack:
+            this->downloadPack(std::string(arg<Opcode::DownloadPack, 0>(parts)));
+            break;
+        case Opcode::Watch:
+            this->watch(std::string(arg<Opcode::Watch, 0>(parts)));
+            break;
+        case Opcode::Unwatch:
+            this->unwatch(std::string(arg<Opcode::Unwatch, 0>(parts)));
+            break;
+        case Opcode::Count:
+            throw std::runtime_error("unknown_command: Invalid opcode");
+    }
+}
+
+void Session::commandFailed(const metrics::Command &cmd, const Tokens &parts, const std::string_view &body, const bool &recordable, const std::chrono::nanoseconds &elapsed, const std::exception &e) {
+    std::string err_msg = "ERROR " + std::string(e.what());
+    size_t pos = err_msg.find(':');
+    if (pos != std::string::npos) {
+        err_msg.replace(pos, 2, ":\n");
+    }
+    metrics::record_error(cmd);
+    // transfer locks are only held while a transfer runs, which this error ends
+    this->releaseUpload();
+    this->download_lock.release();
+    this->download_tree_lock.clear();
+    this->download_pack.reset();
+    this->download_file.reset();
+    if (recordable && this->workload_recorder.isOpen()) {
+        this->recordCommand(cmd, parts, body, false, elapsed);
+    }
+    this->send(err_msg);
+    this->setState(this->discard_left > 0 ? State::AwaitingFile : State::AwaitingMessage);
+    if (logging::error_limiter().allow()) {
+        spdlog::warn("command failed fd={} user={} cmd={} error=\"{}\"", this->client_fd, this->client_username, metrics::command_name(cmd), e.what());
+    }
+}
+
+void Session::runAsync(std::function<std::string()> work, std::function<void()> then) {
+    auto reply = std::make_shared<std::string>();
+    this->setState(State::Busy);
+    this->executor.submit([work = std::move(work), reply]() { *reply = work(); },
+                          [this, reply, then = std::move(then)](std::exception_ptr error) { this->finishAsync(*reply, error, then); });
+}
+
+void Session::finishAsync(const std::string &reply, std::exception_ptr error, const std::function<void()> &then) {
+    const auto end = std::chrono::steady_clock::now();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - this->pending.start);
+    metrics::record_latency(this->pending.cmd, elapsed);
+    if (this->session_trace.enabled()) {
+        this->session_trace.complete(metrics::command_name(this->pending.cmd), "fs_executor", this->pending.start, end);
+    }
+
+    Tokens parts;
+    tokenize(command_line(this->pending.msg), parts);
+    this->setState(State::AwaitingMessage);
+    if (!error && then) {
+        try {
+            then();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    try {
+        if (error) {
+            try {
+                std::rethrow_exception(error);
+            } catch (const std::exception &e) {
+                this->commandFailed(this->pending.cmd, parts, command_body(this->pending.msg), this->pending.recordable, elapsed, e);
+            }
         } else {
-            throw std::runtime_error("unknown_command: Unknown command: " + msg);
+            if (this->pending.recordable && this->workload_recorder.isOpen()) {
+                this->recordCommand(this->pending.cmd, parts, command_body(this->pending.msg), true, elapsed);
+            }
+            if (!reply.empty()) {
+                this->send(reply);
+            }
         }
     } catch (const std::exception &e) {
-        std::string err_msg = "ERROR " + std::string(e.what());
-        size_t pos = err_msg.find(':');
-        if (pos != std::string::npos) {
-            err_msg.replace(pos, 2, ":\n");
-        }
-        this->send(err_msg);
-        this->setState(State::AwaitingMessage);
-        std::cerr << "Error processing command from client fd=" << this->client_fd << ": " << e.what() << "\n";
+        // the client went away while the command ran
+        spdlog::info("disconnected fd={} error=\"{}\"", this->client_fd, e.what());
+        this->close_callback(this->client_fd);
     }
+    this->pending = {};
 }
 
 void Session::exit() {
@@ -122,8 +325,23 @@ std::string Session::verifyPath(const std::string &path, const VerifyType &type,
     return abs_path.string();
 }
 
+void Session::refuseReserved(const std::string &path) const {
+    namespace fs = std::filesystem;
+    const fs::path rel = fs::weakly_canonical(path).lexically_relative(fs::weakly_canonical(this->client_directory));
+    if (!rel.empty() && usage::UserUsage::isMetadata(rel.begin()->string())) {
+        throw std::runtime_error("access_denied: " + rel.begin()->string() + " is reserved for the server's own data");
+    }
+}
+
+void Session::requireAdmin(const std::string &command) const {
+    if (!this->authenticated || !this->config.admin_users.contains(this->client_username)) {
+        throw std::runtime_error("permission_denied: " + command + " requires an admin user");
+    }
+}
+
 void Session::send(const std::string &msg) const {
     send_msg(this->client_fd, msg);
+    metrics::bytes_out(msg.size());
 }
 
 void Session::setState(const State &new_state) {
@@ -148,6 +366,22 @@ Session::State Session::getState() const {
     return this->state;
 }
 
+const std::string &Session::getUsername() const {
+    return this->client_username;
+}
+
+size_t Session::getUploadProgress() const {
+    return this->current_transfer.bytes_completed + this->discarded;
+}
+
+size_t Session::getDownloadProgress() const {
+    return this->download_bytes_sent;
+}
+
+size_t Session::getTransferTotal() const {
+    return this->state == State::DownloadingFile ? this->download_total_bytes : this->current_transfer.total_bytes;
+}
+
 // helpers
 
 std::string Session::path(const std::string &relative_path) const {
@@ -160,10 +394,20 @@ std::string Session::path(const std::string &relative_path) const {
 
 // command implementations
 
-void Session::list(const std::string &path) {
+void Session::list(const std::string &path, const std::string &etag) {
     std::string full_path = this->path(path);
     verifyPath(full_path, VerifyType::Directory, VerifyExistence::MustExist);
-    
+
+    // conditional: "-" asks for the tag without having a listing cached yet
+    std::string tag;
+    if (!etag.empty()) {
+        tag = DirGenerations::global().etag(full_path);
+        if (etag == tag) {
+            this->send("NOT_MODIFIED " + tag);
+            return;
+        }
+    }
+
     std::ostringstream out;
     size_t n = 0;
     for (const auto &entry : std::filesystem::directory_iterator(full_path)) {
@@ -181,7 +425,7 @@ void Session::list(const std::string &path) {
         n++;
     }
 
-    this->send("OK\n" + out.str());
+    this->send((tag.empty() ? "OK\n" : "OK " + tag + "\n") + out.str());
 }
 
 
@@ -192,12 +436,13 @@ void Session::deleteFile(const std::string &path) {
     std::string full_path = this->path(path);
     this->verifyPath(full_path, VerifyType::File, VerifyExistence::MustExist);
 
-    // check if file is currently being downloaded
-    if (isFileLocked(full_path)) {
-        throw std::runtime_error("file_in_use: Cannot delete file while it is being downloaded");
-    }
-
+    // refused while another session reads or writes it, under any path
+    LockTable::Guard lock = LockTable::global().acquire(full_path, LockTable::Mode::Exclusive);
+    usage::UserUsage &usage = this->usage();
+    usage.removeTree(full_path);
     std::filesystem::remove(full_path);
+    DirGenerations::global().changed(full_path, ChangeFeed::Kind::Deleted);
+    usage.save();
 
     this->send("OK\nDeleted file " + path);
 }
@@ -219,9 +464,12 @@ void Session::makeDirectory(const std::string &path) {
         throw std::runtime_error("no_path: MKDIR command requires a path argument");
     }
     std::string full_path = this->path(path);
+    this->refuseReserved(full_path);
     this->verifyPath(full_path, VerifyType::None, VerifyExistence::MustNotExist);
 
+    const std::string created = first_missing(full_path);
     std::filesystem::create_directories(full_path);
+    DirGenerations::global().changed(created, ChangeFeed::Kind::Created);
 
     this->send("OK\nCreated directory " + path);
 }
@@ -233,7 +481,12 @@ void Session::removeDirectory(const std::string &path) {
     std::string full_path = this->path(path);
     this->verifyPath(full_path, VerifyType::Directory, VerifyExistence::MustExist);
 
+    std::vector<LockTable::Guard> locks = LockTable::global().acquireTree(full_path, LockTable::Mode::Exclusive);
+    usage::UserUsage &usage = this->usage();
+    usage.removeTree(full_path);
     std::filesystem::remove_all(full_path);
+    DirGenerations::global().changed(full_path, ChangeFeed::Kind::Deleted);
+    usage.save();
 
     this->send("OK\nRemoved directory " + path);
 }
@@ -245,11 +498,21 @@ void Session::move(const std::string &source, const std::string &destination) {
     std::string full_source_path = this->path(source);
     std::string full_destination_path = this->path(destination);
     this->verifyPath(full_source_path, VerifyType::None, VerifyExistence::MustExist);
+    this->refuseReserved(full_destination_path);
     this->verifyPath(full_destination_path, VerifyType::None, VerifyExistence::MustNotExist);
 
+    std::vector<LockTable::Guard> locks = LockTable::global().acquireTree(full_source_path, LockTable::Mode::Exclusive);
     std::string dest_parent = full_destination_path.substr(0, full_destination_path.find_last_of("/\\"));
+    const std::string created = first_missing(dest_parent);
     std::filesystem::create_directories(dest_parent);
+    if (!created.empty()) {
+        DirGenerations::global().changed(created, ChangeFeed::Kind::Created);
+    }
     std::filesystem::rename(full_source_path, full_destination_path);
+    DirGenerations::global().moved(full_source_path, full_destination_path);
+    usage::UserUsage &usage = this->usage();
+    usage.moveTree(full_source_path, full_destination_path);
+    usage.save();
 
     this->send("OK\nMoved " + source + " to " + destination);
 }
@@ -261,26 +524,119 @@ void Session::copy(const std::string &source, const std::string &destination) {
     std::string full_source_path = this->working_directory + "/" + source;
     std::string full_destination_path = this->working_directory + "/" + destination;
     this->verifyPath(full_source_path, VerifyType::None, VerifyExistence::MustExist);
+    this->refuseReserved(full_destination_path);
     this->verifyPath(full_destination_path, VerifyType::None, VerifyExistence::MustNotExist);
 
-    std::string dest_parent = full_destination_path.substr(0, full_destination_path.find_last_of("/\\"));
-    std::filesystem::create_directories(dest_parent);
-    std::filesystem::copy(full_source_path, full_destination_path, std::filesystem::copy_options::recursive);
+    // data moves on the filesystem executor (reflink / copy_file_range); the reply follows when done
+    FsExecutor &executor = this->executor;
+    usage::UserUsage &usage = this->usage();
+    const std::uint64_t reserved = this->reserveCopy(usage, full_source_path);
+    this->runAsync([full_source_path, full_destination_path, source, destination, reserved, &executor, &usage]() {
+        const usage::Reservation reservation(usage, reserved);
+        // the source stays readable by others but cannot change underneath the copy
+        std::vector<LockTable::Guard> locks = LockTable::global().acquireTree(full_source_path, LockTable::Mode::Shared);
+        std::string dest_parent = full_destination_path.substr(0, full_destination_path.find_last_of("/\\"));
+        const std::string created = first_missing(dest_parent);
+        if (!created.empty()) {
+            DirGenerations::global().expect(created);
+        }
+        DirGenerations::global().expect(full_destination_path);
+        std::filesystem::create_directories(dest_parent);
+        if (!created.empty()) {
+            DirGenerations::global().changed(created, ChangeFeed::Kind::Created);
+        }
+        fscopy::Stats stats;
+        try {
+            stats = fscopy::copy(full_source_path, full_destination_path, executor);
+        } catch (...) {
+            // a failed copy removes what it made, after LIST may have seen it
+            DirGenerations::global().bump(full_destination_path);
+            throw;
+        }
+        DirGenerations::global().changed(full_destination_path, ChangeFeed::Kind::Created);
+        spdlog::debug("copy src={} dst={} files={} dirs={} bytes={} reflinked={} kernel={} userspace={}", full_source_path, full_destination_path,
+                      stats.files, stats.directories, stats.bytes, stats.reflinked, stats.kernel_copied, stats.userspace_copied);
+        // charged in full even when the copy shares extents through a reflink
+        usage.addTree(full_destination_path);
+        usage.save();
+        return "OK\nCopied " + source + " to " + destination;
+    });
+}
 
-    this->send("OK\nCopied " + source + " to " + destination);
+void Session::claimUpload(const std::string &part_path) {
+    // the .part must exist to have an inode to lock
+    const std::filesystem::path parent = std::filesystem::path(part_path).parent_path();
+    const std::string created_dir = parent.empty() ? "" : first_missing(parent);
+    if (!parent.empty()) {
+        std::filesystem::create_directories(parent);
+    }
+    const bool created = !std::filesystem::exists(part_path);
+    std::ofstream(part_path, std::ios::binary | std::ios::app).close();
+    if (!created_dir.empty() || created) {
+        DirGenerations::global().changed(created_dir.empty() ? part_path : created_dir, ChangeFeed::Kind::Created);
+    }
+    this->upload_lock = LockTable::global().acquire(part_path, LockTable::Mode::Exclusive);
+
+    // chunks are charged without saving, so the saved totals are stale until the upload ends
+    this->upload_usage = &this->usage();
+    this->upload_usage_key = this->upload_usage->parentKey(part_path);
+    if (!this->upload_dirty) {
+        this->upload_usage->markDirty();
+        this->upload_dirty = true;
+    }
+    if (created) {
+        this->upload_usage->add(this->upload_usage_key, 0, 1);
+    }
 }
 
-void Session::lockFileForDownload(const std::string &filepath) {
-    std::unique_lock<std::shared_mutex> lock(files_mutex);
-    locked_files.insert(filepath);
+void Session::releaseUpload() {
+    this->upload_lock.release();
+    this->upload_writer.reset();
+    this->upload_pack.reset();
+    if (this->upload_usage != nullptr) {
+        this->upload_usage->unreserve(this->upload_reserved);
+        if (this->upload_dirty) {
+            this->upload_usage->releaseDirty();
+            this->upload_dirty = false;
+        }
+        this->upload_usage->save();
+    }
+    this->upload_usage = nullptr;
+    this->upload_reserved = 0;
+}
+
+usage::UserUsage &Session::usage() const {
+    return usage::for_directory(this->client_directory);
+}
+
+std::uint64_t Session::userQuota() const {
+    auto quota = this->config.user_quotas.find(this->client_username);
+    return quota != this->config.user_quotas.end() ? quota->second : this->config.default_user_quota;
 }
 
-void Session::unlockFileForDownload(const std::string &filepath) {
-    std::unique_lock<std::shared_mutex> lock(files_mutex);
-    locked_files.erase(filepath);
+void Session::reserveQuota(const std::uint64_t &bytes) {
+    // recorded before claimUpload, which can still fail (a locked .part), so releaseUpload gives it back
+    this->upload_usage = &this->usage();
+    reserve_or_throw(*this->upload_usage, bytes, this->userQuota());
+    this->upload_reserved += bytes;
 }
 
-bool Session::isFileLocked(const std::string &filepath) {
-    std::shared_lock<std::shared_mutex> lock(files_mutex);
-    return locked_files.count(filepath) > 0;
-}
\ No newline at end of file
+std::uint64_t Session::reserveCopy(usage::UserUsage &usage, const std::string &source) const {
+    // a copy is charged in full, reflinked or not
+    const std::uint64_t bytes = std::filesystem::is_directory(source) ? static_cast<std::uint64_t>(std::max<std::int64_t>(0, usage.totals(source).bytes))
+                                                                      : static_cast<std::uint64_t>(std::filesystem::file_size(source));
+    reserve_or_throw(usage, bytes, this->userQuota());
+    return bytes;
+}
+
+void Session::diskUsage(const std::string &path) {
+    std::string full_path = this->path(path.empty() ? "." : path);
+    this->verifyPath(full_path, VerifyType::Directory, VerifyExistence::MustExist);
+
+    // answered from the per-directory aggregates, never by walking the tree
+    usage::UserUsage &usage = this->usage();
+    const usage::Totals totals = usage.totals(full_path);
+    const std::uint64_t limit = this->userQuota();
+    this->send("OK\n" + (path.empty() ? "." : path) + ": " + std::to_string(totals.bytes) + " bytes in " + std::to_string(totals.files) + " files\nquota: " +
+               std::to_string(usage.used()) + (limit > 0 ? " of " + std::to_string(limit) + " bytes used" : " bytes used, unlimited"));
+}
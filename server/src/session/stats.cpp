@@ -0,0 +1,36 @@
+#include "session.hpp"
+#include "metrics.hpp"
+
+#include <charconv>
+#include <cmath>
+
+void Session::stats() {
+    // only authenticated admins may inspect server internals
+    this->requireAdmin("STATS");
+    this->send("OK\n" + metrics::render_stats());
+}
+
+void Session::traceControl(const std::string &what, const std::string &arg, const std::string &value) {
+    this->requireAdmin("TRACE");
+
+    // TRACE USER <name|-> on|off, TRACE SAMPLE <rate>, TRACE -> show settings
+    if (what == "USER") {
+        if (arg.empty() || (value != "on" && value != "off")) {
+            throw std::runtime_error("invalid_argument: Usage: TRACE USER <name|-> on|off");
+        }
+        tracing::set_user(arg == "-" ? "" : arg, value == "on");
+    } else if (what == "SAMPLE") {
+        double rate = 0.0;
+        const auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), rate);
+        if (ec != std::errc() || end != arg.data() + arg.size() || !std::isfinite(rate)) {
+            throw std::runtime_error("invalid_argument: Sample rate must be a number, got \"" + arg + "\"");
+        }
+        if (rate < 0.0 || rate > 1.0) {
+            throw std::runtime_error("invalid_argument: Sample rate must be between 0 and 1");
+        }
+        tracing::set_sample_rate(rate);
+    } else if (!what.empty()) {
+        throw std::runtime_error("invalid_argument: Usage: TRACE [USER <name|-> on|off | SAMPLE <rate>]");
+    }
+    this->send("OK\n" + tracing::describe());
+}
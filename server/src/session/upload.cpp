@@ -1,6 +1,14 @@
 #include "session.hpp"
+#include "metrics.hpp"
+#include "dir_generations.hpp"
+#include "durability.hpp"
+#include "minidrive/buffer_pool.hpp"
 
-void Session::uploadFile(const std::string &local_path, const std::string &remote_path, const size_t &filesize) {
+#include <cstring>
+#include <sys/socket.h>
+#include <spdlog/spdlog.h>
+
+void Session::uploadFile(const std::string &local_path, const std::string &remote_path, const size_t &filesize, const bool &pipelined) {
     // processs paths
     if (local_path.empty()) {
         throw std::runtime_error("no_path: UPLOAD command requires a path argument");
@@ -12,34 +20,328 @@ void Session::uploadFile(const std::string &local_path, const std::string &remot
     } else {
         this->current_transfer.remote_path += remote_path;
     }
+    this->refuseReserved(this->current_transfer.remote_path);
     this->current_transfer.remote_path += ".part";
-    this->verifyPath(this->current_transfer.remote_path, VerifyType::None, VerifyExistence::MustNotExist);
+
+    // a pipelining client cannot wait to hear that a .part is in the way, so one left by an interrupted
+    // upload is started over (one still being written is locked, and refused)
+    this->verifyPath(this->current_transfer.remote_path, VerifyType::None, pipelined ? VerifyExistence::DontCare : VerifyExistence::MustNotExist);
+    this->reserveQuota(filesize); // refused before READY, so no data is sent
+    const bool stale = pipelined && std::filesystem::exists(this->current_transfer.remote_path);
+    this->claimUpload(this->current_transfer.remote_path);
+    if (stale) {
+        const std::uintmax_t size = std::filesystem::file_size(this->current_transfer.remote_path);
+        std::filesystem::resize_file(this->current_transfer.remote_path, 0);
+        this->upload_usage->add(this->upload_usage_key, -static_cast<std::int64_t>(size), 0);
+        TransferState::removeTransfer(this->getClientDirectory(), this->current_transfer.remote_path);
+    }
 
     // log transfer
     this->current_transfer.bytes_completed = 0;
     this->current_transfer.total_bytes = filesize;
     this->current_transfer.timestamp = std::to_string(std::time(nullptr));
+    this->upload_hash = StreamHash();
+    this->current_transfer.hash_state = this->upload_hash.save();
     TransferState::addTransfer(this->getClientDirectory(), this->current_transfer);
 
-    // prepare to receive file
+    // prepare to receive file (an empty one is complete already, no chunk will come)
     this->setState(State::AwaitingFile);
-    this->send("READY");
+    if (!pipelined) {
+        this->send("READY");
+    }
+    if (filesize == 0) {
+        this->finishUpload();
+        return;
+    }
+    if (this->session_trace.enabled()) {
+        this->last_chunk_end = tracing::Clock::now();
+    }
+}
+
+void Session::finishUpload() {
+    tracing::Span span(this->session_trace, "finish_upload", "upload");
+    const std::string part_path = this->current_transfer.remote_path;
+    if (durability::level() == durability::Level::None) {
+        const std::string reply = this->renameUpload(part_path);
+        this->releaseUpload();
+        this->state = State::AwaitingMessage;
+        this->send(reply);
+        return;
+    }
+
+    // the data is synced before the rename and the rename before the reply, so a crash leaves either
+    // the .part or the whole file, and never loses an upload the client was told about; the session
+    // stays Busy through both group commit rounds and is answered by finishAsync
+    this->upload_writer.reset();
+    this->setState(State::Busy);
+    durability::sync({part_path}, this->executor.handoff([this, part_path](std::exception_ptr error) {
+        if (!error) {
+            try {
+                const std::string reply = this->renameUpload(part_path);
+                const std::string parent = std::filesystem::path(this->current_transfer.remote_path).parent_path().string();
+                durability::sync({parent}, this->executor.handoff([this, reply](std::exception_ptr error) {
+                    this->releaseUpload();
+                    this->finishAsync(error ? std::string() : reply, error, nullptr);
+                }));
+                return;
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        this->finishAsync("", error, nullptr);
+    }));
+}
+
+std::string Session::renameUpload(const std::string &part_path) {
+    // a file being downloaded is not replaced under its reader; the .part stays, so the upload can resume
+    const std::string target = part_path.substr(0, part_path.size() - 5);
+    LockTable::Guard target_lock;
+    LockTable::Key key;
+    if (LockTable::keyOf(target, key)) {
+        target_lock = LockTable::global().acquire(key, LockTable::Mode::Exclusive, target);
+    }
+    this->current_transfer.remote_path = target;
+    const bool replaced = std::filesystem::exists(this->current_transfer.remote_path);
+    this->upload_usage->removeTree(this->current_transfer.remote_path); // replaced by the rename, if it exists
+    std::filesystem::rename(part_path, this->current_transfer.remote_path);
+    DirGenerations::global().changed(this->current_transfer.remote_path, replaced ? ChangeFeed::Kind::Modified : ChangeFeed::Kind::Created);
+    TransferState::removeTransfer(this->getClientDirectory(), part_path); // entries are keyed by the .part path
+    return "OK\nUploaded file to " + this->current_transfer.remote_path + "\n" + digest_line(this->upload_hash.hex());
+}
+
+void Session::checkpointUpload() {
+    // strict: the journal only records data that is on disk, so progress goes to the commit thread a
+    // step at a time and is written back on the reactor once it is synced (the finishing chunk needs
+    // none); the journal itself then syncs in a later round
+    const std::uint64_t written = this->upload_writer->written();
+    if (written - this->upload_checkpoint < durability::CHECKPOINT_STEP || written == this->current_transfer.total_bytes) {
+        return;
+    }
+    this->upload_checkpoint = written;
+    const std::string user_dir = this->getClientDirectory();
+    const std::string part_path = this->current_transfer.remote_path;
+    const std::string hash_state = this->upload_hash.save();
+    durability::sync({part_path}, this->executor.handoff([user_dir, part_path, written, hash_state](std::exception_ptr error) {
+        if (error) {
+            return;
+        }
+        try {
+            TransferState::updateProgress(user_dir, part_path, static_cast<size_t>(written), hash_state);
+        } catch (const std::exception &e) {
+            spdlog::warn("upload checkpoint failed path={} error=\"{}\"", part_path, e.what());
+        }
+    }));
+}
+
+void Session::discardUpload() {
+    // data of a refused pipelined upload; the error went out when it was refused
+    const size_t size = std::min(this->discard_left, TMP_BUFF_SIZE);
+    BufferPool::Buffer buffer = BufferPool::global().acquire(size);
+    const ssize_t n = ::recv(this->client_fd, buffer.data(), size, 0);
+    if (n <= 0) {
+        throw std::runtime_error("connection_closed: Connection closed during a refused upload");
+    }
+    this->discard_left -= static_cast<size_t>(n);
+    this->discarded += static_cast<size_t>(n);
+    metrics::bytes_in(static_cast<size_t>(n));
+    if (this->discard_left == 0) {
+        this->state = State::AwaitingMessage;
+    }
 }
 
 void Session::uploadFileChunk() {
+    if (this->discard_left > 0) {
+        this->discardUpload();
+        return;
+    }
+    if (this->upload_pack) {
+        this->uploadPackChunk();
+        return;
+    }
+
+    // time since the previous chunk was handled = waiting for the client/socket
+    if (this->session_trace.enabled()) {
+        this->session_trace.complete("socket_wait", "upload", this->last_chunk_end, tracing::Clock::now());
+    }
+
     size_t bytes_left = this->current_transfer.total_bytes - this->current_transfer.bytes_completed;
-    size_t to_recv = bytes_left < TMP_BUFF_SIZE ? bytes_left : TMP_BUFF_SIZE;
-    size_t bytes_sent=  recv_file_chunk(this->client_fd, this->current_transfer.remote_path, this->current_transfer.bytes_completed, to_recv);
+    size_t to_recv = std::min(bytes_left, this->chunk_sizer.next(this->client_fd, ChunkSizer::Direction::Receive));
+    size_t bytes_sent = 0;
+    if (!this->upload_writer) {
+        this->upload_writer = std::make_unique<transfer_io::PartWriter>(this->current_transfer.remote_path, this->current_transfer.bytes_completed, this->current_transfer.total_bytes);
+        this->upload_checkpoint = this->current_transfer.bytes_completed;
+    }
+    {
+        tracing::Span span(this->session_trace, "recv_file_chunk", "upload");
+        bytes_sent = this->upload_writer->receive(this->client_fd, to_recv, &this->upload_hash);
+        span.setBytes(bytes_sent);
+    }
+
+    metrics::bytes_in(bytes_sent);
+    this->upload_usage->add(this->upload_usage_key, static_cast<std::int64_t>(bytes_sent), 0);
+    this->upload_usage->unreserve(bytes_sent);
+    this->upload_reserved -= std::min<std::uint64_t>(bytes_sent, this->upload_reserved);
+    this->chunk_sizer.observe(this->client_fd, ChunkSizer::Direction::Receive, bytes_sent);
 
     bytes_left -= bytes_sent;
     this->current_transfer.bytes_completed += bytes_sent;
-    TransferState::updateProgress(this->getClientDirectory(), this->current_transfer.remote_path, this->current_transfer.bytes_completed);
+    if (durability::level() == durability::Level::Strict) {
+        this->checkpointUpload();
+    } else {
+        tracing::Span span(this->session_trace, "TransferState::updateProgress", "upload");
+        // what is on disk, which O_DIRECT staging can leave behind what was received
+        TransferState::updateProgress(this->getClientDirectory(), this->current_transfer.remote_path, static_cast<size_t>(this->upload_writer->written()), this->upload_hash.save());
+    }
     
     if (bytes_left == 0) { // file received -> finish upload
-        std::filesystem::rename(this->current_transfer.remote_path, this->current_transfer.remote_path.substr(0, this->current_transfer.remote_path.size() - 5));
-        this->current_transfer.remote_path = this->current_transfer.remote_path.substr(0, this->current_transfer.remote_path.size() - 5);
-        this->send("OK\nUploaded file to " + this->current_transfer.remote_path);
-        TransferState::removeTransfer(this->getClientDirectory(), this->current_transfer.remote_path);
-        this->state = State::AwaitingMessage;
+        this->finishUpload();
+    }
+
+    if (this->session_trace.enabled()) {
+        this->last_chunk_end = tracing::Clock::now();
+    }
+}
+void Session::uploadPack(const std::string &local_dir, const std::string &remote_dir, const size_t &size) {
+    if (local_dir.empty()) {
+        throw std::runtime_error("no_path: UPLOAD_PACK command requires a path argument");
+    }
+    std::string name = local_dir;
+    while (name.size() > 1 && name.back() == '/') {
+        name.pop_back();
+    }
+    const std::string target = this->path(remote_dir.empty() ? name.substr(name.find_last_of("/\\") + 1) : remote_dir);
+    this->verifyPath(target, VerifyType::None, VerifyExistence::DontCare);
+    this->refuseReserved(target);
+    if (std::filesystem::exists(target) && !std::filesystem::is_directory(target)) {
+        throw std::runtime_error("not_directory: Path is not a directory: " + target);
+    }
+
+    // the transfer is journalled like a single upload under a placeholder .part inside the target, so
+    // it shows up in the RESUME offer; the journal holds the last entry boundary, not the bytes received
+    this->current_transfer.local_path = local_dir;
+    this->current_transfer.remote_path = target + "/" + pack::PART_NAME;
+    this->verifyPath(this->current_transfer.remote_path, VerifyType::None, VerifyExistence::MustNotExist);
+    this->reserveQuota(size);
+    this->claimUpload(this->current_transfer.remote_path);
+    this->current_transfer.bytes_completed = 0;
+    this->current_transfer.total_bytes = size;
+    this->current_transfer.timestamp = std::to_string(std::time(nullptr));
+    this->current_transfer.hash_state = StreamHash().save();
+    TransferState::addTransfer(this->getClientDirectory(), this->current_transfer);
+
+    this->startPackUpload(0, StreamHash());
+    this->setState(State::AwaitingFile);
+    this->send("READY");
+}
+
+void Session::startPackUpload(const std::uint64_t &offset, const StreamHash &hash) {
+    // files are charged to the quota as they complete, replacing any file of the same name
+    usage::UserUsage *usage = this->upload_usage;
+    const std::string &part = this->current_transfer.remote_path;
+    const std::string target = part.substr(0, part.size() - std::strlen(pack::PART_NAME) - 1);
+    this->upload_pack = std::make_unique<pack::Reader>(target, offset, hash, [usage](const std::string &path, const std::uint64_t &size) {
+        usage->removeTree(path);
+        usage->add(usage->parentKey(path), static_cast<std::int64_t>(size), 1);
+    });
+    std::error_code ec;
+    if (std::filesystem::equivalent(target, this->getClientDirectory(), ec)) {
+        this->upload_pack->reserve(usage::UserUsage::isMetadata);
+    }
+    if (durability::level() != durability::Level::None) {
+        this->upload_pack->deferRenames(); // see commitPack
     }
-}
\ No newline at end of file
+    this->current_transfer.bytes_completed = static_cast<size_t>(offset);
+}
+
+void Session::uploadPackChunk() {
+    const size_t bytes_left = this->current_transfer.total_bytes - this->current_transfer.bytes_completed;
+    const size_t to_recv = std::min(bytes_left, this->chunk_sizer.next(this->client_fd, ChunkSizer::Direction::Receive));
+    const std::uint64_t boundary = this->upload_pack->boundary();
+    size_t received = 0;
+    {
+        tracing::Span span(this->session_trace, "recv_pack_chunk", "upload");
+        received = pack::recv_pack_chunk(this->client_fd, *this->upload_pack, to_recv);
+        span.setBytes(received);
+    }
+    metrics::bytes_in(received);
+    this->chunk_sizer.observe(this->client_fd, ChunkSizer::Direction::Receive, received);
+    this->upload_usage->unreserve(received);
+    this->upload_reserved -= std::min<std::uint64_t>(received, this->upload_reserved);
+    this->current_transfer.bytes_completed += received;
+    const std::string &part = this->current_transfer.remote_path;
+    const std::string target = part.substr(0, part.size() - std::strlen(pack::PART_NAME) - 1);
+    DirGenerations::global().bump(target); // any chunk can start directories, .parts or renames anywhere below
+
+    // a resume restarts at the first entry that was not complete (with durability, once commitPack
+    // has made the files before it durable)
+    const bool durable = durability::level() != durability::Level::None;
+    if (!durable && this->upload_pack->boundary() != boundary) {
+        TransferState::updateProgress(this->getClientDirectory(), this->current_transfer.remote_path, static_cast<size_t>(this->upload_pack->boundary()),
+                                      this->upload_pack->boundaryHash().save());
+    }
+
+    const bool complete = this->current_transfer.bytes_completed == this->current_transfer.total_bytes;
+    if (complete && !this->upload_pack->done()) {
+        throw std::runtime_error("invalid_pack: Stream ended before the end of the pack");
+    }
+    if (durable) {
+        if (complete || !this->upload_pack->uncommitted().empty()) {
+            this->commitPack(complete);
+        }
+        return;
+    }
+    if (!complete) {
+        return;
+    }
+    const std::string reply = this->finishPackUpload();
+    this->state = State::AwaitingMessage;
+    this->send(reply);
+}
+
+void Session::commitPack(const bool &complete) {
+    // like finishUpload for every file the chunk finished: the data is synced before the rename, and the
+    // renames (and at the end the target itself) before the boundary is journalled or the upload
+    // answered. Reading pauses meanwhile, the session stays Busy and finishAsync picks it up again
+    const std::string &part = this->current_transfer.remote_path;
+    const std::string target = part.substr(0, part.size() - std::strlen(pack::PART_NAME) - 1);
+    this->setState(State::Busy);
+    durability::sync(this->upload_pack->uncommitted(), this->executor.handoff([this, complete, target](std::exception_ptr error) {
+        if (!error) {
+            try {
+                std::vector<std::string> dirs = this->upload_pack->commit();
+                DirGenerations::global().bump(target);
+                if (complete) {
+                    dirs.push_back(std::filesystem::path(target).parent_path().string());
+                }
+                durability::sync(std::move(dirs), this->executor.handoff([this, complete](std::exception_ptr error) {
+                    this->finishAsync("", error, [this, complete]() {
+                        if (complete) {
+                            this->send(this->finishPackUpload());
+                            return;
+                        }
+                        TransferState::updateProgress(this->getClientDirectory(), this->current_transfer.remote_path, static_cast<size_t>(this->upload_pack->boundary()),
+                                                      this->upload_pack->boundaryHash().save());
+                        this->setState(State::AwaitingFile);
+                    });
+                }));
+                return;
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        this->finishAsync("", error, nullptr);
+    }));
+}
+
+std::string Session::finishPackUpload() {
+    const std::string part_path = this->current_transfer.remote_path;
+    const std::string target = part_path.substr(0, part_path.size() - std::strlen(pack::PART_NAME) - 1);
+    const std::string reply = "OK\nUnpacked " + std::to_string(this->upload_pack->files()) + " files (" + std::to_string(this->upload_pack->bytes()) + " bytes) into " + target +
+                              "\n" + digest_line(this->upload_pack->hash().hex());
+    std::filesystem::remove(part_path);
+    DirGenerations::global().bump(part_path);
+    this->upload_usage->add(this->upload_usage_key, 0, -1);
+    TransferState::removeTransfer(this->getClientDirectory(), part_path);
+    this->releaseUpload();
+    return reply;
+}
@@ -0,0 +1,68 @@
+#include "session.hpp"
+#include "dir_generations.hpp"
+
+void Session::watch(const std::string &path) {
+    const std::string name = path.empty() ? "." : path;
+    const std::string full_path = this->path(name);
+    this->verifyPath(full_path, VerifyType::Directory, VerifyExistence::MustExist);
+
+    const std::string key = DirGenerations::key(full_path);
+    for (const Watch &watch : this->watches) {
+        if (watch.subscription->directory() == key) {
+            throw std::runtime_error("invalid_argument: Already watching " + watch.path);
+        }
+    }
+    if (this->watches.size() >= MAX_WATCHES) {
+        throw std::runtime_error("invalid_argument: At most " + std::to_string(MAX_WATCHES) + " directories can be watched per session");
+    }
+    this->watches.push_back({name, ChangeFeed::global().subscribe(key)});
+
+    this->send("OK\nWatching " + name);
+}
+
+void Session::unwatch(const std::string &path) {
+    if (this->watches.empty()) {
+        throw std::runtime_error("invalid_argument: Not watching anything");
+    }
+    size_t removed = this->watches.size();
+    if (path.empty()) {
+        this->watches.clear();
+    } else {
+        const std::string key = DirGenerations::key(this->path(path));
+        std::erase_if(this->watches, [&key](const Watch &watch) { return watch.subscription->directory() == key; });
+        removed -= this->watches.size();
+        if (removed == 0) {
+            throw std::runtime_error("invalid_argument: Not watching " + path);
+        }
+    }
+
+    // events still queued for these directories go with their subscriptions
+    this->send("OK\nStopped watching " + std::to_string(removed) + (removed == 1 ? " directory" : " directories"));
+}
+
+bool Session::hasEvents() const {
+    for (const Watch &watch : this->watches) {
+        if (watch.subscription->pending()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Session::pushEvents() {
+    // EVENTS <path>\n<kind> <generation> <name> [<new name>]... one message per directory
+    for (const Watch &watch : this->watches) {
+        const std::vector<ChangeFeed::Event> events = watch.subscription->take(MAX_EVENTS_PER_MESSAGE);
+        if (events.empty()) {
+            continue;
+        }
+        std::string msg = "EVENTS " + watch.path;
+        for (const ChangeFeed::Event &event : events) {
+            msg += "\n" + std::string(ChangeFeed::kindName(event.kind)) + " " + std::to_string(event.generation) + " " + event.name;
+            if (event.kind == ChangeFeed::Kind::Moved) {
+                msg += " " + event.to;
+            }
+        }
+        this->send(msg);
+    }
+}
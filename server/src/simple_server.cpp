@@ -1,8 +1,29 @@
 #include "simple_server.hpp"
 #include "session.hpp"
+#include "metrics.hpp"
+#include "logging.hpp"
+#include "tracing.hpp"
+#include "scheduler.hpp"
+#include "fs_executor.hpp"
+#include "change_feed.hpp"
+#include "file_cache.hpp"
+#include "transfer_io.hpp"
+#include "durability.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unordered_set>
 
 namespace {
 
+// non-blocking readiness check between chunks of one scheduler grant
+bool socket_ready(const int &fd, const short &events) {
+    pollfd pfd{fd, events, 0};
+    return ::poll(&pfd, 1, 0) > 0 && (pfd.revents & events) != 0;
+}
+
 int create_listen_socket(std::uint16_t port) {
     int fd = ::socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0) {
@@ -61,7 +82,10 @@ const std::string download(const int &client_fd, const std::string &cmd) {
     return "Downloaded " + server_path + " to " + client_path;
 }
 
-void start_simple_server(const std::uint16_t &port, const std::string &root, const std::string &log_file) {
+void start_simple_server(const ServerConfig &config) {
+    const std::uint16_t &port = config.port;
+    const std::string &root = config.root;
+
     // verify root directory exists
     if (!std::filesystem::exists("./" +root)) {
         std::cout << "Root directory does not exist: " << root << std::endl;
@@ -73,50 +97,138 @@ void start_simple_server(const std::uint16_t &port, const std::string &root, con
         std::filesystem::create_directory(root + "/public");
     }
 
-    // open log file
-    std::ofstream log(log_file, std::ios::app);
-    if (!log.is_open()) {
-        std::cerr << "Failed to open log file: " << log_file << std::endl;
+    // start async logger
+    try {
+        logging::init(config);
+    } catch (const std::exception &e) {
+        std::cerr << "Failed to open log file: " << config.log_file << " (" << e.what() << ")" << std::endl;
         return;
     }
+    Session::sweepBatchStaging(root);
+    tracing::configure(config);
+    FileCache::global().configure(config);
+    transfer_io::configure(config);
+    durability::configure(config);
 
     // create listen socket
     int listen_fd = create_listen_socket(port);
     if (listen_fd < 0) {
-        log << "Failed to set up listen socket on port " << port << std::endl;
+        spdlog::critical("listen failed port={}", port);
+        logging::shutdown();
         return;
     }
-    log << "Simple server listening on port " << port << std::endl;
+    spdlog::info("listening port={}", port);
 
+    FsExecutor executor(config.fs_threads);
     std::unordered_map<int, std::unique_ptr<Session>> sessions;
+    TransferScheduler scheduler(config);
+
+    // periodic Prometheus export
+    const auto stats_interval = std::chrono::seconds(config.stats_interval_seconds);
+    auto next_stats_write = std::chrono::steady_clock::now() + stats_interval;
 
     // main server loop
     std::vector<int> toClose;
     while (true) {
         toClose.clear();
+        scheduler.resetWake();
+        auto now = std::chrono::steady_clock::now();
         
-        // add all client fds to sets
+        // add all client fds to sets (transfers over their user's rate limit sit out until refilled);
+        // a session that is sending a file is not read, so requests pipelined behind a download wait
+        // in the socket until it ends; an idle one with change events waits to be writable
         fd_set readfds;
         fd_set writefds;
         FD_ZERO(&readfds);
         FD_ZERO(&writefds);
         FD_SET(listen_fd, &readfds);
-        int maxfd = listen_fd;
+        FD_SET(executor.wakeFd(), &readfds);
+        int maxfd = std::max(listen_fd, executor.wakeFd());
+        const int inotify_fd = ChangeFeed::global().inotifyFd();
+        if (inotify_fd >= 0) {
+            FD_SET(inotify_fd, &readfds);
+            maxfd = std::max(maxfd, inotify_fd);
+        }
+        std::int64_t uploads = 0;
+        std::int64_t watches = 0;
+        std::int64_t downloads = 0;
+        std::int64_t throttled = 0;
         for (auto &p : sessions) {
-            FD_SET(p.first, &readfds);
-            if (p.second->getState() == Session::State::DownloadingFile) {
-                FD_SET(p.first, &writefds);
+            const Session::State state = p.second->getState();
+            if (state == Session::State::DownloadingFile) {
+                downloads++;
+                if (scheduler.eligible(p.second->getUsername(), TransferScheduler::Direction::Download, now)) {
+                    FD_SET(p.first, &writefds);
+                } else {
+                    throttled++;
+                }
+            } else if (state == Session::State::AwaitingFile) {
+                uploads++;
+                if (scheduler.eligible(p.second->getUsername(), TransferScheduler::Direction::Upload, now)) {
+                    FD_SET(p.first, &readfds);
+                } else {
+                    throttled++;
+                }
+            } else if (state != Session::State::Busy) {
+                FD_SET(p.first, &readfds);
+                if (state == Session::State::AwaitingMessage && p.second->hasEvents()) {
+                    FD_SET(p.first, &writefds);
+                }
             }
+            watches += static_cast<std::int64_t>(p.second->watchCount());
             if (p.first > maxfd) maxfd = p.first;
         }
+        metrics::set_gauge(metrics::Gauge::ActiveSessions, static_cast<std::int64_t>(sessions.size()));
+        metrics::set_gauge(metrics::Gauge::OpenUploads, uploads);
+        metrics::set_gauge(metrics::Gauge::OpenDownloads, downloads);
+        metrics::set_gauge(metrics::Gauge::ThrottledFlows, throttled);
+        metrics::set_gauge(metrics::Gauge::FsPending, static_cast<std::int64_t>(executor.pending()));
+        metrics::set_gauge(metrics::Gauge::Watches, watches);
+        metrics::set_gauge(metrics::Gauge::CachedFiles, static_cast<std::int64_t>(FileCache::global().files()));
+        metrics::set_gauge(metrics::Gauge::CachedBytes, static_cast<std::int64_t>(FileCache::global().bytes()));
+        metrics::set_gauge(metrics::Gauge::SyncQueued, static_cast<std::int64_t>(durability::queued()));
 
-        // wait for event
-        int activity = select(maxfd + 1, &readfds, &writefds, nullptr, nullptr);
+        // wait for event (wake up in time for the next stats export or token refill)
+        auto wake = scheduler.nextWake();
+        if (!config.stats_file.empty()) {
+            wake = std::min(wake, next_stats_write);
+        }
+        timeval timeout{};
+        timeval *timeout_ptr = nullptr;
+        if (wake != std::chrono::steady_clock::time_point::max()) {
+            auto wait = wake > now ? std::chrono::duration_cast<std::chrono::microseconds>(wake - now) : std::chrono::microseconds(0);
+            timeout.tv_sec = static_cast<time_t>(wait.count() / 1000000);
+            timeout.tv_usec = static_cast<suseconds_t>(wait.count() % 1000000);
+            timeout_ptr = &timeout;
+        }
+        int activity = select(maxfd + 1, &readfds, &writefds, nullptr, timeout_ptr);
         if (activity < 0) {
             if (errno == EINTR) continue;
             perror("select");
             break;
         }
+        metrics::set_gauge(metrics::Gauge::ReadyFds, activity);
+        now = std::chrono::steady_clock::now();
+
+        // export stats file
+        if (!config.stats_file.empty() && std::chrono::steady_clock::now() >= next_stats_write) {
+            try {
+                metrics::write_prometheus(config.stats_file);
+            } catch (const std::exception &e) {
+                spdlog::warn("stats export failed path={} error=\"{}\"", config.stats_file, e.what());
+            }
+            next_stats_write = std::chrono::steady_clock::now() + stats_interval;
+        }
+
+        // filesystem work finished -> sessions send their replies and accept commands again
+        if (FD_ISSET(executor.wakeFd(), &readfds)) {
+            executor.drain();
+        }
+
+        // changes made outside the server, for WATCH
+        if (inotify_fd >= 0 && FD_ISSET(inotify_fd, &readfds)) {
+            ChangeFeed::global().readInotify();
+        }
 
         // new client -> accept connection and create session
         if (FD_ISSET(listen_fd, &readfds)) {
@@ -130,78 +242,139 @@ void start_simple_server(const std::uint16_t &port, const std::string &root, con
                 perror("accept");
                 continue;
             }
+            // replies are written as a header and data in separate sends; with pipelined requests
+            // Nagle would hold each small one back for the client's delayed ACK
+            int nodelay = 1;
+            ::setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
             char ipbuf[INET_ADDRSTRLEN];
             const char* ipstr = ::inet_ntop(AF_INET, &client_addr.sin_addr, ipbuf, sizeof(ipbuf));
             if (ipstr) {
-                log << "Client connected from " << ipstr << ":" << ntohs(client_addr.sin_port) << std::endl;
+                spdlog::info("connected fd={} addr={}:{}", client_fd, ipstr, ntohs(client_addr.sin_port));
             }
 
             // create session
             sessions.emplace(client_fd,
-                std::make_unique<Session>(client_fd, root, [&](int fd){
+                std::make_unique<Session>(client_fd, config, executor, [&](int fd){
                     toClose.push_back(fd);
                 })
             );
         }
 
-        // handle existing clients
+        // transfer chunks: the scheduler decides how many bytes each ready session may move this round
+        std::vector<TransferScheduler::Flow> flows;
         for (auto &p : sessions) {
-            int fd = p.first;
-
-            // handle active downloads when socket is writable
-            if (p.second->getState() == Session::State::DownloadingFile && FD_ISSET(fd, &writefds)) {
-                try {
-                    p.second->downloadFileChunk();
-                } catch (const std::exception &e) {
-                    log << "Error sending file to client " << fd << ": " << e.what() << "\n";
-                    toClose.push_back(fd);
-                }
-                continue;
+            const Session::State state = p.second->getState();
+            if (state == Session::State::DownloadingFile && FD_ISSET(p.first, &writefds)) {
+                flows.push_back({p.first, p.second->getUsername(), TransferScheduler::Direction::Download, p.second->getTransferTotal()});
+            } else if (state == Session::State::AwaitingFile && FD_ISSET(p.first, &readfds)) {
+                flows.push_back({p.first, p.second->getUsername(), TransferScheduler::Direction::Upload, p.second->getTransferTotal()});
             }
+        }
+        std::unordered_map<int, size_t> grants;
+        for (const auto &grant : scheduler.schedule(flows, now)) {
+            grants[grant.fd] = grant.max_bytes;
+        }
 
-            // existing client sent message -> read and process
-            if (FD_ISSET(fd, &readfds)) {
-                std::string msg;
-
-                // session waits for file -> delegate to flow
-                if (sessions[fd]->getState() == Session::State::AwaitingFile) {
-                    try {
-                        sessions[fd]->onMessage("");
-                    } catch (const std::exception &e) {
-                        log << "Error processing file for client " << fd << ": " << e.what() << "\n";
-                        toClose.push_back(fd);
-                    }
-                    continue;
-                }
+        std::unordered_set<int> served;
+        for (const auto &flow : flows) {
+            served.insert(flow.fd);
+            auto it = grants.find(flow.fd);
+            if (it == grants.end()) {
+                continue; // ready, but out of deficit this round
+            }
+            Session &session = *sessions[flow.fd];
+            const bool upload = flow.direction == TransferScheduler::Direction::Upload;
+            const Session::State state = upload ? Session::State::AwaitingFile : Session::State::DownloadingFile;
+            auto progress = [&]() { return upload ? session.getUploadProgress() : session.getDownloadProgress(); };
 
-                try {
-                    msg = recv_msg(fd);
-                } catch (const std::exception &e) {
-                    if (std::string(e.what()).find("connection_closed") != std::string::npos) {
-                        log << "Client " << fd << " disconnected\n";
-                        toClose.push_back(fd);
-                        continue;
+            // move chunks until the grant is used up, the transfer ends or the socket would block
+            size_t moved = 0;
+            try {
+                while (moved < it->second) {
+                    const size_t before = progress();
+                    if (upload) {
+                        session.onMessage(""); // session waits for file -> delegate to flow
                     } else {
-                        log << "Error receiving message from client " << fd << ": " << e.what() << "\n";
-                        continue;
+                        session.downloadFileChunk();
+                    }
+                    const size_t after = progress();
+                    if (after <= before) {
+                        break;
+                    }
+                    moved += after - before;
+                    if (session.getState() != state || !socket_ready(flow.fd, upload ? POLLIN : POLLOUT)) {
+                        break;
                     }
                 }
+            } catch (const std::exception &e) {
+                spdlog::warn("{} failed fd={} error=\"{}\"", upload ? "upload" : "download", flow.fd, e.what());
+                toClose.push_back(flow.fd);
+            }
+            scheduler.complete(flow, it->second, moved);
+        }
 
-                if (msg.empty()) {
-                    // client disconnected
-                    log << "Client " << fd << " disconnected\n";
+        // control messages from everyone else
+        for (auto &p : sessions) {
+            int fd = p.first;
+            if (!FD_ISSET(fd, &readfds) || served.contains(fd)) {
+                continue;
+            }
+            if (p.second->getState() == Session::State::AwaitingFile) {
+                continue; // raw file bytes are only read under a scheduler grant
+            }
+
+            std::string msg;
+            try {
+                msg = recv_msg(fd);
+            } catch (const std::exception &e) {
+                if (std::string(e.what()).find("connection_closed") != std::string::npos) {
+                    spdlog::info("disconnected fd={}", fd);
+                    toClose.push_back(fd);
+                    continue;
+                } else if (std::string(e.what()).starts_with("invalid_message")) {
+                    // the framing is lost, so nothing after it can be read as a message
+                    if (logging::error_limiter().allow()) {
+                        spdlog::warn("dropping fd={} error=\"{}\"", fd, e.what());
+                    }
                     toClose.push_back(fd);
                     continue;
+                } else {
+                    if (logging::error_limiter().allow()) {
+                        spdlog::warn("recv failed fd={} error=\"{}\"", fd, e.what());
+                    }
+                    continue;
                 }
+            }
 
-                log << "Received (" << msg.size() << " bytes) from fd=" << fd << ": " << msg << "\n";
+            if (msg.empty()) {
+                // client disconnected
+                spdlog::info("disconnected fd={}", fd);
+                toClose.push_back(fd);
+                continue;
+            }
 
-                // delegate session logic
-                p.second->onMessage(msg);
+            metrics::bytes_in(msg.size());
+
+            // delegate session logic
+            p.second->onMessage(msg);
+        }
+
+        // push change events; what was published this round goes out on the next one
+        for (auto &p : sessions) {
+            if (p.second->getState() != Session::State::AwaitingMessage || !FD_ISSET(p.first, &writefds) ||
+                std::find(toClose.begin(), toClose.end(), p.first) != toClose.end()) {
+                continue;
+            }
+            try {
+                p.second->pushEvents();
+            } catch (const std::exception &e) {
+                spdlog::info("event push failed fd={} error=\"{}\"", p.first, e.what());
+                toClose.push_back(p.first);
             }
         }
 
         // close disconnected sessions
+        metrics::set_gauge(metrics::Gauge::PendingCloses, static_cast<std::int64_t>(toClose.size()));
         for (int fd : toClose) {
             ::close(fd);
             sessions.erase(fd);
@@ -209,5 +382,5 @@ void start_simple_server(const std::uint16_t &port, const std::string &root, con
     }
 
     ::close(listen_fd);
-    log.close();
+    logging::shutdown();
 }
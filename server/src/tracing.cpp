@@ -0,0 +1,163 @@
+#include "tracing.hpp"
+
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+#include <unordered_set>
+
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+namespace tracing {
+
+namespace {
+
+std::mutex settings_mutex;
+std::string trace_dir = "";
+std::unordered_set<std::string> traced_users;
+double sample_rate = 0.0;
+std::mt19937_64 rng{std::random_device{}()};
+const Clock::time_point process_start = Clock::now();
+
+std::int64_t micros_since_start(const Clock::time_point &tp) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(tp - process_start).count();
+}
+
+} // namespace
+
+void configure(const ServerConfig &config) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    trace_dir = config.trace_dir;
+    traced_users = config.trace_users;
+    sample_rate = config.trace_sample_rate;
+}
+
+void set_user(const std::string &user, const bool &enabled) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    if (enabled) {
+        traced_users.insert(user);
+    } else {
+        traced_users.erase(user);
+    }
+}
+
+void set_sample_rate(const double &rate) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    sample_rate = rate;
+}
+
+bool should_trace(const std::string &user) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    if (trace_dir.empty()) {
+        return false;
+    }
+    if (traced_users.contains(user)) {
+        return true;
+    }
+    return sample_rate > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(rng) < sample_rate;
+}
+
+std::string describe() {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    std::ostringstream out;
+    out << "dir " << (trace_dir.empty() ? "(disabled)" : trace_dir) << "\n";
+    out << "sample " << sample_rate << "\n";
+    out << "users";
+    for (const auto &u : traced_users) {
+        out << " " << (u.empty() ? "(public)" : u);
+    }
+    return out.str();
+}
+
+std::string file_tag(const std::string &user) {
+    if (user.empty()) {
+        return "public";
+    }
+    std::string tag = user;
+    for (char &c : tag) {
+        const bool safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
+        if (!safe) {
+            c = '_';
+        }
+    }
+    return tag;
+}
+
+void SessionTrace::hold() {
+    this->held = true;
+    this->events.reserve(1024);
+}
+
+void SessionTrace::start(const int &client_fd, const std::string &username) {
+    if (!this->held) {
+        return;
+    }
+    this->held = false;
+    this->active = true;
+    this->fd = client_fd;
+    this->user = username;
+}
+
+void SessionTrace::discard() {
+    this->held = false;
+    this->events.clear();
+    this->dropped = 0;
+}
+
+void SessionTrace::complete(const char *name, const char *category, const Clock::time_point &begin, const Clock::time_point &end, const std::uint64_t &bytes) {
+    if (this->events.size() >= MAX_EVENTS) {
+        this->dropped++;
+        return;
+    }
+    this->events.push_back({name, category, micros_since_start(begin), std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count(), bytes});
+}
+
+void SessionTrace::dump(FsExecutor &executor) {
+    if (!this->active || this->events.empty()) {
+        return;
+    }
+    std::string dir;
+    {
+        std::lock_guard<std::mutex> lock(settings_mutex);
+        dir = trace_dir;
+    }
+    if (dir.empty()) {
+        return;
+    }
+
+    // the session is going away; the pool thread owns the events from here on
+    auto work = [dir = std::move(dir), fd = this->fd, user = this->user, events = std::move(this->events), dropped = this->dropped]() {
+        // one process per server, one thread track per session
+        const int pid = static_cast<int>(::getpid());
+        nlohmann::json trace;
+        nlohmann::json &out_events = trace["traceEvents"];
+        out_events.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", pid}, {"tid", fd},
+                              {"args", {{"name", "fd " + std::to_string(fd) + " " + (user.empty() ? "public" : user)}}}});
+        for (const auto &e : events) {
+            nlohmann::json event = {{"name", e.name}, {"cat", e.category}, {"ph", "X"}, {"ts", e.ts_us}, {"dur", e.dur_us}, {"pid", pid}, {"tid", fd}};
+            if (e.bytes > 0) {
+                event["args"] = {{"bytes", e.bytes}};
+            }
+            out_events.push_back(std::move(event));
+        }
+        trace["otherData"] = {{"user", user}, {"dropped_events", dropped}};
+
+        const std::string path = dir + "/trace-" + file_tag(user) + "-fd" + std::to_string(fd) + "-" + std::to_string(std::time(nullptr)) + ".json";
+        try {
+            std::filesystem::create_directories(dir);
+            std::ofstream out(path, std::ios::trunc);
+            out << trace.dump();
+            spdlog::info("trace written fd={} user={} events={} path={}", fd, user, events.size(), path);
+        } catch (const std::exception &e) {
+            spdlog::warn("trace write failed fd={} path={} error=\"{}\"", fd, path, e.what());
+        }
+    };
+    this->events.clear();
+    executor.submit(std::move(work), [](std::exception_ptr) {});
+}
+
+} // namespace tracing
@@ -0,0 +1,205 @@
+#include "transfer_io.hpp"
+#include "../../shared/include/minidrive/buffer_pool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace transfer_io {
+namespace {
+
+struct Policy {
+    size_t readahead = 2 * 1024 * 1024;
+    std::uint64_t drop_behind = 64 * 1024 * 1024;
+    std::uint64_t direct_upload = 0;
+};
+
+Policy policy;
+
+std::uint64_t align_down(const std::uint64_t &value, const std::uint64_t &step) {
+    return value - value % step;
+}
+
+} // namespace
+
+void configure(const ServerConfig &config) {
+    policy.readahead = config.readahead_bytes;
+    policy.drop_behind = config.drop_behind_bytes;
+    policy.direct_upload = config.direct_upload_bytes;
+}
+
+void ReadCursor::start(const int &fd, const std::uint64_t &size, const std::uint64_t &offset) {
+    this->fd = fd;
+    if (fd < 0) {
+        return;
+    }
+    this->size = size;
+    this->prefetched = offset;
+    this->dropped = align_down(offset, DROP_STEP);
+    this->drop = policy.drop_behind > 0 && size >= policy.drop_behind;
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); // doubles the kernel's own readahead
+    this->advance(offset, true);
+}
+
+void ReadCursor::advance(const std::uint64_t &offset, const bool &shared) {
+    if (this->fd < 0) {
+        return;
+    }
+
+    // the next window is requested once the cursor is half way through the current one, so the disk
+    // works ahead of the socket instead of after it
+    if (policy.readahead > 0 && this->prefetched < this->size && offset + policy.readahead / 2 >= this->prefetched) {
+        const std::uint64_t start = std::max(this->prefetched, offset);
+        const std::uint64_t length = std::min<std::uint64_t>(policy.readahead, this->size - start);
+        ::posix_fadvise(this->fd, static_cast<off_t>(start), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+        this->prefetched = start + length;
+    }
+
+    const std::uint64_t behind = align_down(offset, DROP_STEP);
+    if (this->drop && !shared && behind > this->dropped) {
+        ::posix_fadvise(this->fd, static_cast<off_t>(this->dropped), static_cast<off_t>(behind - this->dropped), POSIX_FADV_DONTNEED);
+        this->dropped = behind;
+    }
+}
+
+PartWriter::PartWriter(const std::string &path, const std::uint64_t &offset, const std::uint64_t &total)
+    : path(path), disk(offset), total(total), flushed(align_down(offset, DROP_STEP)), dropped(align_down(offset, DROP_STEP)) {
+    // O_DIRECT needs aligned file offsets, so a resume from the middle of a block stays buffered; so
+    // does a filesystem without O_DIRECT (tmpfs)
+    if (policy.direct_upload > 0 && total >= policy.direct_upload && offset % DIRECT_ALIGN == 0) {
+        void *memory = nullptr;
+        if (::posix_memalign(&memory, DIRECT_ALIGN, DIRECT_STAGE) == 0) {
+            this->file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | O_DIRECT, 0644);
+            if (this->file >= 0) {
+                this->direct = true;
+                this->stage = static_cast<char *>(memory);
+            } else {
+                std::free(memory);
+            }
+        }
+    }
+    if (this->file < 0) {
+        this->file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    }
+    if (this->file < 0 && errno == ENOENT) {
+        const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+        if (!parent.empty()) {
+            std::filesystem::create_directories(parent);
+        }
+        this->file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    }
+    if (this->file < 0) {
+        throw std::runtime_error("file_open_failed: Failed to open file for writing (path: " + path + ")");
+    }
+    this->drop = !this->direct && policy.drop_behind > 0 && total >= policy.drop_behind;
+}
+
+PartWriter::~PartWriter() {
+    if (this->file >= 0) {
+        ::close(this->file);
+    }
+    std::free(this->stage);
+}
+
+size_t PartWriter::receive(const int &fd, const size_t &max, StreamHash *hash) {
+    if (max > MAX_CHUNK_SIZE) {
+        throw std::runtime_error("invalid_argument: chunk_size exceeds MAX_CHUNK_SIZE");
+    }
+
+    // O_DIRECT: straight into the staging buffer, which goes to disk whole (or padded, at the end)
+    BufferPool::Buffer pooled;
+    char *buffer = nullptr;
+    size_t length = max;
+    if (this->direct) {
+        length = static_cast<size_t>(std::min<std::uint64_t>({max, DIRECT_STAGE - this->fill, this->total - this->disk - this->fill}));
+        buffer = this->stage + this->fill;
+    } else {
+        pooled = BufferPool::global().acquire(max);
+        buffer = pooled.data();
+    }
+    const ssize_t received = ::recv(fd, buffer, length, 0);
+    if (received < 0) {
+        if (errno == ECONNRESET) {
+            throw std::runtime_error("connection_closed: Connection reset by remote node");
+        }
+        throw std::runtime_error("recv: Failed to receive file chunk");
+    }
+    if (received == 0) {
+        throw std::runtime_error("connection_closed: Connection closed by remote node");
+    }
+    const size_t n = static_cast<size_t>(received);
+
+    if (this->direct) {
+        this->fill += n;
+        if (this->fill == DIRECT_STAGE || this->disk + this->fill == this->total) {
+            this->flushStage(hash);
+        }
+        return n;
+    }
+    this->writeAll(buffer, n);
+    if (hash) {
+        hash->update(buffer, n);
+    }
+    this->disk += n;
+    this->writeBehind();
+    return n;
+}
+
+void PartWriter::writeAll(const char *data, const size_t &length) {
+    for (size_t done = 0; done < length;) {
+        const ssize_t n = ::pwrite(this->file, data + done, length - done, static_cast<off_t>(this->disk + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EINVAL && this->direct) {
+            // the filesystem took O_DIRECT at open but refuses its writes; the rest goes through the cache
+            const int flags = ::fcntl(this->file, F_GETFL);
+            if (flags >= 0 && ::fcntl(this->file, F_SETFL, flags & ~O_DIRECT) == 0) {
+                this->direct = false;
+                continue;
+            }
+        }
+        if (n <= 0) {
+            throw std::runtime_error("file_write_failed: Failed to write to file (path: " + this->path + ")");
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+void PartWriter::flushStage(StreamHash *hash) {
+    // only the last block can be short: it is padded to the alignment and the file cut back after
+    const size_t padded = (this->fill + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+    std::memset(this->stage + this->fill, 0, padded - this->fill);
+    this->writeAll(this->stage, padded);
+    if (padded != this->fill && ::ftruncate(this->file, static_cast<off_t>(this->disk + this->fill)) != 0) {
+        throw std::runtime_error("file_write_failed: Failed to truncate file (path: " + this->path + ")");
+    }
+    if (hash) {
+        hash->update(this->stage, this->fill);
+    }
+    this->disk += this->fill;
+    this->fill = 0;
+}
+
+void PartWriter::writeBehind() {
+    // writeback of each step starts as soon as it is written, and the step before it, whose writeback
+    // has had a step's time to finish, is dropped; dirty pages are skipped by DONTNEED, never waited for
+    if (!this->drop || this->disk - this->flushed < DROP_STEP) {
+        return;
+    }
+    const std::uint64_t end = align_down(this->disk, DROP_STEP);
+    ::sync_file_range(this->file, static_cast<off_t>(this->flushed), static_cast<off_t>(end - this->flushed), SYNC_FILE_RANGE_WRITE);
+    if (this->flushed > this->dropped) {
+        ::posix_fadvise(this->file, static_cast<off_t>(this->dropped), static_cast<off_t>(this->flushed - this->dropped), POSIX_FADV_DONTNEED);
+        this->dropped = this->flushed;
+    }
+    this->flushed = end;
+}
+
+} // namespace transfer_io
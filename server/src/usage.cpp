@@ -0,0 +1,301 @@
+#include "usage.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+namespace usage {
+
+namespace {
+
+constexpr const char *HEADER = "minidrive-usage 1";
+
+std::string parent_of(const std::string &key) {
+    const size_t slash = key.find_last_of('/');
+    return slash == std::string::npos ? "" : key.substr(0, slash);
+}
+
+} // namespace
+
+UserUsage::UserUsage(const std::string &user_dir) : user_dir(user_dir), base(std::filesystem::weakly_canonical(user_dir).string()) {
+    if (!this->load()) {
+        this->rebuild();
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->write(true);
+        this->saved_clean = true;
+    }
+}
+
+bool UserUsage::isMetadata(const std::string &name) {
+    return name == FILE_NAME || name == std::string(FILE_NAME) + ".tmp" || name == ".transfers_state" || name == BATCH_STAGING;
+}
+
+std::string UserUsage::dirKey(const std::string &path) const {
+    const std::string rel = std::filesystem::weakly_canonical(path).lexically_relative(this->base).generic_string();
+    return rel == "." || rel.empty() || rel.starts_with("..") ? "" : rel;
+}
+
+std::string UserUsage::parentKey(const std::string &path) const {
+    return this->dirKey(std::filesystem::weakly_canonical(path).parent_path().string());
+}
+
+void UserUsage::add(const std::string &key, const std::int64_t &bytes, const std::int64_t &files) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->addLocked(key, bytes, files);
+}
+
+void UserUsage::addLocked(const std::string &key, const std::int64_t &bytes, const std::int64_t &files) {
+    // the directory itself and every ancestor up to the user root
+    std::string k = key;
+    while (true) {
+        Totals &t = this->dirs[k];
+        t.bytes += bytes;
+        t.files += files;
+        if (k.empty()) {
+            break;
+        }
+        k = parent_of(k);
+    }
+    this->changed = true;
+}
+
+void UserUsage::addTree(const std::string &path) {
+    namespace fs = std::filesystem;
+    std::vector<std::pair<std::string, std::int64_t>> found;
+    if (fs::is_regular_file(fs::symlink_status(path))) {
+        found.emplace_back(this->parentKey(path), static_cast<std::int64_t>(fs::file_size(path)));
+    } else if (fs::is_directory(fs::symlink_status(path))) {
+        const std::string root = this->dirKey(path);
+        for (const auto &entry : fs::recursive_directory_iterator(path, fs::directory_options::skip_permission_denied)) {
+            if (!entry.is_regular_file() || entry.is_symlink() || isMetadata(entry.path().filename().string())) {
+                continue;
+            }
+            const std::string rel = entry.path().parent_path().lexically_relative(path).generic_string();
+            const std::string key = rel == "." ? root : (root.empty() ? rel : root + "/" + rel);
+            found.emplace_back(key, static_cast<std::int64_t>(entry.file_size()));
+        }
+    }
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (const auto &[key, bytes] : found) {
+        this->addLocked(key, bytes, 1);
+    }
+}
+
+void UserUsage::removeTree(const std::string &path) {
+    this->forget(this->measure(path));
+}
+
+Removal UserUsage::measure(const std::string &path) const {
+    namespace fs = std::filesystem;
+    const fs::file_status status = fs::symlink_status(path);
+    Removal removal;
+    if (fs::is_directory(status)) {
+        removal.key = this->dirKey(path);
+        removal.directory = true;
+    } else if (fs::is_regular_file(status)) {
+        removal.key = this->parentKey(path);
+        removal.bytes = static_cast<std::int64_t>(fs::file_size(path));
+        removal.files = 1;
+    }
+    return removal;
+}
+
+void UserUsage::forget(const Removal &removal) {
+    if (!removal.directory) {
+        if (removal.files != 0) {
+            this->add(removal.key, -removal.bytes, -removal.files);
+        }
+        return;
+    }
+    const std::string &key = removal.key;
+    if (key.empty()) {
+        return; // the user root itself is never removed
+    }
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->dirs.find(key);
+    if (it == this->dirs.end()) {
+        return; // nothing counted below it
+    }
+    const Totals removed = it->second;
+    this->dirs.erase(it);
+    // the subtree from key + "/": siblings such as "a.x" or "a b" sort between "a" and "a/..."
+    const std::string prefix = key + "/";
+    for (auto below = this->dirs.lower_bound(prefix); below != this->dirs.end() && below->first.starts_with(prefix);) {
+        below = this->dirs.erase(below);
+    }
+    this->addLocked(parent_of(key), -removed.bytes, -removed.files);
+}
+
+void UserUsage::moveTree(const std::string &from, const std::string &to) {
+    namespace fs = std::filesystem;
+    const fs::file_status status = fs::symlink_status(to);
+    if (!fs::is_directory(status)) {
+        if (fs::is_regular_file(status)) {
+            const auto size = static_cast<std::int64_t>(fs::file_size(to));
+            const std::string from_key = this->parentKey(from);
+            const std::string to_key = this->parentKey(to);
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->addLocked(from_key, -size, -1);
+            this->addLocked(to_key, size, 1);
+        }
+        return;
+    }
+
+    // re-key the subtree's aggregates and move its totals between the two ancestor chains
+    const std::string from_key = this->dirKey(from);
+    const std::string to_key = this->dirKey(to);
+    if (from_key.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->dirs.find(from_key);
+    if (it == this->dirs.end()) {
+        return; // nothing counted below it
+    }
+    const Totals moved = it->second;
+    this->dirs.erase(it);
+    std::vector<std::pair<std::string, Totals>> subtree{{to_key, moved}};
+    const std::string prefix = from_key + "/";
+    for (auto below = this->dirs.lower_bound(prefix); below != this->dirs.end() && below->first.starts_with(prefix);) {
+        subtree.emplace_back(to_key + below->first.substr(from_key.size()), below->second);
+        below = this->dirs.erase(below);
+    }
+    this->addLocked(parent_of(from_key), -moved.bytes, -moved.files);
+    for (const auto &[key, totals] : subtree) {
+        this->dirs[key] = totals;
+    }
+    this->addLocked(parent_of(to_key), moved.bytes, moved.files);
+}
+
+Totals UserUsage::totals(const std::string &path) const {
+    const std::string key = this->dirKey(path);
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->dirs.find(key);
+    return it == this->dirs.end() ? Totals{} : it->second;
+}
+
+std::int64_t UserUsage::used() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->dirs.find("");
+    return it == this->dirs.end() ? 0 : std::max<std::int64_t>(0, it->second.bytes);
+}
+
+bool UserUsage::reserve(const std::uint64_t &bytes, const std::uint64_t &quota) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->dirs.find("");
+    const std::uint64_t used = it == this->dirs.end() ? 0 : static_cast<std::uint64_t>(std::max<std::int64_t>(0, it->second.bytes));
+    if (quota > 0 && used + this->reserved + bytes > quota) {
+        return false;
+    }
+    this->reserved += bytes;
+    return true;
+}
+
+void UserUsage::unreserve(const std::uint64_t &bytes) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->reserved -= std::min(bytes, this->reserved);
+}
+
+void UserUsage::markDirty() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->dirty_holders++;
+    if (this->saved_clean) {
+        this->write(false);
+        this->saved_clean = false;
+    }
+}
+
+void UserUsage::releaseDirty() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->dirty_holders -= std::min<size_t>(1, this->dirty_holders);
+}
+
+void UserUsage::save() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    // a save from another session must not pass off an upload's unsaved chunks as clean
+    const bool clean = this->dirty_holders == 0;
+    if (this->changed || clean != this->saved_clean) {
+        this->write(clean);
+        this->saved_clean = clean;
+        this->changed = false;
+    }
+}
+
+void UserUsage::rebuild() {
+    spdlog::info("usage: rebuilding totals for {}", this->user_dir);
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->dirs.clear();
+    }
+    this->addTree(this->user_dir);
+}
+
+bool UserUsage::load() {
+    std::ifstream in(this->user_dir + "/" + FILE_NAME, std::ios::binary);
+    std::string line;
+    if (!in || !std::getline(in, line) || line != std::string(HEADER) + " clean") {
+        return false;
+    }
+    // anything that does not parse is treated like a missing file: rebuilt by one walk
+    auto number = [](const std::string_view &field, std::int64_t &out) {
+        const auto [end, ec] = std::from_chars(field.data(), field.data() + field.size(), out);
+        return !field.empty() && ec == std::errc() && end == field.data() + field.size();
+    };
+    std::lock_guard<std::mutex> lock(this->mutex);
+    while (std::getline(in, line)) {
+        // "<bytes> <files> <directory>", "." for the user root
+        const std::string_view view(line);
+        const size_t first = view.find(' ');
+        const size_t second = first == std::string_view::npos ? std::string_view::npos : view.find(' ', first + 1);
+        Totals t;
+        if (second == std::string_view::npos || !number(view.substr(0, first), t.bytes) || !number(view.substr(first + 1, second - first - 1), t.files)) {
+            this->dirs.clear();
+            return false;
+        }
+        const std::string key(view.substr(second + 1));
+        this->dirs[key == "." ? "" : key] = t;
+    }
+    this->saved_clean = true;
+    return true;
+}
+
+void UserUsage::write(const bool &clean) {
+    // write next to the target and rename so a crash never leaves a torn file
+    const std::string path = this->user_dir + "/" + FILE_NAME;
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            spdlog::warn("usage: cannot write {}", tmp);
+            return;
+        }
+        out << HEADER << (clean ? " clean" : " dirty") << "\n";
+        for (const auto &[key, t] : this->dirs) {
+            if (t.bytes != 0 || t.files != 0 || key.empty()) {
+                out << t.bytes << " " << t.files << " " << (key.empty() ? "." : key) << "\n";
+            }
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+}
+
+UserUsage &for_directory(const std::string &user_dir) {
+    static std::mutex registry_mutex;
+    static std::unordered_map<std::string, std::unique_ptr<UserUsage>> registry;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::unique_ptr<UserUsage> &entry = registry[user_dir];
+    if (!entry) {
+        entry = std::make_unique<UserUsage>(user_dir);
+    }
+    return *entry;
+}
+
+} // namespace usage
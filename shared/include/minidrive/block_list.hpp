@@ -0,0 +1,40 @@
+#pragma once
+
+#include "minidrive/stream_hash.hpp"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// digests of fixed-size file blocks, exchanged on resume so both ends continue from the longest
+// prefix that is really identical on disk instead of trusting the journalled byte count
+class BlockList {
+public:
+    static constexpr size_t BLOCK_SIZE = 4 * 1024 * 1024;
+    static constexpr size_t MAX_BLOCK_SIZE = 64 * 1024 * 1024;
+    static constexpr size_t DIGEST_BYTES = 16;
+
+    // digests of the whole blocks within the first `limit` bytes of a file (none if it does not exist)
+    static BlockList of(const std::string &path, const size_t &limit, const size_t &block_size = BLOCK_SIZE);
+
+    // wire form "<block_size> [<hex>,<hex>,...]", split into its two tokens
+    static BlockList parse(const std::string_view &block_size, const std::string_view &digests);
+    std::string encode() const;
+
+    size_t blockSize() const { return this->block_size; }
+    size_t count() const { return this->digests.size(); }
+
+    // re-reads the file block by block until the first one that differs from this list; returns the
+    // agreed offset (at most `limit`) and sets `prefix` to the stream hash of the bytes before it
+    size_t match(const std::string &path, const size_t &limit, StreamHash &prefix) const;
+
+    // stream hash of the first `offset` bytes of the file this list was built from with of();
+    // `offset` must be a block boundary within the list
+    const StreamHash &prefix(const size_t &offset) const;
+
+private:
+    size_t block_size = BLOCK_SIZE;
+    std::vector<std::string> digests;  // hex
+    std::vector<StreamHash> prefixes;  // prefixes[i] = stream hash of the first i blocks (of() only)
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// transfer buffers shared by every session and chunk instead of per-call 64 KB stack arrays;
+// power-of-two size classes from 16 KB to 4 MB, idle buffers are cached up to a byte budget
+class BufferPool {
+public:
+    static constexpr size_t MIN_CLASS_BITS = 14; // 16 KB
+    static constexpr size_t MAX_CLASS_BITS = 22; // 4 MB
+    static constexpr size_t CLASS_COUNT = MAX_CLASS_BITS - MIN_CLASS_BITS + 1;
+    static constexpr size_t MIN_SIZE = size_t{1} << MIN_CLASS_BITS;
+    static constexpr size_t MAX_SIZE = size_t{1} << MAX_CLASS_BITS;
+
+    // move-only handle; returns the memory to the pool when it goes out of scope
+    class Buffer {
+    public:
+        Buffer() = default;
+        Buffer(Buffer &&other) noexcept { *this = std::move(other); }
+        Buffer &operator=(Buffer &&other) noexcept;
+        Buffer(const Buffer &) = delete;
+        Buffer &operator=(const Buffer &) = delete;
+        ~Buffer() { this->release(); }
+
+        char *data() const { return this->memory.get(); }
+        size_t size() const { return this->capacity; }
+
+    private:
+        friend class BufferPool;
+        Buffer(BufferPool *pool, std::unique_ptr<char[]> memory, const size_t &capacity) : pool(pool), memory(std::move(memory)), capacity(capacity) {}
+        void release();
+
+        BufferPool *pool = nullptr;
+        std::unique_ptr<char[]> memory;
+        size_t capacity = 0;
+    };
+
+    struct ClassStats {
+        size_t size;
+        std::uint64_t acquires;
+        std::uint64_t hits; // served from the cache without allocating
+        std::uint64_t in_use;
+        std::uint64_t cached;
+    };
+
+    explicit BufferPool(const size_t &max_cached_bytes = 64 * 1024 * 1024) : max_cached_bytes(max_cached_bytes) {}
+
+    // process-wide pool used by the protocol helpers
+    static BufferPool &global();
+
+    // smallest class holding at least min_size bytes (clamped to MAX_SIZE)
+    Buffer acquire(const size_t &min_size);
+
+    static size_t classSize(const size_t &min_size);
+    std::vector<ClassStats> stats() const;
+    std::string render() const;
+
+private:
+    struct SizeClass {
+        std::vector<std::unique_ptr<char[]>> free;
+        std::uint64_t acquires = 0;
+        std::uint64_t hits = 0;
+        std::uint64_t in_use = 0;
+    };
+
+    static size_t classIndex(const size_t &min_size);
+    void giveBack(std::unique_ptr<char[]> memory, const size_t &capacity);
+
+    mutable std::mutex mutex;
+    std::array<SizeClass, CLASS_COUNT> classes;
+    size_t cached_bytes = 0;
+    const size_t max_cached_bytes;
+};
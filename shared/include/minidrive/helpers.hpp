@@ -1,8 +1,13 @@
 #pragma once
 
 #include "transfer_state.hpp"
+#include "buffer_pool.hpp"
+#include "stream_hash.hpp"
 
+#include <array>
+#include <limits>
 #include <string>
+#include <string_view>
 #include <sys/socket.h>
 #include <stdexcept>
 #include <fstream>
@@ -11,14 +16,25 @@
 bool is_cmd(const std::string &msg, const std::string &cmd);
 const std::vector<std::string> split_cmd(const std::string &cmd);
 
-size_t receive_length_prefix(const int &fd);
-size_t recv_file_chunk(const int &fd, const std::string &path, const size_t &offset, const size_t &chunk_size);
-size_t send_file_chunk(const int &fd, std::ifstream &stream, const size_t &chunk_size);
+// allocation-free split_cmd: views into msg, tokens past MAX_TOKENS are counted but not stored
+constexpr size_t MAX_TOKENS = 5;
+using Tokens = std::array<std::string_view, MAX_TOKENS>;
+size_t tokenize(const std::string_view &msg, Tokens &tokens);
+
+// throws once the digits exceed max, before they can overflow
+size_t receive_length_prefix(const int &fd, const size_t &max = std::numeric_limits<size_t>::max());
+// optional hash is fed with exactly the bytes written / sent
+size_t recv_file_chunk(const int &fd, const std::string &path, const size_t &offset, const size_t &chunk_size, StreamHash *hash = nullptr);
+size_t send_file_chunk(const int &fd, std::ifstream &stream, const size_t &chunk_size, StreamHash *hash = nullptr);
 
 const std::string recv_msg(const int &fd);
 void send_msg(const int &fd, const std::string &msg);
 
 void recv_file(const int &fd, const std::string &filepath, const std::string &user_dir, const size_t &offset = 0, const bool &resume = false);
-void send_file(const int &fd, const std::string &filepath, const size_t &offset = 0);
+void send_file(const int &fd, const std::string &filepath, const size_t &offset = 0, StreamHash *hash = nullptr);
 
-constexpr size_t TMP_BUFF_SIZE = 64 * 1024; // 64 KB buffer size
\ No newline at end of file
+constexpr size_t TMP_BUFF_SIZE = 64 * 1024; // 64 KB default chunk size
+constexpr size_t MIN_CHUNK_SIZE = BufferPool::MIN_SIZE;
+constexpr size_t MAX_CHUNK_SIZE = BufferPool::MAX_SIZE;
+constexpr size_t MAX_MESSAGE_SIZE = 64 * 1024 * 1024; // largest length prefix recv_msg accepts
+constexpr size_t MAX_BATCH_OPS = 10000;               // operations the server takes in one BATCH
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+// reader/writer locks between sessions, keyed by (device, inode) so every path to a file (hard links,
+// "a/../b", different working directories) maps to the same entry. Sharded by key so sessions on
+// different files never share a mutex. Acquisition never blocks: a conflict fails the command with
+// file_in_use, as the reactor cannot wait for another session.
+class LockTable {
+public:
+    static constexpr size_t SHARDS = 64;
+
+    enum class Mode { Shared, Exclusive };
+
+    struct Key {
+        dev_t dev = 0;
+        ino_t ino = 0;
+        bool operator==(const Key &other) const { return dev == other.dev && ino == other.ino; }
+    };
+
+    // move-only; releases the lock when it goes out of scope
+    class Guard {
+    public:
+        Guard() = default;
+        Guard(Guard &&other) noexcept { *this = std::move(other); }
+        Guard &operator=(Guard &&other) noexcept;
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+        ~Guard() { this->release(); }
+
+        bool held() const { return this->table != nullptr; }
+        void release();
+
+    private:
+        friend class LockTable;
+        Guard(LockTable *table, const Key &key, const Mode &mode) : table(table), key(key), mode(mode) {}
+        LockTable *table = nullptr;
+        Key key;
+        Mode mode = Mode::Shared;
+    };
+
+    struct Stats {
+        std::uint64_t shared = 0;          // shared locks granted
+        std::uint64_t exclusive = 0;       // exclusive locks granted
+        std::uint64_t conflicts = 0;       // requests refused because of another holder
+        std::uint64_t shard_contended = 0; // shard mutex was busy and had to be waited for
+        std::uint64_t held = 0;            // entries currently locked
+    };
+
+    // process-wide table shared by all sessions
+    static LockTable &global();
+
+    // throws path_not_found if the path does not exist, file_in_use on a conflicting holder
+    Guard acquire(const std::string &path, const Mode &mode);
+    Guard acquire(const Key &key, const Mode &mode, const std::string &what);
+
+    // the entry itself and everything below it (without following symlinks), all or nothing
+    std::vector<Guard> acquireTree(const std::string &path, const Mode &mode);
+
+    bool isLocked(const std::string &path);
+
+    static bool keyOf(const std::string &path, Key &key);
+
+    Stats stats() const;
+    std::string render() const;
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key &key) const;
+    };
+    struct Entry {
+        std::uint32_t readers = 0;
+        bool writer = false;
+    };
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<Key, Entry, KeyHash> entries;
+    };
+
+    Shard &shardOf(const Key &key);
+    std::unique_lock<std::mutex> lockShard(Shard &shard);
+    void release(const Key &key, const Mode &mode);
+
+    std::array<Shard, SHARDS> shards;
+    std::atomic<std::uint64_t> granted_shared{0};
+    std::atomic<std::uint64_t> granted_exclusive{0};
+    std::atomic<std::uint64_t> conflicts{0};
+    std::atomic<std::uint64_t> shard_contended{0};
+    std::atomic<std::int64_t> held{0};
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "minidrive/stream_hash.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+// packed transfers: a whole directory as one stream, so many small files cost one handshake.
+//
+//   MDPACK 1\n
+//   D <mode> <path>\n                              directory
+//   F <size> <mode> <path>\n <size bytes> H <hex>\n  file and the BLAKE2b digest of its bytes
+//   E\n                                            end
+//
+// Paths are relative, '/'-separated and sorted, so packing the same tree twice gives the same
+// stream; an interrupted transfer resumes by regenerating it and skipping to the offset of the
+// last entry the receiver finished (its "boundary").
+namespace pack {
+
+constexpr const char *MAGIC = "MDPACK 1\n";
+constexpr const char *PART_NAME = ".mdpack.part"; // journalled stand-in for a packed upload, inside the target
+constexpr size_t MAX_LINE = 4096 + 64;
+
+struct Entry {
+    bool directory = false;
+    std::string path; // relative to the packed directory
+    std::uint64_t size = 0;
+    unsigned mode = 0;
+};
+
+// produces the stream of a local directory; sizes are taken when it is built, and a file that has
+// changed size by the time it is read fails the transfer (file_changed)
+class Writer {
+public:
+    explicit Writer(const std::string &dir);
+
+    std::uint64_t size() const { return this->total; } // of the whole stream, known up front
+    size_t files() const { return this->file_count; }
+    std::uint64_t position() const { return this->pos; }
+
+    // next bytes of the stream, 0 at the end
+    size_t read(char *out, const size_t &size);
+
+    // regenerate the first `offset` bytes (reading the files again) and feed them to `hash`
+    void skip(const std::uint64_t &offset, StreamHash &hash);
+
+private:
+    void nextRecord();
+
+    std::string dir;
+    std::vector<Entry> entries;
+    std::uint64_t total = 0;
+    size_t file_count = 0;
+
+    size_t index = 0;            // next entry to emit
+    std::string pending = MAGIC; // header / trailer bytes not returned yet
+    size_t pending_pos = 0;
+    std::ifstream file;
+    std::uint64_t file_left = 0;
+    StreamHash file_hash;
+    bool in_file = false;
+    bool ended = false;
+    std::uint64_t pos = 0;
+};
+
+// unpacks a stream into a directory as it arrives: each file is written to "<path>.part" and renamed
+// once its digest checks out
+class Reader {
+public:
+    // called with the final path and size of each file right before its .part is renamed over it
+    using OnFile = std::function<void(const std::string &path, const std::uint64_t &size)>;
+
+    explicit Reader(const std::string &dir, OnFile on_file = nullptr);
+
+    // continue an interrupted stream at `offset`, a boundary reported earlier, with the stream hash
+    // saved there
+    Reader(const std::string &dir, const std::uint64_t &offset, const StreamHash &hash, OnFile on_file = nullptr);
+
+    // names the stream may not create at its top level, besides PART_NAME (metadata kept in a user root)
+    using Reserved = std::function<bool(const std::string &name)>;
+    void reserve(Reserved reserved) { this->reserved = std::move(reserved); }
+
+    // durable unpacking: a finished file waits under its .part until commit() instead of being
+    // renamed at once, so the caller can sync its data first
+    void deferRenames() { this->deferred = true; }
+    const std::vector<std::string> &uncommitted() const { return this->waiting; } // .part paths
+
+    // renames the waiting files; returns the directories whose entries changed since the last commit
+    std::vector<std::string> commit();
+
+    // throws invalid_pack on malformed input, unsafe or reserved paths, integrity_error on a digest mismatch
+    void feed(const char *data, const size_t &size);
+
+    bool done() const { return this->state == State::Done; }
+    std::uint64_t position() const { return this->pos; }
+    std::uint64_t boundary() const { return this->boundary_pos; } // end of the last complete entry
+    const StreamHash &hash() const { return this->stream_hash; }  // of everything fed so far
+    const StreamHash &boundaryHash() const { return this->boundary_hash; }
+    size_t files() const { return this->file_count; }
+    std::uint64_t bytes() const { return this->byte_count; }
+
+private:
+    enum class State { Magic, Header, Data, Trailer, Done };
+
+    void onLine(const std::string &line);
+    void finishEntry();
+    std::string target(const std::string &path) const;
+
+    std::string dir;
+    OnFile on_file;
+    Reserved reserved;
+    State state = State::Magic;
+    std::string line;
+    std::uint64_t pos = 0;
+    std::uint64_t boundary_pos = 0;
+    StreamHash stream_hash;
+    StreamHash boundary_hash;
+
+    // file being written
+    std::string file_path;
+    std::ofstream file;
+    std::uint64_t file_left = 0;
+    std::uint64_t file_size = 0;
+    unsigned file_mode = 0;
+    StreamHash file_hash;
+
+    size_t file_count = 0;
+    std::uint64_t byte_count = 0;
+
+    // deferred renames
+    struct Finished {
+        std::string path;
+        std::uint64_t size = 0;
+        unsigned mode = 0;
+    };
+    void rename(const Finished &finished);
+
+    bool deferred = false;
+    std::vector<Finished> finished;
+    std::vector<std::string> waiting;
+    std::set<std::string> changed_dirs;
+};
+
+// counterparts of recv_file_chunk / send_file_chunk for packed streams
+size_t recv_pack_chunk(const int &fd, Reader &reader, const size_t &chunk_size);
+size_t send_pack_chunk(const int &fd, Writer &writer, const size_t &chunk_size, StreamHash *hash = nullptr);
+
+} // namespace pack
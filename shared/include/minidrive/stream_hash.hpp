@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <sodium.h>
+
+// incremental BLAKE2b (libsodium crypto_generichash) fed with file bytes as they cross the
+// socket, so end-to-end verification never reads a file a second time
+class StreamHash {
+public:
+    static constexpr size_t DIGEST_BYTES = crypto_generichash_BYTES; // 32
+    static constexpr const char *LABEL = "BLAKE2b";
+
+    StreamHash();
+
+    void update(const char *data, const size_t &size);
+
+    // hex digest of everything so far; the state stays usable
+    std::string hex() const;
+
+    // opaque state as hex, stored next to the resume offset; empty / invalid input -> false
+    std::string save() const;
+    bool restore(const std::string &saved);
+
+    // hash of the first `bytes` bytes of a file, for resumes without a saved state
+    static StreamHash ofPrefix(const std::string &path, const size_t &bytes);
+
+private:
+    crypto_generichash_state state;
+};
+
+// "BLAKE2b <hex>" line appended to completion messages
+std::string digest_line(const std::string &hex);
+
+// hex digest from a message containing a digest_line, "" if there is none
+std::string find_digest(const std::string &msg);
+
+// compares the digest in a completion message with the locally computed one; throws the server's error
+// for "ERROR" replies and integrity_error on mismatch
+void verify_digest(const std::string &response, const StreamHash &hash, const std::string &path);
@@ -1,9 +1,10 @@
 #pragma once
 
+#include <ctime>
+#include <functional>
 #include <string>
 #include <vector>
 #include <fstream>
-#include <thread>
 
 constexpr time_t TRANSFER_TIMEOUT_MINUTES = 60;
 
@@ -18,11 +19,23 @@ public:
         size_t bytes_completed;
         size_t total_bytes;
         std::string timestamp;
+        std::string hash_state = ""; // StreamHash::save() of the bytes so far, "" if unknown
     };
     
     static void addTransfer(const std::string& user_dir, const Transfer& transfer);
-    static void updateProgress(const std::string& user_dir, const std::string& remote_path, size_t bytes);
+    static void updateProgress(const std::string& user_dir, const std::string& remote_path, size_t bytes, const std::string& hash_state = "");
     static void removeTransfer(const std::string& user_dir, const std::string& filename);
     static std::vector<Transfer> getActiveTransfers(const std::string& user_dir);
     static void clearTransfers(const std::string& user_dir);
+
+    // when set, every rewrite of .transfers_state goes through a temporary file renamed over it, and
+    // after each change the journal and its directory are handed to `sync`, which makes them durable
+    // later without holding up the writer (server --durability strict: the next group commit round)
+    using Sync = std::function<void(std::vector<std::string> paths)>;
+    static void setDurable(Sync sync);
+
+    // AUTH reply listing the uploads a client may resume:
+    // "RESUME" or "RESUME <n>" followed by one "\n<local> <remote.part> <bytes> <total>" line per upload
+    static std::string formatOffer(const std::vector<Transfer>& transfers);
+    static std::vector<Transfer> parseOffer(const std::string& offer);
 };
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// compact binary record of one session's command stream (no file contents, no passwords)
+//
+// file:   "MDWL" | u8 version | varint session_start_us (unix) | string user | record...
+// record: u8 op | u8 status | varint offset_us | varint duration_us | varint bytes | u8 argc | string...
+// string: varint length | bytes
+namespace workload {
+
+constexpr char MAGIC[4] = {'M', 'D', 'W', 'L'};
+constexpr std::uint8_t VERSION = 2; // 2 added DU, BATCH and the packed and pipelined transfers
+constexpr const char *EXTENSION = ".mdw";
+
+enum class Op : std::uint8_t {
+    Auth,
+    List,
+    Delete,
+    Cd,
+    Mkdir,
+    Rmdir,
+    Move,
+    Copy,
+    Exit,
+    Upload,
+    Download,
+    Du,
+    Batch,
+    UploadPack,
+    DownloadPack,
+    UploadPipelined,
+    Count
+};
+
+const char *op_name(const Op &op);
+
+struct Record {
+    Op op = Op::Exit;
+    bool ok = true;
+    std::uint64_t offset_us = 0;   // command start relative to the session start
+    std::uint64_t duration_us = 0; // server-side handling time of the command message
+    std::uint64_t bytes = 0;       // file or stream size for the transfers
+    std::vector<std::string> args; // paths exactly as sent by the client; BATCH: mode and body
+};
+
+struct Trace {
+    std::string user;
+    std::uint64_t start_us = 0;
+    std::vector<Record> records;
+};
+
+// appends records to a trace file; buffered, flushed on close
+class TraceWriter {
+public:
+    bool isOpen() const { return this->out.is_open(); }
+    void open(const std::string &path, const std::string &user, const std::uint64_t &start_us);
+    void append(const Record &record);
+    void close();
+
+private:
+    std::ofstream out;
+};
+
+Trace read_trace(const std::string &path);
+
+} // namespace workload
@@ -0,0 +1,111 @@
+#include "minidrive/block_list.hpp"
+#include "minidrive/buffer_pool.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+
+namespace {
+
+// reads up to `max_blocks` whole blocks, calling `on_block(index, digest, stream_hash_so_far)` after
+// each one until it returns false; a short final block is not reported
+void scan(const std::string &path, const size_t &max_blocks, const size_t &block_size, const std::function<bool(size_t, const std::string &, const StreamHash &)> &on_block) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in || max_blocks == 0) {
+        return;
+    }
+    BufferPool::Buffer buffer = BufferPool::global().acquire(1024 * 1024);
+    StreamHash stream;
+    for (size_t index = 0; index < max_blocks; ++index) {
+        crypto_generichash_state block;
+        crypto_generichash_init(&block, nullptr, 0, BlockList::DIGEST_BYTES);
+        size_t remaining = block_size;
+        while (remaining > 0) {
+            in.read(buffer.data(), static_cast<std::streamsize>(std::min(remaining, buffer.size())));
+            const std::streamsize n = in.gcount();
+            if (n <= 0) {
+                return;
+            }
+            crypto_generichash_update(&block, reinterpret_cast<const unsigned char *>(buffer.data()), static_cast<unsigned long long>(n));
+            stream.update(buffer.data(), static_cast<size_t>(n));
+            remaining -= static_cast<size_t>(n);
+        }
+        unsigned char digest[BlockList::DIGEST_BYTES];
+        crypto_generichash_final(&block, digest, BlockList::DIGEST_BYTES);
+        char hex[BlockList::DIGEST_BYTES * 2 + 1];
+        sodium_bin2hex(hex, sizeof(hex), digest, BlockList::DIGEST_BYTES);
+        if (!on_block(index, hex, stream)) {
+            return;
+        }
+    }
+}
+
+} // namespace
+
+BlockList BlockList::of(const std::string &path, const size_t &limit, const size_t &block_size) {
+    BlockList list;
+    list.block_size = block_size;
+    list.prefixes.emplace_back();
+    scan(path, limit / block_size, block_size, [&list](size_t, const std::string &digest, const StreamHash &stream) {
+        list.digests.push_back(digest);
+        list.prefixes.push_back(stream);
+        return true;
+    });
+    return list;
+}
+
+BlockList BlockList::parse(const std::string_view &block_size, const std::string_view &digests) {
+    BlockList list;
+    auto [end, ec] = std::from_chars(block_size.data(), block_size.data() + block_size.size(), list.block_size);
+    if (block_size.empty() || ec != std::errc() || end != block_size.data() + block_size.size() || list.block_size == 0 || list.block_size > MAX_BLOCK_SIZE) {
+        throw std::runtime_error("invalid_argument: Block size must be between 1 and " + std::to_string(MAX_BLOCK_SIZE));
+    }
+    // a trailing comma would otherwise end the list as if nothing followed it
+    if (digests.ends_with(',')) {
+        throw std::runtime_error("invalid_argument: Malformed block digest");
+    }
+    size_t start = 0;
+    while (start < digests.size()) {
+        size_t pos = std::min(digests.find(',', start), digests.size());
+        std::string_view digest = digests.substr(start, pos - start);
+        if (digest.size() != DIGEST_BYTES * 2 || digest.find_first_not_of("0123456789abcdef") != std::string_view::npos) {
+            throw std::runtime_error("invalid_argument: Malformed block digest");
+        }
+        list.digests.emplace_back(digest);
+        start = pos + 1;
+    }
+    return list;
+}
+
+std::string BlockList::encode() const {
+    std::string out = std::to_string(this->block_size);
+    for (size_t i = 0; i < this->digests.size(); ++i) {
+        out += (i == 0 ? ' ' : ',');
+        out += this->digests[i];
+    }
+    return out;
+}
+
+size_t BlockList::match(const std::string &path, const size_t &limit, StreamHash &prefix) const {
+    prefix = StreamHash();
+    size_t offset = 0;
+    scan(path, std::min(this->digests.size(), limit / this->block_size), this->block_size, [&](size_t index, const std::string &digest, const StreamHash &stream) {
+        if (digest != this->digests[index]) {
+            return false;
+        }
+        offset += this->block_size;
+        prefix = stream;
+        return true;
+    });
+    return offset;
+}
+
+const StreamHash &BlockList::prefix(const size_t &offset) const {
+    const size_t index = offset / this->block_size;
+    if (offset % this->block_size != 0 || index >= this->prefixes.size()) {
+        throw std::runtime_error("invalid_offset: Resume offset " + std::to_string(offset) + " is not a verified block boundary");
+    }
+    return this->prefixes[index];
+}
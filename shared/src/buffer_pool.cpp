@@ -0,0 +1,104 @@
+#include "minidrive/buffer_pool.hpp"
+
+#include <bit>
+#include <iomanip>
+#include <sstream>
+
+BufferPool::Buffer &BufferPool::Buffer::operator=(Buffer &&other) noexcept {
+    if (this != &other) {
+        this->release();
+        this->pool = other.pool;
+        this->memory = std::move(other.memory);
+        this->capacity = other.capacity;
+        other.pool = nullptr;
+        other.capacity = 0;
+    }
+    return *this;
+}
+
+void BufferPool::Buffer::release() {
+    if (this->pool && this->memory) {
+        this->pool->giveBack(std::move(this->memory), this->capacity);
+    }
+    this->pool = nullptr;
+    this->capacity = 0;
+}
+
+BufferPool &BufferPool::global() {
+    // never destroyed, so buffers released during static destruction still have a home
+    static BufferPool *pool = new BufferPool();
+    return *pool;
+}
+
+size_t BufferPool::classIndex(const size_t &min_size) {
+    if (min_size <= MIN_SIZE) {
+        return 0;
+    }
+    if (min_size >= MAX_SIZE) {
+        return CLASS_COUNT - 1;
+    }
+    return static_cast<size_t>(std::bit_width(min_size - 1)) - MIN_CLASS_BITS;
+}
+
+size_t BufferPool::classSize(const size_t &min_size) {
+    return MIN_SIZE << classIndex(min_size);
+}
+
+BufferPool::Buffer BufferPool::acquire(const size_t &min_size) {
+    const size_t index = classIndex(min_size);
+    const size_t capacity = MIN_SIZE << index;
+    std::unique_ptr<char[]> memory;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        SizeClass &c = this->classes[index];
+        c.acquires++;
+        c.in_use++;
+        if (!c.free.empty()) {
+            c.hits++;
+            memory = std::move(c.free.back());
+            c.free.pop_back();
+            this->cached_bytes -= capacity;
+        }
+    }
+    if (!memory) {
+        // uninitialised on purpose: every user overwrites what it reads
+        memory.reset(new char[capacity]);
+    }
+    return Buffer(this, std::move(memory), capacity);
+}
+
+void BufferPool::giveBack(std::unique_ptr<char[]> memory, const size_t &capacity) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    SizeClass &c = this->classes[classIndex(capacity)];
+    c.in_use--;
+    if (this->cached_bytes + capacity <= this->max_cached_bytes) {
+        c.free.push_back(std::move(memory));
+        this->cached_bytes += capacity;
+    }
+}
+
+std::vector<BufferPool::ClassStats> BufferPool::stats() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::vector<ClassStats> out;
+    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+        const SizeClass &c = this->classes[i];
+        out.push_back({MIN_SIZE << i, c.acquires, c.hits, c.in_use, c.free.size()});
+    }
+    return out;
+}
+
+std::string BufferPool::render() const {
+    std::ostringstream out;
+    out << std::left << std::setw(16) << "buffer_class" << std::right
+        << std::setw(12) << "acquires" << std::setw(10) << "hit_rate" << std::setw(8) << "in_use" << std::setw(8) << "cached";
+    for (const auto &c : this->stats()) {
+        if (c.acquires == 0) {
+            continue;
+        }
+        out << "\n" << std::left << std::setw(16) << (std::to_string(c.size / 1024) + "K") << std::right
+            << std::setw(12) << c.acquires << std::setw(10) << std::fixed << std::setprecision(3)
+            << static_cast<double>(c.hits) / static_cast<double>(c.acquires)
+            << std::setw(8) << c.in_use << std::setw(8) << c.cached;
+    }
+    return out.str();
+}
@@ -21,12 +21,34 @@ const std::vector<std::string> split_cmd(const std::string &cmd) {
     return parts;
 }
 
-size_t receive_length_prefix(const int &fd) {
+size_t tokenize(const std::string_view &msg, Tokens &tokens) {
+    tokens.fill(std::string_view());
+    size_t count = 0;
+    size_t start = 0;
+    while (start < msg.size()) {
+        size_t pos = msg.find(' ', start);
+        std::string_view token = msg.substr(start, pos == std::string_view::npos ? std::string_view::npos : pos - start);
+        if (count < MAX_TOKENS) {
+            tokens[count] = token;
+        }
+        count++;
+        if (pos == std::string_view::npos) {
+            break;
+        }
+        start = pos + 1;
+    }
+    return count;
+}
+
+size_t receive_length_prefix(const int &fd, const size_t &max) {
     char c = '\0';
     size_t length = 0;
     while(true) {
         ssize_t recvd = ::recv(fd, &c, 1, 0);
         if (recvd < 0) {
+            if (errno == ECONNRESET) {
+                throw std::runtime_error("connection_closed: Connection reset by remote node");
+            }
             throw std::runtime_error("recv: Failed to receive length");
         }
         if (recvd == 0) {
@@ -35,7 +57,15 @@ size_t receive_length_prefix(const int &fd) {
         if (c == ' ') {
             break;
         }
-        length = length * 10 + static_cast<size_t>(static_cast<unsigned char>(c) - static_cast<unsigned char>('0'));
+        if (c < '0' || c > '9') {
+            throw std::runtime_error("invalid_message: Malformed length prefix");
+        }
+        // checked before multiplying, so a long run of digits cannot wrap around below max
+        const size_t digit = static_cast<size_t>(static_cast<unsigned char>(c) - static_cast<unsigned char>('0'));
+        if (length > (max - digit) / 10) {
+            throw std::runtime_error("invalid_message: Length prefix exceeds " + std::to_string(max) + " bytes");
+        }
+        length = length * 10 + digit;
     }
     return length;
 }
@@ -43,22 +73,24 @@ size_t receive_length_prefix(const int &fd) {
 const std::string recv_msg(const int &fd) {
     std::string result;
     
-    // receive message length
-    size_t len = receive_length_prefix(fd);
+    // receive message length; the prefix is not authenticated, so a huge one is refused before allocating for it
+    size_t len = receive_length_prefix(fd, MAX_MESSAGE_SIZE);
     
-    // receive full message
+    // receive full message straight into the result
+    result.resize(len);
     size_t remaining = len;
-    char temp[TMP_BUFF_SIZE];
     while (remaining > 0) {
-        ssize_t recvd = ::recv(fd, temp, (remaining < sizeof(temp)) ? remaining : sizeof(temp), 0);
+        ssize_t recvd = ::recv(fd, result.data() + (len - remaining), remaining, 0);
         if (recvd < 0) {
             if (errno == EINTR) continue;
+            if (errno == ECONNRESET) {
+                throw std::runtime_error("connection_closed: Connection reset by remote node");
+            }
             throw std::runtime_error("recv: Failed to receive message");
         }
         if (recvd == 0) {
             throw std::runtime_error("connection_closed: Connection closed by remote node");
         }
-        result.append(temp, static_cast<size_t>(recvd));
         remaining -= static_cast<size_t>(recvd);
     }
     return result;
@@ -73,7 +105,7 @@ void send_msg(const int &fd, const std::string &msg) {
     ssize_t total_sent = 0;
     ssize_t total_size = static_cast<ssize_t>(full_msg.size());
     while (total_sent < total_size) {
-        ssize_t sent = ::send(fd, full_msg.c_str() + total_sent, static_cast<size_t>(total_size - total_sent), 0);
+        ssize_t sent = ::send(fd, full_msg.c_str() + total_sent, static_cast<size_t>(total_size - total_sent), MSG_NOSIGNAL);
         if (sent < 0) {
             if (errno == EINTR) continue;
             throw std::runtime_error("send: Failed to send message");
@@ -82,17 +114,21 @@ void send_msg(const int &fd, const std::string &msg) {
     }
 }
 
-size_t recv_file_chunk(const int &fd, const std::string &path, const size_t &offset, const size_t &chunk_size) {
+size_t recv_file_chunk(const int &fd, const std::string &path, const size_t &offset, const size_t &chunk_size, StreamHash *hash) {
     namespace fs = std::filesystem;
 
-    if (chunk_size > TMP_BUFF_SIZE) {
-        throw std::runtime_error("invalid_argument: chunk_size exceeds TMP_BUFF_SIZE");
+    if (chunk_size > MAX_CHUNK_SIZE) {
+        throw std::runtime_error("invalid_argument: chunk_size exceeds MAX_CHUNK_SIZE");
     }
 
     // receive chunk
-    char temp[TMP_BUFF_SIZE];
+    BufferPool::Buffer buffer = BufferPool::global().acquire(chunk_size);
+    char *temp = buffer.data();
     ssize_t recvd = ::recv(fd, temp, chunk_size, 0);
     if (recvd < 0) {
+        if (errno == ECONNRESET) {
+            throw std::runtime_error("connection_closed: Connection reset by remote node");
+        }
         throw std::runtime_error("recv: Failed to receive file chunk");
     }
     if (recvd == 0) {
@@ -127,6 +163,9 @@ size_t recv_file_chunk(const int &fd, const std::string &path, const size_t &off
     if (!outfile) {
         throw std::runtime_error("file_write_failed: Failed to write to file (path: " + path + ")"); 
     }
+    if (hash) {
+        hash->update(temp, static_cast<size_t>(recvd));
+    }
 
     return static_cast<size_t>(recvd);
 }
@@ -166,9 +205,10 @@ void recv_file(const int &fd, const std::string &filepath, const std::string &us
     // receive file data
     size_t remaining = length;
     size_t chunks_received = 0;
-    char temp[TMP_BUFF_SIZE];
+    BufferPool::Buffer buffer = BufferPool::global().acquire(TMP_BUFF_SIZE);
+    char *temp = buffer.data();
     while (remaining > 0) {
-        ssize_t recvd = ::recv(fd, temp, (remaining < sizeof(temp)) ? remaining : sizeof(temp), 0);
+        ssize_t recvd = ::recv(fd, temp, (remaining < buffer.size()) ? remaining : buffer.size(), 0);
         if (recvd < 0) {
             if (errno == EINTR) continue;
             throw std::runtime_error("recv: Failed to receive file data");
@@ -196,7 +236,7 @@ void recv_file(const int &fd, const std::string &filepath, const std::string &us
     }
 }
 
-void send_file(const int &fd, const std::string &filepath, const size_t &offset) {
+void send_file(const int &fd, const std::string &filepath, const size_t &offset, StreamHash *hash) {
     // open file
     std::ifstream infile(filepath, std::ios::binary);
     if (!infile) {
@@ -210,19 +250,23 @@ void send_file(const int &fd, const std::string &filepath, const size_t &offset)
     }
 
     // send file data
-    char temp[TMP_BUFF_SIZE];
+    BufferPool::Buffer buffer = BufferPool::global().acquire(TMP_BUFF_SIZE);
+    char *temp = buffer.data();
     size_t total_sent = offset;
     size_t remaining = static_cast<size_t>(std::filesystem::file_size(filepath) - offset);
     while (remaining > 0) {
-        infile.read(temp, sizeof(temp));
+        infile.read(temp, static_cast<std::streamsize>(buffer.size()));
         std::streamsize read_bytes = infile.gcount();
         if (read_bytes <= 0) break;
+        if (hash) {
+            hash->update(temp, static_cast<size_t>(read_bytes));
+        }
 
         size_t sent_total = 0;
 
         while (sent_total < static_cast<size_t>(read_bytes)) {
             ssize_t sent = ::send(fd, temp + sent_total,
-                                static_cast<size_t>(read_bytes) - sent_total, 0);
+                                static_cast<size_t>(read_bytes) - sent_total, MSG_NOSIGNAL);
 
             if (sent < 0) {
                 if (errno == EINTR) continue;
@@ -240,22 +284,26 @@ void send_file(const int &fd, const std::string &filepath, const size_t &offset)
     }
 }
 
-size_t send_file_chunk(const int &fd, std::ifstream &stream, const size_t &chunk_size) {
-    if (chunk_size > TMP_BUFF_SIZE) {
-        throw std::runtime_error("invalid_argument: chunk_size exceeds TMP_BUFF_SIZE");
+size_t send_file_chunk(const int &fd, std::ifstream &stream, const size_t &chunk_size, StreamHash *hash) {
+    if (chunk_size > MAX_CHUNK_SIZE) {
+        throw std::runtime_error("invalid_argument: chunk_size exceeds MAX_CHUNK_SIZE");
     }
 
-    char buffer[TMP_BUFF_SIZE];
+    BufferPool::Buffer pooled = BufferPool::global().acquire(chunk_size);
+    char *buffer = pooled.data();
     stream.read(buffer, static_cast<std::streamsize>(chunk_size));
     std::streamsize read_bytes = stream.gcount();
     if (read_bytes <= 0) {
         throw std::runtime_error("file_read_failed: Failed to read from file during download");
     }
+    if (hash) {
+        hash->update(buffer, static_cast<size_t>(read_bytes));
+    }
 
     ssize_t sent_total = 0;
     while (sent_total < read_bytes) {
         ssize_t sent = ::send(fd, buffer + sent_total,
-                              static_cast<size_t>(read_bytes - sent_total), 0);
+                              static_cast<size_t>(read_bytes - sent_total), MSG_NOSIGNAL);
 
         if (sent < 0) {
             if (errno == EINTR) {
@@ -0,0 +1,169 @@
+#include "minidrive/lock_table.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace {
+
+constexpr int SHARD_BITS = std::bit_width(LockTable::SHARDS - 1);
+static_assert((LockTable::SHARDS & (LockTable::SHARDS - 1)) == 0, "shard count must be a power of two");
+
+bool key_of(const std::string &path, LockTable::Key &key, const bool &follow) {
+    struct stat st {};
+    if ((follow ? ::stat(path.c_str(), &st) : ::lstat(path.c_str(), &st)) != 0) {
+        return false;
+    }
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    return true;
+}
+
+} // namespace
+
+LockTable::Guard &LockTable::Guard::operator=(Guard &&other) noexcept {
+    if (this != &other) {
+        this->release();
+        this->table = other.table;
+        this->key = other.key;
+        this->mode = other.mode;
+        other.table = nullptr;
+    }
+    return *this;
+}
+
+void LockTable::Guard::release() {
+    if (this->table) {
+        this->table->release(this->key, this->mode);
+    }
+    this->table = nullptr;
+}
+
+size_t LockTable::KeyHash::operator()(const Key &key) const {
+    // fibonacci hashing; the top bits pick the shard, the whole value the bucket
+    const std::uint64_t mixed = (static_cast<std::uint64_t>(key.ino) ^ (static_cast<std::uint64_t>(key.dev) << 32)) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(mixed);
+}
+
+LockTable &LockTable::global() {
+    // never destroyed, so guards released during static destruction still find it
+    static LockTable *table = new LockTable();
+    return *table;
+}
+
+bool LockTable::keyOf(const std::string &path, Key &key) {
+    return key_of(path, key, true);
+}
+
+LockTable::Shard &LockTable::shardOf(const Key &key) {
+    return this->shards[static_cast<std::uint64_t>(KeyHash{}(key)) >> (64 - SHARD_BITS)];
+}
+
+std::unique_lock<std::mutex> LockTable::lockShard(Shard &shard) {
+    std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        this->shard_contended.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+    }
+    return lock;
+}
+
+LockTable::Guard LockTable::acquire(const std::string &path, const Mode &mode) {
+    Key key;
+    if (!keyOf(path, key)) {
+        throw std::runtime_error("path_not_found: Path does not exist: " + path);
+    }
+    return this->acquire(key, mode, path);
+}
+
+LockTable::Guard LockTable::acquire(const Key &key, const Mode &mode, const std::string &what) {
+    Shard &shard = this->shardOf(key);
+    {
+        std::unique_lock<std::mutex> lock = this->lockShard(shard);
+        Entry &entry = shard.entries[key];
+        const bool free = mode == Mode::Shared ? !entry.writer : (!entry.writer && entry.readers == 0);
+        if (!free) {
+            lock.unlock();
+            this->conflicts.fetch_add(1, std::memory_order_relaxed);
+            throw std::runtime_error("file_in_use: " + what + " is being " + (mode == Mode::Shared ? "modified" : "used") + " by another session");
+        }
+        if (entry.readers == 0 && !entry.writer) {
+            this->held.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (mode == Mode::Shared) {
+            entry.readers++;
+        } else {
+            entry.writer = true;
+        }
+    }
+    (mode == Mode::Shared ? this->granted_shared : this->granted_exclusive).fetch_add(1, std::memory_order_relaxed);
+    return Guard(this, key, mode);
+}
+
+std::vector<LockTable::Guard> LockTable::acquireTree(const std::string &path, const Mode &mode) {
+    namespace fs = std::filesystem;
+    std::vector<Guard> guards;
+    guards.push_back(this->acquire(path, mode));
+    if (!fs::is_directory(fs::symlink_status(path))) {
+        return guards;
+    }
+    for (const auto &entry : fs::recursive_directory_iterator(path)) {
+        Key key;
+        if (key_of(entry.path().string(), key, false)) {
+            guards.push_back(this->acquire(key, mode, entry.path().string()));
+        }
+    }
+    return guards;
+}
+
+bool LockTable::isLocked(const std::string &path) {
+    Key key;
+    if (!keyOf(path, key)) {
+        return false;
+    }
+    Shard &shard = this->shardOf(key);
+    std::unique_lock<std::mutex> lock = this->lockShard(shard);
+    return shard.entries.count(key) > 0;
+}
+
+void LockTable::release(const Key &key, const Mode &mode) {
+    Shard &shard = this->shardOf(key);
+    std::unique_lock<std::mutex> lock = this->lockShard(shard);
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        return;
+    }
+    if (mode == Mode::Shared) {
+        it->second.readers--;
+    } else {
+        it->second.writer = false;
+    }
+    if (it->second.readers == 0 && !it->second.writer) {
+        shard.entries.erase(it);
+        this->held.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+LockTable::Stats LockTable::stats() const {
+    Stats s;
+    s.shared = this->granted_shared.load(std::memory_order_relaxed);
+    s.exclusive = this->granted_exclusive.load(std::memory_order_relaxed);
+    s.conflicts = this->conflicts.load(std::memory_order_relaxed);
+    s.shard_contended = this->shard_contended.load(std::memory_order_relaxed);
+    s.held = static_cast<std::uint64_t>(std::max<std::int64_t>(0, this->held.load(std::memory_order_relaxed)));
+    return s;
+}
+
+std::string LockTable::render() const {
+    const Stats s = this->stats();
+    std::ostringstream out;
+    out << "locks_shared " << s.shared << "\n";
+    out << "locks_exclusive " << s.exclusive << "\n";
+    out << "locks_conflicts " << s.conflicts << "\n";
+    out << "locks_shard_contended " << s.shard_contended << "\n";
+    out << "locks_held " << s.held;
+    return out.str();
+}
@@ -0,0 +1,402 @@
+#include "minidrive/pack.hpp"
+#include "minidrive/buffer_pool.hpp"
+#include "minidrive/lock_table.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <sys/socket.h>
+
+namespace pack {
+
+namespace {
+
+constexpr size_t DIGEST_HEX = StreamHash::DIGEST_BYTES * 2;
+
+std::string octal(const unsigned &mode) {
+    char buf[16];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), mode, 8);
+    (void)ec;
+    return std::string(buf, end);
+}
+
+// permission bits only (no setuid, setgid or sticky), and a directory always stays usable by its
+// owner so the entries after it can still be unpacked into it
+std::filesystem::perms unpacked_perms(const unsigned &mode, const bool &directory) {
+    namespace fs = std::filesystem;
+    const fs::perms perms = static_cast<fs::perms>(mode) & fs::perms::all;
+    return directory ? perms | fs::perms::owner_all : perms;
+}
+
+std::string directory_header(const Entry &e) {
+    return "D " + octal(e.mode) + " " + e.path + "\n";
+}
+
+std::string file_header(const Entry &e) {
+    return "F " + std::to_string(e.size) + " " + octal(e.mode) + " " + e.path + "\n";
+}
+
+std::uint64_t parse_number(const std::string &token, const int &base, const std::string &line) {
+    std::uint64_t out = 0;
+    auto [end, ec] = std::from_chars(token.data(), token.data() + token.size(), out, base);
+    if (token.empty() || ec != std::errc() || end != token.data() + token.size()) {
+        throw std::runtime_error("invalid_pack: Malformed record: " + line);
+    }
+    return out;
+}
+
+} // namespace
+
+// writer
+
+Writer::Writer(const std::string &dir) : dir(dir) {
+    namespace fs = std::filesystem;
+    if (!fs::is_directory(dir)) {
+        throw std::runtime_error("directory_not_found: Directory does not exist: " + dir);
+    }
+    // symlinks are skipped, never followed; leftovers of interrupted transfers are not content
+    for (const auto &item : fs::recursive_directory_iterator(dir)) {
+        const fs::file_status status = item.symlink_status();
+        const std::string name = item.path().filename().string();
+        if (fs::is_symlink(status) || name == PART_NAME || (!fs::is_directory(status) && !fs::is_regular_file(status))) {
+            continue;
+        }
+        Entry e;
+        e.directory = fs::is_directory(status);
+        e.path = item.path().lexically_relative(dir).generic_string();
+        e.mode = static_cast<unsigned>(status.permissions() & fs::perms::all);
+        e.size = e.directory ? 0 : static_cast<std::uint64_t>(item.file_size());
+        if (e.path.find('\n') != std::string::npos) {
+            throw std::runtime_error("invalid_path: Cannot pack a path containing a newline: " + item.path().string());
+        }
+        this->entries.push_back(std::move(e));
+    }
+    std::sort(this->entries.begin(), this->entries.end(), [](const Entry &a, const Entry &b) { return a.path < b.path; });
+
+    this->total = std::strlen(MAGIC) + 2; // "E\n"
+    for (const Entry &e : this->entries) {
+        if (e.directory) {
+            this->total += directory_header(e).size();
+        } else {
+            this->total += file_header(e).size() + e.size + 2 + DIGEST_HEX + 1;
+            this->file_count++;
+        }
+    }
+}
+
+void Writer::nextRecord() {
+    this->pending.clear();
+    this->pending_pos = 0;
+    if (this->in_file) {
+        this->pending = "H " + this->file_hash.hex() + "\n";
+        this->in_file = false;
+        this->file.close();
+        return;
+    }
+    if (this->index == this->entries.size()) {
+        this->pending = "E\n";
+        this->ended = true;
+        return;
+    }
+    const Entry &e = this->entries[this->index++];
+    if (e.directory) {
+        this->pending = directory_header(e);
+        return;
+    }
+    const std::string path = this->dir + "/" + e.path;
+    this->file.close();
+    this->file.clear();
+    this->file.open(path, std::ios::binary);
+    if (!this->file) {
+        throw std::runtime_error("file_open_failed: Failed to open file for reading (path: " + path + ")");
+    }
+    this->pending = file_header(e);
+    this->file_left = e.size;
+    this->file_hash = StreamHash();
+    this->in_file = true;
+}
+
+size_t Writer::read(char *out, const size_t &size) {
+    size_t n = 0;
+    while (n < size) {
+        if (this->pending_pos < this->pending.size()) {
+            const size_t take = std::min(size - n, this->pending.size() - this->pending_pos);
+            std::memcpy(out + n, this->pending.data() + this->pending_pos, take);
+            this->pending_pos += take;
+            n += take;
+        } else if (this->in_file && this->file_left > 0) {
+            const size_t want = static_cast<size_t>(std::min<std::uint64_t>(size - n, this->file_left));
+            this->file.read(out + n, static_cast<std::streamsize>(want));
+            const std::streamsize got = this->file.gcount();
+            if (got <= 0) {
+                throw std::runtime_error("file_changed: " + this->dir + "/" + this->entries[this->index - 1].path + " shrank while it was packed");
+            }
+            this->file_hash.update(out + n, static_cast<size_t>(got));
+            this->file_left -= static_cast<std::uint64_t>(got);
+            n += static_cast<size_t>(got);
+        } else if (!this->ended || this->in_file) {
+            this->nextRecord();
+        } else {
+            break;
+        }
+    }
+    this->pos += n;
+    return n;
+}
+
+void Writer::skip(const std::uint64_t &offset, StreamHash &hash) {
+    BufferPool::Buffer buffer = BufferPool::global().acquire(1024 * 1024);
+    while (this->pos < offset) {
+        const size_t n = this->read(buffer.data(), static_cast<size_t>(std::min<std::uint64_t>(buffer.size(), offset - this->pos)));
+        if (n == 0) {
+            throw std::runtime_error("invalid_offset: Offset " + std::to_string(offset) + " is past the end of the pack");
+        }
+        hash.update(buffer.data(), n);
+    }
+}
+
+// reader
+
+Reader::Reader(const std::string &dir, OnFile on_file) : dir(dir), on_file(std::move(on_file)) {}
+
+Reader::Reader(const std::string &dir, const std::uint64_t &offset, const StreamHash &hash, OnFile on_file) : Reader(dir, std::move(on_file)) {
+    if (offset > 0) {
+        this->state = State::Header;
+        this->pos = offset;
+        this->boundary_pos = offset;
+        this->stream_hash = hash;
+        this->boundary_hash = hash;
+    }
+}
+
+std::string Reader::target(const std::string &path) const {
+    namespace fs = std::filesystem;
+    const fs::path p(path);
+    bool safe = !path.empty() && !p.is_absolute() && p.lexically_normal().generic_string() == path;
+    for (const auto &part : p) {
+        safe = safe && part != ".." && part != "." && !part.empty();
+    }
+    if (!safe) {
+        throw std::runtime_error("invalid_pack: Unsafe path in pack: " + path);
+    }
+    // the placeholder of the transfer itself lives there, and in a user root the server's own files
+    const std::string top = path.substr(0, path.find('/'));
+    if (top == PART_NAME || (this->reserved && this->reserved(top))) {
+        throw std::runtime_error("invalid_pack: Reserved name in pack: " + path);
+    }
+    return this->dir + "/" + path;
+}
+
+void Reader::feed(const char *data, const size_t &size) {
+    size_t i = 0;
+    while (i < size) {
+        if (this->state == State::Data) {
+            const size_t take = static_cast<size_t>(std::min<std::uint64_t>(size - i, this->file_left));
+            this->file.write(data + i, static_cast<std::streamsize>(take));
+            if (!this->file) {
+                throw std::runtime_error("file_write_failed: Failed to write to file (path: " + this->file_path + ".part)");
+            }
+            this->file_hash.update(data + i, take);
+            this->stream_hash.update(data + i, take);
+            this->file_left -= take;
+            this->pos += take;
+            i += take;
+            if (this->file_left == 0) {
+                this->state = State::Trailer;
+            }
+            continue;
+        }
+        if (this->state == State::Done) {
+            throw std::runtime_error("invalid_pack: Data after the end of the pack");
+        }
+
+        // record lines
+        const char *newline = static_cast<const char *>(std::memchr(data + i, '\n', size - i));
+        const size_t take = newline ? static_cast<size_t>(newline - (data + i)) + 1 : size - i;
+        this->stream_hash.update(data + i, take);
+        this->pos += take;
+        this->line.append(data + i, newline ? take - 1 : take);
+        i += take;
+        if (this->line.size() > MAX_LINE) {
+            throw std::runtime_error("invalid_pack: Record header too long");
+        }
+        if (newline) {
+            std::string complete = std::move(this->line);
+            this->line.clear();
+            this->onLine(complete);
+        }
+    }
+}
+
+void Reader::onLine(const std::string &record) {
+    namespace fs = std::filesystem;
+    switch (this->state) {
+        case State::Magic:
+            if (record + "\n" != MAGIC) {
+                throw std::runtime_error("invalid_pack: Not a minidrive pack");
+            }
+            this->state = State::Header;
+            this->finishEntry();
+            return;
+        case State::Trailer: {
+            if (record.size() != 2 + DIGEST_HEX || !record.starts_with("H ")) {
+                throw std::runtime_error("invalid_pack: Missing digest after " + this->file_path);
+            }
+            this->file.close();
+            const std::string part = this->file_path + ".part";
+            if (record.substr(2) != this->file_hash.hex()) {
+                std::error_code ec;
+                fs::remove(part, ec);
+                throw std::runtime_error("integrity_error: Digest mismatch for " + this->file_path);
+            }
+            const Finished finished{this->file_path, this->file_size, this->file_mode};
+            this->changed_dirs.insert(fs::path(this->file_path).parent_path().string());
+            if (this->deferred) {
+                this->finished.push_back(finished);
+                this->waiting.push_back(part);
+            } else {
+                this->rename(finished);
+            }
+            this->file_count++;
+            this->byte_count += this->file_size;
+            this->state = State::Header;
+            this->finishEntry();
+            return;
+        }
+        case State::Header:
+            break;
+        default:
+            throw std::runtime_error("invalid_pack: Unexpected record");
+    }
+
+    if (record == "E") {
+        this->state = State::Done;
+        this->finishEntry();
+        return;
+    }
+    // "D <mode> <path>" / "F <size> <mode> <path>"
+    const bool is_file = record.starts_with("F ");
+    if (!is_file && !record.starts_with("D ")) {
+        throw std::runtime_error("invalid_pack: Unknown record: " + record.substr(0, 64));
+    }
+    size_t start = 2;
+    std::uint64_t size = 0;
+    if (is_file) {
+        const size_t space = record.find(' ', start);
+        if (space == std::string::npos) {
+            throw std::runtime_error("invalid_pack: Malformed record: " + record);
+        }
+        size = parse_number(record.substr(start, space - start), 10, record);
+        start = space + 1;
+    }
+    const size_t space = record.find(' ', start);
+    if (space == std::string::npos) {
+        throw std::runtime_error("invalid_pack: Malformed record: " + record);
+    }
+    const unsigned mode = static_cast<unsigned>(parse_number(record.substr(start, space - start), 8, record));
+    const std::string path = this->target(record.substr(space + 1));
+
+    if (!is_file) {
+        this->changed_dirs.insert(fs::path(path).parent_path().string());
+        fs::create_directories(path);
+        std::error_code ec;
+        fs::permissions(path, unpacked_perms(mode, true), ec);
+        this->finishEntry();
+        return;
+    }
+    const fs::path parent = fs::path(path).parent_path();
+    fs::create_directories(parent);
+    this->file_path = path;
+    this->file.close();
+    this->file.clear();
+    this->file.open(path + ".part", std::ios::binary | std::ios::trunc);
+    if (!this->file) {
+        throw std::runtime_error("file_open_failed: Failed to open file for writing (path: " + path + ".part)");
+    }
+    this->file_size = size;
+    this->file_left = size;
+    this->file_mode = mode;
+    this->file_hash = StreamHash();
+    this->state = size > 0 ? State::Data : State::Trailer;
+}
+
+std::vector<std::string> Reader::commit() {
+    for (const auto &finished : this->finished) {
+        this->rename(finished);
+    }
+    this->finished.clear();
+    this->waiting.clear();
+    std::vector<std::string> dirs(this->changed_dirs.begin(), this->changed_dirs.end());
+    this->changed_dirs.clear();
+    return dirs;
+}
+
+void Reader::rename(const Finished &finished) {
+    namespace fs = std::filesystem;
+    // same as a single upload: a file another session holds is not replaced under it
+    LockTable::Guard target_lock;
+    LockTable::Key key;
+    if (LockTable::keyOf(finished.path, key)) {
+        target_lock = LockTable::global().acquire(key, LockTable::Mode::Exclusive, finished.path);
+    }
+    if (this->on_file) {
+        this->on_file(finished.path, finished.size);
+    }
+    fs::rename(finished.path + ".part", finished.path);
+    std::error_code ec;
+    fs::permissions(finished.path, unpacked_perms(finished.mode, false), ec);
+}
+
+void Reader::finishEntry() {
+    this->boundary_pos = this->pos;
+    this->boundary_hash = this->stream_hash;
+}
+
+// socket helpers
+
+size_t recv_pack_chunk(const int &fd, Reader &reader, const size_t &chunk_size) {
+    BufferPool::Buffer buffer = BufferPool::global().acquire(chunk_size);
+    ssize_t recvd = ::recv(fd, buffer.data(), std::min(chunk_size, buffer.size()), 0);
+    if (recvd < 0) {
+        if (errno == ECONNRESET) {
+            throw std::runtime_error("connection_closed: Connection reset by remote node");
+        }
+        throw std::runtime_error("recv: Failed to receive pack chunk");
+    }
+    if (recvd == 0) {
+        throw std::runtime_error("connection_closed: Connection closed by remote node");
+    }
+    reader.feed(buffer.data(), static_cast<size_t>(recvd));
+    return static_cast<size_t>(recvd);
+}
+
+size_t send_pack_chunk(const int &fd, Writer &writer, const size_t &chunk_size, StreamHash *hash) {
+    BufferPool::Buffer buffer = BufferPool::global().acquire(chunk_size);
+    const size_t n = writer.read(buffer.data(), std::min(chunk_size, buffer.size()));
+    if (n == 0) {
+        throw std::runtime_error("file_read_failed: Pack stream ended early");
+    }
+    if (hash) {
+        hash->update(buffer.data(), n);
+    }
+    size_t sent_total = 0;
+    while (sent_total < n) {
+        ssize_t sent = ::send(fd, buffer.data() + sent_total, n - sent_total, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("send_failed: Failed to send pack chunk");
+        }
+        if (sent == 0) {
+            throw std::runtime_error("connection_closed: Connection closed during transfer");
+        }
+        sent_total += static_cast<size_t>(sent);
+    }
+    return sent_total;
+}
+
+} // namespace pack
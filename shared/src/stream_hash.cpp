@@ -0,0 +1,93 @@
+#include "minidrive/stream_hash.hpp"
+#include "minidrive/buffer_pool.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+StreamHash::StreamHash() {
+    if (sodium_init() < 0) {
+        throw std::runtime_error("sodium_init: Failed to initialise libsodium");
+    }
+    crypto_generichash_init(&this->state, nullptr, 0, DIGEST_BYTES);
+}
+
+void StreamHash::update(const char *data, const size_t &size) {
+    crypto_generichash_update(&this->state, reinterpret_cast<const unsigned char *>(data), size);
+}
+
+std::string StreamHash::hex() const {
+    // finalising consumes the state, so work on a copy
+    crypto_generichash_state copy = this->state;
+    unsigned char digest[DIGEST_BYTES];
+    crypto_generichash_final(&copy, digest, DIGEST_BYTES);
+    char out[DIGEST_BYTES * 2 + 1];
+    sodium_bin2hex(out, sizeof(out), digest, DIGEST_BYTES);
+    return out;
+}
+
+std::string StreamHash::save() const {
+    std::string out(sizeof(this->state) * 2 + 1, '\0');
+    sodium_bin2hex(out.data(), out.size(), reinterpret_cast<const unsigned char *>(&this->state), sizeof(this->state));
+    out.pop_back();
+    return out;
+}
+
+bool StreamHash::restore(const std::string &saved) {
+    if (saved.size() != sizeof(this->state) * 2) {
+        return false;
+    }
+    crypto_generichash_state loaded;
+    size_t len = 0;
+    if (sodium_hex2bin(reinterpret_cast<unsigned char *>(&loaded), sizeof(loaded), saved.c_str(), saved.size(), nullptr, &len, nullptr) != 0 || len != sizeof(loaded)) {
+        return false;
+    }
+    this->state = loaded;
+    return true;
+}
+
+StreamHash StreamHash::ofPrefix(const std::string &path, const size_t &bytes) {
+    StreamHash hash;
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("file_open_failed: Failed to open file for hashing (path: " + path + ")");
+    }
+    BufferPool::Buffer buffer = BufferPool::global().acquire(1024 * 1024);
+    size_t remaining = bytes;
+    while (remaining > 0) {
+        in.read(buffer.data(), static_cast<std::streamsize>(std::min(remaining, buffer.size())));
+        const std::streamsize n = in.gcount();
+        if (n <= 0) {
+            throw std::runtime_error("file_read_failed: File is shorter than the resume offset (path: " + path + ")");
+        }
+        hash.update(buffer.data(), static_cast<size_t>(n));
+        remaining -= static_cast<size_t>(n);
+    }
+    return hash;
+}
+
+std::string digest_line(const std::string &hex) {
+    return std::string(StreamHash::LABEL) + " " + hex;
+}
+
+std::string find_digest(const std::string &msg) {
+    const std::string label = std::string(StreamHash::LABEL) + " ";
+    const size_t pos = msg.find(label);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    const size_t start = pos + label.size();
+    const size_t end = msg.find_first_not_of("0123456789abcdef", start);
+    return msg.substr(start, (end == std::string::npos ? msg.size() : end) - start);
+}
+
+void verify_digest(const std::string &response, const StreamHash &hash, const std::string &path) {
+    if (response.starts_with("ERROR")) {
+        throw std::runtime_error(response.substr(6));
+    }
+    const std::string remote = find_digest(response);
+    const std::string local = hash.hex();
+    if (remote != local) {
+        throw std::runtime_error("integrity_error: " + std::string(StreamHash::LABEL) + " mismatch for " + path + " (server " + (remote.empty() ? "none" : remote) + ", local " + local + ")");
+    }
+}
@@ -1,21 +1,68 @@
 #include "minidrive/transfer_state.hpp"
-#include <iostream>
+#include "minidrive/helpers.hpp"
+#include <cstdio>
+#include <mutex>
+#include <spdlog/spdlog.h>
+
+namespace {
+
+// one read-modify-write of .transfers_state at a time (client resume workers and the server's
+// filesystem executor run on their own threads)
+std::mutex state_mutex;
+
+TransferState::Sync journal_sync; // set once at startup
+
+// queues the journal and its directory (which a rename or the first append changes) for syncing
+void journal_changed(const std::string& path) {
+    if (journal_sync) {
+        const size_t slash = path.find_last_of('/');
+        journal_sync({path, slash == std::string::npos ? "." : path.substr(0, slash)});
+    }
+}
+
+// replaces the journal with `lines`; in durable mode the new contents are renamed over the old ones
+// whole, and reach the disk with the rename on filesystems that flush a file replacing another
+// before the rename itself (ext4 auto_da_alloc, btrfs)
+void write_lines(const std::string& path, const std::vector<std::string>& lines) {
+    const std::string target = journal_sync ? path + ".tmp" : path;
+    {
+        std::ofstream outfile(target, std::ios::binary | std::ios::trunc);
+        if (!outfile) {
+            throw std::runtime_error("file_open_failed: Failed to open transfers state file for writing");
+        }
+        for (const auto& l : lines) {
+            outfile << l << "\n";
+        }
+    }
+    if (journal_sync) {
+        if (std::rename(target.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("file_write_failed: Failed to replace transfers state file");
+        }
+        journal_changed(path);
+    }
+}
+
+} // namespace
+
+void TransferState::setDurable(Sync sync) {
+    journal_sync = std::move(sync);
+}
+
 void TransferState::addTransfer(const std::string& user_dir, const Transfer& transfer) {
+    std::lock_guard<std::mutex> lock(state_mutex);
     // add transfer to .transfers_state file in user_dir
     std::ofstream outfile(user_dir + "/.transfers_state", std::ios::binary | std::ios::app);
     if (!outfile) {
         throw std::runtime_error("file_open_failed: Failed to open transfers state file for writing");
     }
-    outfile << transfer.local_path << ":" << transfer.remote_path << ":" << transfer.bytes_completed << ":" << transfer.total_bytes << ":" << transfer.timestamp << "\n";
-    
-    // create timer for removing transfer after TRANSFER_TIMEOUT_MINUTES minutes
-    std::thread([user_dir, transfer]() {
-        std::this_thread::sleep_for(std::chrono::minutes(TRANSFER_TIMEOUT_MINUTES));
-        TransferState::removeTransfer(user_dir, transfer.local_path);
-    }).detach();
+    outfile << transfer.local_path << ":" << transfer.remote_path << ":" << transfer.bytes_completed << ":" << transfer.total_bytes << ":" << transfer.timestamp << ":" << transfer.hash_state << "\n";
+    outfile.close();
+    journal_changed(user_dir + "/.transfers_state");
+    // entries older than TRANSFER_TIMEOUT_MINUTES are dropped by clearTransfers, before every resume offer
 }
 
-void TransferState::updateProgress(const std::string& user_dir, const std::string& remote_path, size_t bytes) {
+void TransferState::updateProgress(const std::string& user_dir, const std::string& remote_path, size_t bytes, const std::string& hash_state) {
+    std::lock_guard<std::mutex> lock(state_mutex);
     // open .transfers_state file
     const std::string path = user_dir + "/.transfers_state";
     std::ifstream infile(path, std::ios::binary);
@@ -39,6 +86,17 @@ void TransferState::updateProgress(const std::string& user_dir, const std::strin
             if (pos3 != std::string::npos) {
                 line.replace(pos2 + 1, pos3 - pos2 - 1, std::to_string(bytes));
                 updated = true;
+
+                // hash state is the last field, after the timestamp (older lines have none)
+                size_t total_end = line.find(':', line.find(':', pos2 + 1) + 1);
+                if (!hash_state.empty() && total_end != std::string::npos) {
+                    size_t timestamp_end = line.find(':', total_end + 1);
+                    if (timestamp_end == std::string::npos) {
+                        line += ":" + hash_state;
+                    } else {
+                        line.replace(timestamp_end + 1, std::string::npos, hash_state);
+                    }
+                }
             }
         }
         lines.push_back(line);
@@ -50,21 +108,16 @@ void TransferState::updateProgress(const std::string& user_dir, const std::strin
         // nothing to change
         return;
     }
-    std::ofstream outfile(path, std::ios::binary | std::ios::trunc);
-    if (!outfile) {
-        throw std::runtime_error("file_open_failed: Failed to open transfers state file for writing");
-    }
-    for (const auto& l : lines) {
-        outfile << l << "\n";
-    }
+    write_lines(path, lines);
 }
 
 void TransferState::removeTransfer(const std::string& user_dir, const std::string& local_path) {
+    std::lock_guard<std::mutex> lock(state_mutex);
     // open .transfers_state file
     const std::string path = user_dir + "/.transfers_state";
     std::ifstream infile(path, std::ios::binary);
     if (!infile) {
-        throw std::runtime_error("file_open_failed: Failed to open transfers state file for reading");
+        return; // no transfers state file -> nothing to remove
     }
 
     // read all lines except the one to remove
@@ -85,16 +138,11 @@ void TransferState::removeTransfer(const std::string& user_dir, const std::strin
     infile.close();
 
     // rewrite .transfers_state file
-    std::ofstream outfile(path, std::ios::binary | std::ios::trunc);
-    if (!outfile) {
-        throw std::runtime_error("file_open_failed: Failed to open transfers state file for writing");
-    }
-    for (const auto& l : lines) {
-        outfile << l << "\n";
-    }
+    write_lines(path, lines);
 }
 
 std::vector<TransferState::Transfer> TransferState::getActiveTransfers(const std::string& user_dir) {
+    std::lock_guard<std::mutex> lock(state_mutex);
     std::vector<Transfer> transfers;
 
     // open .transfers_state file
@@ -120,10 +168,11 @@ std::vector<TransferState::Transfer> TransferState::getActiveTransfers(const std
         transfer.local_path = line.substr(0, pos1);
         transfer.remote_path = line.substr(pos1 + 1, pos2 - pos1 - 1);
         transfer.bytes_completed = static_cast<size_t>(std::stoull(line.substr(pos2 + 1, pos3 - pos2 - 1)));
-        std::cout << "Parsed bytes_completed: " << transfer.bytes_completed << std::endl;
         transfer.total_bytes = static_cast<size_t>(std::stoull(line.substr(pos3 + 1, pos4 - pos3 - 1)));
-        std::cout << "Parsed total_bytes: " << transfer.total_bytes << std::endl;
-        transfer.timestamp = line.substr(pos4 + 1);
+        spdlog::debug("parsed transfer remote={} bytes_completed={} total_bytes={}", transfer.remote_path, transfer.bytes_completed, transfer.total_bytes);
+        size_t pos5 = line.find(':', pos4 + 1);
+        transfer.timestamp = line.substr(pos4 + 1, pos5 == std::string::npos ? std::string::npos : pos5 - pos4 - 1);
+        transfer.hash_state = pos5 == std::string::npos ? "" : line.substr(pos5 + 1);
 
         transfers.push_back(transfer);
     }
@@ -132,6 +181,7 @@ std::vector<TransferState::Transfer> TransferState::getActiveTransfers(const std
 }
 
 void TransferState::clearTransfers(const std::string& user_dir) {
+    std::lock_guard<std::mutex> lock(state_mutex);
     const std::string path = user_dir + "/.transfers_state";
 
     // read existing lines
@@ -154,7 +204,8 @@ void TransferState::clearTransfers(const std::string& user_dir) {
             continue;
         }
 
-        std::string timestamp_str = line.substr(pos4 + 1);
+        size_t pos5 = line.find(':', pos4 + 1);
+        std::string timestamp_str = line.substr(pos4 + 1, pos5 == std::string::npos ? std::string::npos : pos5 - pos4 - 1);
         try {
             unsigned long long ts = std::stoull(timestamp_str);
             // keep if not older than timeout
@@ -169,11 +220,39 @@ void TransferState::clearTransfers(const std::string& user_dir) {
     infile.close();
 
     // rewrite .transfers_state file with kept lines
-    std::ofstream outfile(path, std::ios::binary | std::ios::trunc);
-    if (!outfile) {
-        throw std::runtime_error("file_open_failed: Failed to open transfers state file for writing");
+    write_lines(path, keep);
+}
+
+std::string TransferState::formatOffer(const std::vector<Transfer>& transfers) {
+    if (transfers.empty()) {
+        return "RESUME";
     }
-    for (const auto& l : keep) {
-        outfile << l << "\n";
+    std::string offer = "RESUME " + std::to_string(transfers.size());
+    for (const auto& transfer : transfers) {
+        offer += "\n" + transfer.local_path + " " + transfer.remote_path + " " + std::to_string(transfer.bytes_completed) + " " + std::to_string(transfer.total_bytes);
     }
-}
\ No newline at end of file
+    return offer;
+}
+
+std::vector<TransferState::Transfer> TransferState::parseOffer(const std::string& offer) {
+    if (!is_cmd(offer, "RESUME")) {
+        throw std::runtime_error("unknown_response: Expected RESUME, got " + offer);
+    }
+    std::vector<Transfer> transfers;
+    size_t start = offer.find('\n');
+    while (start != std::string::npos) {
+        size_t end = offer.find('\n', start + 1);
+        std::vector<std::string> parts = split_cmd(offer.substr(start + 1, end == std::string::npos ? std::string::npos : end - start - 1));
+        if (parts.size() != 4) {
+            throw std::runtime_error("invalid_response: Malformed RESUME offer line");
+        }
+        Transfer transfer;
+        transfer.local_path = parts[0];
+        transfer.remote_path = parts[1];
+        transfer.bytes_completed = static_cast<size_t>(std::stoull(parts[2]));
+        transfer.total_bytes = static_cast<size_t>(std::stoull(parts[3]));
+        transfers.push_back(transfer);
+        start = end;
+    }
+    return transfers;
+}
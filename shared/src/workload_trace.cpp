@@ -0,0 +1,146 @@
+#include "minidrive/workload_trace.hpp"
+
+#include <stdexcept>
+
+namespace workload {
+
+namespace {
+
+constexpr std::uint64_t MAX_STRING = 16 * 1024 * 1024; // a BATCH body can run to thousands of lines
+
+const char *const OP_NAMES[static_cast<size_t>(Op::Count)] = {
+    "AUTH", "LIST", "DELETE", "CD", "MKDIR", "RMDIR", "MOVE", "COPY", "EXIT", "UPLOAD", "DOWNLOAD", "DU", "BATCH", "UPLOAD_PACK", "DOWNLOAD_PACK", "UPLOAD_PIPELINED",
+};
+
+void put_varint(std::ofstream &out, std::uint64_t v) {
+    char buf[10];
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = static_cast<char>((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = static_cast<char>(v);
+    out.write(buf, static_cast<std::streamsize>(n));
+}
+
+void put_string(std::ofstream &out, const std::string &s) {
+    put_varint(out, s.size());
+    out.write(s.data(), static_cast<std::streamsize>(s.size()));
+}
+
+std::uint8_t get_byte(std::ifstream &in) {
+    int c = in.get();
+    if (c == std::ifstream::traits_type::eof()) {
+        throw std::runtime_error("invalid_trace: Unexpected end of trace file");
+    }
+    return static_cast<std::uint8_t>(c);
+}
+
+std::uint64_t get_varint(std::ifstream &in) {
+    std::uint64_t v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        std::uint8_t b = get_byte(in);
+        v |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return v;
+        }
+    }
+    throw std::runtime_error("invalid_trace: Varint too long");
+}
+
+std::string get_string(std::ifstream &in) {
+    std::uint64_t len = get_varint(in);
+    if (len > MAX_STRING) {
+        throw std::runtime_error("invalid_trace: String too long (" + std::to_string(len) + " bytes)");
+    }
+    std::string s(static_cast<size_t>(len), '\0');
+    if (!in.read(s.data(), static_cast<std::streamsize>(len))) {
+        throw std::runtime_error("invalid_trace: Unexpected end of trace file");
+    }
+    return s;
+}
+
+} // namespace
+
+const char *op_name(const Op &op) {
+    size_t i = static_cast<size_t>(op);
+    return i < static_cast<size_t>(Op::Count) ? OP_NAMES[i] : "UNKNOWN";
+}
+
+void TraceWriter::open(const std::string &path, const std::string &user, const std::uint64_t &start_us) {
+    this->out.open(path, std::ios::binary | std::ios::trunc);
+    if (!this->out) {
+        throw std::runtime_error("file_open_failed: Failed to open workload trace for writing (path: " + path + ")");
+    }
+    this->out.write(MAGIC, sizeof(MAGIC));
+    this->out.put(static_cast<char>(VERSION));
+    put_varint(this->out, start_us);
+    put_string(this->out, user);
+}
+
+void TraceWriter::append(const Record &record) {
+    if (!this->out.is_open()) {
+        return;
+    }
+    this->out.put(static_cast<char>(record.op));
+    this->out.put(record.ok ? 0 : 1);
+    put_varint(this->out, record.offset_us);
+    put_varint(this->out, record.duration_us);
+    put_varint(this->out, record.bytes);
+    this->out.put(static_cast<char>(record.args.size()));
+    for (const auto &arg : record.args) {
+        put_string(this->out, arg);
+    }
+}
+
+void TraceWriter::close() {
+    if (this->out.is_open()) {
+        this->out.close();
+    }
+}
+
+Trace read_trace(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("file_open_failed: Failed to open workload trace (path: " + path + ")");
+    }
+
+    char magic[sizeof(MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || std::string(magic, sizeof(magic)) != std::string(MAGIC, sizeof(MAGIC))) {
+        throw std::runtime_error("invalid_trace: Not a workload trace (path: " + path + ")");
+    }
+    std::uint8_t version = get_byte(in);
+    if (version == 0 || version > VERSION) {
+        throw std::runtime_error("invalid_trace: Unsupported trace version " + std::to_string(version));
+    }
+
+    Trace trace;
+    trace.start_us = get_varint(in);
+    trace.user = get_string(in);
+
+    // a session cut short by a crash may leave a partial last record; keep everything before it
+    while (in.peek() != std::ifstream::traits_type::eof()) {
+        try {
+            Record r;
+            std::uint8_t op = get_byte(in);
+            if (op >= static_cast<std::uint8_t>(Op::Count)) {
+                throw std::runtime_error("invalid_trace: Unknown op " + std::to_string(op));
+            }
+            r.op = static_cast<Op>(op);
+            r.ok = get_byte(in) == 0;
+            r.offset_us = get_varint(in);
+            r.duration_us = get_varint(in);
+            r.bytes = get_varint(in);
+            std::uint8_t argc = get_byte(in);
+            for (std::uint8_t i = 0; i < argc; ++i) {
+                r.args.push_back(get_string(in));
+            }
+            trace.records.push_back(std::move(r));
+        } catch (const std::exception &) {
+            break;
+        }
+    }
+    return trace;
+}
+
+} // namespace workload
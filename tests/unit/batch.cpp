@@ -0,0 +1,206 @@
+#include "check.hpp"
+#include "fs_executor.hpp"
+#include "server_config.hpp"
+#include "session.hpp"
+#include "usage.hpp"
+#include "minidrive/lock_table.hpp"
+#include "minidrive/helpers.hpp"
+
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string ROOT = scratch_dir("batch");
+const std::string HOME = ROOT + "/public";
+
+// one public session on a socketpair; requests run to their reply, executor work included
+class Client {
+public:
+    Client() : executor(2) {
+        this->config.root = ROOT;
+        fs::create_directories(HOME);
+        CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, this->fds) == 0);
+        this->session = std::make_unique<Session>(this->fds[0], this->config, this->executor, [](int) {});
+    }
+
+    ~Client() {
+        this->session.reset();
+        ::close(this->fds[0]);
+        ::close(this->fds[1]);
+    }
+
+    std::string request(const std::string &msg) {
+        this->session->onMessage(msg);
+        while (this->session->getState() == Session::State::Busy) {
+            pollfd pfd{this->executor.wakeFd(), POLLIN, 0};
+            ::poll(&pfd, 1, 1000);
+            this->executor.drain();
+        }
+        return recv_msg(this->fds[1]);
+    }
+
+    // a second reply to the same request
+    std::string next() { return recv_msg(this->fds[1]); }
+
+private:
+    ServerConfig config;
+    FsExecutor executor;
+    int fds[2] = {-1, -1};
+    std::unique_ptr<Session> session;
+};
+
+usage::Totals totals() {
+    return usage::for_directory(HOME).totals(HOME);
+}
+
+bool same(const usage::Totals &a, const usage::Totals &b) {
+    return a.bytes == b.bytes && a.files == b.files;
+}
+
+// batch directories left in the staging directory, kept ones included
+size_t staged() {
+    const std::string staging = HOME + "/" + usage::BATCH_STAGING;
+    return fs::exists(staging) ? static_cast<size_t>(std::distance(fs::directory_iterator(staging), fs::directory_iterator())) : 0;
+}
+
+// a failing operation puts back every earlier step, newest first, and the usage totals with them
+void test_atomic_rollback(Client &client) {
+    write_file(HOME + "/keep.txt", std::string(100, 'k'));
+    write_file(HOME + "/dir/f", std::string(50, 'f'));
+    write_file(HOME + "/dir/sub/g", std::string(5, 'g'));
+    write_file(HOME + "/m.txt", std::string(10, 'm'));
+    const usage::Totals before = totals();
+    CHECK(before.bytes == 165 && before.files == 4);
+
+    const std::string reply = client.request("BATCH ATOMIC\nDELETE keep.txt\nRMDIR dir\nMOVE m.txt moved/deeper/m.txt\nMKDIR new/deep\nDELETE missing");
+    CHECK(reply.starts_with("ERROR batch_aborted:\nOperation 5 (DELETE missing)"));
+    CHECK(reply.find("rolled back 4 of 4 completed operations") != std::string::npos);
+    CHECK(reply.find("kept in") == std::string::npos);
+
+    CHECK(read_file(HOME + "/keep.txt") == std::string(100, 'k'));
+    CHECK(read_file(HOME + "/dir/f") == std::string(50, 'f'));
+    CHECK(read_file(HOME + "/dir/sub/g") == std::string(5, 'g'));
+    CHECK(read_file(HOME + "/m.txt") == std::string(10, 'm'));
+    CHECK(!fs::exists(HOME + "/moved") && !fs::exists(HOME + "/new"));
+    CHECK(same(totals(), before));
+    CHECK(same(usage::for_directory(HOME).totals(HOME + "/dir"), {55, 2}));
+    CHECK(staged() == 0);
+
+    // the same batch without the failing line commits
+    CHECK(client.request("BATCH ATOMIC\nDELETE keep.txt\nRMDIR dir\nMOVE m.txt moved/deeper/m.txt\nMKDIR new/deep").starts_with("OK\n4 of 4"));
+    CHECK(!fs::exists(HOME + "/keep.txt") && !fs::exists(HOME + "/dir") && fs::is_directory(HOME + "/new/deep"));
+    CHECK(read_file(HOME + "/moved/deeper/m.txt") == std::string(10, 'm'));
+    CHECK(same(totals(), {10, 1}));
+    CHECK(staged() == 0);
+}
+
+// an undo step never replaces what is at the path now, and the parked data it could not put back is
+// kept (and charged) rather than deleted with the staging directory
+void test_rollback_kept(Client &client) {
+    write_file(HOME + "/d/file", "keep");
+    usage::for_directory(HOME).addTree(HOME + "/d"); // as an upload would have charged it
+    const usage::Totals before = totals();
+
+    // the MOVE fails (a directory into itself) after creating d/x, so d cannot be removed again and
+    // the RMDIR cannot be undone
+    const std::string reply = client.request("BATCH ATOMIC\nRMDIR d\nMKDIR d\nMOVE d d/x/y");
+    CHECK(reply.starts_with("ERROR batch_aborted:\nOperation 3"));
+    CHECK(reply.find("rolled back 1 of 2 completed operations") != std::string::npos);
+    const size_t at = reply.find("kept in ");
+    CHECK(at != std::string::npos);
+    const std::string kept = reply.substr(at + 8);
+    CHECK(kept.starts_with(std::string(usage::BATCH_STAGING) + "/kept-"));
+    CHECK(read_file(HOME + "/" + kept + "/0/file") == "keep");
+    CHECK(fs::is_directory(HOME + "/d/x") && !fs::exists(HOME + "/d/file"));
+    CHECK(same(totals(), before));
+
+    // at the next start, kept data stays and what a crashed batch parked is discarded
+    write_file(HOME + "/" + usage::BATCH_STAGING + "/1-1/0", "parked");
+    Session::sweepBatchStaging(ROOT);
+    CHECK(read_file(HOME + "/" + kept + "/0/file") == "keep");
+    CHECK(!fs::exists(HOME + "/" + usage::BATCH_STAGING + "/1-1"));
+    CHECK(staged() == 1);
+    fs::remove_all(HOME + "/" + usage::BATCH_STAGING);
+    Session::sweepBatchStaging(ROOT);
+}
+
+// without ATOMIC every line runs and reports on its own
+void test_per_line(Client &client) {
+    const std::string reply = client.request("BATCH\nMKDIR a\nDELETE missing\nMKDIR a\nRMDIR a");
+    CHECK(reply.starts_with("OK\n2 of 4 operations succeeded\nOK\nERROR "));
+    size_t lines = 0;
+    size_t errors = 0;
+    for (size_t at = reply.find('\n'); at != std::string::npos; at = reply.find('\n', at + 1)) {
+        lines++;
+        errors += reply.compare(at + 1, 6, "ERROR ") == 0;
+    }
+    CHECK(lines == 5 && errors == 2);
+    CHECK(reply.find("\nERROR overwrite_error:") != std::string::npos);
+    CHECK(!fs::exists(HOME + "/a"));
+
+    // malformed batches are refused before anything runs
+    CHECK(client.request("BATCH\nMKDIR b\nLIST").starts_with("ERROR invalid_argument:"));
+    CHECK(client.request("BATCH SOMETIMES\nMKDIR b").starts_with("ERROR invalid_argument:"));
+    CHECK(!fs::exists(HOME + "/b"));
+}
+
+// nothing is created at or below the server's own names in the user directory
+void test_reserved_names(Client &client) {
+    write_file(HOME + "/r.txt", "r");
+    for (const char *command : {"MOVE r.txt .usage", "COPY r.txt .usage", "MKDIR .usage", "MOVE r.txt .transfers_state", "COPY r.txt .batch-staging/x",
+                                       "MKDIR .batch-staging/x/y", "MOVE r.txt sub/../.usage.tmp", "UPLOAD 1 local .usage", "UPLOAD_PACK 1 local .batch-staging"}) {
+        CHECK(client.request(command).starts_with("ERROR access_denied:"));
+    }
+    const std::string reply = client.request("BATCH\nMOVE r.txt .usage\nCOPY r.txt .transfers_state\nMKDIR .batch-staging");
+    CHECK(reply.starts_with("OK\n0 of 3") && reply.find("\nERROR access_denied:") != std::string::npos);
+    CHECK(read_file(HOME + "/r.txt") == "r");
+    CHECK(!fs::exists(HOME + "/.transfers_state.part") && !fs::exists(HOME + "/" + usage::BATCH_STAGING));
+
+    // the same names further down are ordinary
+    CHECK(client.request("MKDIR sub/.usage").starts_with("OK"));
+    CHECK(client.request("MOVE r.txt sub/.batch-staging").starts_with("OK"));
+    CHECK(client.request("BATCH\nRMDIR sub").starts_with("OK\n1 of 1"));
+}
+
+// a finished upload does not replace a file another session is reading; its .part waits for a retry
+void test_upload_over_locked_file(Client &client) {
+    write_file(HOME + "/busy.txt", "old");
+    {
+        LockTable::Guard reader = LockTable::global().acquire(HOME + "/busy.txt", LockTable::Mode::Shared);
+        CHECK(client.request("UPLOAD 0 busy.txt busy.txt") == "READY");
+        CHECK(client.next().starts_with("ERROR file_in_use:"));
+        CHECK(read_file(HOME + "/busy.txt") == "old");
+        CHECK(fs::exists(HOME + "/busy.txt.part"));
+    }
+    CHECK(client.request("UPLOAD_PIPELINED 0 busy.txt busy.txt").starts_with("OK"));
+    CHECK(read_file(HOME + "/busy.txt").empty() && !fs::exists(HOME + "/busy.txt.part"));
+}
+
+// the staging directory is the server's own name in a user directory, so nobody can log in as it
+void test_usernames(Client &client) {
+    CHECK(client.request("AUTH .batch-staging").starts_with("ERROR invalid_argument:"));
+    CHECK(client.request("AUTH ../public").starts_with("ERROR invalid_argument:"));
+    CHECK(client.request("AUTH") == "RESUME");
+}
+
+} // namespace
+
+int main() {
+    Client client;
+    test_usernames(client);
+    test_atomic_rollback(client);
+    test_rollback_kept(client);
+    test_per_line(client);
+    test_reserved_names(client);
+    test_upload_over_locked_file(client);
+    std::cout << "batch tests passed" << std::endl;
+    return 0;
+}
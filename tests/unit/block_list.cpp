@@ -0,0 +1,79 @@
+#include "check.hpp"
+#include "minidrive/block_list.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string DIGEST_A(BlockList::DIGEST_BYTES * 2, 'a');
+const std::string DIGEST_B = "0123456789abcdef0123456789abcdef";
+
+void test_parse_valid() {
+    const BlockList empty = BlockList::parse("4096", "");
+    CHECK(empty.blockSize() == 4096);
+    CHECK(empty.count() == 0);
+    CHECK(empty.encode() == "4096");
+
+    const BlockList two = BlockList::parse("1", DIGEST_A + "," + DIGEST_B);
+    CHECK(two.count() == 2);
+    CHECK(two.encode() == "1 " + DIGEST_A + "," + DIGEST_B);
+
+    const BlockList largest = BlockList::parse(std::to_string(BlockList::MAX_BLOCK_SIZE), DIGEST_B);
+    CHECK(largest.blockSize() == BlockList::MAX_BLOCK_SIZE);
+}
+
+void test_parse_malformed_block_size() {
+    const std::vector<std::string> sizes = {"", "0", "-1", "+4", "4k", " 4", "4 ", "0x10", "99999999999999999999999", std::to_string(BlockList::MAX_BLOCK_SIZE + 1)};
+    for (const auto &size : sizes) {
+        CHECK_THROWS(BlockList::parse(size, DIGEST_A), "invalid_argument");
+    }
+}
+
+void test_parse_malformed_digests() {
+    const std::string upper = "0123456789ABCDEF0123456789ABCDEF";
+    const std::vector<std::string> malformed = {DIGEST_A.substr(1), DIGEST_A + "a", upper, DIGEST_A.substr(1) + "g", DIGEST_A + ",", "," + DIGEST_A, DIGEST_A + ",," + DIGEST_B,
+                                      DIGEST_A + " " + DIGEST_B, DIGEST_A + ";" + DIGEST_B, ",", " "};
+    for (const auto &digests : malformed) {
+        CHECK_THROWS(BlockList::parse("4096", digests), "invalid_argument");
+    }
+}
+
+// what of() lists is what parse() reads back, and match() agrees up to the first changed block
+void test_of_and_match() {
+    const std::string dir = scratch_dir("block_list");
+    const std::string path = dir + "/file";
+    std::ofstream(path, std::ios::binary) << std::string(10, 'x') << std::string(10, 'y') << std::string(5, 'z');
+
+    const BlockList listed = BlockList::of(path, 25, 10);
+    CHECK(listed.count() == 2); // the partial last block is not listed
+    const std::string encoded = listed.encode();
+    const BlockList parsed = BlockList::parse(encoded.substr(0, encoded.find(' ')), encoded.substr(encoded.find(' ') + 1));
+    CHECK(parsed.encode() == encoded);
+
+    StreamHash prefix;
+    CHECK(parsed.match(path, 25, prefix) == 20);
+    CHECK(prefix.hex() == listed.prefix(20).hex());
+    CHECK(parsed.match(path, 15, prefix) == 10); // never past the limit
+
+    std::ofstream(path, std::ios::binary) << std::string(10, 'x') << std::string(10, 'Y');
+    CHECK(parsed.match(path, 25, prefix) == 10);
+    CHECK(prefix.hex() == listed.prefix(10).hex());
+}
+
+} // namespace
+
+int main() {
+    test_parse_valid();
+    test_parse_malformed_block_size();
+    test_parse_malformed_digests();
+    test_of_and_match();
+    std::cout << "block list tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "check.hpp"
+#include "change_feed.hpp"
+#include "dir_generations.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <poll.h>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Kind = ChangeFeed::Kind;
+
+const std::string ROOT = scratch_dir("change_feed");
+
+std::string make_dir(const std::string &name) {
+    const std::string dir = DirGenerations::key(ROOT + "/" + name);
+    fs::create_directories(dir);
+    return dir;
+}
+
+bool is(const ChangeFeed::Event &event, const Kind &kind, const std::string &name, const std::string &to = "") {
+    return event.kind == kind && event.name == name && event.to == to;
+}
+
+// reads whatever inotify has for the feed, waiting up to a second for the first of it
+void read_inotify() {
+    pollfd pfd{ChangeFeed::global().inotifyFd(), POLLIN, 0};
+    CHECK(pfd.fd >= 0);
+    if (::poll(&pfd, 1, 1000) > 0) {
+        ChangeFeed::global().readInotify();
+    }
+}
+
+// created + modified = created, created + deleted = nothing, deleted + created = modified
+void test_coalescing() {
+    const std::string dir = make_dir("coalesce");
+    ChangeFeed &feed = ChangeFeed::global();
+    const auto watch = feed.subscribe(dir);
+    CHECK(!watch->pending());
+
+    feed.publish(dir, {Kind::Created, "a", "", 1});
+    feed.publish(dir, {Kind::Created, "b", "", 2});
+    feed.publish(dir, {Kind::Modified, "a", "", 3});
+    feed.publish(dir, {Kind::Deleted, "b", "", 4});
+    feed.publish(dir, {Kind::Deleted, "c", "", 5});
+    feed.publish(dir, {Kind::Created, "c", "", 6});
+    // a rename is never merged, and ends merging for both of its names
+    feed.publish(dir, {Kind::Moved, "a", "d", 7});
+    feed.publish(dir, {Kind::Modified, "d", "", 8});
+    // the server's own files and unfinished uploads are never reported
+    feed.publish(dir, {Kind::Created, "e.part", "", 9});
+    feed.publish(dir, {Kind::Modified, ".usage", "", 10});
+    CHECK(watch->pending());
+
+    const std::vector<ChangeFeed::Event> first = watch->take(2);
+    CHECK(first.size() == 2);
+    CHECK(is(first[0], Kind::Created, "a") && first[0].generation == 3);
+    CHECK(is(first[1], Kind::Modified, "c") && first[1].generation == 6);
+    const std::vector<ChangeFeed::Event> rest = watch->take(100);
+    CHECK(rest.size() == 2);
+    CHECK(is(rest[0], Kind::Moved, "a", "d"));
+    CHECK(is(rest[1], Kind::Modified, "d"));
+    CHECK(!watch->pending());
+}
+
+// a subscriber that falls MAX_QUEUED events behind gets one overflow instead
+void test_overflow() {
+    const std::string dir = make_dir("overflow");
+    ChangeFeed &feed = ChangeFeed::global();
+    const auto watch = feed.subscribe(dir);
+    const auto other = feed.subscribe(make_dir("quiet"));
+    for (size_t i = 0; i <= ChangeFeed::MAX_QUEUED; ++i) {
+        feed.publish(dir, {Kind::Created, "f" + std::to_string(i), "", i + 1});
+    }
+    const std::vector<ChangeFeed::Event> events = watch->take(ChangeFeed::MAX_QUEUED);
+    CHECK(events.size() == 1 && is(events[0], Kind::Overflow, "."));
+    CHECK(events[0].generation == ChangeFeed::MAX_QUEUED + 1);
+    CHECK(!watch->pending() && !other->pending());
+
+    // and is back to single events after that
+    feed.publish(dir, {Kind::Deleted, "f0", "", 1});
+    CHECK(watch->take(10).size() == 1);
+}
+
+// sessions report through DirGenerations; every subscriber of the directory hears it, nobody after unsubscribing
+void test_generations_publish() {
+    const std::string dir = make_dir("sessions");
+    auto first = ChangeFeed::global().subscribe(dir);
+    const auto second = ChangeFeed::global().subscribe(dir);
+    write_file(dir + "/new", "x");
+    DirGenerations::global().changed(dir + "/new", Kind::Created);
+    std::vector<ChangeFeed::Event> events = first->take(10);
+    CHECK(events.size() == 1 && is(events[0], Kind::Created, "new"));
+    CHECK(events[0].generation == DirGenerations::global().generation(dir));
+    CHECK(second->take(10).size() == 1);
+
+    first.reset();
+    fs::rename(dir + "/new", dir + "/renamed");
+    DirGenerations::global().moved(dir + "/new", dir + "/renamed");
+    events = second->take(10);
+    CHECK(events.size() == 1 && is(events[0], Kind::Moved, "new", "renamed"));
+
+    // the inotify echo of what was just published is dropped
+    read_inotify();
+    CHECK(!second->pending());
+}
+
+// changes made outside the server arrive through inotify
+void test_inotify() {
+    const std::string dir = make_dir("outside");
+    const auto watch = ChangeFeed::global().subscribe(dir);
+    write_file(dir + "/external", "x");
+    read_inotify();
+    std::vector<ChangeFeed::Event> events = watch->take(10);
+    CHECK(!events.empty() && is(events[0], Kind::Created, "external"));
+
+    // finishing an upload (x.part -> x) is a creation of x
+    write_file(dir + "/upload.part", "x");
+    fs::rename(dir + "/upload.part", dir + "/upload");
+    read_inotify();
+    events = watch->take(10);
+    CHECK(events.size() == 1 && is(events[0], Kind::Created, "upload"));
+}
+
+} // namespace
+
+int main() {
+    test_coalescing();
+    test_overflow();
+    test_generations_publish();
+    test_inotify();
+    std::cout << "change feed tests passed" << std::endl;
+    return 0;
+}
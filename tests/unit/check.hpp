@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <unistd.h>
+
+// minimal checks for the unit tests; unlike assert they stay on in release builds
+#define CHECK(cond) check_true((cond), #cond, __FILE__, __LINE__)
+#define CHECK_THROWS(expr, code) check_throws([&]() { expr; }, (code), #expr, __FILE__, __LINE__)
+
+inline void check_true(const bool &ok, const char *what, const char *file, const int &line) {
+    if (!ok) {
+        std::cerr << file << ":" << line << ": CHECK(" << what << ") failed" << std::endl;
+        std::exit(1);
+    }
+}
+
+// `run` must throw an error whose message starts with "<code>:" (the repo's "code: message" form)
+template <typename F>
+void check_throws(F run, const std::string &code, const char *what, const char *file, const int &line) {
+    try {
+        run();
+    } catch (const std::exception &e) {
+        if (std::string(e.what()).starts_with(code + ":")) {
+            return;
+        }
+        std::cerr << file << ":" << line << ": " << what << " threw \"" << e.what() << "\", expected " << code << std::endl;
+        std::exit(1);
+    }
+    std::cerr << file << ":" << line << ": " << what << " did not throw, expected " << code << std::endl;
+    std::exit(1);
+}
+
+// empty directory for one test binary under the system temp directory, removed again when the
+// process exits (a failed CHECK exits through std::exit, which still runs this cleanup)
+inline std::string scratch_dir(const std::string &name) {
+    struct Cleanup {
+        std::vector<std::string> dirs;
+        ~Cleanup() {
+            for (const auto &dir : this->dirs) {
+                std::error_code ec;
+                std::filesystem::remove_all(dir, ec);
+            }
+        }
+    };
+    static Cleanup cleanup;
+    const std::string dir = (std::filesystem::temp_directory_path() / ("minidrive_test_" + name + "_" + std::to_string(::getpid()))).string();
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    cleanup.dirs.push_back(dir);
+    return dir;
+}
+
+// replaces `path` with `content`, creating its parent directories; returns the path
+inline std::string write_file(const std::string &path, const std::string &content) {
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << content;
+    return path;
+}
+
+inline std::string read_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
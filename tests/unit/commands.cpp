@@ -0,0 +1,81 @@
+#include "check.hpp"
+#include "commands.hpp"
+#include "minidrive/helpers.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+void test_lookup() {
+    for (const auto &spec : commands::SPECS) {
+        CHECK(commands::lookup(spec.name) == &spec);
+        CHECK(&commands::spec(spec.opcode) == &spec);
+    }
+    const std::vector<std::string> unknown = {"", "list", "List", "LIST ", " LIST", "LISTX", "UPLOAD_", "UPLOAD_PACKS", "DOWNLOAD_PACK_", "X", "E", std::string("LIST\0", 5),
+                                   std::string(commands::MAX_NAME_LENGTH + 1, 'A')};
+    for (const auto &name : unknown) {
+        CHECK(commands::lookup(name) == nullptr);
+    }
+}
+
+void test_tokenize() {
+    Tokens parts;
+    CHECK(tokenize("UPLOAD 5 local remote", parts) == 4);
+    CHECK(parts[0] == "UPLOAD" && parts[1] == "5" && parts[2] == "local" && parts[3] == "remote" && parts[4].empty());
+    CHECK((commands::arg<commands::Opcode::Upload, 2>(parts)) == "remote");
+
+    // optional arguments that are not sent read as empty
+    CHECK(tokenize("LIST", parts) == 1);
+    CHECK(parts[1].empty() && (commands::arg<commands::Opcode::List, 1>(parts)).empty());
+
+    // every space separates, so a doubled one gives an empty token the handlers refuse; a trailing one adds none
+    CHECK(tokenize("MOVE a  b", parts) == 4);
+    CHECK(parts[2].empty() && parts[3] == "b");
+    CHECK(tokenize("CD ", parts) == 1);
+    CHECK(parts[1].empty());
+    CHECK(tokenize("", parts) == 0);
+
+    // tokens past MAX_TOKENS are counted, so the arity check still sees them
+    CHECK(tokenize("RESUME a b c d e f", parts) == 7);
+    CHECK(parts[MAX_TOKENS - 1] == "d");
+    CHECK(7 - 1 > commands::spec(commands::Opcode::Resume).max_args);
+}
+
+// what onMessage checks before dispatch: every declared arity tokenizes into range, one more does not
+void test_arity() {
+    Tokens parts;
+    for (const auto &spec : commands::SPECS) {
+        for (size_t n = 0; n <= spec.max_args + size_t{1}; ++n) {
+            std::string msg(spec.name);
+            for (size_t i = 0; i < n; ++i) {
+                msg += " a" + std::to_string(i);
+            }
+            const size_t arg_count = tokenize(msg, parts) - 1;
+            CHECK(arg_count == n);
+            CHECK((arg_count >= spec.min_args && arg_count <= spec.max_args) == (n >= spec.min_args && n <= spec.max_args));
+            if (n <= spec.max_args && n > 0) {
+                CHECK(parts[n] == "a" + std::to_string(n - 1));
+            }
+        }
+    }
+
+    // each command is counted under its own metric
+    for (size_t i = 0; i < commands::SPECS.size(); ++i) {
+        for (size_t j = i + 1; j < commands::SPECS.size(); ++j) {
+            CHECK(commands::SPECS[i].metric != commands::SPECS[j].metric);
+            CHECK(commands::SPECS[i].name != commands::SPECS[j].name);
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    test_lookup();
+    test_tokenize();
+    test_arity();
+    std::cout << "command table tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "check.hpp"
+#include "dir_generations.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string ROOT = scratch_dir("dir_generations");
+
+void test_key() {
+    CHECK(DirGenerations::key("/a/./b/") == "/a/b");
+    CHECK(DirGenerations::key("/a//b/../c") == "/a/c");
+    CHECK(DirGenerations::key("/") == "/");
+    CHECK(first_missing(ROOT + "/x/y/z") == ROOT + "/x");
+    CHECK(first_missing(ROOT).empty());
+}
+
+// a change bumps the directory holding it and nothing beside it
+void test_changed() {
+    DirGenerations &table = DirGenerations::global();
+    fs::create_directories(ROOT + "/a/sub");
+    fs::create_directories(ROOT + "/b");
+    const std::uint64_t a = table.generation(ROOT + "/a");
+    const std::uint64_t b = table.generation(ROOT + "/b");
+    const std::uint64_t sub = table.generation(ROOT + "/a/sub");
+
+    write_file(ROOT + "/a/file", "x");
+    table.changed(ROOT + "/a/file", ChangeFeed::Kind::Created);
+    const std::uint64_t bumped = table.generation(ROOT + "/a/");
+    CHECK(bumped > a);
+    CHECK(table.generation(ROOT + "/b") == b);
+    CHECK(table.generation(ROOT + "/a/sub") == sub);
+
+    // a rename across directories bumps both ends
+    fs::rename(ROOT + "/a/file", ROOT + "/b/file");
+    table.moved(ROOT + "/a/file", ROOT + "/b/file");
+    CHECK(table.generation(ROOT + "/a") > bumped);
+    CHECK(table.generation(ROOT + "/b") > b);
+
+    // so does bump(), which reports nothing to watchers
+    const std::uint64_t before = table.generation(ROOT + "/b");
+    table.bump(ROOT + "/b/file");
+    CHECK(table.generation(ROOT + "/b") > before);
+}
+
+// replacing a directory invalidates every listing below it without visiting them
+void test_subtree() {
+    DirGenerations &table = DirGenerations::global();
+    fs::create_directories(ROOT + "/tree/x/y");
+    const std::uint64_t y = table.generation(ROOT + "/tree/x/y");
+    const std::uint64_t other = table.generation(ROOT + "/a/sub");
+    table.changed(ROOT + "/tree", ChangeFeed::Kind::Modified);
+    CHECK(table.generation(ROOT + "/tree/x/y") > y);
+    CHECK(table.generation(ROOT + "/tree/x") == table.generation(ROOT + "/tree/x/y"));
+    CHECK(table.generation(ROOT + "/a/sub") == other);
+
+    // an entry bumped later is newer than the subtree bump
+    const std::uint64_t tree = table.generation(ROOT + "/tree/x");
+    write_file(ROOT + "/tree/x/f", "x");
+    table.changed(ROOT + "/tree/x/f", ChangeFeed::Kind::Created);
+    CHECK(table.generation(ROOT + "/tree/x") > tree);
+    CHECK(table.generation(ROOT + "/tree/x/y") == tree);
+}
+
+// the etag follows both the generation and changes made on the disk directly
+void test_etag() {
+    DirGenerations &table = DirGenerations::global();
+    const std::string dir = ROOT + "/etag";
+    fs::create_directories(dir);
+    const std::string first = table.etag(dir);
+    CHECK(table.etag(dir + "/") == first);
+
+    write_file(dir + "/outside", "x");
+    fs::last_write_time(dir, fs::last_write_time(dir) + std::chrono::seconds(1));
+    const std::string second = table.etag(dir);
+    CHECK(second != first);
+
+    table.changed(dir + "/outside", ChangeFeed::Kind::Modified);
+    const std::string third = table.etag(dir);
+    CHECK(third != second);
+    CHECK(third.substr(0, third.find('-')) == std::to_string(table.generation(dir)));
+
+    // a missing directory still has a tag, which never matches one taken while it existed
+    CHECK(table.etag(ROOT + "/missing").ends_with("-0"));
+}
+
+} // namespace
+
+int main() {
+    test_key();
+    test_changed();
+    test_subtree();
+    test_etag();
+    std::cout << "dir generations tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "check.hpp"
+#include "durability.hpp"
+
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string ROOT = scratch_dir("durability");
+
+// done callbacks run on the commit thread; this collects their outcomes
+struct Outcomes {
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t done = 0;
+    std::vector<std::string> errors;
+
+    durability::Done callback() {
+        return [this](std::exception_ptr error) {
+            std::string what;
+            if (error) {
+                try {
+                    std::rethrow_exception(error);
+                } catch (const std::exception &e) {
+                    what = e.what();
+                }
+            }
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->errors.push_back(what);
+            this->done++;
+            this->cv.notify_all();
+        };
+    }
+
+    void wait(const size_t &n) {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cv.wait(lock, [this, &n]() { return this->done >= n; });
+    }
+};
+
+void test_parse_level() {
+    CHECK(durability::parse_level("none") == durability::Level::None);
+    CHECK(durability::parse_level("on-complete") == durability::Level::OnComplete);
+    CHECK(durability::parse_level("strict") == durability::Level::Strict);
+    CHECK_THROWS(durability::parse_level("always"), "invalid_argument");
+}
+
+// many requests from many threads, sharing files and directories, over many rounds
+void test_concurrent_rounds() {
+    constexpr size_t THREADS = 8;
+    constexpr size_t PER_THREAD = 50;
+    std::vector<std::string> files;
+    for (size_t i = 0; i < 20; ++i) {
+        files.push_back(write_file(ROOT + "/f" + std::to_string(i), "data"));
+    }
+
+    Outcomes outcomes;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < PER_THREAD; ++i) {
+                durability::sync({files[(t + i) % files.size()], files[(t * i) % files.size()], ROOT}, outcomes.callback());
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    outcomes.wait(THREADS * PER_THREAD);
+    for (const auto &error : outcomes.errors) {
+        CHECK(error.empty());
+    }
+    CHECK(durability::queued() == 0);
+}
+
+// a path that cannot be synced fails only the requests that named it
+void test_failure_is_per_request() {
+    const std::string good = write_file(ROOT + "/good", "data");
+    Outcomes outcomes;
+    durability::sync({good, ROOT + "/missing"}, outcomes.callback());
+    outcomes.wait(1);
+    durability::sync({good}, outcomes.callback());
+    durability::sync({}, outcomes.callback());
+    outcomes.wait(3);
+    CHECK(outcomes.errors[0].starts_with("fsync_failed:"));
+    CHECK(outcomes.errors[1].empty());
+    CHECK(outcomes.errors[2].empty());
+}
+
+} // namespace
+
+int main() {
+    test_parse_level();
+    test_concurrent_rounds();
+    test_failure_is_per_request();
+    std::cout << "durability tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "check.hpp"
+#include "file_cache.hpp"
+#include "dir_generations.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string ROOT = scratch_dir("file_cache");
+
+// what File::send puts on the wire for the whole file
+std::string send_all(const FileCache::File &file) {
+    int fds[2];
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    size_t offset = 0;
+    while (offset < file.size()) {
+        offset += file.send(fds[0], offset, 3, nullptr);
+    }
+    ::close(fds[0]);
+    std::string out(file.size(), '\0');
+    CHECK(::recv(fds[1], out.data(), out.size(), MSG_WAITALL) == static_cast<ssize_t>(out.size()));
+    ::close(fds[1]);
+    return out;
+}
+
+void configure(const size_t &files, const std::uint64_t &bytes) {
+    ServerConfig config;
+    config.file_cache_files = files;
+    config.file_cache_bytes = bytes;
+    FileCache::global().configure(config);
+}
+
+// the first download shares the descriptor, the second loads a small file for everyone after it
+void test_share_then_load() {
+    FileCache &cache = FileCache::global();
+    configure(16, 1024 * 1024);
+    const std::string path = write_file(ROOT + "/hot", "hello world");
+
+    const auto first = cache.open(path);
+    CHECK(!first->loaded() && first->descriptor() >= 0);
+    const auto second = cache.open(path);
+    CHECK(second->loaded() && second->descriptor() == -1);
+    CHECK(cache.open(path) == second);
+    CHECK(cache.bytes() == 11);
+
+    // both versions serve the same bytes, and the first stays open for the download holding it
+    CHECK(send_all(*first) == "hello world");
+    CHECK(send_all(*second) == "hello world");
+    CHECK_THROWS(second->send(-1, 11, 1, nullptr), "file_read_failed");
+}
+
+// a changed file is opened again, whether or not a session reported the change
+void test_stale_entries() {
+    FileCache &cache = FileCache::global();
+    configure(16, 1024 * 1024);
+    const std::string path = write_file(ROOT + "/edited", "v1");
+    const auto before = cache.open(path);
+    write_file(ROOT + "/edited", "v2");
+    fs::last_write_time(path, fs::last_write_time(path) + std::chrono::seconds(1)); // past the timestamp granularity
+    CHECK(cache.open(path) != before); // same size, newer mtime
+
+    // replaced by a rename as uploads are: the download holding the old inode keeps its contents
+    const auto old = cache.open(path);
+    fs::rename(write_file(ROOT + "/edited.new", "version 3"), path);
+    const auto after = cache.open(path);
+    CHECK(after != old && after->size() == 9);
+    CHECK(send_all(*old) == "v2");
+
+    // invalidating a directory drops everything below it, not its siblings
+    const auto inside = cache.open(write_file(ROOT + "/dir/a", "a"));
+    cache.open(write_file(ROOT + "/dir.x/b", "b"));
+    const auto sibling = cache.open(ROOT + "/dir.x/b"); // loaded, cached from now on
+    const size_t cached = cache.files();
+    DirGenerations::global().bump(ROOT + "/dir");
+    CHECK(cache.files() == cached - 1);
+    CHECK(cache.open(ROOT + "/dir.x/b") == sibling);
+    CHECK(cache.open(ROOT + "/dir/a") != inside);
+
+    CHECK_THROWS(cache.open(ROOT + "/missing"), "file_open_failed");
+}
+
+// least recently used first, by count and by loaded bytes
+void test_eviction() {
+    FileCache &cache = FileCache::global();
+    configure(2, 1024 * 1024);
+    CHECK(cache.files() <= 2);
+    const auto a = cache.open(write_file(ROOT + "/lru/a", "a"));
+    cache.open(write_file(ROOT + "/lru/b", "b"));
+    CHECK(cache.open(ROOT + "/lru/a") != a); // second open loads it
+    cache.open(write_file(ROOT + "/lru/c", "c"));
+    CHECK(cache.files() == 2);
+    CHECK(cache.bytes() == 1);
+
+    configure(16, 4);
+    cache.open(write_file(ROOT + "/big", "12345"));
+    CHECK(!cache.open(ROOT + "/big")->loaded()); // larger than the whole budget
+    CHECK(cache.bytes() <= 4);
+
+    configure(0, 1024 * 1024);
+    CHECK(cache.files() == 0);
+    CHECK(cache.open(ROOT + "/lru/a")->size() == 1);
+    CHECK(cache.files() == 0);
+}
+
+} // namespace
+
+int main() {
+    test_share_then_load();
+    test_stale_entries();
+    test_eviction();
+    std::cout << "file cache tests passed" << std::endl;
+    return 0;
+}
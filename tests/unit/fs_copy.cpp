@@ -0,0 +1,90 @@
+#include "check.hpp"
+#include "fs_copy.hpp"
+#include "fs_executor.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string ROOT = scratch_dir("fs_copy");
+
+// whichever method the filesystem allows, the copy has the same bytes and permission bits
+void test_copy_file() {
+    const std::string data(3 * 1024 * 1024 + 17, 'x');
+    write_file(ROOT + "/source", data);
+    fs::permissions(ROOT + "/source", fs::perms::owner_read | fs::perms::owner_write | fs::perms::owner_exec);
+    size_t bytes = 0;
+    fscopy::copy_file(ROOT + "/source", ROOT + "/copy", bytes);
+    CHECK(bytes == data.size());
+    CHECK(read_file(ROOT + "/copy") == data);
+    CHECK(fs::status(ROOT + "/copy").permissions() == fs::status(ROOT + "/source").permissions());
+
+    // never overwrites
+    write_file(ROOT + "/existing", "keep");
+    CHECK_THROWS(fscopy::copy_file(ROOT + "/source", ROOT + "/existing", bytes), "copy_failed");
+    CHECK(read_file(ROOT + "/existing") == "keep");
+    CHECK_THROWS(fscopy::copy_file(ROOT + "/missing", ROOT + "/other", bytes), "copy_failed");
+    CHECK(!fs::exists(ROOT + "/other"));
+
+    // empty files take the copy_file_range path with nothing to copy
+    write_file(ROOT + "/empty", "");
+    bytes = 0;
+    fscopy::copy_file(ROOT + "/empty", ROOT + "/empty_copy", bytes);
+    CHECK(bytes == 0 && fs::file_size(ROOT + "/empty_copy") == 0);
+}
+
+// trees: directories and links up front, files in parallel on the executor
+void test_copy_tree() {
+    FsExecutor executor(3);
+    const std::string source = ROOT + "/tree";
+    fs::create_directories(source + "/a/b");
+    fs::create_directories(source + "/empty");
+    size_t total = 0;
+    for (int i = 0; i < 20; ++i) {
+        const std::string data(static_cast<size_t>(i) * 1000, static_cast<char>('a' + i));
+        write_file(source + (i % 2 ? "/a/f" : "/a/b/f") + std::to_string(i), data);
+        total += data.size();
+    }
+    fs::create_symlink("a/f1", source + "/link");
+    fs::create_symlink("/nonexistent", source + "/a/dangling");
+
+    const fscopy::Stats stats = fscopy::copy(source, ROOT + "/tree_copy", executor);
+    CHECK(stats.files == 20 && stats.directories == 4 && stats.symlinks == 2);
+    CHECK(stats.bytes == total);
+    CHECK(stats.reflinked + stats.kernel_copied + stats.userspace_copied == stats.files);
+    for (int i = 0; i < 20; ++i) {
+        const std::string name = (i % 2 ? "/a/f" : "/a/b/f") + std::to_string(i);
+        CHECK(read_file(ROOT + "/tree_copy" + name) == read_file(source + name));
+    }
+    CHECK(fs::is_directory(ROOT + "/tree_copy/empty"));
+    // links are recreated as links, never followed
+    CHECK(fs::is_symlink(ROOT + "/tree_copy/link") && fs::read_symlink(ROOT + "/tree_copy/link") == "a/f1");
+    CHECK(fs::is_symlink(ROOT + "/tree_copy/a/dangling"));
+
+    // an existing destination directory is left as it is
+    fs::create_directories(ROOT + "/taken");
+    write_file(ROOT + "/taken/mine", "keep");
+    CHECK_THROWS(fscopy::copy(source, ROOT + "/taken", executor), "overwrite_error");
+    CHECK(read_file(ROOT + "/taken/mine") == "keep" && !fs::exists(ROOT + "/taken/a"));
+
+    // a single file or link as the source
+    CHECK(fscopy::copy(source + "/a/f1", ROOT + "/single", executor).files == 1);
+    CHECK(read_file(ROOT + "/single") == read_file(source + "/a/f1"));
+    CHECK(fscopy::copy(source + "/link", ROOT + "/single_link", executor).symlinks == 1);
+    CHECK(fs::is_symlink(ROOT + "/single_link"));
+}
+
+} // namespace
+
+int main() {
+    test_copy_file();
+    test_copy_tree();
+    std::cout << "fs copy tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "check.hpp"
+#include "minidrive/helpers.hpp"
+
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// the peer's bytes, then EOF, read back through recv_msg
+std::string recv_raw(const std::string &raw) {
+    int fds[2];
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CHECK(::send(fds[1], raw.data(), raw.size(), 0) == static_cast<ssize_t>(raw.size()));
+    ::close(fds[1]);
+    struct Closer {
+        int fd;
+        ~Closer() { ::close(this->fd); }
+    } closer{fds[0]};
+    return recv_msg(fds[0]);
+}
+
+void test_valid() {
+    CHECK(recv_raw("5 hello") == "hello");
+    CHECK(recv_raw("0 ").empty());
+    // leading zeros never overflow, however many there are
+    CHECK(recv_raw(std::string(100, '0') + "5 hello") == "hello");
+}
+
+void test_limit() {
+    CHECK_THROWS(recv_raw(std::to_string(MAX_MESSAGE_SIZE + 1) + " x"), "invalid_message");
+    // exactly the limit is accepted by the parser, then runs into EOF
+    CHECK_THROWS(recv_raw(std::to_string(MAX_MESSAGE_SIZE) + " x"), "connection_closed");
+}
+
+// 2^64 + 5 wraps around to 5 without the check before multiplying
+void test_wraparound() {
+    CHECK_THROWS(recv_raw("18446744073709551621 hello"), "invalid_message");
+    CHECK_THROWS(recv_raw(std::string(1000, '9') + " x"), "invalid_message");
+}
+
+void test_malformed() {
+    CHECK_THROWS(recv_raw("5x hello"), "invalid_message");
+    CHECK_THROWS(recv_raw("-5 hello"), "invalid_message");
+    CHECK_THROWS(recv_raw("12"), "connection_closed");
+}
+
+} // namespace
+
+int main() {
+    test_valid();
+    test_limit();
+    test_wraparound();
+    test_malformed();
+    std::cout << "length prefix tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "check.hpp"
+#include "listing_cache.hpp"
+
+#include <iostream>
+#include <string>
+
+namespace {
+
+// relative paths follow the remote working directory, absolute ones do not
+void test_key() {
+    ListingCache cache;
+    CHECK(cache.key("") == "~");
+    CHECK(cache.key(".") == "~");
+    CHECK(cache.key("docs/") == "~/docs");
+    CHECK(cache.key("/srv/./x") == "/srv/x");
+    cache.changeDirectory("docs");
+    CHECK(cache.key("") == "~/docs");
+    CHECK(cache.key("../pics") == "~/pics");
+    cache.changeDirectory("/srv");
+    CHECK(cache.key("a") == "/srv/a");
+}
+
+void test_entries() {
+    ListingCache cache(2);
+    CHECK(cache.find("~") == nullptr);
+    cache.store("~", "1-1", "a\nb");
+    const ListingCache::Entry *entry = cache.find("~");
+    CHECK(entry != nullptr && entry->etag == "1-1" && entry->listing == "a\nb");
+
+    // storing again replaces
+    cache.store("~", "2-1", "a");
+    CHECK(cache.find("~")->etag == "2-1" && cache.find("~")->listing == "a");
+
+    // the least recently listed directory goes first; find() counts as a listing
+    cache.store("~/x", "3-1", "");
+    CHECK(cache.find("~") != nullptr);
+    cache.store("~/y", "4-1", "");
+    CHECK(cache.find("~/x") == nullptr);
+    CHECK(cache.find("~") != nullptr && cache.find("~/y") != nullptr);
+
+    cache.drop("~");
+    cache.drop("~/missing");
+    CHECK(cache.find("~") == nullptr && cache.find("~/y") != nullptr);
+
+    // a zero capacity still keeps the last listing
+    ListingCache one(0);
+    one.store("a", "1", "");
+    one.store("b", "2", "");
+    CHECK(one.find("a") == nullptr && one.find("b") != nullptr);
+}
+
+} // namespace
+
+int main() {
+    test_key();
+    test_entries();
+    std::cout << "listing cache tests passed" << std::endl;
+    return 0;
+}
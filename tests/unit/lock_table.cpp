@@ -0,0 +1,87 @@
+#include "check.hpp"
+#include "minidrive/lock_table.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string ROOT = scratch_dir("lock_table");
+
+void test_modes() {
+    LockTable table;
+    const std::string path = write_file(ROOT + "/modes", "x");
+    {
+        LockTable::Guard first = table.acquire(path, LockTable::Mode::Shared);
+        LockTable::Guard second = table.acquire(path, LockTable::Mode::Shared);
+        CHECK(first.held() && second.held());
+        CHECK_THROWS(table.acquire(path, LockTable::Mode::Exclusive), "file_in_use");
+        first.release();
+        CHECK_THROWS(table.acquire(path, LockTable::Mode::Exclusive), "file_in_use");
+    }
+    CHECK(!table.isLocked(path));
+    {
+        LockTable::Guard writer = table.acquire(path, LockTable::Mode::Exclusive);
+        CHECK(table.isLocked(path));
+        CHECK_THROWS(table.acquire(path, LockTable::Mode::Shared), "file_in_use");
+        CHECK_THROWS(table.acquire(path, LockTable::Mode::Exclusive), "file_in_use");
+
+        // a moved guard releases once, from where it ended up
+        LockTable::Guard moved = std::move(writer);
+        CHECK(!writer.held() && moved.held());
+        CHECK(table.isLocked(path));
+    }
+    CHECK(!table.isLocked(path));
+    CHECK_THROWS(table.acquire(ROOT + "/missing", LockTable::Mode::Shared), "path_not_found");
+
+    const LockTable::Stats stats = table.stats();
+    CHECK(stats.shared == 2 && stats.exclusive == 1 && stats.conflicts == 4 && stats.held == 0);
+}
+
+// every name of a file is the same lock
+void test_aliases() {
+    LockTable table;
+    const std::string path = write_file(ROOT + "/dir/target", "x");
+    const std::string link = ROOT + "/hardlink";
+    fs::create_hard_link(path, link);
+    LockTable::Guard guard = table.acquire(path, LockTable::Mode::Exclusive);
+    CHECK_THROWS(table.acquire(link, LockTable::Mode::Shared), "file_in_use");
+    CHECK_THROWS(table.acquire(ROOT + "/dir/../dir/./target", LockTable::Mode::Shared), "file_in_use");
+    CHECK(table.acquire(write_file(ROOT + "/other", "x"), LockTable::Mode::Exclusive).held());
+}
+
+// all or nothing: a busy entry deep in the tree leaves none of the others locked
+void test_tree() {
+    LockTable table;
+    write_file(ROOT + "/tree/a", "x");
+    const std::string busy = write_file(ROOT + "/tree/sub/b", "x");
+    write_file(ROOT + "/tree/sub/c", "x");
+    {
+        LockTable::Guard reader = table.acquire(busy, LockTable::Mode::Shared);
+        CHECK_THROWS(table.acquireTree(ROOT + "/tree", LockTable::Mode::Exclusive), "file_in_use");
+        CHECK(!table.isLocked(ROOT + "/tree"));
+        CHECK(!table.isLocked(ROOT + "/tree/a"));
+        CHECK(table.acquireTree(ROOT + "/tree", LockTable::Mode::Shared).size() == 5);
+    }
+    std::vector<LockTable::Guard> guards = table.acquireTree(ROOT + "/tree", LockTable::Mode::Exclusive);
+    CHECK(guards.size() == 5);
+    CHECK_THROWS(table.acquire(ROOT + "/tree/sub/c", LockTable::Mode::Shared), "file_in_use");
+    guards.clear();
+    CHECK(table.stats().held == 0);
+}
+
+} // namespace
+
+int main() {
+    test_modes();
+    test_aliases();
+    test_tree();
+    std::cout << "lock table tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,320 @@
+#include "check.hpp"
+#include "minidrive/lock_table.hpp"
+#include "minidrive/pack.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string ROOT = scratch_dir("pack");
+
+// empty scratch directory below ROOT
+std::string scratch(const std::string &name) {
+    const std::string dir = ROOT + "/" + name;
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    return dir;
+}
+
+// files of several sizes, an empty one, nested and empty directories
+std::string make_tree(const std::string &name) {
+    const std::string dir = scratch(name);
+    write_file(dir + "/a.txt", "alpha");
+    write_file(dir + "/empty", "");
+    fs::create_directories(dir + "/sub/deeper");
+    fs::create_directories(dir + "/empty_dir");
+    write_file(dir + "/sub/b.bin", std::string(100000, 'b') + "end");
+    write_file(dir + "/sub/deeper/c", "gamma");
+    return dir;
+}
+
+std::string read_stream(pack::Writer &writer) {
+    std::string stream(static_cast<size_t>(writer.size() - writer.position()), '\0');
+    size_t n = 0;
+    for (size_t got = 1; got > 0 && n < stream.size(); n += got) {
+        got = writer.read(stream.data() + n, stream.size() - n);
+    }
+    CHECK(n == stream.size());
+    return stream;
+}
+
+// in small uneven pieces, so record lines, data and digests are split across calls
+void feed(pack::Reader &reader, const std::string &stream) {
+    size_t piece = 1;
+    for (size_t i = 0; i < stream.size(); i += piece, piece = piece % 97 + 13) {
+        reader.feed(stream.data() + i, std::min(piece, stream.size() - i));
+    }
+}
+
+// same entries with the same contents, and nothing left over such as .part files
+void check_same_tree(const std::string &expected, const std::string &actual) {
+    size_t count = 0;
+    for (const auto &entry : fs::recursive_directory_iterator(expected)) {
+        const std::string other = actual + "/" + fs::relative(entry.path(), expected).string();
+        CHECK(fs::is_directory(other) == entry.is_directory());
+        if (entry.is_regular_file()) {
+            CHECK(read_file(other) == read_file(entry.path().string()));
+        }
+        count++;
+    }
+    CHECK(count == static_cast<size_t>(std::distance(fs::recursive_directory_iterator(actual), fs::recursive_directory_iterator())));
+}
+
+std::string hash_of(const std::string &data) {
+    StreamHash hash;
+    hash.update(data.data(), data.size());
+    return hash.hex();
+}
+
+void test_round_trip() {
+    const std::string src = make_tree("round_trip_src");
+    pack::Writer writer(src);
+    const std::string stream = read_stream(writer);
+    CHECK(stream.starts_with(pack::MAGIC));
+    CHECK(writer.files() == 4);
+
+    // the stream only depends on the tree
+    pack::Writer again(src);
+    CHECK(read_stream(again) == stream);
+
+    const std::string dst = scratch("round_trip_dst");
+    pack::Reader reader(dst);
+    feed(reader, stream);
+    CHECK(reader.done());
+    CHECK(reader.position() == stream.size());
+    CHECK(reader.boundary() == stream.size());
+    CHECK(reader.files() == 4);
+    CHECK(reader.bytes() == 5 + 100003 + 5);
+    CHECK(reader.hash().hex() == hash_of(stream));
+    check_same_tree(src, dst);
+}
+
+void test_resume_with_skip() {
+    const std::string src = make_tree("resume_src");
+    pack::Writer full(src);
+    const std::string stream = read_stream(full);
+
+    // interrupted halfway through the large file
+    const std::string dst = scratch("resume_dst");
+    pack::Reader first(dst);
+    feed(first, stream.substr(0, stream.size() / 2));
+    const std::uint64_t boundary = first.boundary();
+    CHECK(boundary > 0 && boundary < stream.size() / 2);
+
+    // the sender regenerates the stream up to the boundary, the receiver continues from its saved hash
+    pack::Writer writer(src);
+    StreamHash skipped;
+    writer.skip(boundary, skipped);
+    CHECK(writer.position() == boundary);
+    CHECK(skipped.hex() == first.boundaryHash().hex());
+    const std::string rest = read_stream(writer);
+    CHECK(rest == stream.substr(static_cast<size_t>(boundary)));
+
+    pack::Reader second(dst, boundary, first.boundaryHash());
+    feed(second, rest);
+    CHECK(second.done());
+    CHECK(second.hash().hex() == hash_of(stream));
+    check_same_tree(src, dst);
+
+    // a boundary past the end cannot be skipped to
+    pack::Writer past(src);
+    StreamHash ignored;
+    CHECK_THROWS(past.skip(stream.size() + 1, ignored), "invalid_offset");
+}
+
+void test_deferred_renames() {
+    const std::string src = make_tree("deferred_src");
+    pack::Writer writer(src);
+    const std::string stream = read_stream(writer);
+
+    const std::string dst = scratch("deferred_dst");
+    std::vector<std::string> renamed;
+    pack::Reader reader(dst, [&renamed](const std::string &path, const std::uint64_t &) { renamed.push_back(path); });
+    reader.deferRenames();
+    feed(reader, stream);
+    CHECK(reader.done());
+    CHECK(renamed.empty());
+    CHECK(reader.uncommitted().size() == 4);
+    for (const auto &part : reader.uncommitted()) {
+        CHECK(part.ends_with(".part") && fs::exists(part));
+        CHECK(!fs::exists(part.substr(0, part.size() - 5)));
+    }
+
+    // every directory that gained an entry, once
+    const std::vector<std::string> dirs = reader.commit();
+    CHECK((dirs == std::vector<std::string>{dst, dst + "/sub", dst + "/sub/deeper"}));
+    CHECK(renamed.size() == 4);
+    CHECK(reader.uncommitted().empty());
+    CHECK(reader.commit().empty());
+    check_same_tree(src, dst);
+}
+
+// a file another session holds is not replaced; its .part stays for a resume
+void test_locked_target() {
+    const std::string src = scratch("locked_src");
+    write_file(src + "/a.txt", "new");
+    pack::Writer writer(src);
+    const std::string stream = read_stream(writer);
+
+    for (const bool deferred : {false, true}) {
+        const std::string dst = scratch("locked_dst");
+        write_file(dst + "/a.txt", "old");
+        LockTable::Guard reader_lock = LockTable::global().acquire(dst + "/a.txt", LockTable::Mode::Shared);
+        size_t renamed = 0;
+        pack::Reader reader(dst, [&renamed](const std::string &, const std::uint64_t &) { renamed++; });
+        if (deferred) {
+            reader.deferRenames();
+            feed(reader, stream);
+            CHECK_THROWS(reader.commit(), "file_in_use");
+        } else {
+            CHECK_THROWS(feed(reader, stream), "file_in_use");
+        }
+        CHECK(renamed == 0);
+        CHECK(read_file(dst + "/a.txt") == "old");
+        CHECK(read_file(dst + "/a.txt.part") == "new");
+    }
+}
+
+void test_unsafe_paths() {
+    const std::string dst = scratch("unsafe/dst");
+    for (const std::string path : {"..", "../escape", "a/../../escape", "a/..", "/tmp/escape", "/", ".", "./a", "a/.", "a/./b", "", "a//b", "a/"}) {
+        for (const auto &record : {"D 755 " + path + "\n", "F 1 644 " + path + "\n"}) {
+            pack::Reader reader(dst);
+            const std::string stream = pack::MAGIC + record;
+            CHECK_THROWS(reader.feed(stream.data(), stream.size()), "invalid_pack");
+        }
+    }
+    CHECK(!fs::exists(ROOT + "/unsafe/escape"));
+    CHECK(fs::is_empty(dst));
+}
+
+void test_reserved_names() {
+    const std::string dst = scratch("reserved");
+    for (const auto &record : {std::string("F 1 644 ") + pack::PART_NAME + "\n", std::string("D 755 ") + pack::PART_NAME + "\n",
+                                     std::string("F 1 644 ") + pack::PART_NAME + "/x\n", std::string("F 1 644 .usage\n"), std::string("D 755 .usage/x\n")}) {
+        pack::Reader reader(dst);
+        reader.reserve([](const std::string &name) { return name == ".usage"; });
+        const std::string stream = pack::MAGIC + record;
+        CHECK_THROWS(reader.feed(stream.data(), stream.size()), "invalid_pack");
+    }
+    CHECK(fs::is_empty(dst));
+
+    // only the top level is reserved, and only when asked
+    const std::string src = scratch("reserved_src");
+    fs::create_directories(src + "/sub");
+    write_file(src + "/sub/.usage", "nested");
+    write_file(src + "/.usage", "top");
+    pack::Writer writer(src);
+    const std::string stream = read_stream(writer);
+    pack::Reader plain(scratch("reserved_plain"));
+    feed(plain, stream);
+    CHECK(plain.done());
+
+    fs::remove(src + "/.usage");
+    pack::Writer nested_writer(src);
+    pack::Reader nested(scratch("reserved_nested"));
+    nested.reserve([](const std::string &name) { return name == ".usage"; });
+    feed(nested, read_stream(nested_writer));
+    CHECK(nested.done());
+}
+
+void test_modes() {
+    // special bits are dropped, and a directory its owner cannot enter still takes its entries
+    const std::string stream = pack::MAGIC + std::string("D 7000 locked\nF 1 7777 locked/x\nx") + "H " + hash_of("x") + "\nE\n";
+    const std::string dst = scratch("modes");
+    pack::Reader reader(dst);
+    feed(reader, stream);
+    CHECK(reader.done());
+    const fs::perms dir = fs::status(dst + "/locked").permissions();
+    const fs::perms file = fs::status(dst + "/locked/x").permissions();
+    CHECK((dir & fs::perms::owner_all) == fs::perms::owner_all);
+    CHECK((dir & ~fs::perms::all) == fs::perms::none);
+    CHECK(file == fs::perms::all);
+    CHECK(read_file(dst + "/locked/x") == "x");
+}
+
+void test_truncated_stream() {
+    const std::string src = make_tree("truncated_src");
+    pack::Writer writer(src);
+    const std::string stream = read_stream(writer);
+
+    // cut inside the data of the large file, inside a record line and right before the end record
+    const size_t data_cut = stream.find(std::string(1000, 'b')) + 500;
+    for (const size_t cut : {data_cut, std::string(pack::MAGIC).size() + 3, stream.size() - 2}) {
+        const std::string dst = scratch("truncated_dst");
+        pack::Reader reader(dst);
+        feed(reader, stream.substr(0, cut));
+        CHECK(!reader.done());
+        CHECK(reader.position() == cut);
+        CHECK(reader.boundary() <= cut);
+    }
+
+    // the file being written is left as its .part, never under its final name
+    const std::string dst = scratch("truncated_dst");
+    pack::Reader reader(dst);
+    feed(reader, stream.substr(0, data_cut));
+    CHECK(fs::exists(dst + "/sub/b.bin.part"));
+    CHECK(!fs::exists(dst + "/sub/b.bin"));
+}
+
+void test_digest_mismatch() {
+    const std::string src = make_tree("digest_src");
+    pack::Writer writer(src);
+    std::string stream = read_stream(writer);
+    const size_t at = stream.find("alpha");
+    CHECK(at != std::string::npos);
+    stream[at] = 'A';
+
+    const std::string dst = scratch("digest_dst");
+    pack::Reader reader(dst);
+    CHECK_THROWS(feed(reader, stream), "integrity_error");
+    CHECK(!fs::exists(dst + "/a.txt"));
+    CHECK(!fs::exists(dst + "/a.txt.part"));
+
+    // a trailer that is not a digest line
+    const std::string bad_trailer = std::string(pack::MAGIC) + "F 1 644 x\nyX " + std::string(64, '0') + "\n";
+    pack::Reader other(scratch("digest_trailer"));
+    CHECK_THROWS(other.feed(bad_trailer.data(), bad_trailer.size()), "invalid_pack");
+}
+
+void test_malformed_records() {
+    const std::string long_path(pack::MAX_LINE, 'x');
+    for (const auto &stream : {std::string("MDPACK 2\n"), std::string("not a pack\n"), pack::MAGIC + std::string("X 755 a\n"), pack::MAGIC + std::string("D 755\n"),
+                                     pack::MAGIC + std::string("F 1 644\n"), pack::MAGIC + std::string("F abc 644 a\n"), pack::MAGIC + std::string("F -1 644 a\n"),
+                                     pack::MAGIC + std::string("D 789 a\n"), pack::MAGIC + std::string("F  644 a\n"), pack::MAGIC + std::string("D 755 ") + long_path + "\n",
+                                     pack::MAGIC + std::string("E\nE\n"), pack::MAGIC + std::string("E\n\n")}) {
+        pack::Reader reader(scratch("malformed"));
+        CHECK_THROWS(feed(reader, stream), "invalid_pack");
+    }
+
+    // an over-long line is refused before its newline arrives
+    pack::Reader reader(scratch("malformed"));
+    const std::string endless = pack::MAGIC + std::string("D 755 ") + long_path;
+    CHECK_THROWS(feed(reader, endless), "invalid_pack");
+}
+
+} // namespace
+
+int main() {
+    test_round_trip();
+    test_resume_with_skip();
+    test_deferred_renames();
+    test_locked_target();
+    test_unsafe_paths();
+    test_reserved_names();
+    test_modes();
+    test_truncated_stream();
+    test_digest_mismatch();
+    test_malformed_records();
+    std::cout << "pack tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "check.hpp"
+#include "server_config.hpp"
+#include "transfer_io.hpp"
+#include "minidrive/stream_hash.hpp"
+
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+const std::string ROOT = scratch_dir("part_writer");
+
+// more than one staging buffer, ending mid-block
+const size_t SIZE = transfer_io::DIRECT_STAGE + 3 * transfer_io::DIRECT_ALIGN + 123;
+
+std::string pattern(const size_t &size) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+        data[i] = static_cast<char>('a' + (i * 7 + i / 4096) % 26);
+    }
+    return data;
+}
+
+void configure(const std::uint64_t &direct_upload_bytes) {
+    ServerConfig config;
+    config.direct_upload_bytes = direct_upload_bytes;
+    transfer_io::configure(config);
+}
+
+// sends data[offset..] through a socketpair into a PartWriter and returns the digest it kept; on a
+// filesystem without O_DIRECT the writer is buffered, and the result must be the same
+std::string upload(const std::string &path, const std::string &data, const size_t &offset) {
+    int fds[2];
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::thread sender([&data, &offset, fd = fds[1]]() {
+        for (size_t sent = offset; sent < data.size();) {
+            const ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, 0);
+            if (n <= 0) {
+                break;
+            }
+            sent += static_cast<size_t>(n);
+        }
+    });
+
+    StreamHash hash;
+    hash.update(data.data(), offset);
+    {
+        transfer_io::PartWriter writer(path, offset, data.size());
+        for (size_t received = offset; received < data.size();) {
+            received += writer.receive(fds[0], 64 * 1024, &hash);
+        }
+        CHECK(writer.written() == data.size());
+    }
+    sender.join();
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return hash.hex();
+}
+
+std::string digest(const std::string &data) {
+    StreamHash hash;
+    hash.update(data.data(), data.size());
+    return hash.hex();
+}
+
+// an unaligned total: the last block is padded for O_DIRECT and the file cut back to size
+void test_unaligned_total() {
+    const std::string data = pattern(SIZE);
+    for (const std::uint64_t threshold : {std::uint64_t{0}, std::uint64_t{1}}) {
+        configure(threshold);
+        const std::string path = ROOT + "/whole_" + std::to_string(threshold) + ".part";
+        CHECK(upload(path, data, 0) == digest(data));
+        CHECK(read_file(path) == data);
+    }
+
+    // smaller than one block
+    configure(1);
+    const std::string small = pattern(100);
+    CHECK(upload(ROOT + "/small.part", small, 0) == digest(small));
+    CHECK(read_file(ROOT + "/small.part") == small);
+}
+
+// a resume from an aligned offset may go direct, one from the middle of a block stays buffered
+void test_resume() {
+    configure(1);
+    const std::string data = pattern(SIZE);
+    for (const size_t offset : {2 * transfer_io::DIRECT_ALIGN, size_t{5000}}) {
+        const std::string path = write_file(ROOT + "/resume_" + std::to_string(offset) + ".part", data.substr(0, offset));
+        CHECK(upload(path, data, offset) == digest(data));
+        CHECK(read_file(path) == data);
+    }
+}
+
+} // namespace
+
+int main() {
+    test_unaligned_total();
+    test_resume();
+    std::cout << "part_writer tests passed" << std::endl;
+    return 0;
+}
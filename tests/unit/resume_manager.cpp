@@ -0,0 +1,172 @@
+#include "check.hpp"
+#include "resume_manager.hpp"
+#include "minidrive/helpers.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string ROOT = scratch_dir("resume_manager");
+
+// hands the manager socketpair connections whose other end answers every request with an error
+class FakeServer {
+public:
+    explicit FakeServer(const std::string &offer, const size_t &gate = 0) : offer(offer), gate(gate) {}
+
+    ~FakeServer() { this->join(); }
+
+    // once the manager is done every connection is closed, so each peer is finishing
+    void join() {
+        for (auto &peer : this->peers) {
+            peer.join();
+        }
+        this->peers.clear();
+    }
+
+    // with a gate, each connect waits (up to a second) until that many are in progress at once
+    ResumeManager::Connect connect() {
+        return [this](std::string &offer) {
+            int fds[2];
+            if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+                throw std::runtime_error("socketpair failed");
+            }
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->connects++;
+            this->active++;
+            this->peak = std::max(this->peak, this->active);
+            this->cv.notify_all();
+            this->cv.wait_for(lock, std::chrono::seconds(1), [this]() { return this->active >= this->gate; });
+            this->active--;
+            this->peers.emplace_back([this, fd = fds[1]]() { this->serve(fd); });
+            offer = this->offer;
+            return fds[0];
+        };
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t connects = 0;
+    size_t active = 0;
+    size_t peak = 0;
+    size_t exits = 0;
+    std::vector<std::string> requests;
+
+private:
+    const std::string offer;
+    const size_t gate;
+    std::vector<std::thread> peers;
+
+    void serve(const int &fd) {
+        try {
+            while (true) {
+                const std::string msg = recv_msg(fd);
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (msg == "EXIT") {
+                    this->exits++;
+                    break;
+                }
+                if (msg != "n") {
+                    this->requests.push_back(msg);
+                    send_msg(fd, "ERROR file_not_found: gone");
+                }
+            }
+        } catch (const std::exception &) {
+            // the manager closed the connection
+        }
+        ::close(fd);
+    }
+};
+
+ResumeManager::Job job(const ResumeManager::Kind &kind, const std::string &name) {
+    TransferState::Transfer transfer;
+    transfer.local_path = ROOT + "/" + name;
+    transfer.remote_path = name;
+    transfer.bytes_completed = 0;
+    transfer.total_bytes = 10;
+    return {kind, transfer};
+}
+
+// uploads the server no longer offers fail without sending anything, each on its own connection
+void test_upload_not_offered() {
+    std::vector<ResumeManager::Job> jobs;
+    for (int i = 0; i < 6; ++i) {
+        jobs.push_back(job(ResumeManager::Kind::Upload, "up" + std::to_string(i)));
+    }
+    FakeServer server("RESUME 1\n/elsewhere other 0 10", 3);
+    CHECK(ResumeManager(server.connect(), 3, 4).run(jobs) == 6);
+    server.join();
+    CHECK(server.connects == 6 && server.exits == 6 && server.requests.empty());
+    // the transfers ran side by side, never more than asked for
+    CHECK(server.peak == 3);
+}
+
+// downloads share a worker's connection, decline the offered uploads, and reconnect after a failure
+void test_downloads() {
+    std::vector<ResumeManager::Job> jobs;
+    for (int i = 0; i < 4; ++i) {
+        jobs.push_back(job(ResumeManager::Kind::Download, "down" + std::to_string(i)));
+    }
+    FakeServer server("RESUME 1\n/elsewhere other 0 10");
+    CHECK(ResumeManager(server.connect(), 2, 4).run(jobs) == 4);
+    server.join();
+    CHECK(server.requests.size() == 4);
+    for (const auto &request : server.requests) {
+        CHECK(request.starts_with("RESUME down") && request.find(" 0 ") != std::string::npos);
+    }
+    CHECK(server.connects == 4);
+}
+
+// the rest of an upload is sent from the file as it is now, so a changed size is refused up front
+void test_upload_changed() {
+    write_file(ROOT + "/changed", "not ten bytes");
+    ResumeManager::Job upload = job(ResumeManager::Kind::Upload, "changed");
+    FakeServer server("RESUME 1\n" + upload.transfer.local_path + " changed 0 10");
+    CHECK(ResumeManager(server.connect(), 1, 1).run({upload}) == 1);
+    server.join();
+    CHECK(server.requests.empty() && server.connects == 1);
+
+    int fds[2];
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CHECK_THROWS(resume_upload(fds[0], upload.transfer), "file_changed");
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+// a server that cannot be reached fails every job instead of hanging a worker
+void test_connect_fails() {
+    std::vector<ResumeManager::Job> jobs = {job(ResumeManager::Kind::Upload, "a"), job(ResumeManager::Kind::Download, "b"), job(ResumeManager::Kind::Tree, "c")};
+    size_t attempts = 0;
+    std::mutex mutex;
+    ResumeManager manager([&](std::string &) -> int {
+        std::lock_guard<std::mutex> lock(mutex);
+        attempts++;
+        throw std::runtime_error("connect_failed: refused");
+    }, 4, 1);
+    CHECK(manager.run(jobs) == 3);
+    CHECK(attempts == 3);
+    CHECK(manager.run({}) == 0);
+}
+
+} // namespace
+
+int main() {
+    test_upload_not_offered();
+    test_downloads();
+    test_upload_changed();
+    test_connect_fails();
+    std::cout << "resume manager tests passed" << std::endl;
+    return 0;
+}
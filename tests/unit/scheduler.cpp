@@ -0,0 +1,120 @@
+#include "check.hpp"
+#include "scheduler.hpp"
+#include "minidrive/helpers.hpp"
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Direction = TransferScheduler::Direction;
+using Flow = TransferScheduler::Flow;
+
+constexpr size_t BULK = 100 * 1024 * 1024;
+constexpr size_t SMALL = 1024;
+
+// one reactor iteration: schedule, then every grant moves in full; bytes granted per user
+std::map<std::string, size_t> round(TransferScheduler &scheduler, const std::vector<Flow> &flows, const TransferScheduler::Clock::time_point &now) {
+    std::map<std::string, size_t> per_user;
+    for (const auto &grant : scheduler.schedule(flows, now)) {
+        for (const auto &flow : flows) {
+            if (flow.fd == grant.fd) {
+                scheduler.complete(flow, grant.max_bytes, grant.max_bytes);
+                per_user[flow.user] += grant.max_bytes;
+            }
+        }
+    }
+    return per_user;
+}
+
+// a user with three sessions gets no more than a user with one
+void test_fair_across_users() {
+    ServerConfig config;
+    TransferScheduler scheduler(config);
+    const std::vector<Flow> flows = {{1, "a", Direction::Download, BULK}, {2, "a", Direction::Download, BULK}, {3, "a", Direction::Download, BULK}, {4, "b", Direction::Download, BULK}};
+    size_t a = 0;
+    size_t b = 0;
+    const auto now = TransferScheduler::Clock::now();
+    for (size_t i = 0; i < 10; ++i) {
+        auto granted = round(scheduler, flows, now);
+        a += granted["a"];
+        b += granted["b"];
+    }
+    CHECK(a == b);
+    CHECK(a == 10 * config.sched_quantum);
+}
+
+// interactive users earn interactive_weight quanta per round
+void test_interactive_weight() {
+    ServerConfig config;
+    config.user_classes["i"] = "interactive";
+    TransferScheduler scheduler(config);
+    const std::vector<Flow> flows = {{1, "i", Direction::Upload, BULK}, {2, "i", Direction::Upload, BULK}, {3, "b", Direction::Upload, BULK}};
+    auto granted = round(scheduler, flows, TransferScheduler::Clock::now());
+    CHECK(granted["b"] == config.sched_quantum);
+    CHECK(granted["i"] == config.interactive_weight * config.sched_quantum);
+}
+
+// a user's bulk transfer does not borrow the credit its small transfer left unused
+void test_separate_class_deficits() {
+    ServerConfig config;
+    TransferScheduler scheduler(config);
+    const std::vector<Flow> flows = {{1, "u", Direction::Download, SMALL}, {2, "u", Direction::Download, BULK}};
+    const auto now = TransferScheduler::Clock::now();
+    for (size_t i = 0; i < 3; ++i) {
+        std::map<int, size_t> per_fd;
+        for (const auto &grant : scheduler.schedule(flows, now)) {
+            per_fd[grant.fd] = grant.max_bytes;
+            scheduler.complete(flows[static_cast<size_t>(grant.fd - 1)], grant.max_bytes, grant.max_bytes);
+        }
+        CHECK(per_fd[1] == config.sched_max_chunks_per_flow * TMP_BUFF_SIZE);
+        CHECK(per_fd[2] == config.sched_quantum);
+    }
+}
+
+// what a grant did not use is credited to the next round
+void test_refund() {
+    ServerConfig config;
+    TransferScheduler scheduler(config);
+    const Flow flow{1, "u", Direction::Download, BULK};
+    const auto now = TransferScheduler::Clock::now();
+    auto grants = scheduler.schedule({flow}, now);
+    CHECK(grants.size() == 1 && grants[0].max_bytes == config.sched_quantum);
+    scheduler.complete(flow, grants[0].max_bytes, TMP_BUFF_SIZE);
+    grants = scheduler.schedule({flow}, now);
+    CHECK(grants.size() == 1 && grants[0].max_bytes == 2 * config.sched_quantum - TMP_BUFF_SIZE);
+}
+
+// the token bucket caps a rate-limited user and says when to look again
+void test_token_bucket() {
+    ServerConfig config;
+    config.user_rate_limits["r"] = 2 * TMP_BUFF_SIZE; // bytes per second, bucket of two chunks
+    TransferScheduler scheduler(config);
+    const Flow flow{1, "r", Direction::Upload, BULK};
+    const auto now = TransferScheduler::Clock::now();
+    CHECK(scheduler.eligible("r", Direction::Upload, now));
+    auto granted = round(scheduler, {flow}, now);
+    CHECK(granted["r"] == 2 * TMP_BUFF_SIZE);
+
+    scheduler.resetWake();
+    CHECK(!scheduler.eligible("r", Direction::Upload, now));
+    CHECK(scheduler.nextWake() > now && scheduler.nextWake() <= now + std::chrono::seconds(1));
+    CHECK(scheduler.eligible("r", Direction::Upload, now + std::chrono::seconds(1)));
+    // downloads have their own bucket, other users none at all
+    CHECK(scheduler.eligible("r", Direction::Download, now));
+    CHECK(scheduler.eligible("other", Direction::Upload, now));
+}
+
+} // namespace
+
+int main() {
+    test_fair_across_users();
+    test_interactive_weight();
+    test_separate_class_deficits();
+    test_refund();
+    test_token_bucket();
+    std::cout << "scheduler tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "check.hpp"
+#include "minidrive/stream_hash.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string EMPTY_DIGEST = "0e5751c026e543b2e8ab2eb06099daa1d1e5df47778f7787faab45cdf12fe3a8";
+const std::string ABC_DIGEST = "bddd813c634239723171ef3fee98579b94964e3bb1cb3e427262c8c068d52319";
+
+StreamHash hash_of(const std::string &data) {
+    StreamHash hash;
+    hash.update(data.data(), data.size());
+    return hash;
+}
+
+// unkeyed 32-byte BLAKE2b, however the bytes are split
+void test_digest() {
+    CHECK(StreamHash().hex() == EMPTY_DIGEST);
+    CHECK(hash_of("abc").hex() == ABC_DIGEST);
+
+    const std::string data(300000, 'q');
+    StreamHash pieces;
+    for (size_t at = 0; at < data.size(); at += 4093) {
+        pieces.update(data.data() + at, std::min<size_t>(4093, data.size() - at));
+    }
+    CHECK(pieces.hex() == hash_of(data).hex());
+
+    // reading the digest does not finish the hash
+    StreamHash running = hash_of("a");
+    CHECK(running.hex() != ABC_DIGEST);
+    running.update("bc", 2);
+    CHECK(running.hex() == ABC_DIGEST && running.hex() == ABC_DIGEST);
+}
+
+// resumes continue from a saved state or from the prefix already on disk
+void test_resume() {
+    const StreamHash first = hash_of("ab");
+    StreamHash resumed;
+    CHECK(resumed.restore(first.save()));
+    resumed.update("c", 1);
+    CHECK(resumed.hex() == ABC_DIGEST);
+
+    StreamHash untouched = hash_of("ab");
+    CHECK(!untouched.restore(""));
+    CHECK(!untouched.restore(first.save().substr(2)));
+    CHECK(!untouched.restore(std::string(first.save().size(), 'z')));
+    untouched.update("c", 1);
+    CHECK(untouched.hex() == ABC_DIGEST);
+
+    const std::string path = write_file(scratch_dir("stream_hash") + "/file", "abcdef");
+    StreamHash prefix = StreamHash::ofPrefix(path, 2);
+    prefix.update("c", 1);
+    CHECK(prefix.hex() == ABC_DIGEST);
+    CHECK(StreamHash::ofPrefix(path, 0).hex() == EMPTY_DIGEST);
+    CHECK_THROWS(StreamHash::ofPrefix(path, 7), "file_read_failed");
+    fs::remove(path);
+    CHECK_THROWS(StreamHash::ofPrefix(path, 1), "file_open_failed");
+}
+
+// the digest line in completion messages, and what the client makes of the reply
+void test_completion() {
+    const std::string line = digest_line(ABC_DIGEST);
+    CHECK(line == "BLAKE2b " + ABC_DIGEST);
+    CHECK(find_digest("OK\nUploaded 3 bytes\n" + line) == ABC_DIGEST);
+    CHECK(find_digest("OK\n" + line + "\nmore") == ABC_DIGEST);
+    CHECK(find_digest("OK\nUploaded 3 bytes").empty());
+
+    const StreamHash abc = hash_of("abc");
+    verify_digest("OK\n" + line, abc, "f");
+    CHECK_THROWS(verify_digest("OK\n" + digest_line(EMPTY_DIGEST), abc, "f"), "integrity_error");
+    CHECK_THROWS(verify_digest("OK\nno digest", abc, "f"), "integrity_error");
+    CHECK_THROWS(verify_digest("ERROR file_not_found: gone", abc, "f"), "file_not_found");
+}
+
+} // namespace
+
+int main() {
+    test_digest();
+    test_resume();
+    test_completion();
+    std::cout << "stream hash tests passed" << std::endl;
+    return 0;
+}
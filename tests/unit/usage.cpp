@@ -0,0 +1,157 @@
+#include "check.hpp"
+#include "usage.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string ROOT = scratch_dir("usage");
+
+// "a" with a file in "a/sub", and siblings that sort between "a" and "a/" ('.' and ' ' < '/')
+std::string make_user(const std::string &name) {
+    const std::string dir = ROOT + "/" + name;
+    fs::remove_all(dir);
+    fs::create_directories(dir + "/a/sub");
+    fs::create_directories(dir + "/a.x");
+    fs::create_directories(dir + "/a b");
+    write_file(dir + "/a/sub/f", std::string(100, 'f'));
+    write_file(dir + "/a/g", std::string(10, 'g'));
+    write_file(dir + "/a.x/h", std::string(1, 'h'));
+    write_file(dir + "/a b/i", std::string(1000, 'i'));
+    return dir;
+}
+
+bool same(const usage::Totals &totals, const std::int64_t &bytes, const std::int64_t &files) {
+    return totals.bytes == bytes && totals.files == files;
+}
+
+void test_remove_tree_past_siblings() {
+    const std::string dir = make_user("remove");
+    usage::UserUsage usage(dir);
+    CHECK(usage.used() == 1111);
+
+    usage.removeTree(dir + "/a");
+    fs::remove_all(dir + "/a");
+    CHECK(usage.used() == 1001);
+    CHECK(same(usage.totals(dir + "/a.x"), 1, 1));
+    CHECK(same(usage.totals(dir + "/a b"), 1000, 1));
+
+    // nothing of the old subtree is left to be found again under the same name
+    fs::create_directories(dir + "/a/sub");
+    CHECK(same(usage.totals(dir + "/a"), 0, 0));
+    CHECK(same(usage.totals(dir + "/a/sub"), 0, 0));
+}
+
+// measured before the removal, forgotten after it, when the path no longer exists
+void test_forget_after_removal() {
+    const std::string dir = make_user("forget");
+    usage::UserUsage usage(dir);
+
+    const usage::Removal file = usage.measure(dir + "/a/g");
+    const usage::Removal tree = usage.measure(dir + "/a");
+    CHECK(!file.directory && file.bytes == 10 && file.files == 1);
+    CHECK(tree.directory);
+    fs::remove(dir + "/a/g");
+    usage.forget(file);
+    CHECK(same(usage.totals(dir + "/a"), 100, 1));
+    fs::remove_all(dir + "/a");
+    usage.forget(tree);
+    CHECK(usage.used() == 1001);
+    CHECK(same(usage.totals(dir + "/a/sub"), 0, 0));
+
+    // nothing there, nothing forgotten
+    usage.forget(usage.measure(dir + "/missing"));
+    CHECK(usage.used() == 1001);
+}
+
+void test_move_tree_past_siblings() {
+    const std::string dir = make_user("move");
+    usage::UserUsage usage(dir);
+
+    fs::rename(dir + "/a", dir + "/b");
+    usage.moveTree(dir + "/a", dir + "/b");
+    CHECK(usage.used() == 1111);
+    CHECK(same(usage.totals(dir + "/b"), 110, 2));
+    CHECK(same(usage.totals(dir + "/b/sub"), 100, 1));
+    CHECK(same(usage.totals(dir + "/a.x"), 1, 1));
+    CHECK(same(usage.totals(dir + "/a b"), 1000, 1));
+
+    fs::create_directories(dir + "/a/sub");
+    CHECK(same(usage.totals(dir + "/a"), 0, 0));
+    CHECK(same(usage.totals(dir + "/a/sub"), 0, 0));
+
+    // and down into a sibling's subtree
+    fs::rename(dir + "/b", dir + "/a.x/b");
+    usage.moveTree(dir + "/b", dir + "/a.x/b");
+    CHECK(same(usage.totals(dir + "/a.x"), 111, 3));
+    CHECK(same(usage.totals(dir + "/a.x/b/sub"), 100, 1));
+    CHECK(same(usage.totals(dir + "/b/sub"), 0, 0));
+}
+
+std::string saved_header(const std::string &dir) {
+    std::ifstream in(dir + "/" + usage::FILE_NAME, std::ios::binary);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+// a save from another session keeps the file dirty while an upload still holds it
+void test_save_while_dirty() {
+    const std::string dir = make_user("dirty");
+    usage::UserUsage usage(dir);
+    CHECK(saved_header(dir).ends_with(" clean"));
+
+    usage.markDirty();
+    usage.add(usage.dirKey(dir + "/a"), 50, 0); // an upload chunk, not saved
+    CHECK(saved_header(dir).ends_with(" dirty"));
+    usage.removeTree(dir + "/a.x"); // DELETE elsewhere, saved at once
+    fs::remove_all(dir + "/a.x");
+    usage.save();
+    CHECK(saved_header(dir).ends_with(" dirty"));
+
+    // two holders: the file turns clean only once both are done
+    usage.markDirty();
+    usage.releaseDirty();
+    usage.save();
+    CHECK(saved_header(dir).ends_with(" dirty"));
+    usage.releaseDirty();
+    usage.save();
+    CHECK(saved_header(dir).ends_with(" clean"));
+    CHECK(usage::UserUsage(dir).used() == 1160);
+}
+
+// a saved file that does not parse is rebuilt from the tree, whatever is wrong with it
+void test_malformed_file() {
+    const std::string dir = make_user("malformed");
+    const std::string path = dir + "/" + usage::FILE_NAME;
+    const std::string header = "minidrive-usage 1 clean\n";
+    for (const char *line : {"abc 1 .", "1 x .", "1 2", "5", "1  .", "-1e3 1 .", "99999999999999999999 1 .", "1 1 a\n7 1"}) {
+        write_file(path, header + "1111 4 .\n" + line + "\n");
+        usage::UserUsage usage(dir);
+        CHECK(usage.used() == 1111);
+        CHECK(same(usage.totals(dir + "/a"), 110, 2));
+        CHECK(saved_header(dir).ends_with(" clean"));
+    }
+
+    // a well-formed file is taken as it is, without a walk
+    write_file(path, header + "7 1 .\n");
+    CHECK(usage::UserUsage(dir).used() == 7);
+}
+
+} // namespace
+
+int main() {
+    test_remove_tree_past_siblings();
+    test_move_tree_past_siblings();
+    test_forget_after_removal();
+    test_save_while_dirty();
+    test_malformed_file();
+    std::cout << "usage tests passed" << std::endl;
+    return 0;
+}